@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "DemoAngles.hpp"
+#include "DemoFrame.hpp"
+#include "DemoKernels.hpp"
+
+enum {
+	ANGLE_FIELDS = 3,
+	ANGLE_AXES = 3
+};
+
+static float* angle_field(NetMsgFrame& f, size_t field)
+{
+	switch (field) {
+	case 0:
+		return f.DemoInfo.RefParams.viewangles;
+	case 1:
+		return f.DemoInfo.RefParams.cl_viewangles;
+	default:
+		return f.DemoInfo.UserCmd.viewangles;
+	}
+}
+
+// The [first, last) runs of frames the transform applies to.
+static std::vector<std::pair<size_t, size_t>> time_runs(const std::vector<float>& time, const DemoAngleTransform& t)
+{
+	std::vector<std::pair<size_t, size_t>> runs;
+	if (t.allFrames) {
+		if (!time.empty())
+			runs.emplace_back(0, time.size());
+		return runs;
+	}
+
+	auto inside = [&](size_t k) { return time[k] >= t.from && time[k] <= t.to; };
+	for (size_t k = 0; k < time.size(); ) {
+		if (!inside(k)) {
+			++k;
+			continue;
+		}
+
+		auto first = k;
+		while (k < time.size() && inside(k))
+			++k;
+		runs.emplace_back(first, k);
+	}
+	return runs;
+}
+
+/*
+ * A moving average over the angles unwrapped into a continuous series, so
+ * that a turn across 180 isn't averaged into the opposite direction. Every
+ * result is then moved back by the whole turns its angle was unwrapped by.
+ */
+static void smooth_angles(float* values, size_t count, size_t radius, std::vector<double>& unwrapped, std::vector<double>& sums)
+{
+	if (radius == 0 || count == 0)
+		return;
+
+	unwrapped.resize(count);
+	sums.resize(count + 1);
+	unwrapped[0] = values[0];
+	sums[0] = 0;
+	sums[1] = unwrapped[0];
+	for (size_t k = 1; k < count; ++k) {
+		double step = values[k] - values[k - 1];
+		unwrapped[k] = unwrapped[k - 1] + step - 360.0 * std::nearbyint(step / 360.0);
+		sums[k + 1] = sums[k] + unwrapped[k];
+	}
+
+	for (size_t k = 0; k < count; ++k) {
+		auto first = k > radius ? k - radius : 0;
+		auto last = std::min(count, k + radius + 1);
+		auto mean = (sums[last] - sums[first]) / static_cast<double>(last - first);
+		values[k] = static_cast<float>(mean - (unwrapped[k] - values[k]));
+	}
+}
+
+// The SMOOTH radius in frames; a radius over count is as good as count.
+static size_t smooth_radius(float value, size_t count)
+{
+	if (!IsFiniteFloat(value) || value < 0)
+		throw std::runtime_error("The smoothing radius must be a finite number of frames, not negative.");
+
+	auto radius = std::round(static_cast<double>(value));
+	return radius >= static_cast<double>(count) ? count : static_cast<size_t>(radius);
+}
+
+/*
+ * Rotates the views given by the angles around an axis of the world. The
+ * view is turned into the matrix Rz(yaw) Ry(pitch) Rx(roll) of the engine's
+ * AngleVectors, the rotation applied in front of it and the angles read
+ * back. The yaw and the roll keep the whole turns they had.
+ */
+static void rotate_views(float* pitch, float* yaw, float* roll, size_t count, DemoAngleAxis axis, float degrees)
+{
+	// Going through the matrix rounds the angles, so no rotation is left alone.
+	if (degrees == 0)
+		return;
+
+	const double radians = 3.14159265358979323846 / 180.0;
+	double qc = std::cos(degrees * radians), qs = std::sin(degrees * radians);
+
+	for (size_t k = 0; k < count; ++k) {
+		double cp = std::cos(pitch[k] * radians), sp = std::sin(pitch[k] * radians);
+		double cy = std::cos(yaw[k] * radians), sy = std::sin(yaw[k] * radians);
+		double cr = std::cos(roll[k] * radians), sr = std::sin(roll[k] * radians);
+
+		double m[3][3] = {
+			{ cy * cp, cy * sp * sr - sy * cr, cy * sp * cr + sy * sr },
+			{ sy * cp, sy * sp * sr + cy * cr, sy * sp * cr - cy * sr },
+			{ -sp, cp * sr, cp * cr }
+		};
+
+		// The two rows of the matrix the rotation mixes.
+		size_t a, b;
+		switch (axis) {
+		case DemoAngleAxis::YAW:
+			a = 0, b = 1;
+			break;
+		case DemoAngleAxis::PITCH:
+			a = 2, b = 0;
+			break;
+		default:
+			a = 1, b = 2;
+			break;
+		}
+		for (size_t column = 0; column < 3; ++column) {
+			auto x = m[a][column], y = m[b][column];
+			m[a][column] = qc * x - qs * y;
+			m[b][column] = qs * x + qc * y;
+		}
+
+		double p, y, r;
+		auto s = std::max(-1.0, std::min(1.0, -m[2][0]));
+		p = std::asin(s);
+		if (std::abs(s) < 1.0 - 1e-12) {
+			y = std::atan2(m[1][0], m[0][0]);
+			r = std::atan2(m[2][1], m[2][2]);
+		} else {
+			// Looking straight up or down the yaw and the roll are the same turn.
+			y = std::atan2(-m[0][1], m[1][1]);
+			r = 0;
+		}
+
+		p /= radians;
+		y /= radians;
+		r /= radians;
+		y += 360.0 * std::nearbyint((yaw[k] - y) / 360.0);
+		r += 360.0 * std::nearbyint((roll[k] - r) / 360.0);
+		pitch[k] = static_cast<float>(p);
+		yaw[k] = static_cast<float>(y);
+		roll[k] = static_cast<float>(r);
+	}
+}
+
+size_t TransformAngles(DemoFile& demo, const std::vector<DemoAngleTransform>& transforms)
+{
+	std::vector<NetMsgFrame*> frames;
+	std::vector<float> time;
+	for (auto& entry : demo.directoryEntries) {
+		for (auto& frame : entry.frames) {
+			if (static_cast<int>(frame->type) >= 2 && static_cast<int>(frame->type) <= 9)
+				continue;
+			frames.push_back(static_cast<NetMsgFrame*>(frame.get()));
+			time.push_back(frame->time);
+		}
+	}
+
+	// Only the axes the transforms change are gathered and written back.
+	// The radii are checked first so that nothing is changed on an error.
+	bool used[ANGLE_AXES] = {};
+	for (const auto& t : transforms) {
+		used[static_cast<size_t>(t.axis)] = true;
+		if (t.operation == DemoAngleOperation::ROTATE)
+			used[0] = used[1] = used[2] = true;
+		else if (t.operation == DemoAngleOperation::SMOOTH)
+			smooth_radius(t.value, 0);
+	}
+
+	std::vector<float> angles[ANGLE_FIELDS][ANGLE_AXES];
+	for (size_t field = 0; field < ANGLE_FIELDS; ++field) {
+		for (size_t axis = 0; axis < ANGLE_AXES; ++axis) {
+			if (!used[axis])
+				continue;
+			auto& values = angles[field][axis];
+			values.resize(frames.size());
+			for (size_t k = 0; k < frames.size(); ++k)
+				values[k] = angle_field(*frames[k], field)[axis];
+		}
+	}
+
+	std::vector<double> unwrapped, sums;
+	for (const auto& t : transforms) {
+		auto axis = static_cast<size_t>(t.axis);
+		for (const auto& run : time_runs(time, t)) {
+			auto count = run.second - run.first;
+			for (size_t field = 0; field < ANGLE_FIELDS; ++field) {
+				if (t.operation == DemoAngleOperation::ROTATE) {
+					auto& a = angles[field];
+					rotate_views(a[0].data() + run.first, a[1].data() + run.first, a[2].data() + run.first, count, t.axis, t.value);
+					continue;
+				}
+
+				auto values = angles[field][axis].data() + run.first;
+				switch (t.operation) {
+				case DemoAngleOperation::SET:
+					std::fill(values, values + count, t.value);
+					break;
+
+				case DemoAngleOperation::OFFSET:
+					OffsetFloats(values, count, t.value);
+					break;
+
+				case DemoAngleOperation::NORMALIZE:
+					WrapDegrees(values, count);
+					break;
+
+				case DemoAngleOperation::SMOOTH:
+					smooth_angles(values, count, smooth_radius(t.value, count), unwrapped, sums);
+					break;
+
+				case DemoAngleOperation::ROTATE:
+					break;
+				}
+			}
+		}
+	}
+
+	// Frames that come out bit for bit the same are left alone, so that Save can copy them.
+	size_t changed = 0;
+	for (size_t k = 0; k < frames.size(); ++k) {
+		bool modified = false;
+		for (size_t field = 0; field < ANGLE_FIELDS; ++field) {
+			auto out = angle_field(*frames[k], field);
+			for (size_t axis = 0; axis < ANGLE_AXES; ++axis) {
+				if (!used[axis] || !std::memcmp(&out[axis], &angles[field][axis][k], sizeof(float)))
+					continue;
+				out[axis] = angles[field][axis][k];
+				modified = true;
+			}
+		}
+
+		if (modified) {
+			frames[k]->MarkModified();
+			changed++;
+		}
+	}
+
+	return changed;
+}
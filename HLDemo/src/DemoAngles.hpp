@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "DemoFile.hpp"
+
+enum class DemoAngleAxis {
+	PITCH,
+	YAW,
+	ROLL
+};
+
+enum class DemoAngleOperation {
+	// Set the angle to the value.
+	SET,
+	// Add the value, for the yaw this turns the view around the vertical axis.
+	OFFSET,
+	// Wrap the angle into [-180, 180].
+	NORMALIZE,
+	/*
+	 * Average the angle over the value frames on either side, the short way
+	 * around. Only the frames within the time range are averaged, so the
+	 * window gets narrower at its ends. The value must be a finite number
+	 * of frames, not negative; a window wider than the range averages it all.
+	 */
+	SMOOTH,
+	/*
+	 * Rotate the whole view by the value around an axis of the world: the
+	 * vertical axis for the yaw, the side axis for the pitch and the
+	 * forward axis for the roll. Unlike OFFSET this changes all three
+	 * angles when the view isn't level.
+	 */
+	ROTATE
+};
+
+/*
+ * One operation on one axis of the view angles of the netmsg frames
+ * whose time is within [from, to], or of all of them if allFrames is set,
+ * whatever their time, infinite and NaN included. The operations change the angles
+ * the engine uses for the view (RefParams.viewangles), the client view
+ * angles (RefParams.cl_viewangles) and the user command angles alike.
+ */
+struct DemoAngleTransform {
+	DemoAngleOperation operation;
+	DemoAngleAxis axis;
+	float value;
+	float from, to;
+	bool allFrames;
+};
+
+/*
+ * Applies the transforms in order to the frames of the demo, which must
+ * have been read with the frames kept. The angles of every field and axis
+ * are gathered into arrays first, transformed with the vector kernels and
+ * then written back, marking the frames that changed as modified.
+ * Returns the number of changed frames. Throws std::runtime_error on an
+ * invalid SMOOTH radius.
+ */
+size_t TransformAngles(DemoFile& demo, const std::vector<DemoAngleTransform>& transforms);
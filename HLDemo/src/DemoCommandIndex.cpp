@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "DemoCommandIndex.hpp"
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPlatform.hpp"
+
+enum {
+	COMMAND_INDEX_VERSION = 1
+};
+
+static const char COMMAND_INDEX_MAGIC[8] = { 'H', 'L', 'C', 'M', 'D', 'I', 'D', 'X' };
+
+static std::string to_lower(std::string str)
+{
+	for (auto& c : str)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return str;
+}
+
+std::vector<std::string> DemoCommandIndex::NormalizeCommands(const std::string& text)
+{
+	std::vector<std::string> result;
+	std::string current;
+	bool quoted = false, space = false;
+
+	auto finish = [&]() {
+		if (!current.empty()) {
+			auto nameEnd = std::min(current.find(' '), current.size());
+			for (size_t i = 0; i < nameEnd; ++i)
+				current[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(current[i])));
+			result.push_back(current);
+		}
+		current.clear();
+		quoted = false;
+		space = false;
+	};
+
+	for (auto c : text) {
+		// Like the engine, a newline ends the command even inside of quotes.
+		if (c == '\0')
+			break;
+		if (c == '\n' || c == '\r' || (c == ';' && !quoted)) {
+			finish();
+			continue;
+		}
+
+		if (!quoted && std::isspace(static_cast<unsigned char>(c))) {
+			space = !current.empty();
+			continue;
+		}
+
+		if (c == '"')
+			quoted = !quoted;
+		if (space) {
+			current += ' ';
+			space = false;
+		}
+		current += c;
+	}
+	finish();
+
+	return result;
+}
+
+std::string DemoCommandIndex::CommandName(const std::string& command)
+{
+	return command.substr(0, command.find(' '));
+}
+
+std::vector<DemoCommandOccurrence> DemoCommandIndex::ReadCommands(const std::string& path, std::string& error)
+{
+	std::vector<DemoCommandOccurrence> occurrences;
+
+	try {
+		DemoFile demo(path);
+		demo.keepFrames = false;
+		demo.ReadFrames([&](DemoDirectoryEntry& entry, DemoFrame& frame) {
+			if (frame.type != DemoFrameType::CONSOLE_COMMAND)
+				return;
+
+			DemoCommandOccurrence o;
+			o.demo = 0;
+			o.entry = static_cast<uint32_t>(&entry - demo.directoryEntries.data());
+			o.time = frame.time;
+			o.frame = frame.frame;
+			for (auto& command : NormalizeCommands(static_cast<ConsoleCommandFrame&>(frame).command.str())) {
+				o.command = std::move(command);
+				occurrences.push_back(o);
+			}
+		});
+	} catch (const std::exception& ex) {
+		error = ex.what();
+		if (error.empty())
+			error = "Unknown error.";
+		occurrences.clear();
+	}
+
+	return occurrences;
+}
+
+DemoCommandIndex::DemoCommandIndex(const std::string& filename)
+	: filename(filename)
+{
+	Load();
+}
+
+DemoCommandIndex::DemoCommandIndex(const std::wstring& filename)
+	: filename(utf16_to_utf8(filename))
+{
+	Load();
+}
+
+void DemoCommandIndex::Load()
+{
+	uint64_t size;
+	int64_t time;
+	if (!stat_file(filename, size, time))
+		return;
+
+	MappedFile file(filename);
+	BufferReader r{ file.data, file.data + file.size };
+
+	try {
+		char magic[sizeof(COMMAND_INDEX_MAGIC)];
+		r.Read(magic, sizeof(magic));
+		if (std::memcmp(magic, COMMAND_INDEX_MAGIC, sizeof(magic)))
+			throw std::runtime_error("the signature doesn't match");
+		if (r.Read<uint32_t>() != COMMAND_INDEX_VERSION)
+			throw std::runtime_error("unsupported version");
+
+		demos.resize(static_cast<size_t>(r.ReadCount(32)));
+		for (auto& demo : demos) {
+			r.ReadBlob(demo.path);
+			demo.size = r.Read<uint64_t>();
+			demo.modificationTime = r.Read<int64_t>();
+			r.ReadBlob(demo.error);
+		}
+
+		commands.resize(static_cast<size_t>(r.ReadCount(sizeof(uint64_t))));
+		for (auto& command : commands)
+			r.ReadBlob(command);
+
+		auto termCount = r.ReadCount(2 * sizeof(uint64_t));
+		for (uint64_t i = 0; i < termCount; ++i) {
+			std::string name;
+			r.ReadBlob(name);
+			auto& postings = terms[name];
+			r.ReadBlob(postings);
+
+			for (const auto& p : postings) {
+				if (p.demo >= demos.size() || p.command >= commands.size())
+					throw std::runtime_error("a posting is out of range");
+			}
+		}
+	} catch (const std::exception& ex) {
+		throw std::runtime_error("Invalid command index " + filename + " (" + ex.what() + ").");
+	}
+}
+
+void DemoCommandIndex::Save()
+{
+	std::vector<char> o;
+	o.insert(o.end(), COMMAND_INDEX_MAGIC, COMMAND_INDEX_MAGIC + sizeof(COMMAND_INDEX_MAGIC));
+	write_object(o, static_cast<uint32_t>(COMMAND_INDEX_VERSION));
+
+	write_object(o, static_cast<uint64_t>(demos.size()));
+	for (const auto& demo : demos) {
+		write_blob(o, demo.path);
+		write_object(o, demo.size);
+		write_object(o, demo.modificationTime);
+		write_blob(o, demo.error);
+	}
+
+	write_object(o, static_cast<uint64_t>(commands.size()));
+	for (const auto& command : commands)
+		write_blob(o, command);
+
+	write_object(o, static_cast<uint64_t>(terms.size()));
+	for (const auto& term : terms) {
+		write_blob(o, term.first);
+		write_blob(o, term.second);
+	}
+
+	// Write into a temporary file first so that the index is never left half-written.
+	auto temporary = temporary_filename(filename);
+	{
+		std::ofstream out(utf8_filename(temporary), std::ios::trunc | std::ios::binary);
+		out.write(o.data(), o.size());
+		out.close();
+		if (!out) {
+			remove_file(temporary);
+			throw std::runtime_error("Error writing " + temporary + ".");
+		}
+	}
+
+	if (!replace_file(temporary, filename)) {
+		remove_file(temporary);
+		throw std::runtime_error("Error writing " + filename + ".");
+	}
+}
+
+size_t DemoCommandIndex::Update(const std::vector<std::string>& filenames, unsigned threads)
+{
+	std::unordered_map<std::string, size_t> index;
+	for (size_t i = 0; i < demos.size(); ++i)
+		index[demos[i].path] = i;
+
+	std::vector<bool> remove(demos.size(), false);
+	std::vector<IndexedDemo> changed;
+	std::unordered_set<std::string> seen;
+
+	for (const auto& name : filenames) {
+		IndexedDemo demo;
+		demo.path = full_path(name);
+		if (!seen.insert(demo.path).second)
+			continue;
+
+		auto it = index.find(demo.path);
+		if (!stat_file(demo.path, demo.size, demo.modificationTime)) {
+			if (it != index.end())
+				remove[it->second] = true;
+			continue;
+		}
+
+		if (it != index.end()) {
+			const auto& old = demos[it->second];
+			if (old.size == demo.size && old.modificationTime == demo.modificationTime)
+				continue;
+			remove[it->second] = true;
+		}
+
+		changed.push_back(demo);
+	}
+
+	// Ingest the changed demos in parallel.
+	std::vector<std::vector<DemoCommandOccurrence>> occurrences(changed.size());
+	parallel_for(changed.size(), threads, [&](unsigned, size_t i) {
+		occurrences[i] = ReadCommands(changed[i].path, changed[i].error);
+	});
+
+	// The new demo list, and where the kept and the changed demos end up in it.
+	std::vector<IndexedDemo> merged;
+	std::vector<uint32_t> oldIds, newIds;
+	for (size_t i = 0; i < demos.size(); ++i) {
+		if (!remove[i])
+			merged.push_back(demos[i]);
+	}
+	for (const auto& demo : changed)
+		merged.push_back(demo);
+
+	std::vector<size_t> order(merged.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return merged[a].path < merged[b].path;
+	});
+
+	std::vector<uint32_t> position(merged.size());
+	std::vector<IndexedDemo> sorted;
+	sorted.reserve(merged.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		position[order[i]] = static_cast<uint32_t>(i);
+		sorted.push_back(std::move(merged[order[i]]));
+	}
+
+	const auto REMOVED = UINT32_MAX;
+	oldIds.assign(demos.size(), REMOVED);
+	for (size_t i = 0, kept = 0; i < demos.size(); ++i) {
+		if (!remove[i])
+			oldIds[i] = position[kept++];
+	}
+	auto keptCount = merged.size() - changed.size();
+	newIds.resize(changed.size());
+	for (size_t i = 0; i < changed.size(); ++i)
+		newIds[i] = position[keptCount + i];
+
+	// Rebuild the postings, dropping the unused commands.
+	std::vector<std::string> newCommands;
+	std::unordered_map<std::string, uint32_t> commandIds;
+	auto intern = [&](const std::string& command) {
+		auto it = commandIds.find(command);
+		if (it != commandIds.end())
+			return it->second;
+		auto id = static_cast<uint32_t>(newCommands.size());
+		commandIds.emplace(command, id);
+		newCommands.push_back(command);
+		return id;
+	};
+
+	std::map<std::string, std::vector<Posting>> newTerms;
+	for (const auto& term : terms) {
+		std::vector<Posting> postings;
+		for (auto p : term.second) {
+			if (oldIds[p.demo] == REMOVED)
+				continue;
+			p.demo = oldIds[p.demo];
+			p.command = intern(commands[p.command]);
+			postings.push_back(p);
+		}
+		if (!postings.empty())
+			newTerms[term.first] = std::move(postings);
+	}
+
+	for (size_t i = 0; i < changed.size(); ++i) {
+		for (const auto& o : occurrences[i]) {
+			Posting p;
+			p.demo = newIds[i];
+			p.entry = o.entry;
+			p.time = o.time;
+			p.frame = o.frame;
+			p.command = intern(o.command);
+			newTerms[CommandName(o.command)].push_back(p);
+		}
+	}
+
+	// The postings of every demo are already in order, only the demos need sorting.
+	for (auto& term : newTerms) {
+		std::stable_sort(term.second.begin(), term.second.end(), [](const Posting& a, const Posting& b) {
+			return a.demo < b.demo;
+		});
+	}
+
+	demos = std::move(sorted);
+	commands = std::move(newCommands);
+	terms = std::move(newTerms);
+
+	return changed.size();
+}
+
+std::vector<DemoCommandOccurrence> DemoCommandIndex::Find(const std::string& name, bool prefix) const
+{
+	std::vector<DemoCommandOccurrence> result;
+	auto key = to_lower(name);
+
+	auto add = [&](const std::vector<Posting>& postings) {
+		for (const auto& p : postings)
+			result.push_back(DemoCommandOccurrence{ p.demo, p.entry, p.time, p.frame, commands[p.command] });
+	};
+
+	if (!prefix) {
+		auto it = terms.find(key);
+		if (it != terms.end())
+			add(it->second);
+		return result;
+	}
+
+	for (auto it = terms.lower_bound(key); it != terms.end() && !it->first.compare(0, key.size(), key); ++it)
+		add(it->second);
+
+	// Occurrences of different commands are interleaved by demo and position.
+	std::stable_sort(result.begin(), result.end(), [](const DemoCommandOccurrence& a, const DemoCommandOccurrence& b) {
+		if (a.demo != b.demo)
+			return a.demo < b.demo;
+		if (a.entry != b.entry)
+			return a.entry < b.entry;
+		return a.frame < b.frame;
+	});
+
+	return result;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// A console command run in one of the indexed demos.
+struct DemoCommandOccurrence {
+	// Index into DemoCommandIndex::demos.
+	uint32_t demo;
+	// Index into the demo's directory entries.
+	uint32_t entry;
+	float time;
+	int32_t frame;
+	// The normalized command, see DemoCommandIndex::NormalizeCommands.
+	std::string command;
+};
+
+/*
+ * A persistent inverted index from console command names to the places
+ * in a set of demos where they were run. Updating it only reads
+ * the demos that are new or have changed since they were indexed.
+ *
+ * The std::string versions accept multibyte UTF-8 filenames,
+ * the std::wstring versions accept wide UTF-16 filenames.
+ */
+class DemoCommandIndex
+{
+public:
+	// Loads the index if the file exists.
+	DemoCommandIndex(const std::string& filename);
+	DemoCommandIndex(const std::wstring& filename);
+
+	/*
+	 * Brings the given demos up to date, reading the new and changed ones
+	 * on the given number of threads (0 means one per core). Demos that
+	 * don't exist anymore are removed. Returns the number of demos read.
+	 */
+	size_t Update(const std::vector<std::string>& filenames, unsigned threads = 0);
+	void Save();
+
+	/*
+	 * The occurrences of the commands with the given name, or with names
+	 * starting with it if prefix is set, ordered by demo and position.
+	 * The name is matched case-insensitively.
+	 */
+	std::vector<DemoCommandOccurrence> Find(const std::string& name, bool prefix) const;
+
+	/*
+	 * Splits the text of a console command frame into separate commands
+	 * at semicolons and newlines outside of quotes, collapses whitespace
+	 * and lowercases the command names.
+	 */
+	static std::vector<std::string> NormalizeCommands(const std::string& text);
+	// The first word of a normalized command.
+	static std::string CommandName(const std::string& command);
+
+	struct IndexedDemo {
+		// Absolute path, the key together with the size and the modification time.
+		std::string path;
+		uint64_t size;
+		// Seconds since the epoch.
+		int64_t modificationTime;
+		// Empty if the demo was read successfully.
+		std::string error;
+	};
+	// Sorted by path.
+	std::vector<IndexedDemo> demos;
+
+protected:
+	std::string filename;
+
+	struct Posting {
+		uint32_t demo;
+		uint32_t entry;
+		float time;
+		int32_t frame;
+		// Index into commands.
+		uint32_t command;
+	};
+	// The distinct normalized commands.
+	std::vector<std::string> commands;
+	// Command name to the postings, ordered by demo and position.
+	std::map<std::string, std::vector<Posting>> terms;
+
+	void Load();
+	static std::vector<DemoCommandOccurrence> ReadCommands(const std::string& path, std::string& error);
+};
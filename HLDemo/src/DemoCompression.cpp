@@ -0,0 +1,221 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HLDEMO_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HLDEMO_ZSTD
+#include <zstd.h>
+#endif
+
+#include "DemoCompression.hpp"
+
+enum {
+	// Input is read and output is grown in pieces of this size.
+	DECOMPRESS_CHUNK_SIZE = 1 << 18
+};
+
+static const unsigned char GZIP_MAGIC[] = { 0x1F, 0x8B };
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+DemoCompression DetectCompression(std::streambuf& in)
+{
+	unsigned char magic[4];
+	auto read = in.sgetn(reinterpret_cast<char*>(magic), sizeof(magic));
+	in.pubseekoff(-read, std::ios::cur, std::ios::in);
+
+	if (read >= static_cast<std::streamsize>(sizeof(ZSTD_MAGIC)) && !std::memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)))
+		return DemoCompression::ZSTD;
+	if (read >= static_cast<std::streamsize>(sizeof(GZIP_MAGIC)) && !std::memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)))
+		return DemoCompression::GZIP;
+
+	return DemoCompression::NONE;
+}
+
+// Makes room for the next piece of output, returns where it starts.
+static char* grow(std::vector<char>& out, size_t& before)
+{
+	before = out.size();
+	out.resize(before + DECOMPRESS_CHUNK_SIZE);
+	return out.data() + before;
+}
+
+#ifdef HLDEMO_ZLIB
+static bool decompress_gzip(std::streambuf& in, std::vector<char>& out, size_t maxSize)
+{
+	struct Inflater {
+		z_stream z;
+		Inflater()
+		{
+			std::memset(&z, 0, sizeof(z));
+			// Accept both gzip and zlib headers.
+			if (inflateInit2(&z, 15 + 32) != Z_OK)
+				throw std::runtime_error("Error decompressing the demo file: can't initialize zlib.");
+		}
+		~Inflater()
+		{
+			inflateEnd(&z);
+		}
+	} inflater;
+	auto& z = inflater.z;
+
+	std::vector<char> input(DECOMPRESS_CHUNK_SIZE);
+	// Concatenated gzip members make up one file, like with gzip -d.
+	bool memberEnded = false;
+
+	for (;;) {
+		auto read = in.sgetn(input.data(), input.size());
+		if (read <= 0)
+			break;
+
+		z.next_in = reinterpret_cast<Bytef*>(input.data());
+		z.avail_in = static_cast<uInt>(read);
+
+		do {
+			if (memberEnded) {
+				if (z.avail_in == 0)
+					break;
+				inflateReset(&z);
+				memberEnded = false;
+			}
+
+			size_t before;
+			z.next_out = reinterpret_cast<Bytef*>(grow(out, before));
+			z.avail_out = DECOMPRESS_CHUNK_SIZE;
+
+			auto ret = inflate(&z, Z_NO_FLUSH);
+			out.resize(before + DECOMPRESS_CHUNK_SIZE - z.avail_out);
+			if (ret == Z_STREAM_END)
+				memberEnded = true;
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+				throw std::runtime_error("Error decompressing the demo file: corrupt gzip data.");
+
+			if (out.size() > maxSize) {
+				out.resize(maxSize);
+				return false;
+			}
+		} while (z.avail_in > 0 || z.avail_out == 0);
+	}
+
+	if (!memberEnded)
+		throw std::runtime_error("Error decompressing the demo file: the gzip data is truncated.");
+
+	return true;
+}
+#endif
+
+#ifdef HLDEMO_ZSTD
+static bool decompress_zstd(std::streambuf& in, std::vector<char>& out, size_t maxSize)
+{
+	struct Decompressor {
+		ZSTD_DStream* s;
+		Decompressor()
+			: s(ZSTD_createDStream())
+		{
+			if (!s || ZSTD_isError(ZSTD_initDStream(s))) {
+				ZSTD_freeDStream(s);
+				throw std::runtime_error("Error decompressing the demo file: can't initialize zstd.");
+			}
+		}
+		~Decompressor()
+		{
+			ZSTD_freeDStream(s);
+		}
+	} decompressor;
+
+	std::vector<char> input(DECOMPRESS_CHUNK_SIZE);
+	// 0 once a frame is fully decoded and flushed.
+	size_t remaining = 0;
+	bool any = false;
+
+	for (;;) {
+		auto read = in.sgetn(input.data(), input.size());
+		if (read <= 0)
+			break;
+		any = true;
+
+		ZSTD_inBuffer inBuffer = { input.data(), static_cast<size_t>(read), 0 };
+		bool full;
+		do {
+			size_t before;
+			ZSTD_outBuffer outBuffer = { grow(out, before), DECOMPRESS_CHUNK_SIZE, 0 };
+
+			remaining = ZSTD_decompressStream(decompressor.s, &outBuffer, &inBuffer);
+			out.resize(before + outBuffer.pos);
+			if (ZSTD_isError(remaining))
+				throw std::runtime_error(std::string("Error decompressing the demo file: ") + ZSTD_getErrorName(remaining) + '.');
+			full = outBuffer.pos == outBuffer.size;
+
+			if (out.size() > maxSize) {
+				out.resize(maxSize);
+				return false;
+			}
+		} while (inBuffer.pos < inBuffer.size || full);
+	}
+
+	if (!any || remaining != 0)
+		throw std::runtime_error("Error decompressing the demo file: the zstd data is truncated.");
+
+	return true;
+}
+#endif
+
+bool Decompress(std::streambuf& in, DemoCompression compression, std::vector<char>& out, size_t maxSize)
+{
+	switch (compression) {
+	case DemoCompression::NONE:
+		break;
+
+	case DemoCompression::GZIP:
+#ifdef HLDEMO_ZLIB
+		return decompress_gzip(in, out, maxSize);
+#else
+		throw std::runtime_error("Error opening the demo file: this build can't read gzip-compressed demos.");
+#endif
+
+	case DemoCompression::ZSTD:
+#ifdef HLDEMO_ZSTD
+		return decompress_zstd(in, out, maxSize);
+#else
+		throw std::runtime_error("Error opening the demo file: this build can't read zstd-compressed demos.");
+#endif
+	}
+
+	throw std::runtime_error("Error opening the demo file: the data isn't compressed.");
+}
+
+DemoMemoryBuffer::DemoMemoryBuffer(std::vector<char> data)
+	: data(std::move(data))
+{
+	auto begin = this->data.data();
+	setg(begin, begin, begin + this->data.size());
+}
+
+DemoMemoryBuffer::pos_type DemoMemoryBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+	if (!(which & std::ios_base::in))
+		return pos_type(off_type(-1));
+
+	off_type base = 0;
+	if (dir == std::ios_base::cur)
+		base = gptr() - eback();
+	else if (dir == std::ios_base::end)
+		base = egptr() - eback();
+
+	auto pos = base + off;
+	if (pos < 0 || pos > egptr() - eback())
+		return pos_type(off_type(-1));
+
+	setg(eback(), eback() + pos, egptr());
+	return pos_type(pos);
+}
+
+DemoMemoryBuffer::pos_type DemoMemoryBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	return seekoff(off_type(pos), std::ios_base::beg, which);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+#include <vector>
+
+enum class DemoCompression {
+	NONE,
+	GZIP,
+	ZSTD
+};
+
+// Looks at the magic bytes at the current position, leaves the position as it was.
+DemoCompression DetectCompression(std::streambuf& in);
+
+/*
+ * Decompresses everything from the current position into out, reading the
+ * input in chunks. Stops after maxSize bytes and returns false if there was
+ * more. Throws if the data is corrupt or the format isn't supported by this
+ * build.
+ */
+bool Decompress(std::streambuf& in, DemoCompression compression, std::vector<char>& out, size_t maxSize);
+
+// A read-only, seekable stream buffer over decompressed data.
+class DemoMemoryBuffer : public std::streambuf
+{
+public:
+	DemoMemoryBuffer(std::vector<char> data);
+
+protected:
+	std::vector<char> data;
+
+	pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+	pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
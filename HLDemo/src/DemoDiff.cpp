@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "DemoDiff.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoSchema.hpp"
+
+enum {
+	// Identical stretches are compared in blocks of growing size, starting
+	// small so that frames which differ early on are given up on quickly.
+	DIFF_FIRST_BLOCK_SIZE = 64,
+	DIFF_MAX_BLOCK_SIZE = 1 << 16
+};
+
+static const size_t NO_INDEX = SIZE_MAX;
+
+static std::string format_value(float value)
+{
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.9g", value);
+	return buf;
+}
+
+static std::string format_value(const std::string& value)
+{
+	return '"' + value + '"';
+}
+
+static std::string format_value(const DemoString& value)
+{
+	return format_value(value.str());
+}
+
+template<typename T>
+static std::string format_value(T value)
+{
+	return std::to_string(static_cast<long long>(value));
+}
+
+// Floats are compared bitwise, so that NaNs and signed zeros compare like the file bytes do.
+static bool equal_values(float a, float b)
+{
+	return !std::memcmp(&a, &b, sizeof(a));
+}
+
+template<typename T>
+static bool equal_values(const T& a, const T& b)
+{
+	return a == b;
+}
+
+// Compares fields one by one, recording the changed ones unless changes is null.
+class FieldComparer
+{
+public:
+	explicit FieldComparer(std::vector<DemoFieldChange>* changes)
+		: equal(true)
+		, changes(changes)
+	{
+	}
+
+	bool equal;
+
+	// Called by schema_visit for every field.
+	template<typename T>
+	void operator()(const char* name, const T& a, const T& b)
+	{
+		Compare(name, a, b);
+	}
+
+	template<typename T>
+	void Compare(const char* name, const T& a, const T& b, size_t index = NO_INDEX)
+	{
+		if (!equal_values(a, b))
+			Add(name, index, format_value(a), format_value(b));
+	}
+
+	template<typename T, size_t N>
+	void Compare(const char* name, const T (&a)[N], const T (&b)[N])
+	{
+		for (size_t i = 0; i < N; ++i)
+			Compare(name, a[i], b[i], i);
+	}
+
+	// Only the first differing element is recorded.
+	template<typename T>
+	void Compare(const char* name, const std::vector<T>& a, const std::vector<T>& b)
+	{
+		if (a.size() != b.size()) {
+			Add(name, NO_INDEX, std::to_string(a.size()) + " bytes", std::to_string(b.size()) + " bytes");
+			return;
+		}
+		if (a.empty() || !std::memcmp(a.data(), b.data(), a.size() * sizeof(T)))
+			return;
+
+		auto i = static_cast<size_t>(std::mismatch(a.begin(), a.end(), b.begin()).first - a.begin());
+		Compare(name, a[i], b[i], i);
+	}
+
+	// Frames of one demo share the movevars, so usually only the first comparison goes through them.
+	void Compare(const char* name, const std::shared_ptr<const DemoMoveVars>& a, const std::shared_ptr<const DemoMoveVars>& b)
+	{
+		if (a == b)
+			return;
+
+		static const DemoMoveVars noMoveVars = {};
+		auto outer = prefix;
+		prefix += name;
+		prefix += '.';
+		schema_visit<DemoMoveVars>(*this, a ? *a : noMoveVars, b ? *b : noMoveVars);
+		prefix = outer;
+	}
+
+protected:
+	std::vector<DemoFieldChange>* changes;
+	// Of the fields of nested structures.
+	std::string prefix;
+
+	void Add(const char* name, size_t index, std::string first, std::string second)
+	{
+		equal = false;
+		if (!changes)
+			return;
+
+		DemoFieldChange change;
+		change.name = prefix + name;
+		if (index != NO_INDEX)
+			change.name += '[' + std::to_string(index) + ']';
+		change.first = std::move(first);
+		change.second = std::move(second);
+		changes->push_back(std::move(change));
+	}
+};
+
+#define FIELD(name) c.Compare(#name, fa.name, fb.name)
+
+static bool is_netmsg(DemoFrameType type)
+{
+	auto value = static_cast<uint8_t>(type);
+	return value < 2 || value > 9;
+}
+
+static void compare_frames(FieldComparer& c, const DemoFrame& a, const DemoFrame& b)
+{
+	c.Compare("type", static_cast<uint8_t>(a.type), static_cast<uint8_t>(b.type));
+	c.Compare("time", a.time, b.time);
+	c.Compare("frame", a.frame, b.frame);
+
+	// Different kinds of frames have nothing else in common.
+	if (a.type != b.type && !(is_netmsg(a.type) && is_netmsg(b.type)))
+		return;
+
+	dispatch_frame_type(a.type, [&](auto* tag) {
+		using T = std::remove_pointer_t<decltype(tag)>;
+		schema_visit<T>(c, static_cast<const T&>(a), static_cast<const T&>(b));
+	});
+}
+
+// The length of the common prefix of the two buffers.
+static size_t common_prefix(const char* a, const char* b, size_t size)
+{
+	size_t done = 0, block = DIFF_FIRST_BLOCK_SIZE;
+	while (done < size) {
+		auto n = std::min(block, size - done);
+		if (std::memcmp(a + done, b + done, n))
+			return static_cast<size_t>(std::mismatch(a + done, a + done + n, b + done).first - a);
+
+		done += n;
+		block = std::min<size_t>(block * 2, DIFF_MAX_BLOCK_SIZE);
+	}
+
+	return size;
+}
+
+/*
+ * A frame of one of the demos. Frames of uncompressed demos are only
+ * decoded once their bytes differ, the others are read by ReadFrames.
+ */
+struct DiffFrame {
+	DemoFrameType type;
+	float time;
+	int32_t frame;
+	// The bytes of the frame in the mapped file, an offset of -1 if there's none.
+	int64_t offset;
+	int64_t size;
+	std::shared_ptr<DemoFrame> decoded;
+};
+
+// Reads the frame fields from the mapped file, the frame's size is checked up front.
+class MappedSource
+{
+public:
+	MappedSource(const char* p, const char* end)
+		: p(p)
+		, end(end)
+	{
+	}
+
+	bool Available(int64_t size) const
+	{
+		return end - p >= size;
+	}
+
+	template<size_t Size>
+	const char* Fixed()
+	{
+		auto fixed = p;
+		p += Size;
+		return fixed;
+	}
+
+	void Read(void* dst, size_t size)
+	{
+		std::memcpy(dst, p, size);
+		p += size;
+	}
+
+protected:
+	const char* p;
+	const char* end;
+};
+
+/*
+ * The frames of the entry, found by their headers and lengths in the
+ * mapped file the way ReadFrames finds them: up to the NEXT_SECTION, the
+ * end of the file or the first cut off frame.
+ */
+static std::vector<DiffFrame> walk_frames(const DemoDirectoryEntry& entry, const MappedFile& file)
+{
+	std::vector<DiffFrame> frames;
+	if (entry.offset < 0 || static_cast<int64_t>(file.size) < entry.offset)
+		return frames;
+
+	auto size = static_cast<int64_t>(file.size);
+	int64_t pos = entry.offset;
+	while (size - MIN_FRAME_SIZE >= pos) {
+		DiffFrame f;
+		std::memcpy(&f.type, file.data + pos, 1);
+		std::memcpy(&f.time, file.data + pos + 1, 4);
+		std::memcpy(&f.frame, file.data + pos + 5, 4);
+
+		int64_t fixed, lengthOffset;
+		frame_layout(f.type, fixed, lengthOffset);
+
+		int64_t length = 0;
+		if (lengthOffset >= 0) {
+			if (size - FRAME_HEADER_SIZE - lengthOffset - 4 < pos)
+				break;
+
+			int32_t value;
+			std::memcpy(&value, file.data + pos + FRAME_HEADER_SIZE + lengthOffset, sizeof(value));
+			if (value < 0 || value > frame_max_length(f.type))
+				break;
+			length = value;
+		}
+
+		f.offset = pos;
+		f.size = FRAME_HEADER_SIZE + fixed + length;
+		if (size - f.size < pos)
+			break;
+
+		frames.push_back(f);
+		pos += f.size;
+		if (f.type == DemoFrameType::NEXT_SECTION)
+			break;
+	}
+
+	return frames;
+}
+
+// The frames ReadFrames read into the entry.
+static std::vector<DiffFrame> read_frames(const DemoDirectoryEntry& entry)
+{
+	std::vector<DiffFrame> frames;
+	frames.reserve(entry.frames.size());
+	for (const auto& frame : entry.frames)
+		frames.push_back(DiffFrame{ frame->type, frame->time, frame->frame, -1, 0, frame });
+	return frames;
+}
+
+static const DemoFrame& decode(DiffFrame& f, const MappedFile* file)
+{
+	if (f.decoded)
+		return *f.decoded;
+
+	MappedSource source(file->data + f.offset + FRAME_HEADER_SIZE, file->data + f.offset + f.size);
+	SchemaDecodeContext ctx;
+	dispatch_frame_type(f.type, [&](auto* tag) {
+		using T = std::remove_pointer_t<decltype(tag)>;
+		std::shared_ptr<T> frame = std::make_shared<T>();
+		frame->type = f.type;
+		frame->time = f.time;
+		frame->frame = f.frame;
+		// walk_frames has checked the lengths already.
+		schema_decode(source, *frame, ctx);
+		f.decoded = frame;
+	});
+	return *f.decoded;
+}
+
+// Whether a comes before b, when their frame numbers differ.
+static bool earlier(const DiffFrame& a, const DiffFrame& b)
+{
+	if (a.time != b.time)
+		return a.time < b.time;
+	return a.frame < b.frame;
+}
+
+// The mapped file if it's an uncompressed demo, otherwise null.
+static std::unique_ptr<MappedFile> map_demo(const std::string& filename)
+{
+	std::unique_ptr<MappedFile> file(new MappedFile(filename));
+	if (file->size < HEADER_SIZE || std::memcmp(file->data, "HLDEMO", HEADER_SIGNATURE_CHECK_SIZE))
+		file.reset();
+	return file;
+}
+
+DemoDiff::DemoDiff(const std::string& first, const std::string& second)
+	: divergence()
+	, frameTypes()
+	, total()
+	, bytesSkipped(0)
+{
+	Compare(first, second);
+}
+
+DemoDiff::DemoDiff(const std::wstring& first, const std::wstring& second)
+	: divergence()
+	, frameTypes()
+	, total()
+	, bytesSkipped(0)
+{
+	Compare(utf16_to_utf8(first), utf16_to_utf8(second));
+}
+
+bool DemoDiff::Identical() const
+{
+	return !divergence.found;
+}
+
+void DemoDiff::Compare(const std::string& first, const std::string& second)
+{
+	DemoFile a(first), b(second);
+
+	// Uncompressed demos only need their header and directory read.
+	auto rawA = map_demo(first);
+	auto rawB = rawA ? map_demo(second) : nullptr;
+	if (!rawB)
+		rawA.reset();
+
+	if (rawA) {
+		if (a.header.demoProtocol != 5 || b.header.demoProtocol != 5)
+			throw std::runtime_error("Only demo protocol 5 is supported.");
+	} else {
+		// Read the two demos at the same time.
+		std::exception_ptr error;
+		std::thread reader([&]() {
+			try {
+				b.ReadFrames();
+			} catch (...) {
+				error = std::current_exception();
+			}
+		});
+		try {
+			a.ReadFrames();
+		} catch (...) {
+			reader.join();
+			throw;
+		}
+		reader.join();
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	CompareHeaders(a.header, b.header);
+	CompareEntries(a.directoryEntries, b.directoryEntries, rawA.get(), rawB.get());
+
+	for (const auto& tally : frameTypes) {
+		total.identical += tally.identical;
+		total.changed += tally.changed;
+		total.onlyInFirst += tally.onlyInFirst;
+		total.onlyInSecond += tally.onlyInSecond;
+	}
+}
+
+void DemoDiff::CompareHeaders(const DemoHeader& fa, const DemoHeader& fb)
+{
+	std::vector<DemoFieldChange> changes;
+	FieldComparer c(&changes);
+	FIELD(netProtocol);
+	FIELD(demoProtocol);
+	FIELD(mapName);
+	FIELD(gameDir);
+	FIELD(mapCRC);
+
+	if (!c.equal) {
+		Diverge(DemoDivergencePlace::HEADER, 0, nullptr, NO_FRAME, nullptr, NO_FRAME);
+		divergence.fields = std::move(changes);
+	}
+}
+
+void DemoDiff::CompareEntries(const std::vector<DemoDirectoryEntry>& a, const std::vector<DemoDirectoryEntry>& b,
+	const MappedFile* rawA, const MappedFile* rawB)
+{
+	auto count = std::max(a.size(), b.size());
+	for (size_t e = 0; e < count; ++e) {
+		// An entry only one of the demos has.
+		if (e >= a.size() || e >= b.size()) {
+			bool inFirst = e < a.size();
+			if (!divergence.found) {
+				Diverge(DemoDivergencePlace::ENTRY, e, nullptr, NO_FRAME, nullptr, NO_FRAME);
+				divergence.fields.push_back(DemoFieldChange{ "entry", inFirst ? "present" : "missing", inFirst ? "missing" : "present" });
+			}
+			const auto& entry = (inFirst ? a : b)[e];
+			const auto* raw = inFirst ? rawA : rawB;
+			for (const auto& frame : raw ? walk_frames(entry, *raw) : read_frames(entry)) {
+				auto& tally = frameTypes[static_cast<uint8_t>(frame.type)];
+				if (inFirst)
+					tally.onlyInFirst++;
+				else
+					tally.onlyInSecond++;
+			}
+			continue;
+		}
+
+		const auto& fa = a[e];
+		const auto& fb = b[e];
+		{
+			std::vector<DemoFieldChange> changes;
+			FieldComparer c(divergence.found ? nullptr : &changes);
+			FIELD(type);
+			FIELD(description);
+			FIELD(flags);
+			FIELD(CDTrack);
+			FIELD(trackTime);
+			FIELD(frameCount);
+			if (!c.equal && !divergence.found) {
+				Diverge(DemoDivergencePlace::ENTRY, e, nullptr, NO_FRAME, nullptr, NO_FRAME);
+				divergence.fields = std::move(changes);
+			}
+		}
+
+		auto framesA = rawA ? walk_frames(fa, *rawA) : read_frames(fa);
+		auto framesB = rawB ? walk_frames(fb, *rawB) : read_frames(fb);
+		size_t i = 0, j = 0;
+		while (i < framesA.size() || j < framesB.size()) {
+			if (rawA && i < framesA.size() && j < framesB.size()) {
+				// Skip over the frames that are entirely within the identical stretch.
+				auto startA = framesA[i].offset, startB = framesB[j].offset;
+				auto endA = framesA.back().offset + framesA.back().size;
+				auto endB = framesB.back().offset + framesB.back().size;
+				auto size = static_cast<size_t>(std::min(endA - startA, endB - startB));
+				auto same = static_cast<int64_t>(common_prefix(rawA->data + startA, rawB->data + startB, size));
+
+				while (i < framesA.size() && j < framesB.size()
+					&& framesA[i].offset + framesA[i].size - startA <= same && framesA[i].size == framesB[j].size) {
+					frameTypes[static_cast<uint8_t>(framesA[i].type)].identical++;
+					++i;
+					++j;
+				}
+				bytesSkipped += static_cast<uint64_t>((i < framesA.size() ? framesA[i].offset : endA) - startA);
+
+				if (i == framesA.size() || j == framesB.size())
+					continue;
+			}
+
+			if (i < framesA.size() && j < framesB.size() && framesA[i].frame == framesB[j].frame) {
+				std::vector<DemoFieldChange> changes;
+				FieldComparer c(divergence.found ? nullptr : &changes);
+				const auto& da = decode(framesA[i], rawA);
+				const auto& db = decode(framesB[j], rawB);
+				compare_frames(c, da, db);
+
+				auto& tally = frameTypes[static_cast<uint8_t>(framesA[i].type)];
+				if (c.equal) {
+					tally.identical++;
+				} else {
+					tally.changed++;
+					if (!divergence.found) {
+						Diverge(DemoDivergencePlace::FRAME, e, &da, i, &db, j);
+						divergence.fields = std::move(changes);
+					}
+				}
+				// Decoded frames aren't needed again.
+				framesA[i].decoded.reset();
+				framesB[j].decoded.reset();
+				++i;
+				++j;
+			} else if (j == framesB.size() || (i < framesA.size() && earlier(framesA[i], framesB[j]))) {
+				frameTypes[static_cast<uint8_t>(framesA[i].type)].onlyInFirst++;
+				if (!divergence.found)
+					Diverge(DemoDivergencePlace::FRAME, e, &decode(framesA[i], rawA), i, nullptr, NO_FRAME);
+				++i;
+			} else {
+				frameTypes[static_cast<uint8_t>(framesB[j].type)].onlyInSecond++;
+				if (!divergence.found)
+					Diverge(DemoDivergencePlace::FRAME, e, nullptr, NO_FRAME, &decode(framesB[j], rawB), j);
+				++j;
+			}
+		}
+	}
+}
+
+#undef FIELD
+
+void DemoDiff::Diverge(DemoDivergencePlace place, size_t entry, const DemoFrame* a, size_t firstFrame, const DemoFrame* b, size_t secondFrame)
+{
+	divergence.found = true;
+	divergence.place = place;
+	divergence.entry = entry;
+	divergence.firstFrame = firstFrame;
+	divergence.secondFrame = secondFrame;
+	divergence.fields.clear();
+
+	auto frame = a ? a : b;
+	if (frame) {
+		divergence.type = frame->type;
+		divergence.time = frame->time;
+		divergence.frame = frame->frame;
+	}
+}
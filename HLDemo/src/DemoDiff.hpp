@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+
+class MappedFile;
+
+// How the frames of one type compare between the two demos.
+struct DemoDiffTally {
+	size_t identical;
+	size_t changed;
+	size_t onlyInFirst;
+	size_t onlyInSecond;
+};
+
+struct DemoFieldChange {
+	// Like DemoInfo.RefParams.viewangles[1] or msg[12].
+	std::string name;
+	std::string first, second;
+};
+
+enum class DemoDivergencePlace {
+	HEADER,
+	ENTRY,
+	FRAME
+};
+
+// The first place where the two demos differ.
+struct DemoDivergence {
+	bool found;
+	DemoDivergencePlace place;
+	// Index into the directory entries, for ENTRY and FRAME.
+	size_t entry;
+	// Indices into the entry's frames, NO_FRAME in the demo that doesn't have the frame.
+	size_t firstFrame, secondFrame;
+	// Of the frame, taken from the first demo if it has it.
+	DemoFrameType type;
+	float time;
+	int32_t frame;
+	std::vector<DemoFieldChange> fields;
+};
+
+/*
+ * Compares two demos structurally: the header, the directory entries
+ * and every decoded frame field, including the netmsg bytes. The layout
+ * (the offsets and the lengths) isn't compared, it follows from the rest.
+ *
+ * Frames are aligned per entry: frames with the same frame number are
+ * paired in order, otherwise the one earlier in time has no counterpart.
+ * Uncompressed demos are mapped and their frames found by the frame
+ * headers, stretches of identical bytes are skipped and only the frames
+ * in between are decoded. Compressed demos are read whole and compared
+ * field by field.
+ * Frames that differ only in bytes the decoder ignores, such as the
+ * padding after a console command, count as identical.
+ *
+ * The std::string version accepts multibyte UTF-8 filenames,
+ * the std::wstring version accepts wide UTF-16 filenames.
+ */
+class DemoDiff
+{
+public:
+	DemoDiff(const std::string& first, const std::string& second);
+	DemoDiff(const std::wstring& first, const std::wstring& second);
+
+	static const size_t NO_FRAME = SIZE_MAX;
+
+	DemoDivergence divergence;
+	// Indexed by the frame type byte, netmsg frames have types outside of 2-9.
+	DemoDiffTally frameTypes[256];
+	DemoDiffTally total;
+	// Frame bytes skipped over as identical without decoding them again.
+	uint64_t bytesSkipped;
+
+	bool Identical() const;
+
+protected:
+	void Compare(const std::string& first, const std::string& second);
+	void CompareHeaders(const DemoHeader& a, const DemoHeader& b);
+	void CompareEntries(const std::vector<DemoDirectoryEntry>& a, const std::vector<DemoDirectoryEntry>& b,
+		const MappedFile* rawA, const MappedFile* rawB);
+	void Diverge(DemoDivergencePlace place, size_t entry, const DemoFrame* a, size_t firstFrame, const DemoFrame* b, size_t secondFrame);
+};
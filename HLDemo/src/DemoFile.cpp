@@ -1,138 +1,374 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <codecvt>
+#include <climits>
+#include <cstdint>
 #include <cstring>
 #include <exception>
 #include <fstream>
+#include <functional>
 #include <iterator>
 #include <locale>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include "DemoCompression.hpp"
 #include "DemoFile.hpp"
+#include "DemoFormat.hpp"
 #include "DemoFrame.hpp"
+#include "DemoKernels.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoSchema.hpp"
+#include "DemoWriter.hpp"
+
+template<typename T>
+static void read_object(std::istream& i, T& obj)
+{
+	i.read(reinterpret_cast<char*>(&obj), sizeof(T));
+}
 
 enum {
-	HEADER_SIZE = 544,
-	HEADER_SIGNATURE_CHECK_SIZE = 6,
-	HEADER_SIGNATURE_SIZE = 8,
-	HEADER_MAPNAME_SIZE = 260,
-	HEADER_GAMEDIR_SIZE = 260,
-
-	MIN_DIR_ENTRY_COUNT = 1,
-	MAX_DIR_ENTRY_COUNT = 1024,
-	DIR_ENTRY_SIZE = 92,
-	DIR_ENTRY_DESCRIPTION_SIZE = 64,
-
-	MIN_FRAME_SIZE = 12,
-	FRAME_CONSOLE_COMMAND_SIZE = 64,
-	FRAME_CLIENT_DATA_SIZE = 32,
-	FRAME_EVENT_SIZE = 84,
-	FRAME_WEAPON_ANIM_SIZE = 8,
-	FRAME_SOUND_SIZE_1 = 8,
-	FRAME_SOUND_SIZE_2 = 16,
-	FRAME_DEMO_BUFFER_SIZE = 4,
-	FRAME_NETMSG_SIZE = 468,
-	FRAME_NETMSG_DEMOINFO_SIZE = 436,
-	FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE = 32,
-	FRAME_NETMSG_MIN_MESSAGE_LENGTH = 0,
-	FRAME_NETMSG_MAX_MESSAGE_LENGTH = 65536
+	// Recovery mode assumes nobody pauses a recording for longer than that.
+	RECOVERY_MAX_TIME = 1000000,
+	RECOVERY_MAX_FRAME = 100000000,
+	RECOVERY_MAX_TIME_JUMP = 600,
+	RECOVERY_MAX_FRAME_JUMP = 100000,
+	RECOVERY_SCAN_CHUNK_SIZE = 1 << 20,
+	// No frame starts with this many zero bytes: a netmsg has nonzero movevars, the others a nonzero type.
+	RECOVERY_ZERO_RUN = FRAME_HEADER_SIZE + FRAME_NETMSG_SIZE
 };
 
-template<typename T>
-static void read_object(std::ifstream& i, T& obj)
+enum {
+	// Frames per unit of work for SaveParallel.
+	PARALLEL_SAVE_CHUNK_FRAMES = 4096
+};
+
+enum {
+	// ReadFrames looks at the clock for progress reports this often.
+	PROGRESS_CHECK_FRAMES = 64
+};
+
+DemoCancellation::DemoCancellation()
+	: cancelled(false)
 {
-	i.read(reinterpret_cast<char*>(&obj), sizeof(T));
 }
 
-template<typename T>
-static void read_objects(std::ifstream& i, std::vector<T>& objs)
+void DemoCancellation::Cancel()
 {
-	i.read(reinterpret_cast<char*>(objs.data()), objs.size() * sizeof(T));
+	cancelled = true;
 }
 
-template<typename T>
-static void write_object(std::ofstream& o, const T& obj)
+bool DemoCancellation::IsCancelled() const
 {
-	o.write(reinterpret_cast<const char*>(&obj), sizeof(T));
+	return cancelled;
 }
 
-template<typename T>
-static void write_objects(std::ofstream& o, const std::vector<T>& objs)
+DemoCancelled::DemoCancelled()
+	: std::runtime_error("The operation was cancelled.")
+{
+}
+
+/*
+ * Hands out one shared copy of every distinct movevars block and string
+ * (console commands and sky names) while a demo is read. Consecutive frames
+ * nearly always repeat the movevars, so the previous block is checked
+ * before the table. The strings are looked up by the hash of their bytes,
+ * so a string seen before isn't copied.
+ */
+class FrameInterner
+{
+public:
+	// Cleared when a decoded string wouldn't be encoded back to the same bytes, see schema_decode.
+	bool canonical = true;
+
+	std::shared_ptr<const DemoMoveVars> MoveVars(const char* raw)
+	{
+		if (lastMoveVars && !std::memcmp(lastMoveVarsRaw.data(), raw, FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE))
+			return lastMoveVars;
+
+		lastMoveVarsRaw.assign(raw, FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE);
+		auto& mv = moveVars[lastMoveVarsRaw];
+		if (!mv) {
+			auto decoded = std::make_shared<DemoMoveVars>();
+			schema_decode_fixed(raw, *decoded, *this);
+			mv = std::move(decoded);
+		}
+		lastMoveVars = mv;
+		return mv;
+	}
+
+	DemoString Intern(const char* text)
+	{
+		auto size = std::strlen(text);
+		auto hash = hash_bytes(text, size);
+		auto range = strings.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			const auto& str = it->second.str();
+			if (str.size() == size && !std::memcmp(str.data(), text, size))
+				return it->second;
+		}
+		return strings.emplace(hash, DemoString(text))->second;
+	}
+
+protected:
+	std::string lastMoveVarsRaw;
+	std::shared_ptr<const DemoMoveVars> lastMoveVars;
+	std::unordered_map<std::string, std::shared_ptr<const DemoMoveVars>> moveVars;
+	std::unordered_multimap<uint64_t, DemoString> strings;
+};
+
+// Reads the frame fields from the demo, checked once per piece by schema_decode.
+class StreamSource
+{
+public:
+	StreamSource(std::istream& demo, std::streamoff demoSize, std::streamoff pos)
+		: demo(demo)
+		, demoSize(demoSize)
+		, pos(pos)
+	{
+	}
+
+	bool Available(int64_t size) const
+	{
+		return demoSize - size >= pos;
+	}
+
+	template<size_t Size>
+	const char* Fixed()
+	{
+		static_assert(Size <= sizeof(buf), "The fixed part doesn't fit into the buffer.");
+		demo.read(buf, Size);
+		pos += Size;
+		return buf;
+	}
+
+	void Read(void* dst, size_t size)
+	{
+		demo.read(static_cast<char*>(dst), size);
+		pos += size;
+	}
+
+protected:
+	std::istream& demo;
+	std::streamoff demoSize;
+	std::streamoff pos;
+	// The netmsg fixed part is the largest.
+	char buf[FRAME_NETMSG_SIZE];
+};
+
+/*
+ * Keeps the per-entry byte counts and calls the progress callback at most
+ * once per interval. Safe to use from several threads, the callback is
+ * never called concurrently.
+ */
+class ProgressReporter
 {
-	o.write(reinterpret_cast<const char*>(objs.data()), objs.size() * sizeof(T));
+public:
+	ProgressReporter(const DemoFile::ProgressCallback& callback, std::chrono::milliseconds interval, std::vector<int64_t> entryTotals)
+		: callback(callback)
+		, interval(interval)
+		, entryTotals(std::move(entryTotals))
+		, entryDone(this->entryTotals.size(), 0)
+		, done(0)
+		, total(0)
+		, lastReport(std::chrono::steady_clock::now())
+	{
+		for (auto t : this->entryTotals)
+			total += t;
+	}
+
+	// Sets the bytes done in the entry.
+	void Set(size_t entry, int64_t bytes, bool force)
+	{
+		if (!callback)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		done += bytes - entryDone[entry];
+		entryDone[entry] = bytes;
+		Report(entry, force);
+	}
+
+	// Adds to the bytes done in the entry.
+	void Add(size_t entry, int64_t bytes)
+	{
+		if (!callback)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		done += bytes;
+		entryDone[entry] += bytes;
+		Report(entry, entryDone[entry] == entryTotals[entry]);
+	}
+
+protected:
+	const DemoFile::ProgressCallback& callback;
+	std::chrono::milliseconds interval;
+	std::vector<int64_t> entryTotals;
+	std::vector<int64_t> entryDone;
+	int64_t done, total;
+	std::chrono::steady_clock::time_point lastReport;
+	std::mutex mutex;
+
+	void Report(size_t entry, bool force)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (!force && now - lastReport < interval)
+			return;
+
+		lastReport = now;
+		callback(DemoProgress{ entry, entryDone[entry], entryTotals[entry], done, total });
+	}
+};
+
+static bool plausible_frame_header(DemoFrameType type, float time, int32_t frame, bool haveLast, float lastTime, int32_t lastFrame)
+{
+	if (static_cast<uint8_t>(type) > static_cast<uint8_t>(DemoFrameType::DEMO_BUFFER))
+		return false;
+	if (!(time >= 0 && time <= RECOVERY_MAX_TIME) || frame < 0 || frame > RECOVERY_MAX_FRAME)
+		return false;
+	if (!haveLast)
+		return true;
+
+	// Save() terminates entries with a zeroed NEXT_SECTION if it's missing.
+	if (type == DemoFrameType::NEXT_SECTION && time == 0 && frame == 0)
+		return true;
+
+	return time >= lastTime && time - lastTime <= RECOVERY_MAX_TIME_JUMP
+		&& frame >= lastFrame && frame - static_cast<int64_t>(lastFrame) <= RECOVERY_MAX_FRAME_JUMP;
+}
+
+// Returns the position of the first nonzero byte in [from, size), or size.
+static size_t find_nonzero_byte(const char* data, size_t from, size_t size)
+{
+	for (; from + sizeof(uint64_t) <= size; from += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, data + from, sizeof(word));
+		if (word)
+			break;
+	}
+	for (; from < size; ++from) {
+		if (data[from])
+			return from;
+	}
+
+	return size;
 }
 
 static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> string_converter;
-static std::wstring utf8_to_utf16(const std::string& str)
+std::wstring utf8_to_utf16(const std::string& str)
 {
 	return string_converter.from_bytes(str);
 }
 
-static std::string utf16_to_utf8(const std::wstring& str)
+std::string utf16_to_utf8(const std::wstring& str)
 {
 	return string_converter.to_bytes(str);
 }
-
-#ifdef _WIN32
-#define utf8_filename(str) utf8_to_utf16(str)
-#define utf16_filename(str) str
-#else
-#define utf8_filename(str) str
-#define utf16_filename(str) utf16_to_utf8(str)
-#endif
-
 DemoFile::DemoFile(const std::string& filename)
+	: demo(nullptr)
 {
-	demo.open(utf8_filename(filename), std::ios::binary);
-	ConstructorInternal();
+	std::unique_ptr<std::filebuf> file(new std::filebuf);
+	file->open(utf8_filename(filename).c_str(), std::ios::in | std::ios::binary);
+	ConstructorInternal(std::move(file), filename);
 }
 
 DemoFile::DemoFile(const std::wstring& filename)
+	: demo(nullptr)
 {
-	demo.open(utf16_filename(filename), std::ios::binary);
-	ConstructorInternal();
+	std::unique_ptr<std::filebuf> file(new std::filebuf);
+	file->open(utf16_filename(filename).c_str(), std::ios::in | std::ios::binary);
+	ConstructorInternal(std::move(file), utf16_to_utf8(filename));
 }
 
-void DemoFile::ConstructorInternal()
+/*
+ * Frames carry the id of the file version they were read from, so that
+ * frames restored from a snapshot of the same version still have their
+ * source. Save trusts it, so it takes all 64 bits of the hash.
+ */
+static uint64_t source_id(const FileVersion& version)
 {
-	if (!demo)
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (auto v : { version.device, version.index, version.size, static_cast<uint64_t>(version.modified) })
+		h = (h ^ v) * 0x100000001b3ull;
+
+	return h ? h : 1;
+}
+
+DemoFile::DemoFile()
+	: recoveryMode(false)
+	, keepFrames(true)
+	, progressInterval(100)
+	, demo(nullptr)
+	, demoSize(0)
+	, sourceId(0)
+	, readFrames(false)
+	, framesDropped(false)
+{
+}
+
+void DemoFile::OpenSource(const std::string& filename)
+{
+	sourceFilename = filename;
+	try {
+		source = std::make_shared<PositionalFile>(filename);
+		sourceId = source_id(source->Version());
+	} catch (const std::exception&) {
+		// Then everything is encoded on Save.
+	}
+}
+
+void DemoFile::ConstructorInternal(std::unique_ptr<std::filebuf> file, const std::string& filename)
+{
+	if (!file->is_open())
 		throw std::runtime_error("Error opening the demo file.");
 
+	sourceId = 0;
+
+	auto compression = DetectCompression(*file);
+	if (compression == DemoCompression::NONE) {
+		demoBuffer = std::move(file);
+		OpenSource(filename);
+	} else {
+		// Offsets are 32-bit, anything bigger can't be a valid demo.
+		std::vector<char> data;
+		if (!Decompress(*file, compression, data, INT32_MAX))
+			throw std::runtime_error("Invalid demo file (the decompressed size is too big).");
+		demoBuffer.reset(new DemoMemoryBuffer(std::move(data)));
+	}
+	demo.rdbuf(demoBuffer.get());
+
 	demo.seekg(0, std::ios::end);
 	demoSize = demo.tellg();
 	if (demoSize < HEADER_SIZE)
 		throw std::runtime_error("Invalid demo file (the size is too small).");
-
-	demo.seekg(0, std::ios::beg);
-	char signature[HEADER_SIGNATURE_CHECK_SIZE];
-	demo.read(signature, sizeof(signature));
-	if (std::memcmp(signature, "HLDEMO", sizeof(signature)))
-		throw std::runtime_error("Invalid demo file (signature doesn't match).");
+	if (source && source->size != static_cast<uint64_t>(demoSize))
+		source.reset();
 
 	ReadHeader();
 	ReadDirectory();
 
 	readFrames = false;
+	framesDropped = false;
+	recoveryMode = false;
+	keepFrames = true;
+	progressInterval = std::chrono::milliseconds(100);
 }
 
 void DemoFile::ReadHeader()
 {
-	demo.seekg(HEADER_SIGNATURE_SIZE, std::ios::beg);
-	read_object(demo, header.demoProtocol);
-	read_object(demo, header.netProtocol);
-
-	std::vector<char> mapNameBuf(HEADER_MAPNAME_SIZE);
-	read_objects(demo, mapNameBuf);
-	mapNameBuf.push_back('\0');
-	header.mapName = mapNameBuf.data();
-
-	std::vector<char> gameDirBuf(HEADER_GAMEDIR_SIZE);
-	read_objects(demo, gameDirBuf);
-	gameDirBuf.push_back('\0');
-	header.gameDir = gameDirBuf.data();
+	char data[HEADER_SIZE];
+	demo.seekg(0, std::ios::beg);
+	demo.read(data, sizeof(data));
+	if (!demo)
+		throw std::runtime_error("Error reading the demo header.");
 
-	read_object(demo, header.mapCRC);
-	read_object(demo, header.directoryOffset);
+	DecodeHeader(data, header);
 }
 
 void DemoFile::ReadDirectory()
@@ -140,31 +376,57 @@ void DemoFile::ReadDirectory()
 	if (header.directoryOffset < 0 || demoSize - std::streamoff{ 4 } < header.directoryOffset)
 		throw std::runtime_error("Error parsing the demo directory: invalid directory offset.");
 
+	// The whole directory in one read, anything past it is ignored.
+	auto size = std::min<std::streamoff>(demoSize - std::streamoff{ header.directoryOffset }, MAX_DIRECTORY_SIZE);
+	std::vector<char> data(static_cast<size_t>(size));
 	demo.seekg(header.directoryOffset, std::ios::beg);
-	int32_t dirEntryCount;
-	read_object(demo, dirEntryCount);
-	if (dirEntryCount < MIN_DIR_ENTRY_COUNT || dirEntryCount > MAX_DIR_ENTRY_COUNT || (demoSize - std::streamoff{ dirEntryCount * DIR_ENTRY_SIZE }) < demo.tellg())
+	demo.read(data.data(), size);
+	if (!demo)
+		throw std::runtime_error("Error parsing the demo directory: can't read the directory.");
+
+	DecodeDirectory(data.data(), data.size(), directoryEntries);
+}
+
+void DemoFile::DecodeHeader(const char* data, DemoHeader& header)
+{
+	if (std::memcmp(data, "HLDEMO", HEADER_SIGNATURE_CHECK_SIZE))
+		throw std::runtime_error("Invalid demo file (signature doesn't match).");
+
+	BufferReader r = { data + HEADER_SIGNATURE_SIZE, data + HEADER_SIZE };
+	header.demoProtocol = r.Read<int32_t>();
+	header.netProtocol = r.Read<int32_t>();
+	r.ReadString(header.mapName, HEADER_MAPNAME_SIZE);
+	r.ReadString(header.gameDir, HEADER_GAMEDIR_SIZE);
+	header.mapCRC = r.Read<int32_t>();
+	header.directoryOffset = r.Read<int32_t>();
+}
+
+size_t DemoFile::DecodeDirectoryCount(const char* data, size_t size)
+{
+	int32_t dirEntryCount = 0;
+	if (size >= sizeof(dirEntryCount))
+		std::memcpy(&dirEntryCount, data, sizeof(dirEntryCount));
+	if (dirEntryCount < MIN_DIR_ENTRY_COUNT || dirEntryCount > MAX_DIR_ENTRY_COUNT
+		|| (size - sizeof(dirEntryCount)) / DIR_ENTRY_SIZE < static_cast<size_t>(dirEntryCount))
 		throw std::runtime_error("Error parsing the demo directory: invalid directory entry count.");
 
-	directoryEntries.clear();
-	directoryEntries.reserve(dirEntryCount);
-	for (auto i = 0; i < dirEntryCount; ++i) {
-		DemoDirectoryEntry entry;
-		read_object(demo, entry.type);
-
-		std::vector<char> descriptionBuf(DIR_ENTRY_DESCRIPTION_SIZE);
-		read_objects(demo, descriptionBuf);
-		descriptionBuf.push_back('\0');
-		entry.description = descriptionBuf.data();
-
-		read_object(demo, entry.flags);
-		read_object(demo, entry.CDTrack);
-		read_object(demo, entry.trackTime);
-		read_object(demo, entry.frameCount);
-		read_object(demo, entry.offset);
-		read_object(demo, entry.fileLength);
-
-		directoryEntries.push_back(entry);
+	return static_cast<size_t>(dirEntryCount);
+}
+
+void DemoFile::DecodeDirectory(const char* data, size_t size, std::vector<DemoDirectoryEntry>& entries)
+{
+	entries.clear();
+	entries.resize(DecodeDirectoryCount(data, size));
+	BufferReader r = { data + sizeof(int32_t), data + size };
+	for (auto& entry : entries) {
+		entry.type = r.Read<int32_t>();
+		r.ReadString(entry.description, DIR_ENTRY_DESCRIPTION_SIZE);
+		entry.flags = r.Read<int32_t>();
+		entry.CDTrack = r.Read<int32_t>();
+		entry.trackTime = r.Read<float>();
+		entry.frameCount = r.Read<int32_t>();
+		entry.offset = r.Read<int32_t>();
+		entry.fileLength = r.Read<int32_t>();
 	}
 }
 
@@ -183,6 +445,20 @@ bool DemoFile::IsValidDemoFileInternal(std::ifstream in)
 	if (!in)
 		throw std::runtime_error("Error opening the file.");
 
+	// Only the header needs decompressing.
+	auto compression = DetectCompression(*in.rdbuf());
+	if (compression != DemoCompression::NONE) {
+		std::vector<char> data;
+		try {
+			Decompress(*in.rdbuf(), compression, data, HEADER_SIZE);
+		} catch (const std::exception&) {
+			if (data.size() < HEADER_SIZE)
+				return false;
+		}
+
+		return data.size() >= HEADER_SIZE && !std::memcmp(data.data(), "HLDEMO", HEADER_SIGNATURE_CHECK_SIZE);
+	}
+
 	in.seekg(0, std::ios::end);
 	auto size = in.tellg();
 	if (size < HEADER_SIZE)
@@ -198,6 +474,11 @@ bool DemoFile::IsValidDemoFileInternal(std::ifstream in)
 }
 
 void DemoFile::ReadFrames()
+{
+	ReadFrames(FrameCallback());
+}
+
+void DemoFile::ReadFrames(const FrameCallback& onFrame)
 {
 	if (readFrames)
 		return;
@@ -206,6 +487,27 @@ void DemoFile::ReadFrames()
 		throw std::runtime_error("Only demo protocol 5 is supported.");
 	}
 
+	auto check_cancelled = [&]() {
+		if (cancellation && cancellation->IsCancelled()) {
+			// Let go of everything read so far right away.
+			for (auto& entry : directoryEntries)
+				std::vector<std::shared_ptr<DemoFrame>>().swap(entry.frames);
+			std::vector<DemoSkippedRange>().swap(skippedRanges);
+			throw DemoCancelled();
+		}
+	};
+
+	std::vector<int64_t> entryTotals;
+	for (const auto& entry : directoryEntries) {
+		if (entry.offset < 0 || demoSize < entry.offset)
+			entryTotals.push_back(0);
+		else
+			entryTotals.push_back(EntryScanEnd(entry) - entry.offset);
+	}
+	ProgressReporter progress(onProgress, progressInterval, entryTotals);
+
+	FrameInterner interner;
+
 	size_t i = 0;
 	// On any error, just skip to the next entry.
 	for (auto& entry : directoryEntries) {
@@ -217,674 +519,542 @@ void DemoFile::ReadFrames()
 			continue;
 		}
 
+		check_cancelled();
 		demo.seekg(offset, std::ios::beg);
+		auto entryTotal = entryTotals[i - 1];
+		size_t framesSinceReport = 0;
+
+		std::streamoff frameStart = 0;
+		// Cleared when the frame wouldn't be written back byte for byte.
+		bool canonical = true;
+
+		// Hand the frame to the callback while it's still hot, then store it.
+		auto emit = [&](auto& f) {
+			using T = std::decay_t<decltype(f)>;
+			f.sourceOffset = static_cast<uint32_t>(frameStart);
+			f.sourceSize = canonical && frameStart <= UINT32_MAX ? static_cast<uint32_t>(DemoWriter::EncodedFrameSize(f)) : 0;
+			f.sourceId = sourceId;
+			if (onFrame)
+				onFrame(entry, f);
+			if (keepFrames)
+				entry.frames.emplace_back(new T(std::move(f)));
+		};
+
+		LastFrame last = { false, 0, 0 };
+
+		// Skips to the next thing that looks like a frame header.
+		// Returns false if there's nothing left to recover in this entry.
+		auto resync = [&](std::streamoff frameStart) {
+			auto end = EntryScanEnd(entry);
+			auto next = FindNextFrame(frameStart + 1, end, last);
+
+			DemoSkippedRange range;
+			range.entry = i - 1;
+			range.offset = frameStart;
+			range.length = (next < 0 ? end : next) - frameStart;
+			skippedRanges.push_back(range);
+
+			if (next < 0)
+				return false;
+
+			demo.clear();
+			demo.seekg(next, std::ios::beg);
+			return true;
+		};
+
+		// Zero-filled damage reads as empty netmsg frames, see RECOVERY_ZERO_RUN.
+		auto zero_filled = [&](const DemoFrame& frame) {
+			if (static_cast<uint8_t>(frame.type) != 0 || frame.time != 0 || frame.frame != 0)
+				return false;
+
+			char fixed[FRAME_NETMSG_SIZE];
+			demo.read(fixed, sizeof(fixed));
+			bool zero = demo && find_nonzero_byte(fixed, 0, sizeof(fixed)) == sizeof(fixed);
+			demo.clear();
+			demo.seekg(frameStart + FRAME_HEADER_SIZE, std::ios::beg);
+			return zero;
+		};
 
 		bool stop = false;
 		while (!stop) {
-			if (demoSize - std::streamoff{ MIN_FRAME_SIZE } < demo.tellg()) {
+			check_cancelled();
+
+			frameStart = demo.tellg();
+			canonical = true;
+			if (demoSize - std::streamoff{ MIN_FRAME_SIZE } < frameStart) {
 				// Unexpected EOF.
 				break;
 			}
 
+			// Looking at the clock for every frame would cost too much.
+			if (onProgress && ++framesSinceReport == PROGRESS_CHECK_FRAMES) {
+				framesSinceReport = 0;
+				progress.Set(i - 1, std::min<int64_t>(frameStart - offset, entryTotal), false);
+			}
+
 			DemoFrame frame;
 			read_object(demo, frame.type);
 			read_object(demo, frame.time);
 			read_object(demo, frame.frame);
 
-			switch (frame.type) {
-			case DemoFrameType::DEMO_START:
-			{
-				entry.frames.emplace_back(new DemoFrame(std::move(frame)));
-			}
+			if (recoveryMode && (!plausible_frame_header(frame.type, frame.time, frame.frame, last.valid, last.time, last.frame)
+				|| zero_filled(frame))) {
+				if (resync(frameStart))
+					continue;
 				break;
+			}
 
-			case DemoFrameType::CONSOLE_COMMAND:
-			{
-				if (demoSize - std::streamoff{ FRAME_CONSOLE_COMMAND_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+			StreamSource source(demo, demoSize, frameStart + FRAME_HEADER_SIZE);
+			interner.canonical = true;
 
-				ConsoleCommandFrame f;
+			bool corrupt = false;
+			dispatch_frame_type(frame.type, [&](auto* tag) {
+				using T = std::remove_pointer_t<decltype(tag)>;
+				T f;
 				f.type = frame.type;
 				f.time = frame.time;
 				f.frame = frame.frame;
 
-				std::vector<char> commandBuf(FRAME_CONSOLE_COMMAND_SIZE);
-				read_objects(demo, commandBuf);
-				commandBuf.push_back('\0');
-				f.command = commandBuf.data();
-
-				entry.frames.emplace_back(new ConsoleCommandFrame(std::move(f)));
-			}
-				break;
-
-			case DemoFrameType::CLIENT_DATA:
-			{
-				if (demoSize - std::streamoff{ FRAME_CLIENT_DATA_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
+				if (!schema_decode(source, f, interner)) {
+					// Unexpected EOF or an implausible length.
+					corrupt = true;
+					return;
 				}
 
-				ClientDataFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+				canonical = interner.canonical;
+				emit(f);
+			});
 
-				for (auto i = 0; i < 3; ++i)
-					read_object(demo, f.origin[i]);
-				for (auto i = 0; i < 3; ++i)
-					read_object(demo, f.viewangles[i]);
-				read_object(demo, f.weaponBits);
-				read_object(demo, f.fov);
+			if (frame.type == DemoFrameType::NEXT_SECTION)
+				stop = true;
 
-				entry.frames.emplace_back(new ClientDataFrame(std::move(f)));
-			}
+			if (corrupt) {
+				if (recoveryMode && resync(frameStart))
+					continue;
 				break;
-
-			case DemoFrameType::NEXT_SECTION:
-			{
-				entry.frames.emplace_back(new DemoFrame(std::move(frame)));
-
-				stop = true;
 			}
-				break;
-
-			case DemoFrameType::EVENT:
-			{
-				if (demoSize - std::streamoff{ FRAME_EVENT_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
 
-				EventFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+			last.valid = true;
+			last.time = frame.time;
+			last.frame = frame.frame;
+		}
 
-				read_object(demo, f.flags);
-				read_object(demo, f.index);
-				read_object(demo, f.delay);
-				read_object(demo, f.EventArgs.flags);
-				read_object(demo, f.EventArgs.entityIndex);
-				for (auto i = 0; i < 3; ++i)
-					read_object(demo, f.EventArgs.origin[i]);
-				for (auto i = 0; i < 3; ++i)
-					read_object(demo, f.EventArgs.angles[i]);
-				for (auto i = 0; i < 3; ++i)
-					read_object(demo, f.EventArgs.velocity[i]);
-				read_object(demo, f.EventArgs.ducking);
-				read_object(demo, f.EventArgs.fparam1);
-				read_object(demo, f.EventArgs.fparam2);
-				read_object(demo, f.EventArgs.iparam1);
-				read_object(demo, f.EventArgs.iparam2);
-				read_object(demo, f.EventArgs.bparam1);
-				read_object(demo, f.EventArgs.bparam2);
-
-				entry.frames.emplace_back(new EventFrame(std::move(f)));
-			}
-				break;
+		progress.Set(i - 1, entryTotal, true);
+	}
 
-			case DemoFrameType::WEAPON_ANIM:
-			{
-				if (demoSize - std::streamoff{ FRAME_WEAPON_ANIM_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+	readFrames = true;
+	framesDropped = !keepFrames;
+	// Now that we read the frames we can close the demo
+	// as there isn't anything else we can read.
+	CloseDemo();
+}
 
-				WeaponAnimFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+void DemoFile::CloseDemo()
+{
+	demo.rdbuf(nullptr);
+	demoBuffer.reset();
+}
 
-				read_object(demo, f.anim);
-				read_object(demo, f.body);
+std::streamoff DemoFile::EntryScanEnd(const DemoDirectoryEntry& entry) const
+{
+	// The entry ends where the next one or the directory starts.
+	std::streamoff end = demoSize;
+	if (header.directoryOffset > entry.offset)
+		end = std::min<std::streamoff>(end, header.directoryOffset);
+	for (const auto& e : directoryEntries) {
+		if (e.offset > entry.offset)
+			end = std::min<std::streamoff>(end, e.offset);
+	}
 
-				entry.frames.emplace_back(new WeaponAnimFrame(std::move(f)));
-			}
-				break;
+	return end;
+}
 
-			case DemoFrameType::SOUND:
-			{
-				if (demoSize - std::streamoff{ FRAME_SOUND_SIZE_1 } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+std::streamoff DemoFile::FindNextFrame(std::streamoff from, std::streamoff end, const LastFrame& last)
+{
+	std::vector<char> buf;
+	std::streamoff bufStart = 0;
 
-				SoundFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+	auto read_at = [&](std::streamoff offset, void* dst, std::streamoff size) {
+		if (offset < 0 || demoSize - size < offset)
+			return false;
 
-				read_object(demo, f.channel);
+		if (offset >= bufStart && offset + size <= bufStart + static_cast<std::streamoff>(buf.size())) {
+			std::memcpy(dst, buf.data() + (offset - bufStart), static_cast<size_t>(size));
+			return true;
+		}
 
-				int32_t length;
-				read_object(demo, length);
+		demo.clear();
+		demo.seekg(offset, std::ios::beg);
+		demo.read(static_cast<char*>(dst), size);
+		return static_cast<bool>(demo);
+	};
+
+	auto read_header = [&](std::streamoff offset, DemoFrame& frame) {
+		char h[FRAME_HEADER_SIZE];
+		if (!read_at(offset, h, sizeof(h)))
+			return false;
+
+		std::memcpy(&frame.type, h, 1);
+		std::memcpy(&frame.time, h + 1, 4);
+		std::memcpy(&frame.frame, h + 5, 4);
+		return true;
+	};
+
+	// Size of the whole frame, or -1 if its payload length is implausible.
+	auto frame_size = [&](std::streamoff offset, DemoFrameType type) -> std::streamoff {
+		int64_t fixed, lengthOffset;
+		frame_layout(type, fixed, lengthOffset);
+
+		int32_t length = 0;
+		if (lengthOffset >= 0) {
+			if (!read_at(offset + FRAME_HEADER_SIZE + lengthOffset, &length, sizeof(length)))
+				return -1;
+			if (length < FRAME_NETMSG_MIN_MESSAGE_LENGTH || length > FRAME_NETMSG_MAX_MESSAGE_LENGTH)
+				return -1;
+		}
 
-				if (demoSize - std::streamoff{ length } - std::streamoff{ FRAME_SOUND_SIZE_2 } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
+		return FRAME_HEADER_SIZE + fixed + length;
+	};
+
+	for (auto pos = from; pos < end; pos += RECOVERY_SCAN_CHUNK_SIZE) {
+		// Read a bit past the chunk so that most candidates can be checked without seeking.
+		auto size = std::min<std::streamoff>(RECOVERY_SCAN_CHUNK_SIZE + FRAME_HEADER_SIZE + FRAME_NETMSG_SIZE, demoSize - pos);
+		buf.resize(static_cast<size_t>(size));
+		bufStart = pos;
+		demo.clear();
+		demo.seekg(pos, std::ios::beg);
+		demo.read(buf.data(), size);
+		if (!demo)
+			return -1;
+
+		auto scanSize = static_cast<size_t>(std::min<std::streamoff>({ RECOVERY_SCAN_CHUNK_SIZE, end - pos, size }));
+		for (auto c = FindFrameTypeByte(buf.data(), 0, scanSize); c < scanSize; c = FindFrameTypeByte(buf.data(), c + 1, scanSize)) {
+			// Zero-filled damage would match at every byte. Only the last
+			// RECOVERY_ZERO_RUN - 1 zeros of a run can start a frame.
+			if (!buf[c]) {
+				auto nonzero = find_nonzero_byte(buf.data(), c, buf.size());
+				if (nonzero - c >= RECOVERY_ZERO_RUN) {
+					c = nonzero - RECOVERY_ZERO_RUN;
+					continue;
 				}
+			}
 
-				f.sample.resize(length);
-				read_objects(demo, f.sample);
-				read_object(demo, f.attenuation);
-				read_object(demo, f.volume);
-				read_object(demo, f.flags);
-				read_object(demo, f.pitch);
+			auto offset = pos + static_cast<std::streamoff>(c);
 
-				entry.frames.emplace_back(new SoundFrame(std::move(f)));
+			DemoFrame frame;
+			if (!read_header(offset, frame)
+				|| !plausible_frame_header(frame.type, frame.time, frame.frame, last.valid, last.time, last.frame))
+				continue;
+
+			auto frameSize = frame_size(offset, frame.type);
+			if (frameSize < 0 || demoSize - frameSize < offset)
+				continue;
+
+			// The real NEXT_SECTION is either right before the next entry, or continues the frames before it.
+			if (frame.type == DemoFrameType::NEXT_SECTION) {
+				if (last.valid || offset + frameSize == end)
+					return offset;
+				continue;
 			}
-				break;
-
-			case DemoFrameType::DEMO_BUFFER:
-			{
-				if (demoSize - std::streamoff{ FRAME_DEMO_BUFFER_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
 
-				DemoBufferFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+			// A single header can match by accident, so require the following one to fit as well.
+			DemoFrame next;
+			if (read_header(offset + frameSize, next)
+				&& plausible_frame_header(next.type, next.time, next.frame, true, frame.time, frame.frame))
+				return offset;
+		}
+	}
 
-				int32_t length;
-				read_object(demo, length);
+	return -1;
+}
 
-				if (demoSize - std::streamoff{ length } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+void DemoFile::CheckFramesKept() const
+{
+	if (framesDropped)
+		throw std::runtime_error("The frames were read without keeping them, there is nothing to save.");
+}
 
-				f.buffer.resize(length);
-				read_objects(demo, f.buffer);
+// The sources have to be checked before the output is opened, as that truncates it.
+void DemoFile::Save(const std::string& filename)
+{
+	CheckFramesKept();
+	auto copySource = CanCopySource(filename);
+	SaveInternal(std::ofstream(utf8_filename(filename), std::ios::trunc | std::ios::binary), filename, copySource);
+}
 
-				entry.frames.emplace_back(new DemoBufferFrame(std::move(f)));
-			}
-				break;
+void DemoFile::Save(const std::wstring& filename)
+{
+	CheckFramesKept();
+	auto copySource = CanCopySource(utf16_to_utf8(filename));
+	SaveInternal(std::ofstream(utf16_filename(filename), std::ios::trunc | std::ios::binary), utf16_to_utf8(filename), copySource);
+}
 
-			default:
-			{
-				if (demoSize - std::streamoff{ FRAME_NETMSG_SIZE } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+void DemoFile::SaveParallel(const std::string& filename, unsigned threads)
+{
+	CheckFramesKept();
+	SaveParallelInternal(utf8_filename(filename), filename, threads, CanCopySource(filename));
+}
 
-				NetMsgFrame f;
-				f.type = frame.type;
-				f.time = frame.time;
-				f.frame = frame.frame;
+void DemoFile::SaveParallel(const std::wstring& filename, unsigned threads)
+{
+	CheckFramesKept();
+	SaveParallelInternal(utf16_filename(filename), utf16_to_utf8(filename), threads, CanCopySource(utf16_to_utf8(filename)));
+}
 
-				read_object(demo, f.DemoInfo.timestamp);
-				read_object(demo, f.DemoInfo.RefParams.vieworg[0]);
-				read_object(demo, f.DemoInfo.RefParams.vieworg[1]);
-				read_object(demo, f.DemoInfo.RefParams.vieworg[2]);
-				read_object(demo, f.DemoInfo.RefParams.viewangles[0]);
-				read_object(demo, f.DemoInfo.RefParams.viewangles[1]);
-				read_object(demo, f.DemoInfo.RefParams.viewangles[2]);
-				read_object(demo, f.DemoInfo.RefParams.forward[0]);
-				read_object(demo, f.DemoInfo.RefParams.forward[1]);
-				read_object(demo, f.DemoInfo.RefParams.forward[2]);
-				read_object(demo, f.DemoInfo.RefParams.right[0]);
-				read_object(demo, f.DemoInfo.RefParams.right[1]);
-				read_object(demo, f.DemoInfo.RefParams.right[2]);
-				read_object(demo, f.DemoInfo.RefParams.up[0]);
-				read_object(demo, f.DemoInfo.RefParams.up[1]);
-				read_object(demo, f.DemoInfo.RefParams.up[2]);
-				read_object(demo, f.DemoInfo.RefParams.frametime);
-				read_object(demo, f.DemoInfo.RefParams.time);
-				read_object(demo, f.DemoInfo.RefParams.intermission);
-				read_object(demo, f.DemoInfo.RefParams.paused);
-				read_object(demo, f.DemoInfo.RefParams.spectator);
-				read_object(demo, f.DemoInfo.RefParams.onground);
-				read_object(demo, f.DemoInfo.RefParams.waterlevel);
-				read_object(demo, f.DemoInfo.RefParams.simvel[0]);
-				read_object(demo, f.DemoInfo.RefParams.simvel[1]);
-				read_object(demo, f.DemoInfo.RefParams.simvel[2]);
-				read_object(demo, f.DemoInfo.RefParams.simorg[0]);
-				read_object(demo, f.DemoInfo.RefParams.simorg[1]);
-				read_object(demo, f.DemoInfo.RefParams.simorg[2]);
-				read_object(demo, f.DemoInfo.RefParams.viewheight[0]);
-				read_object(demo, f.DemoInfo.RefParams.viewheight[1]);
-				read_object(demo, f.DemoInfo.RefParams.viewheight[2]);
-				read_object(demo, f.DemoInfo.RefParams.idealpitch);
-				read_object(demo, f.DemoInfo.RefParams.cl_viewangles[0]);
-				read_object(demo, f.DemoInfo.RefParams.cl_viewangles[1]);
-				read_object(demo, f.DemoInfo.RefParams.cl_viewangles[2]);
-				read_object(demo, f.DemoInfo.RefParams.health);
-				read_object(demo, f.DemoInfo.RefParams.crosshairangle[0]);
-				read_object(demo, f.DemoInfo.RefParams.crosshairangle[1]);
-				read_object(demo, f.DemoInfo.RefParams.crosshairangle[2]);
-				read_object(demo, f.DemoInfo.RefParams.viewsize);
-				read_object(demo, f.DemoInfo.RefParams.punchangle[0]);
-				read_object(demo, f.DemoInfo.RefParams.punchangle[1]);
-				read_object(demo, f.DemoInfo.RefParams.punchangle[2]);
-				read_object(demo, f.DemoInfo.RefParams.maxclients);
-				read_object(demo, f.DemoInfo.RefParams.viewentity);
-				read_object(demo, f.DemoInfo.RefParams.playernum);
-				read_object(demo, f.DemoInfo.RefParams.max_entities);
-				read_object(demo, f.DemoInfo.RefParams.demoplayback);
-				read_object(demo, f.DemoInfo.RefParams.hardware);
-				read_object(demo, f.DemoInfo.RefParams.smoothing);
-				read_object(demo, f.DemoInfo.RefParams.ptr_cmd);
-				read_object(demo, f.DemoInfo.RefParams.ptr_movevars);
-				read_object(demo, f.DemoInfo.RefParams.viewport[0]);
-				read_object(demo, f.DemoInfo.RefParams.viewport[1]);
-				read_object(demo, f.DemoInfo.RefParams.viewport[2]);
-				read_object(demo, f.DemoInfo.RefParams.viewport[3]);
-				read_object(demo, f.DemoInfo.RefParams.nextView);
-				read_object(demo, f.DemoInfo.RefParams.onlyClientDraw);
-				read_object(demo, f.DemoInfo.UserCmd.lerp_msec);
-				read_object(demo, f.DemoInfo.UserCmd.msec);
-				read_object(demo, f.DemoInfo.UserCmd.align_1);
-				read_object(demo, f.DemoInfo.UserCmd.viewangles[0]);
-				read_object(demo, f.DemoInfo.UserCmd.viewangles[1]);
-				read_object(demo, f.DemoInfo.UserCmd.viewangles[2]);
-				read_object(demo, f.DemoInfo.UserCmd.forwardmove);
-				read_object(demo, f.DemoInfo.UserCmd.sidemove);
-				read_object(demo, f.DemoInfo.UserCmd.upmove);
-				read_object(demo, f.DemoInfo.UserCmd.lightlevel);
-				read_object(demo, f.DemoInfo.UserCmd.align_2);
-				read_object(demo, f.DemoInfo.UserCmd.buttons);
-				read_object(demo, f.DemoInfo.UserCmd.impulse);
-				read_object(demo, f.DemoInfo.UserCmd.weaponselect);
-				read_object(demo, f.DemoInfo.UserCmd.align_3);
-				read_object(demo, f.DemoInfo.UserCmd.align_4);
-				read_object(demo, f.DemoInfo.UserCmd.impact_index);
-				read_object(demo, f.DemoInfo.UserCmd.impact_position[0]);
-				read_object(demo, f.DemoInfo.UserCmd.impact_position[1]);
-				read_object(demo, f.DemoInfo.UserCmd.impact_position[2]);
-				read_object(demo, f.DemoInfo.MoveVars.gravity);
-				read_object(demo, f.DemoInfo.MoveVars.stopspeed);
-				read_object(demo, f.DemoInfo.MoveVars.maxspeed);
-				read_object(demo, f.DemoInfo.MoveVars.spectatormaxspeed);
-				read_object(demo, f.DemoInfo.MoveVars.accelerate);
-				read_object(demo, f.DemoInfo.MoveVars.airaccelerate);
-				read_object(demo, f.DemoInfo.MoveVars.wateraccelerate);
-				read_object(demo, f.DemoInfo.MoveVars.friction);
-				read_object(demo, f.DemoInfo.MoveVars.edgefriction);
-				read_object(demo, f.DemoInfo.MoveVars.waterfriction);
-				read_object(demo, f.DemoInfo.MoveVars.entgravity);
-				read_object(demo, f.DemoInfo.MoveVars.bounce);
-				read_object(demo, f.DemoInfo.MoveVars.stepsize);
-				read_object(demo, f.DemoInfo.MoveVars.maxvelocity);
-				read_object(demo, f.DemoInfo.MoveVars.zmax);
-				read_object(demo, f.DemoInfo.MoveVars.waveHeight);
-				read_object(demo, f.DemoInfo.MoveVars.footsteps);
-				std::vector<char> skyNameBuf(FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE);
-				read_objects(demo, skyNameBuf);
-				skyNameBuf.push_back('\0');
-				f.DemoInfo.MoveVars.skyName = skyNameBuf.data();
-				read_object(demo, f.DemoInfo.MoveVars.rollangle);
-				read_object(demo, f.DemoInfo.MoveVars.rollspeed);
-				read_object(demo, f.DemoInfo.MoveVars.skycolor_r);
-				read_object(demo, f.DemoInfo.MoveVars.skycolor_g);
-				read_object(demo, f.DemoInfo.MoveVars.skycolor_b);
-				read_object(demo, f.DemoInfo.MoveVars.skyvec_x);
-				read_object(demo, f.DemoInfo.MoveVars.skyvec_y);
-				read_object(demo, f.DemoInfo.MoveVars.skyvec_z);
-				read_object(demo, f.DemoInfo.view[0]);
-				read_object(demo, f.DemoInfo.view[1]);
-				read_object(demo, f.DemoInfo.view[2]);
-				read_object(demo, f.DemoInfo.viewmodel);
-
-				read_object(demo, f.incoming_sequence);
-				read_object(demo, f.incoming_acknowledged);
-				read_object(demo, f.incoming_reliable_acknowledged);
-				read_object(demo, f.incoming_reliable_sequence);
-				read_object(demo, f.outgoing_sequence);
-				read_object(demo, f.reliable_sequence);
-				read_object(demo, f.last_reliable_sequence);
-
-				int32_t length;
-				read_object(demo, length);
-				if (length < FRAME_NETMSG_MIN_MESSAGE_LENGTH
-					|| length > FRAME_NETMSG_MAX_MESSAGE_LENGTH) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+void DemoFile::SaveInternal(std::ofstream o, const std::string& filename, bool copySource)
+{
+	if (!o)
+		throw std::runtime_error("Error opening the output file.");
 
-				if (demoSize - std::streamoff{ length } < demo.tellg()) {
-					// Unexpected EOF.
-					stop = true;
-					break;
-				}
+	// The output is truncated now, so it's removed if saving fails or is cancelled.
+	try {
+		SaveStream(o, copySource);
+
+		o.close();
+		if (!o)
+			throw std::runtime_error("Error writing the output file.");
+	} catch (...) {
+		o.close();
+		remove_file(filename);
+		throw;
+	}
+}
 
-				f.msg.resize(length);
-				read_objects(demo, f.msg);
+int32_t DemoFile::ComputeSaveLayout(std::vector<SaveChunk>& chunks, unsigned threads)
+{
+	// Split the entries into chunks of frames, each one encoded by a single thread.
+	chunks.clear();
+	for (size_t e = 0; e < directoryEntries.size(); ++e) {
+		auto count = directoryEntries[e].frames.size();
+		size_t first = 0;
+		do {
+			SaveChunk chunk;
+			chunk.entry = e;
+			chunk.first = first;
+			chunk.last = std::min(count, first + PARALLEL_SAVE_CHUNK_FRAMES);
+			chunk.nextSection = false;
+			chunk.terminate = false;
+			chunk.offset = 0;
+			chunk.size = 0;
+			chunks.push_back(chunk);
+			first = chunk.last;
+		} while (first < count);
+	}
 
-				entry.frames.emplace_back(new NetMsgFrame(std::move(f)));
-			}
-				break;
-			}
+	parallel_for(chunks.size(), threads, [&](unsigned, size_t i) {
+		auto& chunk = chunks[i];
+		const auto& frames = directoryEntries[chunk.entry].frames;
+		for (auto f = chunk.first; f < chunk.last; ++f) {
+			chunk.size += HasSource(*frames[f]) ? frames[f]->sourceSize : DemoWriter::EncodedFrameSize(*frames[f]);
+			if (frames[f]->type == DemoFrameType::NEXT_SECTION)
+				chunk.nextSection = true;
 		}
+	});
+
+	// Entries without a NEXT_SECTION get one appended to their last chunk,
+	// then a prefix sum over the chunk sizes gives every offset.
+	for (size_t i = 0; i < chunks.size(); ) {
+		auto end = i;
+		bool nextSection = false;
+		for (; end < chunks.size() && chunks[end].entry == chunks[i].entry; ++end)
+			nextSection = nextSection || chunks[end].nextSection;
+		if (!nextSection) {
+			chunks[end - 1].terminate = true;
+			chunks[end - 1].size += FRAME_HEADER_SIZE;
+		}
+		i = end;
 	}
 
-	readFrames = true;
-	// Now that we read the frames we can close the demo
-	// as there isn't anything else we can read.
-	demo.close();
+	int64_t offset = HEADER_SIZE;
+	for (auto& chunk : chunks) {
+		if (chunk.first == 0)
+			directoryEntries[chunk.entry].offset = static_cast<int32_t>(offset);
+		chunk.offset = offset;
+		offset += chunk.size;
+	}
+	if (offset > INT32_MAX)
+		throw std::runtime_error("The demo is too big to be saved.");
+
+	return static_cast<int32_t>(offset);
 }
 
-void DemoFile::Save(const std::string& filename)
+std::vector<int64_t> DemoFile::SaveEntryTotals(const std::vector<SaveChunk>& chunks) const
 {
-	DemoFile::SaveInternal(std::ofstream(utf8_filename(filename), std::ios::trunc | std::ios::binary));
+	std::vector<int64_t> totals(directoryEntries.size(), 0);
+	for (const auto& chunk : chunks)
+		totals[chunk.entry] += chunk.size;
+	return totals;
 }
 
-void DemoFile::Save(const std::wstring& filename)
+bool DemoFile::CanCopySource(const std::string& output) const
 {
-	DemoFile::SaveInternal(std::ofstream(utf16_filename(filename), std::ios::trunc | std::ios::binary));
+	// Anything uncertain means encoding, which gives the same result.
+	if (!source || !source->Unchanged())
+		return false;
+
+	return output.empty() || !source->IsFile(output);
 }
 
-void DemoFile::SaveInternal(std::ofstream o)
+bool DemoFile::HasSource(const DemoFrame& frame) const
 {
-	if (!o)
-		throw std::runtime_error("Error opening the output file.");
+	return frame.sourceId == sourceId && frame.sourceSize != 0;
+}
+
+bool DemoFile::CopySource(std::vector<char>& o, PositionalFile& source, const std::vector<std::shared_ptr<DemoFrame>>& frames,
+	size_t first, size_t last)
+{
+	auto offset = frames[first]->sourceOffset;
+	auto size = static_cast<size_t>(frames[last - 1]->sourceOffset) + frames[last - 1]->sourceSize - offset;
+	auto start = o.size();
+	o.resize(start + size);
 
-	char signature[] = { 'H', 'L', 'D', 'E', 'M', 'O', '\0', '\0' };
-	o.write(signature, sizeof(signature));
-	write_object(o, header.demoProtocol);
-	write_object(o, header.netProtocol);
+	if (source.ReadAt(offset, o.data() + start, size) != size) {
+		o.resize(start);
+		return false;
+	}
+	return true;
+}
 
-	std::vector<char> mapNameBuf;
-	std::copy(std::begin(header.mapName), std::end(header.mapName), std::back_inserter(mapNameBuf));
-	mapNameBuf.push_back('\0');
-	mapNameBuf.resize(HEADER_MAPNAME_SIZE);
-	write_objects(o, mapNameBuf);
+void DemoFile::EncodeChunk(std::vector<char>& o, const SaveChunk& chunk, PositionalFile* source) const
+{
+	const auto& frames = directoryEntries[chunk.entry].frames;
 
-	std::vector<char> gameDirBuf;
-	std::copy(std::begin(header.gameDir), std::end(header.gameDir), std::back_inserter(gameDirBuf));
-	gameDirBuf.push_back('\0');
-	gameDirBuf.resize(HEADER_GAMEDIR_SIZE);
-	write_objects(o, gameDirBuf);
+	o.reserve(o.size() + static_cast<size_t>(chunk.size));
+	for (auto f = chunk.first; f < chunk.last; ) {
+		if (cancellation && cancellation->IsCancelled())
+			throw DemoCancelled();
 
-	write_object(o, header.mapCRC);
+		if (!source || !HasSource(*frames[f])) {
+			DemoWriter::EncodeFrame(o, *frames[f]);
+			++f;
+			continue;
+		}
 
-	// Directory offset goes here.
-	auto dirOffsetPos = o.tellp();
-	o.seekp(4, std::ios::cur);
+		// Copy all frames that follow each other in the demo file at once.
+		auto end = f + 1;
+		auto next = static_cast<uint64_t>(frames[f]->sourceOffset) + frames[f]->sourceSize;
+		while (end < chunk.last && frames[end]->sourceOffset == next && HasSource(*frames[end])) {
+			next += frames[end]->sourceSize;
+			++end;
+		}
 
-	for (auto& entry : directoryEntries) {
-		entry.offset = static_cast<int32_t>(o.tellp());
-
-		// We need to write at least one NextSectionFrame, otherwise
-		// the engine might break trying to play back the demo.
-		bool wroteNextSection = false;
-		for (const auto& frame : entry.frames) {
-			write_object(o, frame->type);
-			write_object(o, frame->time);
-			write_object(o, frame->frame);
-
-			switch (frame->type) {
-			case DemoFrameType::DEMO_START:
-				// No extra info.
-				break;
+		if (!CopySource(o, *source, frames, f, end)) {
+			for (auto i = f; i < end; ++i)
+				DemoWriter::EncodeFrame(o, *frames[i]);
+		}
+		f = end;
+	}
 
-			case DemoFrameType::CONSOLE_COMMAND:
-			{
-				auto f = reinterpret_cast<ConsoleCommandFrame*>(frame.get());
+	if (chunk.terminate) {
+		DemoFrame f;
+		f.type = DemoFrameType::NEXT_SECTION;
+		f.time = 0;
+		f.frame = 0;
+		DemoWriter::EncodeFrame(o, f);
+	}
+}
 
-				std::vector<char> commandBuf;
-				std::copy(std::begin(f->command), std::end(f->command), std::back_inserter(commandBuf));
-				commandBuf.push_back('\0');
-				commandBuf.resize(FRAME_CONSOLE_COMMAND_SIZE);
-				write_objects(o, commandBuf);
-			}
-				break;
+template<typename Path>
+void DemoFile::SaveParallelInternal(const Path& path, const std::string& filename, unsigned threads, bool copySource)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<SaveChunk> chunks;
+	auto directoryOffset = ComputeSaveLayout(chunks, threads);
 
-			case DemoFrameType::CLIENT_DATA:
-			{
-				auto f = reinterpret_cast<ClientDataFrame*>(frame.get());
+	std::ofstream o(path, std::ios::trunc | std::ios::binary);
+	if (!o)
+		throw std::runtime_error("Error opening the output file.");
 
-				for (auto i = 0; i < 3; ++i)
-					write_object(o, f->origin[i]);
-				for (auto i = 0; i < 3; ++i)
-					write_object(o, f->viewangles[i]);
-				write_object(o, f->weaponBits);
-				write_object(o, f->fov);
+	// The output is truncated now, so it's removed if saving fails or is cancelled.
+	try {
+		// Write the header and the directory first, this also sizes the file.
+		std::vector<char> buf;
+		DemoWriter::EncodeHeader(buf, header, directoryOffset);
+		o.write(buf.data(), buf.size());
+
+		buf.clear();
+		DemoWriter::EncodeDirectory(buf, directoryEntries);
+		o.seekp(directoryOffset, std::ios::beg);
+		o.write(buf.data(), buf.size());
+
+		o.close();
+		if (!o)
+			throw std::runtime_error("Error writing the output file.");
+
+		ProgressReporter progress(onProgress, progressInterval, SaveEntryTotals(chunks));
+
+		// Every thread writes its chunks through its own stream at the precomputed offsets,
+		// the demo file is read at given offsets, so the threads share it.
+		std::vector<std::unique_ptr<std::ofstream>> streams(threads);
+		parallel_for(chunks.size(), threads, [&](unsigned worker, size_t i) {
+			auto& stream = streams[worker];
+			if (!stream) {
+				stream.reset(new std::ofstream(path, std::ios::in | std::ios::out | std::ios::binary));
+				if (!*stream)
+					throw std::runtime_error("Error opening the output file.");
 			}
-				break;
 
-			case DemoFrameType::NEXT_SECTION:
-				// No extra info.
-				wroteNextSection = true;
-				break;
+			std::vector<char> buf;
+			EncodeChunk(buf, chunks[i], copySource ? source.get() : nullptr);
 
-			case DemoFrameType::EVENT:
-			{
-				auto f = reinterpret_cast<EventFrame*>(frame.get());
-
-				write_object(o, f->flags);
-				write_object(o, f->index);
-				write_object(o, f->delay);
-				write_object(o, f->EventArgs.flags);
-				write_object(o, f->EventArgs.entityIndex);
-				for (auto i = 0; i < 3; ++i)
-					write_object(o, f->EventArgs.origin[i]);
-				for (auto i = 0; i < 3; ++i)
-					write_object(o, f->EventArgs.angles[i]);
-				for (auto i = 0; i < 3; ++i)
-					write_object(o, f->EventArgs.velocity[i]);
-				write_object(o, f->EventArgs.ducking);
-				write_object(o, f->EventArgs.fparam1);
-				write_object(o, f->EventArgs.fparam2);
-				write_object(o, f->EventArgs.iparam1);
-				write_object(o, f->EventArgs.iparam2);
-				write_object(o, f->EventArgs.bparam1);
-				write_object(o, f->EventArgs.bparam2);
-			}
-				break;
+			stream->seekp(chunks[i].offset, std::ios::beg);
+			stream->write(buf.data(), buf.size());
+			if (!*stream)
+				throw std::runtime_error("Error writing the output file.");
 
-			case DemoFrameType::WEAPON_ANIM:
-			{
-				auto f = reinterpret_cast<WeaponAnimFrame*>(frame.get());
+			progress.Add(chunks[i].entry, chunks[i].size);
+		});
 
-				write_object(o, f->anim);
-				write_object(o, f->body);
-			}
-				break;
+		for (auto& stream : streams) {
+			if (!stream)
+				continue;
+			stream->close();
+			if (!*stream)
+				throw std::runtime_error("Error writing the output file.");
+		}
+	} catch (...) {
+		o.close();
+		remove_file(filename);
+		throw;
+	}
 
-			case DemoFrameType::SOUND:
-			{
-				auto f = reinterpret_cast<SoundFrame*>(frame.get());
-
-				write_object(o, f->channel);
-				write_object(o, static_cast<int32_t>(f->sample.size()));
-				write_objects(o, f->sample);
-				write_object(o, f->attenuation);
-				write_object(o, f->volume);
-				write_object(o, f->flags);
-				write_object(o, f->pitch);
-			}
-				break;
+	header.directoryOffset = directoryOffset;
+}
 
-			case DemoFrameType::DEMO_BUFFER:
-			{
-				auto f = reinterpret_cast<DemoBufferFrame*>(frame.get());
+void DemoFile::Save(std::ostream& o)
+{
+	CheckFramesKept();
+	SaveStream(o, CanCopySource(std::string()));
+}
 
-				write_object(o, static_cast<int32_t>(f->buffer.size()));
-				write_objects(o, f->buffer);
-			}
-				break;
+void DemoFile::SaveStream(std::ostream& o, bool copySource)
+{
+	std::vector<SaveChunk> chunks;
+	auto directoryOffset = ComputeSaveLayout(chunks, 1);
 
-			default:
-			{
-				auto f = reinterpret_cast<NetMsgFrame*>(frame.get());
-
-				write_object(o, f->DemoInfo.timestamp);
-				write_object(o, f->DemoInfo.RefParams.vieworg[0]);
-				write_object(o, f->DemoInfo.RefParams.vieworg[1]);
-				write_object(o, f->DemoInfo.RefParams.vieworg[2]);
-				write_object(o, f->DemoInfo.RefParams.viewangles[0]);
-				write_object(o, f->DemoInfo.RefParams.viewangles[1]);
-				write_object(o, f->DemoInfo.RefParams.viewangles[2]);
-				write_object(o, f->DemoInfo.RefParams.forward[0]);
-				write_object(o, f->DemoInfo.RefParams.forward[1]);
-				write_object(o, f->DemoInfo.RefParams.forward[2]);
-				write_object(o, f->DemoInfo.RefParams.right[0]);
-				write_object(o, f->DemoInfo.RefParams.right[1]);
-				write_object(o, f->DemoInfo.RefParams.right[2]);
-				write_object(o, f->DemoInfo.RefParams.up[0]);
-				write_object(o, f->DemoInfo.RefParams.up[1]);
-				write_object(o, f->DemoInfo.RefParams.up[2]);
-				write_object(o, f->DemoInfo.RefParams.frametime);
-				write_object(o, f->DemoInfo.RefParams.time);
-				write_object(o, f->DemoInfo.RefParams.intermission);
-				write_object(o, f->DemoInfo.RefParams.paused);
-				write_object(o, f->DemoInfo.RefParams.spectator);
-				write_object(o, f->DemoInfo.RefParams.onground);
-				write_object(o, f->DemoInfo.RefParams.waterlevel);
-				write_object(o, f->DemoInfo.RefParams.simvel[0]);
-				write_object(o, f->DemoInfo.RefParams.simvel[1]);
-				write_object(o, f->DemoInfo.RefParams.simvel[2]);
-				write_object(o, f->DemoInfo.RefParams.simorg[0]);
-				write_object(o, f->DemoInfo.RefParams.simorg[1]);
-				write_object(o, f->DemoInfo.RefParams.simorg[2]);
-				write_object(o, f->DemoInfo.RefParams.viewheight[0]);
-				write_object(o, f->DemoInfo.RefParams.viewheight[1]);
-				write_object(o, f->DemoInfo.RefParams.viewheight[2]);
-				write_object(o, f->DemoInfo.RefParams.idealpitch);
-				write_object(o, f->DemoInfo.RefParams.cl_viewangles[0]);
-				write_object(o, f->DemoInfo.RefParams.cl_viewangles[1]);
-				write_object(o, f->DemoInfo.RefParams.cl_viewangles[2]);
-				write_object(o, f->DemoInfo.RefParams.health);
-				write_object(o, f->DemoInfo.RefParams.crosshairangle[0]);
-				write_object(o, f->DemoInfo.RefParams.crosshairangle[1]);
-				write_object(o, f->DemoInfo.RefParams.crosshairangle[2]);
-				write_object(o, f->DemoInfo.RefParams.viewsize);
-				write_object(o, f->DemoInfo.RefParams.punchangle[0]);
-				write_object(o, f->DemoInfo.RefParams.punchangle[1]);
-				write_object(o, f->DemoInfo.RefParams.punchangle[2]);
-				write_object(o, f->DemoInfo.RefParams.maxclients);
-				write_object(o, f->DemoInfo.RefParams.viewentity);
-				write_object(o, f->DemoInfo.RefParams.playernum);
-				write_object(o, f->DemoInfo.RefParams.max_entities);
-				write_object(o, f->DemoInfo.RefParams.demoplayback);
-				write_object(o, f->DemoInfo.RefParams.hardware);
-				write_object(o, f->DemoInfo.RefParams.smoothing);
-				write_object(o, f->DemoInfo.RefParams.ptr_cmd);
-				write_object(o, f->DemoInfo.RefParams.ptr_movevars);
-				write_object(o, f->DemoInfo.RefParams.viewport[0]);
-				write_object(o, f->DemoInfo.RefParams.viewport[1]);
-				write_object(o, f->DemoInfo.RefParams.viewport[2]);
-				write_object(o, f->DemoInfo.RefParams.viewport[3]);
-				write_object(o, f->DemoInfo.RefParams.nextView);
-				write_object(o, f->DemoInfo.RefParams.onlyClientDraw);
-				write_object(o, f->DemoInfo.UserCmd.lerp_msec);
-				write_object(o, f->DemoInfo.UserCmd.msec);
-				write_object(o, f->DemoInfo.UserCmd.align_1);
-				write_object(o, f->DemoInfo.UserCmd.viewangles[0]);
-				write_object(o, f->DemoInfo.UserCmd.viewangles[1]);
-				write_object(o, f->DemoInfo.UserCmd.viewangles[2]);
-				write_object(o, f->DemoInfo.UserCmd.forwardmove);
-				write_object(o, f->DemoInfo.UserCmd.sidemove);
-				write_object(o, f->DemoInfo.UserCmd.upmove);
-				write_object(o, f->DemoInfo.UserCmd.lightlevel);
-				write_object(o, f->DemoInfo.UserCmd.align_2);
-				write_object(o, f->DemoInfo.UserCmd.buttons);
-				write_object(o, f->DemoInfo.UserCmd.impulse);
-				write_object(o, f->DemoInfo.UserCmd.weaponselect);
-				write_object(o, f->DemoInfo.UserCmd.align_3);
-				write_object(o, f->DemoInfo.UserCmd.align_4);
-				write_object(o, f->DemoInfo.UserCmd.impact_index);
-				write_object(o, f->DemoInfo.UserCmd.impact_position[0]);
-				write_object(o, f->DemoInfo.UserCmd.impact_position[1]);
-				write_object(o, f->DemoInfo.UserCmd.impact_position[2]);
-				write_object(o, f->DemoInfo.MoveVars.gravity);
-				write_object(o, f->DemoInfo.MoveVars.stopspeed);
-				write_object(o, f->DemoInfo.MoveVars.maxspeed);
-				write_object(o, f->DemoInfo.MoveVars.spectatormaxspeed);
-				write_object(o, f->DemoInfo.MoveVars.accelerate);
-				write_object(o, f->DemoInfo.MoveVars.airaccelerate);
-				write_object(o, f->DemoInfo.MoveVars.wateraccelerate);
-				write_object(o, f->DemoInfo.MoveVars.friction);
-				write_object(o, f->DemoInfo.MoveVars.edgefriction);
-				write_object(o, f->DemoInfo.MoveVars.waterfriction);
-				write_object(o, f->DemoInfo.MoveVars.entgravity);
-				write_object(o, f->DemoInfo.MoveVars.bounce);
-				write_object(o, f->DemoInfo.MoveVars.stepsize);
-				write_object(o, f->DemoInfo.MoveVars.maxvelocity);
-				write_object(o, f->DemoInfo.MoveVars.zmax);
-				write_object(o, f->DemoInfo.MoveVars.waveHeight);
-				write_object(o, f->DemoInfo.MoveVars.footsteps);
-				std::vector<char> skyNameBuf;
-				std::copy(std::begin(f->DemoInfo.MoveVars.skyName), std::end(f->DemoInfo.MoveVars.skyName), std::back_inserter(skyNameBuf));
-				skyNameBuf.push_back('\0');
-				skyNameBuf.resize(FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE);
-				write_objects(o, skyNameBuf);
-				write_object(o, f->DemoInfo.MoveVars.rollangle);
-				write_object(o, f->DemoInfo.MoveVars.rollspeed);
-				write_object(o, f->DemoInfo.MoveVars.skycolor_r);
-				write_object(o, f->DemoInfo.MoveVars.skycolor_g);
-				write_object(o, f->DemoInfo.MoveVars.skycolor_b);
-				write_object(o, f->DemoInfo.MoveVars.skyvec_x);
-				write_object(o, f->DemoInfo.MoveVars.skyvec_y);
-				write_object(o, f->DemoInfo.MoveVars.skyvec_z);
-				write_object(o, f->DemoInfo.view[0]);
-				write_object(o, f->DemoInfo.view[1]);
-				write_object(o, f->DemoInfo.view[2]);
-				write_object(o, f->DemoInfo.viewmodel);
-
-				write_object(o, f->incoming_sequence);
-				write_object(o, f->incoming_acknowledged);
-				write_object(o, f->incoming_reliable_acknowledged);
-				write_object(o, f->incoming_reliable_sequence);
-				write_object(o, f->outgoing_sequence);
-				write_object(o, f->reliable_sequence);
-				write_object(o, f->last_reliable_sequence);
-
-				write_object(o, static_cast<int32_t>(f->msg.size()));
-				write_objects(o, f->msg);
-			}
-				break;
-			}
-		}
+	// With the layout known in advance everything goes out strictly in order.
+	ProgressReporter progress(onProgress, progressInterval, SaveEntryTotals(chunks));
 
-		if (!wroteNextSection) {
-			DemoFrame f;
-			f.type = DemoFrameType::NEXT_SECTION;
-			f.time = 0;
-			f.frame = 0;
+	std::vector<char> buf;
+	DemoWriter::EncodeHeader(buf, header, directoryOffset);
 
-			write_object(o, f.type);
-			write_object(o, f.time);
-			write_object(o, f.frame);
-		}
-	}
+	for (const auto& chunk : chunks) {
+		EncodeChunk(buf, chunk, copySource ? source.get() : nullptr);
+		o.write(buf.data(), buf.size());
+		if (!o)
+			throw std::runtime_error("Error writing the output file.");
+		buf.clear();
 
-	auto dirOffset = o.tellp();
-	write_object(o, static_cast<int32_t>(directoryEntries.size()));
-	for (const auto& entry : directoryEntries) {
-		write_object(o, entry.type);
-
-		std::vector<char> descriptionBuf;
-		std::copy(std::begin(entry.description), std::end(entry.description), std::back_inserter(descriptionBuf));
-		descriptionBuf.push_back('\0');
-		descriptionBuf.resize(DIR_ENTRY_DESCRIPTION_SIZE);
-		write_objects(o, descriptionBuf);
-
-		write_object(o, entry.flags);
-		write_object(o, entry.CDTrack);
-		write_object(o, entry.trackTime);
-		write_object(o, entry.frameCount);
-		write_object(o, entry.offset);
-		write_object(o, entry.fileLength);
+		progress.Add(chunk.entry, chunk.size);
 	}
 
-	o.seekp(dirOffsetPos, std::ios::beg);
-	write_object(o, static_cast<int32_t>(dirOffset));
-	header.directoryOffset = static_cast<int32_t>(dirOffset);
+	DemoWriter::EncodeDirectory(buf, directoryEntries);
+	o.write(buf.data(), buf.size());
+	o.flush();
+	if (!o)
+		throw std::runtime_error("Error writing the output file.");
 
-	o.close();
+	header.directoryOffset = directoryOffset;
 }
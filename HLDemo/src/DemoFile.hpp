@@ -1,13 +1,21 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <istream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "DemoFrame.hpp"
 
+class PositionalFile;
+
 struct DemoHeader {
 	int32_t netProtocol;
 	int32_t demoProtocol;
@@ -30,6 +38,68 @@ struct DemoDirectoryEntry {
 	std::vector<std::shared_ptr<DemoFrame>> frames;
 };
 
+// A byte range ReadFrames skipped in recovery mode.
+struct DemoSkippedRange {
+	// Index into DemoFile::directoryEntries.
+	size_t entry;
+	std::streamoff offset;
+	std::streamoff length;
+};
+
+struct DemoMemoryTally {
+	size_t frames;
+	size_t bytes;
+	size_t allocations;
+};
+
+/*
+ * Heap memory held by a parsed demo, estimated from the object sizes and
+ * the container capacities rather than measured. The numbers assume that
+ * each frame costs its object plus a shared_ptr control block, and that
+ * strings within the small string buffer don't allocate. They leave out
+ * the allocator's own headers and rounding, and count the frames of a
+ * demo loaded from a snapshot as if each was allocated on its own.
+ * Shared movevars and strings count towards the first frame using them.
+ */
+struct DemoMemoryUsage {
+	// Indexed by the frame type byte, netmsg frames have types outside of 2-9.
+	DemoMemoryTally frameTypes[256];
+	// Per directory entry, including the entry's frame pointer vector.
+	std::vector<DemoMemoryTally> entries;
+	// Everything, including the header and the directory.
+	DemoMemoryTally total;
+};
+
+// How far a long operation has got, in bytes of the demo file.
+struct DemoProgress {
+	// Index into DemoFile::directoryEntries.
+	size_t entry;
+	int64_t entryDone, entryTotal;
+	int64_t done, total;
+};
+
+/*
+ * Lets another thread stop ReadFrames or Save. They check it
+ * between frames and throw DemoCancelled once it's set.
+ */
+class DemoCancellation
+{
+public:
+	DemoCancellation();
+
+	void Cancel();
+	bool IsCancelled() const;
+
+protected:
+	std::atomic<bool> cancelled;
+};
+
+class DemoCancelled : public std::runtime_error
+{
+public:
+	DemoCancelled();
+};
+
 /*
  * The std::string versions accept multibyte UTF-8 filenames,
  * the std::wstring versions accept wide UTF-16 filenames.
@@ -39,26 +109,190 @@ class DemoFile
 public:
 	DemoFile(const std::string& filename);
 	DemoFile(const std::wstring& filename);
+
+	/*
+	 * Called for every frame right after it has been decoded, before it is
+	 * stored in the entry. The frame may be modified in place, followed by
+	 * DemoFrame::MarkModified.
+	 */
+	typedef std::function<void(DemoDirectoryEntry& entry, DemoFrame& frame)> FrameCallback;
+
 	void ReadFrames();
+	void ReadFrames(const FrameCallback& onFrame);
+
+	/*
+	 * Frames read from the demo file and not marked as modified are
+	 * copied from it, in runs of frames that follow each other there,
+	 * so only the changed frames are encoded. If the demo file has been
+	 * written since it was opened, or the output is the demo file itself,
+	 * everything is encoded. Either way the result is the same.
+	 */
 	void Save(const std::string& filename);
 	void Save(const std::wstring& filename);
 
+	/*
+	 * Produces the same file as Save, but computes the layout up front
+	 * and encodes chunks of frames on multiple threads, each writing
+	 * into its own slice of the file. threads = 0 means one per core.
+	 */
+	void SaveParallel(const std::string& filename, unsigned threads = 0);
+	void SaveParallel(const std::wstring& filename, unsigned threads = 0);
+
+	/*
+	 * Produces the same file as Save, but never seeks: the layout is
+	 * computed first, so the output can be a pipe or stdout. If this
+	 * fails or is cancelled, the stream is left with partial output.
+	 */
+	void Save(std::ostream& o);
+
+	/*
+	 * Writes the part of the demo between the two times into a new demo
+	 * without decoding any frames. The start segment is copied whole, the
+	 * other entries are cut from their first frame at or after from to the
+	 * frame before the first one after to, found by walking the frame
+	 * headers. The cut frames are copied as they are, between a DEMO_START
+	 * and a NEXT_SECTION made for them, entries with nothing in the range
+	 * are left out. The demo file is only needed up to the end of the cut,
+	 * so this must be called before ReadFrames, which closes it.
+	 */
+	void Trim(const std::string& filename, float from, float to);
+	void Trim(const std::wstring& filename, float from, float to);
+	void Trim(std::ostream& o, float from, float to);
+
 	DemoHeader header;
 	std::vector<DemoDirectoryEntry> directoryEntries;
 
+	/*
+	 * In recovery mode ReadFrames doesn't drop the rest of an entry on a
+	 * corrupt frame. Instead it scans forward for the next plausible frame
+	 * header and continues from there, recording what it skipped.
+	 */
+	bool recoveryMode;
+	std::vector<DemoSkippedRange> skippedRanges;
+
+	/*
+	 * If cleared, ReadFrames only hands the frames to the callback and
+	 * doesn't store them, so that a demo of any size can be streamed
+	 * through in constant memory. The entries are left without frames,
+	 * so saving the demo afterwards throws.
+	 */
+	bool keepFrames;
+
+	/*
+	 * Called while ReadFrames and Save run, at most once per
+	 * progressInterval and at the end of every entry. SaveParallel
+	 * calls it from its worker threads, one at a time.
+	 */
+	typedef std::function<void(const DemoProgress& progress)> ProgressCallback;
+	ProgressCallback onProgress;
+	std::chrono::milliseconds progressInterval;
+
+	/*
+	 * Once cancelled, ReadFrames drops the frames read so far and Save
+	 * removes the partially written file before throwing DemoCancelled.
+	 */
+	std::shared_ptr<DemoCancellation> cancellation;
+
+	DemoMemoryUsage MemoryUsage() const;
+
 	static bool IsValidDemoFile(const std::string& filename);
 	static bool IsValidDemoFile(const std::wstring& filename);
 
+	/*
+	 * Decode the header and the directory from the bytes of a demo file,
+	 * with the same checks as opening it. The header is HEADER_SIZE bytes
+	 * from the start of the file, the directory is what follows the
+	 * directory offset, up to the end of the file or the most entries a
+	 * directory can have.
+	 */
+	static void DecodeHeader(const char* data, DemoHeader& header);
+	static void DecodeDirectory(const char* data, size_t size, std::vector<DemoDirectoryEntry>& entries);
+	// The number of entries in the directory, with the checks of DecodeDirectory. The entries follow the count.
+	static size_t DecodeDirectoryCount(const char* data, size_t size);
+
 protected:
-	std::ifstream demo;
+	// Either the file itself or the decompressed contents of a compressed demo.
+	std::unique_ptr<std::streambuf> demoBuffer;
+	std::istream demo;
 	std::streampos demoSize;
 
-	void ConstructorInternal();
-	void SaveInternal(std::ofstream o);
+	// The uncompressed demo file the frames are read from, empty if there's none.
+	std::string sourceFilename;
+	// Kept open for Save to copy the frames from, null if there's none.
+	std::shared_ptr<PositionalFile> source;
+	// Set in the frames read from this version of the demo file, see DemoFrame.
+	uint64_t sourceId;
+
+	// An empty demo without a file, for DemoSnapshotCache to fill in.
+	DemoFile();
+	void ConstructorInternal(std::unique_ptr<std::filebuf> file, const std::string& filename);
+	// Opens the uncompressed demo file for Save to copy the frames from, leaves it closed on errors.
+	void OpenSource(const std::string& filename);
+	void CloseDemo();
+	// The filename is the output's, in UTF-8, for removing it if saving fails.
+	void SaveInternal(std::ofstream o, const std::string& filename, bool copySource);
+	template<typename Path>
+	void SaveParallelInternal(const Path& path, const std::string& filename, unsigned threads, bool copySource);
+	void SaveStream(std::ostream& o, bool copySource);
+
+	// Whether the frame sources can be copied into the given output, which may be empty for a stream.
+	bool CanCopySource(const std::string& output) const;
+	// Whether the frame was read by this demo and hasn't been modified since.
+	bool HasSource(const DemoFrame& frame) const;
+	// Appends the source bytes of the frames, which follow each other in the demo file, false if they can't be read.
+	static bool CopySource(std::vector<char>& o, PositionalFile& source, const std::vector<std::shared_ptr<DemoFrame>>& frames,
+		size_t first, size_t last);
+
+	// A run of frames from one entry, encoded and written as a unit.
+	struct SaveChunk {
+		size_t entry;
+		size_t first, last;
+		bool nextSection;
+		// Append a NEXT_SECTION, the entry doesn't have one.
+		bool terminate;
+		int64_t offset;
+		int64_t size;
+	};
+	// Fills in the chunks and the entry offsets, returns the directory offset.
+	int32_t ComputeSaveLayout(std::vector<SaveChunk>& chunks, unsigned threads);
+	// The source is null if the frames can't be copied from it.
+	void EncodeChunk(std::vector<char>& o, const SaveChunk& chunk, PositionalFile* source) const;
+	std::vector<int64_t> SaveEntryTotals(const std::vector<SaveChunk>& chunks) const;
+
+	struct TrimFrame {
+		float time;
+		int32_t frame;
+	};
+	// The frames of one entry copied by Trim.
+	struct TrimRange {
+		size_t entry;
+		// The start segment, copied whole.
+		bool whole;
+		std::streamoff offset;
+		std::streamoff size;
+		TrimFrame first, last;
+		int32_t netMsgFrames;
+		bool addDemoStart, addNextSection;
+	};
+	void ComputeTrimRanges(float from, float to, std::vector<TrimRange>& ranges);
 	static bool IsValidDemoFileInternal(std::ifstream in);
 
 	void ReadHeader();
 	void ReadDirectory();
 
+	struct LastFrame {
+		bool valid;
+		float time;
+		int32_t frame;
+	};
+	std::streamoff EntryScanEnd(const DemoDirectoryEntry& entry) const;
+	std::streamoff FindNextFrame(std::streamoff from, std::streamoff end, const LastFrame& last);
+
 	bool readFrames;
+	// Set when ReadFrames didn't keep the frames.
+	bool framesDropped;
+	void CheckFramesKept() const;
+
+	// Restores the frames from a snapshot instead of reading them.
+	friend class DemoSnapshotCache;
 };
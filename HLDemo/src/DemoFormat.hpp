@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DemoFrame.hpp"
+
+/*
+ * Internal definitions of the demo file layout,
+ * shared between the reading and the writing code.
+ */
+
+enum {
+	HEADER_SIZE = 544,
+	HEADER_SIGNATURE_CHECK_SIZE = 6,
+	HEADER_SIGNATURE_SIZE = 8,
+	HEADER_MAPNAME_SIZE = 260,
+	HEADER_GAMEDIR_SIZE = 260,
+
+	MIN_DIR_ENTRY_COUNT = 1,
+	MAX_DIR_ENTRY_COUNT = 1024,
+	DIR_ENTRY_SIZE = 92,
+	DIR_ENTRY_DESCRIPTION_SIZE = 64,
+	// The entry count followed by the most entries a directory can have.
+	MAX_DIRECTORY_SIZE = 4 + MAX_DIR_ENTRY_COUNT * DIR_ENTRY_SIZE,
+
+	MIN_FRAME_SIZE = 12,
+	FRAME_HEADER_SIZE = 9,
+	FRAME_CONSOLE_COMMAND_SIZE = 64,
+	FRAME_CLIENT_DATA_SIZE = 32,
+	FRAME_EVENT_SIZE = 84,
+	FRAME_WEAPON_ANIM_SIZE = 8,
+	FRAME_SOUND_SIZE_1 = 8,
+	FRAME_SOUND_SIZE_2 = 16,
+	FRAME_DEMO_BUFFER_SIZE = 4,
+	FRAME_NETMSG_SIZE = 468,
+	FRAME_NETMSG_DEMOINFO_SIZE = 436,
+	FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE = 132,
+	FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_OFFSET = 68,
+	FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE = 32,
+	FRAME_NETMSG_MIN_MESSAGE_LENGTH = 0,
+	FRAME_NETMSG_MAX_MESSAGE_LENGTH = 65536,
+	FRAME_SOUND_MAX_SAMPLE_LENGTH = INT32_MAX,
+	FRAME_DEMO_BUFFER_MAX_LENGTH = INT32_MAX
+};
+
+/*
+ * The size of the frame after its header, not counting the variable length
+ * part, and the offset of the int32 length of that part within the frame
+ * after the header, or -1 if the frame has no variable length part.
+ */
+inline void frame_layout(DemoFrameType type, int64_t& fixed, int64_t& lengthOffset)
+{
+	lengthOffset = -1;
+	switch (type) {
+	case DemoFrameType::DEMO_START:
+	case DemoFrameType::NEXT_SECTION:
+		fixed = 0;
+		break;
+	case DemoFrameType::CONSOLE_COMMAND:
+		fixed = FRAME_CONSOLE_COMMAND_SIZE;
+		break;
+	case DemoFrameType::CLIENT_DATA:
+		fixed = FRAME_CLIENT_DATA_SIZE;
+		break;
+	case DemoFrameType::EVENT:
+		fixed = FRAME_EVENT_SIZE;
+		break;
+	case DemoFrameType::WEAPON_ANIM:
+		fixed = FRAME_WEAPON_ANIM_SIZE;
+		break;
+	case DemoFrameType::SOUND:
+		fixed = FRAME_SOUND_SIZE_1 + FRAME_SOUND_SIZE_2;
+		lengthOffset = 4;
+		break;
+	case DemoFrameType::DEMO_BUFFER:
+		fixed = FRAME_DEMO_BUFFER_SIZE;
+		lengthOffset = 0;
+		break;
+	default:
+		fixed = FRAME_NETMSG_SIZE;
+		lengthOffset = FRAME_NETMSG_SIZE - 4;
+		break;
+	}
+}
+
+// The longest variable length part a frame of the type can have, the schema checks the same.
+inline int64_t frame_max_length(DemoFrameType type)
+{
+	switch (type) {
+	case DemoFrameType::SOUND:
+		return FRAME_SOUND_MAX_SAMPLE_LENGTH;
+	case DemoFrameType::DEMO_BUFFER:
+		return FRAME_DEMO_BUFFER_MAX_LENGTH;
+	default:
+		return FRAME_NETMSG_MAX_MESSAGE_LENGTH;
+	}
+}
+
+template<typename T>
+inline void write_object(std::vector<char>& o, const T& obj)
+{
+	auto p = reinterpret_cast<const char*>(&obj);
+	o.insert(o.end(), p, p + sizeof(T));
+}
+
+template<typename T>
+inline void write_objects(std::vector<char>& o, const std::vector<T>& objs)
+{
+	auto p = reinterpret_cast<const char*>(objs.data());
+	o.insert(o.end(), p, p + objs.size() * sizeof(T));
+}
+
+// Writes the string into a fixed size field, zero-padded and truncated if needed.
+inline void write_string(std::vector<char>& o, const std::string& str, size_t size)
+{
+	auto length = std::min(str.size(), size);
+	o.insert(o.end(), str.begin(), str.begin() + length);
+	o.insert(o.end(), size - length, '\0');
+}
+
+// Writes the size followed by the contents.
+inline void write_blob(std::vector<char>& o, const std::string& str)
+{
+	write_object(o, static_cast<uint64_t>(str.size()));
+	o.insert(o.end(), str.begin(), str.end());
+}
+
+template<typename T>
+inline void write_blob(std::vector<char>& o, const std::vector<T>& vec)
+{
+	write_object(o, static_cast<uint64_t>(vec.size()));
+	write_objects(o, vec);
+}
+
+// A fast hash of the bytes, not meant to resist collisions made on purpose.
+inline uint64_t hash_bytes(const char* data, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ull ^ size;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+	for (; i < size; ++i)
+		h = (h ^ static_cast<uint8_t>(data[i])) * 0x100000001b3ull;
+
+	return h ^ (h >> 29);
+}
+
+// Reads objects back from a memory buffer, throwing when it runs out.
+struct BufferReader {
+	const char* p;
+	const char* end;
+
+	void Read(void* out, size_t size)
+	{
+		if (static_cast<size_t>(end - p) < size)
+			throw std::runtime_error("Unexpected end of data.");
+		std::memcpy(out, p, size);
+		p += size;
+	}
+
+	template<typename T>
+	T Read()
+	{
+		T value;
+		Read(&value, sizeof(value));
+		return value;
+	}
+
+	// Reads an element count, checking that this many elements can follow.
+	uint64_t ReadCount(size_t elementSize)
+	{
+		auto count = Read<uint64_t>();
+		if (count > static_cast<uint64_t>(end - p) / elementSize)
+			throw std::runtime_error("Unexpected end of data.");
+		return count;
+	}
+
+	// Reads a fixed size field written by write_string, up to the first zero.
+	void ReadString(std::string& str, size_t size)
+	{
+		if (static_cast<size_t>(end - p) < size)
+			throw std::runtime_error("Unexpected end of data.");
+		auto zero = static_cast<const char*>(std::memchr(p, '\0', size));
+		str.assign(p, zero ? zero : p + size);
+		p += size;
+	}
+
+	void ReadBlob(std::string& str)
+	{
+		auto size = static_cast<size_t>(ReadCount(1));
+		str.assign(p, size);
+		p += size;
+	}
+
+	template<typename T>
+	void ReadBlob(std::vector<T>& vec)
+	{
+		auto count = static_cast<size_t>(ReadCount(sizeof(T)));
+		vec.resize(count);
+		Read(vec.data(), count * sizeof(T));
+	}
+};
+
+std::wstring utf8_to_utf16(const std::string& str);
+std::string utf16_to_utf8(const std::wstring& str);
+
+#ifdef _WIN32
+#define utf8_filename(str) utf8_to_utf16(str)
+#define utf16_filename(str) str
+#else
+#define utf8_filename(str) str
+#define utf16_filename(str) utf16_to_utf8(str)
+#endif
@@ -1,5 +1,7 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -18,12 +20,94 @@ struct DemoFrame {
 	DemoFrameType type;
 	float time;
 	int32_t frame;
+
+	// Where the frame starts in the demo file it was read from, 0 for frames made from scratch.
+	uint32_t SourceOffset() const
+	{
+		return sourceOffset;
+	}
+
+	/*
+	 * Save copies the frames read from a demo file straight from their
+	 * bytes there, without encoding them. So any change to such a frame
+	 * has to be followed by MarkModified, otherwise it is lost on Save.
+	 */
+	void MarkModified()
+	{
+		sourceSize = 0;
+	}
+
+private:
+	friend class DemoFile;
+
+	/*
+	 * The bytes of the frame in the demo file it was read from. A size of
+	 * 0 means there's nothing to copy: the frame was made from scratch,
+	 * marked as modified or doesn't encode back to the same bytes. The id
+	 * tells which version of which file the frame was read from, so
+	 * frames moved to another demo aren't copied from the wrong file.
+	 */
+	uint32_t sourceOffset = 0;
+	uint32_t sourceSize = 0;
+	uint64_t sourceId = 0;
+};
+
+/*
+ * An immutable string that frames with the same text share. Copies share
+ * the text, constructing one from a std::string makes a new copy.
+ */
+class DemoString
+{
+public:
+	DemoString()
+		: text(Empty())
+	{
+	}
+
+	DemoString(const std::string& str)
+		: text(std::make_shared<const std::string>(str))
+	{
+	}
+
+	DemoString(const char* str)
+		: text(std::make_shared<const std::string>(str))
+	{
+	}
+
+	const std::string& str() const
+	{
+		return *text;
+	}
+
+	operator const std::string&() const
+	{
+		return *text;
+	}
+
+	bool operator==(const DemoString& other) const
+	{
+		return text == other.text || *text == *other.text;
+	}
+
+	bool operator!=(const DemoString& other) const
+	{
+		return !(*this == other);
+	}
+
+protected:
+	std::shared_ptr<const std::string> text;
+
+	static const std::shared_ptr<const std::string>& Empty()
+	{
+		static const auto empty = std::make_shared<const std::string>();
+		return empty;
+	}
 };
 
 // DEMO_START: no extra data.
 
 struct ConsoleCommandFrame : DemoFrame {
-	std::string command;
+	DemoString command;
 };
 
 struct ClientDataFrame : DemoFrame {
@@ -74,6 +158,36 @@ struct DemoBufferFrame : DemoFrame {
 	std::vector<unsigned char> buffer;
 };
 
+// The netmsg movevars. They rarely change during a demo.
+struct DemoMoveVars {
+	float gravity;
+	float stopspeed;
+	float maxspeed;
+	float spectatormaxspeed;
+	float accelerate;
+	float airaccelerate;
+	float wateraccelerate;
+	float friction;
+	float edgefriction;
+	float waterfriction;
+	float entgravity;
+	float bounce;
+	float stepsize;
+	float maxvelocity;
+	float zmax;
+	float waveHeight;
+	int32_t footsteps;
+	DemoString skyName;
+	float rollangle;
+	float rollspeed;
+	float skycolor_r;
+	float skycolor_g;
+	float skycolor_b;
+	float skyvec_x;
+	float skyvec_y;
+	float skyvec_z;
+};
+
 // Otherwise, netmsg.
 struct NetMsgFrame : DemoFrame {
 	struct {
@@ -134,34 +248,8 @@ struct NetMsgFrame : DemoFrame {
 			float impact_position[3];
 		} UserCmd;
 
-		struct {
-			float gravity;
-			float stopspeed;
-			float maxspeed;
-			float spectatormaxspeed;
-			float accelerate;
-			float airaccelerate;
-			float wateraccelerate;
-			float friction;
-			float edgefriction;
-			float waterfriction;
-			float entgravity;
-			float bounce;
-			float stepsize;
-			float maxvelocity;
-			float zmax;
-			float waveHeight;
-			int32_t footsteps;
-			std::string skyName;
-			float rollangle;
-			float rollspeed;
-			float skycolor_r;
-			float skycolor_g;
-			float skycolor_b;
-			float skyvec_x;
-			float skyvec_y;
-			float skyvec_z;
-		} MoveVars;
+		// Shared between the frames with the same movevars. Null is saved as all zeros.
+		std::shared_ptr<const DemoMoveVars> MoveVars;
 
 		float view[3];
 		int32_t viewmodel;
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "DemoGhost.hpp"
+#include "DemoKernels.hpp"
+
+TrajectoryStage::TrajectoryStage()
+	: skippedFrames(0)
+{
+}
+
+void TrajectoryStage::ProcessFrame(DemoDirectoryEntry&, DemoFrame& frame)
+{
+	if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+		return;
+
+	if (!trajectory.time.empty() && !(frame.time > trajectory.time.back())) {
+		skippedFrames++;
+		return;
+	}
+
+	const auto& f = static_cast<const NetMsgFrame&>(frame);
+	trajectory.time.push_back(frame.time);
+	for (size_t i = 0; i < 3; ++i) {
+		trajectory.origin[i].push_back(f.DemoInfo.RefParams.vieworg[i]);
+		trajectory.angles[i].push_back(f.DemoInfo.RefParams.viewangles[i]);
+	}
+}
+
+/*
+ * Pairs every angle with the next one moved by whole turns to be at most
+ * half a turn away, so that interpolating between them goes the short way
+ * around. Unwrapping the whole series instead would lose precision as the
+ * angles grow with every turn.
+ */
+static void angle_segments(const std::vector<float>& angles, std::vector<float>& out)
+{
+	out.resize(angles.empty() ? 0 : 2 * (angles.size() - 1));
+	for (size_t i = 0; i + 1 < angles.size(); ++i) {
+		auto step = angles[i + 1] - angles[i];
+		out[2 * i] = angles[i];
+		out[2 * i + 1] = angles[i] + (step - 360.0f * std::nearbyint(step * (1.0f / 360.0f)));
+	}
+}
+
+DemoGhostDelta ComputeGhostDelta(const DemoTrajectory& run, const DemoTrajectory& reference, float timeOffset)
+{
+	DemoGhostDelta delta;
+	delta.first = 0;
+	delta.outside = run.time.size();
+
+	const auto& refTime = reference.time;
+	auto m = refTime.size();
+	if (run.time.empty() || m < 2)
+		return delta;
+
+	// Find the reference frames around every run frame. The times
+	// of both only go up, so a single walk over them does it.
+	auto shift = static_cast<double>(refTime[0]) + timeOffset - run.time[0];
+	std::vector<uint32_t> index;
+	std::vector<float> weight;
+	index.reserve(run.time.size());
+	weight.reserve(run.time.size());
+
+	size_t j = 0;
+	for (size_t k = 0; k < run.time.size(); ++k) {
+		auto t = run.time[k] + shift;
+		if (t < refTime[0]) {
+			delta.first = k + 1;
+			continue;
+		}
+		if (t > refTime[m - 1])
+			break;
+
+		while (j + 2 < m && refTime[j + 1] <= t)
+			++j;
+		index.push_back(static_cast<uint32_t>(j));
+		weight.push_back(static_cast<float>((t - refTime[j]) / (static_cast<double>(refTime[j + 1]) - refTime[j])));
+	}
+
+	auto count = index.size();
+	auto first = delta.first;
+	delta.outside = run.time.size() - count;
+	delta.time.assign(run.time.begin() + first, run.time.begin() + first + count);
+
+	for (size_t c = 0; c < 3; ++c) {
+		delta.origin[c].resize(count);
+		InterpolateDelta(reference.origin[c].data(), index.data(), weight.data(), run.origin[c].data() + first, count, delta.origin[c].data());
+	}
+
+	delta.distance.resize(count);
+	VectorLengths(delta.origin[0].data(), delta.origin[1].data(), delta.origin[2].data(), count, delta.distance.data());
+
+	std::vector<uint32_t> segmentIndex(count);
+	for (size_t k = 0; k < count; ++k)
+		segmentIndex[k] = 2 * index[k];
+
+	std::vector<float> segments;
+	for (size_t c = 0; c < 3; ++c) {
+		angle_segments(reference.angles[c], segments);
+		delta.angles[c].resize(count);
+		InterpolateDelta(segments.data(), segmentIndex.data(), weight.data(), run.angles[c].data() + first, count, delta.angles[c].data());
+		WrapDegrees(delta.angles[c].data(), count);
+	}
+
+	return delta;
+}
+
+DemoGhostSummary SummarizeGhostDelta(const DemoGhostDelta& delta, const DemoTrajectory& run, const DemoTrajectory& reference)
+{
+	DemoGhostSummary s = {};
+	s.frames = delta.distance.size();
+	if (!run.time.empty() && !reference.time.empty())
+		s.durationDelta = (run.time.back() - run.time.front()) - (reference.time.back() - reference.time.front());
+	if (s.frames == 0)
+		return s;
+
+	const auto& distance = delta.distance;
+	float minDistance;
+	double sum;
+	ReduceFloats(distance.data(), s.frames, minDistance, s.maxDistance, sum);
+	s.meanDistance = sum / s.frames;
+	s.maxDistanceTime = delta.time[std::max_element(distance.begin(), distance.end()) - distance.begin()];
+	s.finalDistance = distance.back();
+
+	double squares = 0;
+	for (auto d : distance)
+		squares += static_cast<double>(d) * d;
+	s.rmsDistance = std::sqrt(squares / s.frames);
+
+	auto absolute = [&](const std::vector<float>& values, float& maxAbs, double& meanAbs) {
+		maxAbs = 0;
+		double absSum = 0;
+		for (auto v : values) {
+			maxAbs = std::max(maxAbs, std::fabs(v));
+			absSum += std::fabs(v);
+		}
+		meanAbs = absSum / s.frames;
+	};
+	absolute(delta.angles[0], s.maxPitch, s.meanPitch);
+	absolute(delta.angles[1], s.maxYaw, s.meanYaw);
+
+	return s;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPipeline.hpp"
+
+/*
+ * The view origin and angles of the netmsg frames, one array per
+ * component so that the vector kernels can work on them. The times
+ * are strictly increasing.
+ */
+struct DemoTrajectory {
+	std::vector<float> time;
+	std::vector<float> origin[3];
+	std::vector<float> angles[3];
+};
+
+/*
+ * Collects the trajectory of the demo as it streams by. Frames that
+ * don't move the time forward, like the ones repeated at entry
+ * boundaries, are left out.
+ */
+class TrajectoryStage : public DemoStage
+{
+public:
+	TrajectoryStage();
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+
+	DemoTrajectory trajectory;
+	size_t skippedFrames;
+};
+
+// Run minus reference for every frame of the run the reference covers.
+struct DemoGhostDelta {
+	// The run frame the deltas start at, and how many run frames the reference doesn't cover.
+	size_t first;
+	size_t outside;
+
+	// The run times.
+	std::vector<float> time;
+	std::vector<float> origin[3];
+	std::vector<float> distance;
+	// Wrapped into [-180, 180].
+	std::vector<float> angles[3];
+};
+
+struct DemoGhostSummary {
+	size_t frames;
+	float maxDistance;
+	// The run time of the largest distance.
+	float maxDistanceTime;
+	double meanDistance, rmsDistance;
+	float finalDistance;
+	// Of the absolute pitch and yaw differences.
+	float maxPitch, maxYaw;
+	double meanPitch, meanYaw;
+	// How much longer the run is than the reference, negative if shorter.
+	float durationDelta;
+};
+
+/*
+ * Resamples the reference onto the run's times with linear interpolation
+ * and computes the per-frame position and angle differences. Both runs
+ * are timed from their first frame, the reference is additionally shifted
+ * by timeOffset seconds. The angles are interpolated the short way around.
+ */
+DemoGhostDelta ComputeGhostDelta(const DemoTrajectory& run, const DemoTrajectory& reference, float timeOffset = 0);
+DemoGhostSummary SummarizeGhostDelta(const DemoGhostDelta& delta, const DemoTrajectory& run, const DemoTrajectory& reference);
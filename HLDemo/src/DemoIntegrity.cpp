@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DemoFormat.hpp"
+#include "DemoIntegrity.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoSha256.hpp"
+#include "DemoWriter.hpp"
+
+enum {
+	INTEGRITY_VERSION = 1
+};
+
+static const char INTEGRITY_MAGIC[8] = { 'H', 'L', 'D', 'M', 'R', 'K', 'L', 'T' };
+static const char INTEGRITY_EXTENSION[] = ".hlmerkle";
+
+static const size_t NO_BLOCK = SIZE_MAX;
+
+// Leaves and inner nodes are hashed with different prefixes, so one can't pass for the other.
+static DemoHash hash_leaf(const char* data, size_t size)
+{
+	Sha256 sha;
+	uint8_t prefix = 0;
+	sha.Update(&prefix, 1);
+	sha.Update(data, size);
+	return sha.Finish();
+}
+
+static DemoHash hash_node(const DemoHash& left, const DemoHash& right)
+{
+	Sha256 sha;
+	uint8_t prefix = 1;
+	sha.Update(&prefix, 1);
+	sha.Update(left.data(), left.size());
+	sha.Update(right.data(), right.size());
+	return sha.Finish();
+}
+
+// Pairs the nodes level by level, an odd one out moves up as it is.
+static DemoHash merkle_root(std::vector<DemoHash> nodes)
+{
+	if (nodes.empty())
+		return hash_leaf(nullptr, 0);
+
+	while (nodes.size() > 1) {
+		size_t n = 0;
+		for (size_t i = 0; i < nodes.size(); i += 2)
+			nodes[n++] = i + 1 < nodes.size() ? hash_node(nodes[i], nodes[i + 1]) : nodes[i];
+		nodes.resize(n);
+	}
+	return nodes[0];
+}
+
+static DemoIntegrityBlock outside_block(uint64_t offset, uint32_t size)
+{
+	DemoIntegrityBlock b = {};
+	b.offset = offset;
+	b.size = size;
+	b.entry = DemoIntegrity::NO_ENTRY;
+	return b;
+}
+
+// Fills [from, to) with blocks outside of the entries.
+static void add_outside_blocks(std::vector<DemoIntegrityBlock>& blocks, uint64_t from, uint64_t to)
+{
+	for (auto offset = from; offset < to; offset += DemoIntegrity::BLOCK_SIZE)
+		blocks.push_back(outside_block(offset, static_cast<uint32_t>(std::min<uint64_t>(DemoIntegrity::BLOCK_SIZE, to - offset))));
+}
+
+DemoIntegrity::DemoIntegrity()
+	: fileSize(0)
+	, modificationTime(0)
+	, root()
+{
+}
+
+std::string DemoIntegrity::SidecarPath(const std::string& filename)
+{
+	return filename + INTEGRITY_EXTENSION;
+}
+
+DemoIntegrity DemoIntegrity::Create(const std::wstring& filename, unsigned threads)
+{
+	return Create(utf16_to_utf8(filename), threads);
+}
+
+DemoIntegrity DemoIntegrity::Create(const std::string& filename, unsigned threads)
+{
+	DemoIntegrity integrity;
+	integrity.filename = filename;
+	if (!stat_file(filename, integrity.fileSize, integrity.modificationTime))
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	MappedFile file(filename);
+	if (file.size != integrity.fileSize)
+		throw std::runtime_error(filename + " changed while being read.");
+
+	// Group the frames of every entry into blocks, as long as they follow each other.
+	// Compressed demos have no frames in the file itself, they get plain blocks.
+	std::vector<DemoIntegrityBlock> frameBlocks;
+	if (file.size >= HEADER_SIGNATURE_CHECK_SIZE && !std::memcmp(file.data, "HLDEMO", HEADER_SIGNATURE_CHECK_SIZE)) {
+		DemoFile demo(filename);
+		demo.keepFrames = false;
+		integrity.entryRoots.resize(demo.directoryEntries.size());
+
+		std::vector<size_t> current(demo.directoryEntries.size(), NO_BLOCK);
+		std::vector<uint32_t> frameIndex(demo.directoryEntries.size(), 0);
+		demo.ReadFrames([&](DemoDirectoryEntry& entry, DemoFrame& frame) {
+			auto e = static_cast<size_t>(&entry - demo.directoryEntries.data());
+			auto index = frameIndex[e]++;
+			auto size = static_cast<uint32_t>(DemoWriter::EncodedFrameSize(frame));
+
+			if (current[e] != NO_BLOCK) {
+				auto& b = frameBlocks[current[e]];
+				if (b.offset + b.size == frame.SourceOffset() && b.size + size <= BLOCK_SIZE) {
+					b.size += size;
+					b.frameCount++;
+					b.endTime = frame.time;
+					return;
+				}
+			}
+
+			DemoIntegrityBlock b = {};
+			b.offset = frame.SourceOffset();
+			b.size = size;
+			b.entry = static_cast<uint32_t>(e);
+			b.firstFrame = index;
+			b.frameCount = 1;
+			b.startTime = b.endTime = frame.time;
+			current[e] = frameBlocks.size();
+			frameBlocks.push_back(b);
+		});
+	}
+
+	// Cover the rest of the file, skipping blocks that overlap ones before them.
+	std::stable_sort(frameBlocks.begin(), frameBlocks.end(), [](const DemoIntegrityBlock& a, const DemoIntegrityBlock& b) {
+		return a.offset < b.offset;
+	});
+	uint64_t covered = 0;
+	for (const auto& b : frameBlocks) {
+		if (b.offset < covered || b.offset + b.size > file.size)
+			continue;
+		add_outside_blocks(integrity.blocks, covered, b.offset);
+		integrity.blocks.push_back(b);
+		covered = b.offset + b.size;
+	}
+	add_outside_blocks(integrity.blocks, covered, file.size);
+
+	auto now = static_cast<int64_t>(std::time(nullptr));
+	auto& blocks = integrity.blocks;
+	parallel_for(blocks.size(), threads, [&](unsigned, size_t i) {
+		blocks[i].hash = hash_leaf(file.data + blocks[i].offset, blocks[i].size);
+		blocks[i].verified = now;
+	});
+
+	integrity.ComputeRoots(integrity.entryRoots, integrity.root);
+	return integrity;
+}
+
+void DemoIntegrity::ComputeRoots(std::vector<DemoHash>& entries, DemoHash& top) const
+{
+	std::vector<std::vector<DemoHash>> leaves(entries.size());
+	for (const auto& b : blocks) {
+		if (b.entry != NO_ENTRY)
+			leaves[b.entry].push_back(b.hash);
+	}
+	for (size_t e = 0; e < entries.size(); ++e)
+		entries[e] = merkle_root(std::move(leaves[e]));
+
+	// The entries take the place of their first block.
+	std::vector<DemoHash> nodes;
+	std::vector<bool> seen(entries.size(), false);
+	for (const auto& b : blocks) {
+		if (b.entry == NO_ENTRY) {
+			nodes.push_back(b.hash);
+		} else if (!seen[b.entry]) {
+			seen[b.entry] = true;
+			nodes.push_back(entries[b.entry]);
+		}
+	}
+	top = merkle_root(std::move(nodes));
+}
+
+DemoIntegrity DemoIntegrity::Load(const std::wstring& filename)
+{
+	return Load(utf16_to_utf8(filename));
+}
+
+DemoIntegrity DemoIntegrity::Load(const std::string& filename)
+{
+	auto sidecar = SidecarPath(filename);
+	std::unique_ptr<MappedFile> file;
+	try {
+		file.reset(new MappedFile(sidecar));
+	} catch (const std::exception&) {
+		throw std::runtime_error("There's no " + sidecar + ".");
+	}
+
+	DemoIntegrity integrity;
+	integrity.filename = filename;
+	try {
+		BufferReader r{ file->data, file->data + file->size };
+
+		char magic[sizeof(INTEGRITY_MAGIC)];
+		r.Read(magic, sizeof(magic));
+		if (std::memcmp(magic, INTEGRITY_MAGIC, sizeof(magic)) || r.Read<uint32_t>() != INTEGRITY_VERSION)
+			throw std::runtime_error("not a sidecar of this version");
+
+		integrity.fileSize = r.Read<uint64_t>();
+		integrity.modificationTime = r.Read<int64_t>();
+		integrity.root = r.Read<DemoHash>();
+
+		auto entryCount = r.ReadCount(sizeof(DemoHash));
+		if (entryCount > MAX_DIR_ENTRY_COUNT)
+			throw std::runtime_error("too many entries");
+		integrity.entryRoots.resize(static_cast<size_t>(entryCount));
+		for (auto& hash : integrity.entryRoots)
+			hash = r.Read<DemoHash>();
+
+		auto blockCount = r.ReadCount(sizeof(DemoIntegrityBlock));
+		integrity.blocks.resize(static_cast<size_t>(blockCount));
+		r.Read(integrity.blocks.data(), integrity.blocks.size() * sizeof(DemoIntegrityBlock));
+		if (r.p != r.end)
+			throw std::runtime_error("trailing data");
+	} catch (const std::exception& ex) {
+		throw std::runtime_error(sidecar + " is damaged (" + ex.what() + ").");
+	}
+
+	// The blocks must cover the file and hash up to the recorded roots.
+	uint64_t covered = 0;
+	for (const auto& b : integrity.blocks) {
+		if (b.offset != covered || (b.entry != NO_ENTRY && b.entry >= integrity.entryRoots.size()))
+			throw std::runtime_error(sidecar + " is damaged (the blocks don't cover the demo).");
+		covered += b.size;
+	}
+	if (covered != integrity.fileSize)
+		throw std::runtime_error(sidecar + " is damaged (the blocks don't cover the demo).");
+
+	std::vector<DemoHash> entries(integrity.entryRoots.size());
+	DemoHash top;
+	integrity.ComputeRoots(entries, top);
+	if (entries != integrity.entryRoots || top != integrity.root)
+		throw std::runtime_error(sidecar + " is damaged (the hashes don't match the roots).");
+
+	return integrity;
+}
+
+void DemoIntegrity::Save() const
+{
+	std::vector<char> o;
+	o.insert(o.end(), INTEGRITY_MAGIC, INTEGRITY_MAGIC + sizeof(INTEGRITY_MAGIC));
+	write_object(o, static_cast<uint32_t>(INTEGRITY_VERSION));
+	write_object(o, fileSize);
+	write_object(o, modificationTime);
+	write_object(o, root);
+	write_blob(o, entryRoots);
+	write_blob(o, blocks);
+
+	// Write into a temporary file first so that the sidecar is never seen half-written.
+	auto sidecar = SidecarPath(filename);
+	auto temporary = temporary_filename(sidecar);
+	{
+		std::ofstream out(utf8_filename(temporary), std::ios::trunc | std::ios::binary);
+		out.write(o.data(), o.size());
+		out.close();
+		if (!out) {
+			remove_file(temporary);
+			throw std::runtime_error("Error writing " + temporary + ".");
+		}
+	}
+
+	if (!replace_file(temporary, sidecar)) {
+		remove_file(temporary);
+		throw std::runtime_error("Error writing " + sidecar + ".");
+	}
+}
+
+DemoIntegrityReport DemoIntegrity::Verify(int64_t maxAge, unsigned threads)
+{
+	DemoIntegrityReport report;
+	report.checkedBlocks = 0;
+	report.checkedBytes = 0;
+
+	uint64_t size;
+	int64_t time;
+	if (!stat_file(filename, size, time))
+		throw std::runtime_error("Error opening " + filename + ".");
+	report.fileChanged = size != fileSize || time != modificationTime;
+
+	auto now = static_cast<int64_t>(std::time(nullptr));
+	std::vector<size_t> check;
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		if (report.fileChanged || maxAge <= 0 || now - blocks[i].verified >= maxAge)
+			check.push_back(i);
+	}
+
+	MappedFile file(filename);
+	std::vector<uint8_t> intact(check.size(), 0);
+	parallel_for(check.size(), threads, [&](unsigned, size_t c) {
+		const auto& b = blocks[check[c]];
+		intact[c] = b.offset + b.size <= file.size && hash_leaf(file.data + b.offset, b.size) == b.hash;
+	});
+
+	for (size_t c = 0; c < check.size(); ++c) {
+		auto& b = blocks[check[c]];
+		report.checkedBlocks++;
+		report.checkedBytes += b.size;
+		if (intact[c])
+			b.verified = now;
+		else
+			report.damaged.push_back(check[c]);
+	}
+
+	report.size = file.size;
+	if (report.fileChanged && report.damaged.empty() && file.size == fileSize)
+		modificationTime = time;
+
+	return report;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+
+// A SHA-256 digest.
+typedef std::array<uint8_t, 32> DemoHash;
+
+// A range of the demo file, hashed as one leaf of the tree.
+struct DemoIntegrityBlock {
+	uint64_t offset;
+	uint32_t size;
+	// Index into DemoFile::directoryEntries, NO_ENTRY for the header, the directory and anything outside the entries.
+	uint32_t entry;
+	// Index into the entry's frames, and the times of the first and the last frame.
+	uint32_t firstFrame, frameCount;
+	float startTime, endTime;
+	DemoHash hash;
+	// When the block was last found intact, in seconds since the epoch.
+	int64_t verified;
+};
+
+struct DemoIntegrityReport {
+	// The size or the modification time has changed since the last run, so every block was checked.
+	bool fileChanged;
+	// The current size of the file, bytes past the recorded size aren't covered by any block.
+	uint64_t size;
+	size_t checkedBlocks;
+	uint64_t checkedBytes;
+	// Indices into DemoIntegrity::blocks.
+	std::vector<size_t> damaged;
+};
+
+/*
+ * A Merkle tree over the demo file, kept in a sidecar file next to it.
+ * The leaves are blocks of whole frames of one entry, up to BLOCK_SIZE
+ * bytes, so that damage can be traced to the frames. The blocks of every
+ * entry hash up to an entry root, and the entry roots together with the
+ * header, the directory and any bytes between the entries hash up to the
+ * root, so the whole file is covered.
+ *
+ * Creating the tree reads the frames once, verifying it only hashes the
+ * blocks without parsing anything. Every block remembers when it was
+ * last verified, so that a nightly run can check just the blocks that
+ * weren't in a while, spreading a full pass over the archive across
+ * several nights. A file whose size or modification time has changed is
+ * always checked in full.
+ *
+ * The std::string versions accept multibyte UTF-8 filenames,
+ * the std::wstring versions accept wide UTF-16 filenames.
+ */
+class DemoIntegrity
+{
+public:
+	static const uint32_t NO_ENTRY = UINT32_MAX;
+	static const uint32_t BLOCK_SIZE = 64 * 1024;
+
+	// Builds the tree of the demo, hashing on the given number of threads (0 means one per core).
+	static DemoIntegrity Create(const std::string& filename, unsigned threads = 0);
+	static DemoIntegrity Create(const std::wstring& filename, unsigned threads = 0);
+
+	// Reads the sidecar of the demo, throws if it's missing or damaged.
+	static DemoIntegrity Load(const std::string& filename);
+	static DemoIntegrity Load(const std::wstring& filename);
+
+	static std::string SidecarPath(const std::string& filename);
+
+	void Save() const;
+
+	/*
+	 * Hashes the blocks last verified more than maxAge seconds ago, or all
+	 * of them if the file has changed, and checks them against the tree.
+	 * The blocks found intact are marked as verified now, if the whole file
+	 * was checked and found intact its new size and time are taken over.
+	 */
+	DemoIntegrityReport Verify(int64_t maxAge = 0, unsigned threads = 0);
+
+	// The demo file.
+	std::string filename;
+	uint64_t fileSize;
+	// Seconds since the epoch.
+	int64_t modificationTime;
+
+	DemoHash root;
+	// Indexed like DemoFile::directoryEntries.
+	std::vector<DemoHash> entryRoots;
+	// Covering the file without gaps, in the file order.
+	std::vector<DemoIntegrityBlock> blocks;
+
+protected:
+	DemoIntegrity();
+
+	// Computes the entry roots and the root from the block hashes.
+	void ComputeRoots(std::vector<DemoHash>& entries, DemoHash& top) const;
+};
@@ -0,0 +1,631 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "DemoFrame.hpp"
+#include "DemoKernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HLDEMO_X86
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC accepts the intrinsics of any instruction set without extra flags.
+#define HLDEMO_TARGET(isa)
+#else
+#define HLDEMO_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+static const uint8_t MAX_FRAME_TYPE = static_cast<uint8_t>(DemoFrameType::DEMO_BUFFER);
+
+/*
+ * The vector paths wrap angles below this magnitude in double, where the
+ * turn count fits into an int32 and the result is exact. Larger values,
+ * infinities and NaNs go through the scalar version.
+ */
+static const float WRAP_VECTOR_LIMIT = 549755813888.0f; // 2^39
+
+static size_t find_frame_type_byte_scalar(const char* data, size_t i, size_t size)
+{
+	for (; i < size; ++i) {
+		if (static_cast<uint8_t>(data[i]) <= MAX_FRAME_TYPE)
+			return i;
+	}
+
+	return size;
+}
+
+static void reduce_floats_scalar(const float* values, size_t count, float& min, float& max, double& sum)
+{
+	min = max = values[0];
+	sum = 0;
+	for (size_t i = 0; i < count; ++i) {
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+		sum += values[i];
+	}
+}
+
+static void reduce_bytes_scalar(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	min = max = values[0];
+	sum = 0;
+	for (size_t i = 0; i < count; ++i) {
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+		sum += values[i];
+	}
+}
+
+static void interpolate_delta_scalar(const float* values, const uint32_t* index, const float* weight,
+	const float* base, size_t count, float* out)
+{
+	for (size_t k = 0; k < count; ++k) {
+		auto v0 = values[index[k]], v1 = values[index[k] + 1];
+		out[k] = base[k] - (v0 + (v1 - v0) * weight[k]);
+	}
+}
+
+static void vector_lengths_scalar(const float* x, const float* y, const float* z, size_t count, float* out)
+{
+	for (size_t k = 0; k < count; ++k)
+		out[k] = std::sqrt(x[k] * x[k] + y[k] * y[k] + z[k] * z[k]);
+}
+
+static void wrap_degrees_scalar(float* values, size_t count)
+{
+	// Exact for any float in double, with halves rounded to even like the vector paths do.
+	for (size_t k = 0; k < count; ++k)
+		values[k] = static_cast<float>(std::remainder(static_cast<double>(values[k]), 360.0));
+}
+
+static void offset_floats_scalar(float* values, size_t count, float offset)
+{
+	for (size_t k = 0; k < count; ++k)
+		values[k] += offset;
+}
+
+// Folds the vector lanes, then the values the vectors didn't cover.
+static void finish_floats(const float* lanes, size_t laneCount, const double* sums, size_t sumCount,
+	const float* values, size_t i, size_t count, float& min, float& max, double& sum)
+{
+	min = *std::min_element(lanes, lanes + laneCount);
+	max = *std::max_element(lanes + laneCount, lanes + 2 * laneCount);
+	sum = 0;
+	for (size_t s = 0; s < sumCount; ++s)
+		sum += sums[s];
+
+	for (; i < count; ++i) {
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+		sum += values[i];
+	}
+}
+
+static void finish_bytes(const uint8_t* lanes, size_t laneCount, const uint64_t* sums, size_t sumCount,
+	const uint8_t* values, size_t i, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	min = *std::min_element(lanes, lanes + laneCount);
+	max = *std::max_element(lanes + laneCount, lanes + 2 * laneCount);
+	sum = 0;
+	for (size_t s = 0; s < sumCount; ++s)
+		sum += static_cast<long long>(sums[s]);
+
+	for (; i < count; ++i) {
+		min = std::min(min, values[i]);
+		max = std::max(max, values[i]);
+		sum += values[i];
+	}
+}
+
+#ifdef HLDEMO_X86
+static unsigned count_trailing_zeros(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+HLDEMO_TARGET("sse2")
+static size_t find_frame_type_byte_sse2(const char* data, size_t i, size_t size)
+{
+	const auto maxType = _mm_set1_epi8(static_cast<char>(MAX_FRAME_TYPE));
+	for (; i + 16 <= size; i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		// Unsigned v <= maxType exactly when min(v, maxType) == v.
+		auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, maxType), v)));
+		if (mask)
+			return i + count_trailing_zeros(mask);
+	}
+
+	return find_frame_type_byte_scalar(data, i, size);
+}
+
+HLDEMO_TARGET("sse2")
+static void reduce_floats_sse2(const float* values, size_t count, float& min, float& max, double& sum)
+{
+	auto vmin = _mm_set1_ps(values[0]), vmax = vmin;
+	auto sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		auto v = _mm_loadu_ps(values + i);
+		vmin = _mm_min_ps(vmin, v);
+		vmax = _mm_max_ps(vmax, v);
+		sum0 = _mm_add_pd(sum0, _mm_cvtps_pd(v));
+		sum1 = _mm_add_pd(sum1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+	}
+
+	float lanes[8];
+	double sums[4];
+	_mm_storeu_ps(lanes, vmin);
+	_mm_storeu_ps(lanes + 4, vmax);
+	_mm_storeu_pd(sums, sum0);
+	_mm_storeu_pd(sums + 2, sum1);
+	finish_floats(lanes, 4, sums, 4, values, i, count, min, max, sum);
+}
+
+HLDEMO_TARGET("sse2")
+static void reduce_bytes_sse2(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	auto vmin = _mm_set1_epi8(static_cast<char>(values[0])), vmax = vmin;
+	auto vsum = _mm_setzero_si128();
+	const auto zero = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+		vmin = _mm_min_epu8(vmin, v);
+		vmax = _mm_max_epu8(vmax, v);
+		// Sums each half of the bytes into a 64-bit lane.
+		vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+	}
+
+	uint8_t lanes[32];
+	uint64_t sums[2];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), vmin);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 16), vmax);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(sums), vsum);
+	finish_bytes(lanes, 16, sums, 2, values, i, count, min, max, sum);
+}
+
+HLDEMO_TARGET("sse2")
+static void interpolate_delta_sse2(const float* values, const uint32_t* index, const float* weight,
+	const float* base, size_t count, float* out)
+{
+	// There are no gathers before AVX2, the loads stay scalar.
+	size_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		auto v0 = _mm_setr_ps(values[index[k]], values[index[k + 1]], values[index[k + 2]], values[index[k + 3]]);
+		auto v1 = _mm_setr_ps(values[index[k] + 1], values[index[k + 1] + 1], values[index[k + 2] + 1], values[index[k + 3] + 1]);
+		auto v = _mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), _mm_loadu_ps(weight + k)));
+		_mm_storeu_ps(out + k, _mm_sub_ps(_mm_loadu_ps(base + k), v));
+	}
+
+	interpolate_delta_scalar(values, index + k, weight + k, base + k, count - k, out + k);
+}
+
+HLDEMO_TARGET("sse2")
+static void vector_lengths_sse2(const float* x, const float* y, const float* z, size_t count, float* out)
+{
+	size_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		auto vx = _mm_loadu_ps(x + k), vy = _mm_loadu_ps(y + k), vz = _mm_loadu_ps(z + k);
+		auto sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		_mm_storeu_ps(out + k, _mm_sqrt_ps(sq));
+	}
+
+	vector_lengths_scalar(x + k, y + k, z + k, count - k, out + k);
+}
+
+HLDEMO_TARGET("sse2")
+static __m128d wrap_degrees_sse2(__m128d v)
+{
+	// The conversion rounds to nearest even with the default rounding mode.
+	const auto turn = _mm_set1_pd(360.0);
+	return _mm_sub_pd(v, _mm_mul_pd(turn, _mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_div_pd(v, turn)))));
+}
+
+HLDEMO_TARGET("sse2")
+static void wrap_degrees_sse2(float* values, size_t count)
+{
+	const auto limit = _mm_set1_ps(WRAP_VECTOR_LIMIT);
+	const auto magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	size_t k = 0;
+	for (; k + 4 <= count; k += 4) {
+		auto v = _mm_loadu_ps(values + k);
+		// NaNs compare false too.
+		if (_mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(v, magnitude), limit)) != 0xF) {
+			wrap_degrees_scalar(values + k, 4);
+			continue;
+		}
+
+		auto lo = wrap_degrees_sse2(_mm_cvtps_pd(v));
+		auto hi = wrap_degrees_sse2(_mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		_mm_storeu_ps(values + k, _mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+	}
+
+	wrap_degrees_scalar(values + k, count - k);
+}
+
+HLDEMO_TARGET("sse2")
+static void offset_floats_sse2(float* values, size_t count, float offset)
+{
+	const auto o = _mm_set1_ps(offset);
+	size_t k = 0;
+	for (; k + 4 <= count; k += 4)
+		_mm_storeu_ps(values + k, _mm_add_ps(_mm_loadu_ps(values + k), o));
+
+	offset_floats_scalar(values + k, count - k, offset);
+}
+
+HLDEMO_TARGET("avx2")
+static size_t find_frame_type_byte_avx2(const char* data, size_t i, size_t size)
+{
+	const auto maxType = _mm256_set1_epi8(static_cast<char>(MAX_FRAME_TYPE));
+	for (; i + 32 <= size; i += 32) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, maxType), v)));
+		if (mask)
+			return i + count_trailing_zeros(mask);
+	}
+
+	return find_frame_type_byte_sse2(data, i, size);
+}
+
+HLDEMO_TARGET("avx2")
+static void reduce_floats_avx2(const float* values, size_t count, float& min, float& max, double& sum)
+{
+	auto vmin = _mm256_set1_ps(values[0]), vmax = vmin;
+	auto sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		auto v = _mm256_loadu_ps(values + i);
+		vmin = _mm256_min_ps(vmin, v);
+		vmax = _mm256_max_ps(vmax, v);
+		sum0 = _mm256_add_pd(sum0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+		sum1 = _mm256_add_pd(sum1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+	}
+
+	float lanes[16];
+	double sums[8];
+	_mm256_storeu_ps(lanes, vmin);
+	_mm256_storeu_ps(lanes + 8, vmax);
+	_mm256_storeu_pd(sums, sum0);
+	_mm256_storeu_pd(sums + 4, sum1);
+	finish_floats(lanes, 8, sums, 8, values, i, count, min, max, sum);
+}
+
+HLDEMO_TARGET("avx2")
+static void reduce_bytes_avx2(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	auto vmin = _mm256_set1_epi8(static_cast<char>(values[0])), vmax = vmin;
+	auto vsum = _mm256_setzero_si256();
+	const auto zero = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+		vmin = _mm256_min_epu8(vmin, v);
+		vmax = _mm256_max_epu8(vmax, v);
+		vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(v, zero));
+	}
+
+	uint8_t lanes[64];
+	uint64_t sums[4];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), vmin);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes + 32), vmax);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), vsum);
+	finish_bytes(lanes, 32, sums, 4, values, i, count, min, max, sum);
+}
+
+HLDEMO_TARGET("avx2")
+static void interpolate_delta_avx2(const float* values, const uint32_t* index, const float* weight,
+	const float* base, size_t count, float* out)
+{
+	size_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		auto i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + k));
+		auto v0 = _mm256_i32gather_ps(values, i, 4);
+		auto v1 = _mm256_i32gather_ps(values + 1, i, 4);
+		auto v = _mm256_add_ps(v0, _mm256_mul_ps(_mm256_sub_ps(v1, v0), _mm256_loadu_ps(weight + k)));
+		_mm256_storeu_ps(out + k, _mm256_sub_ps(_mm256_loadu_ps(base + k), v));
+	}
+
+	interpolate_delta_sse2(values, index + k, weight + k, base + k, count - k, out + k);
+}
+
+HLDEMO_TARGET("avx2")
+static void vector_lengths_avx2(const float* x, const float* y, const float* z, size_t count, float* out)
+{
+	size_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		auto vx = _mm256_loadu_ps(x + k), vy = _mm256_loadu_ps(y + k), vz = _mm256_loadu_ps(z + k);
+		auto sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+		_mm256_storeu_ps(out + k, _mm256_sqrt_ps(sq));
+	}
+
+	vector_lengths_sse2(x + k, y + k, z + k, count - k, out + k);
+}
+
+HLDEMO_TARGET("avx2")
+static __m128 wrap_degrees_avx2(__m128 v)
+{
+	const auto turn = _mm256_set1_pd(360.0);
+	auto d = _mm256_cvtps_pd(v);
+	auto turns = _mm256_round_pd(_mm256_div_pd(d, turn), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	return _mm256_cvtpd_ps(_mm256_sub_pd(d, _mm256_mul_pd(turn, turns)));
+}
+
+HLDEMO_TARGET("avx2")
+static void wrap_degrees_avx2(float* values, size_t count)
+{
+	const auto limit = _mm256_set1_ps(WRAP_VECTOR_LIMIT);
+	const auto magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	size_t k = 0;
+	for (; k + 8 <= count; k += 8) {
+		auto v = _mm256_loadu_ps(values + k);
+		if (_mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(v, magnitude), limit, _CMP_LT_OQ)) != 0xFF) {
+			wrap_degrees_scalar(values + k, 8);
+			continue;
+		}
+
+		auto lo = wrap_degrees_avx2(_mm256_castps256_ps128(v));
+		auto hi = wrap_degrees_avx2(_mm256_extractf128_ps(v, 1));
+		_mm256_storeu_ps(values + k, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+	}
+
+	wrap_degrees_sse2(values + k, count - k);
+}
+
+HLDEMO_TARGET("avx2")
+static void offset_floats_avx2(float* values, size_t count, float offset)
+{
+	const auto o = _mm256_set1_ps(offset);
+	size_t k = 0;
+	for (; k + 8 <= count; k += 8)
+		_mm256_storeu_ps(values + k, _mm256_add_ps(_mm256_loadu_ps(values + k), o));
+
+	offset_floats_sse2(values + k, count - k, offset);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+// The AVX-512 intrinsics leave their unused pass-through operand undefined on purpose.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+HLDEMO_TARGET("avx512f,avx512bw")
+static size_t find_frame_type_byte_avx512(const char* data, size_t i, size_t size)
+{
+	const auto maxType = _mm512_set1_epi8(static_cast<char>(MAX_FRAME_TYPE));
+	for (; i + 64 <= size; i += 64) {
+		auto v = _mm512_loadu_si512(data + i);
+		auto mask = static_cast<uint64_t>(_mm512_cmple_epu8_mask(v, maxType));
+		if (mask)
+			return i + count_trailing_zeros(mask);
+	}
+
+	return find_frame_type_byte_avx2(data, i, size);
+}
+
+HLDEMO_TARGET("avx512f,avx512bw")
+static void reduce_floats_avx512(const float* values, size_t count, float& min, float& max, double& sum)
+{
+	auto vmin = _mm512_set1_ps(values[0]), vmax = vmin;
+	auto sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		auto v = _mm512_loadu_ps(values + i);
+		vmin = _mm512_min_ps(vmin, v);
+		vmax = _mm512_max_ps(vmax, v);
+		sum0 = _mm512_add_pd(sum0, _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+		sum1 = _mm512_add_pd(sum1, _mm512_cvtps_pd(_mm256_castsi256_ps(_mm512_extracti64x4_epi64(_mm512_castps_si512(v), 1))));
+	}
+
+	float lanes[32];
+	double sums[16];
+	_mm512_storeu_ps(lanes, vmin);
+	_mm512_storeu_ps(lanes + 16, vmax);
+	_mm512_storeu_pd(sums, sum0);
+	_mm512_storeu_pd(sums + 8, sum1);
+	finish_floats(lanes, 16, sums, 16, values, i, count, min, max, sum);
+}
+
+HLDEMO_TARGET("avx512f,avx512bw")
+static void reduce_bytes_avx512(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	auto vmin = _mm512_set1_epi8(static_cast<char>(values[0])), vmax = vmin;
+	auto vsum = _mm512_setzero_si512();
+	const auto zero = _mm512_setzero_si512();
+
+	size_t i = 0;
+	for (; i + 64 <= count; i += 64) {
+		auto v = _mm512_loadu_si512(values + i);
+		vmin = _mm512_min_epu8(vmin, v);
+		vmax = _mm512_max_epu8(vmax, v);
+		vsum = _mm512_add_epi64(vsum, _mm512_sad_epu8(v, zero));
+	}
+
+	uint8_t lanes[128];
+	uint64_t sums[8];
+	_mm512_storeu_si512(lanes, vmin);
+	_mm512_storeu_si512(lanes + 64, vmax);
+	_mm512_storeu_si512(sums, vsum);
+	finish_bytes(lanes, 64, sums, 8, values, i, count, min, max, sum);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static DemoKernelPath detect_kernel_path()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	auto maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	// The OS has to save the vector registers on context switches.
+	auto xcr0 = osxsave ? _xgetbv(0) : 0;
+
+	bool avx2 = false, avx512 = false;
+	if (maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+	}
+
+	if (avx512 && (xcr0 & 0xE6) == 0xE6)
+		return DemoKernelPath::AVX512;
+	if (avx2 && avx && (xcr0 & 0x6) == 0x6)
+		return DemoKernelPath::AVX2;
+	return DemoKernelPath::SSE2;
+#else
+	// These check the OS support too.
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return DemoKernelPath::AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return DemoKernelPath::AVX2;
+	return DemoKernelPath::SSE2;
+#endif
+}
+#else
+static DemoKernelPath detect_kernel_path()
+{
+	return DemoKernelPath::SCALAR;
+}
+#endif
+
+struct Kernels {
+	DemoKernelPath path;
+	size_t (*findFrameTypeByte)(const char* data, size_t from, size_t size);
+	void (*reduceFloats)(const float* values, size_t count, float& min, float& max, double& sum);
+	void (*reduceBytes)(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum);
+	void (*interpolateDelta)(const float* values, const uint32_t* index, const float* weight,
+		const float* base, size_t count, float* out);
+	void (*vectorLengths)(const float* x, const float* y, const float* z, size_t count, float* out);
+	void (*wrapDegrees)(float* values, size_t count);
+	void (*offsetFloats)(float* values, size_t count, float offset);
+};
+
+// The path must be one the CPU supports.
+static Kernels kernels_for(DemoKernelPath path)
+{
+	switch (path) {
+#ifdef HLDEMO_X86
+	// The trajectory and angle kernels are bound by memory, AVX-512 ones wouldn't gain anything.
+	case DemoKernelPath::AVX512:
+		return Kernels{ path, find_frame_type_byte_avx512, reduce_floats_avx512, reduce_bytes_avx512,
+			interpolate_delta_avx2, vector_lengths_avx2, wrap_degrees_avx2, offset_floats_avx2 };
+	case DemoKernelPath::AVX2:
+		return Kernels{ path, find_frame_type_byte_avx2, reduce_floats_avx2, reduce_bytes_avx2,
+			interpolate_delta_avx2, vector_lengths_avx2, wrap_degrees_avx2, offset_floats_avx2 };
+	case DemoKernelPath::SSE2:
+		return Kernels{ path, find_frame_type_byte_sse2, reduce_floats_sse2, reduce_bytes_sse2,
+			interpolate_delta_sse2, vector_lengths_sse2, wrap_degrees_sse2, offset_floats_sse2 };
+#endif
+	default:
+		return Kernels{ DemoKernelPath::SCALAR, find_frame_type_byte_scalar, reduce_floats_scalar, reduce_bytes_scalar,
+			interpolate_delta_scalar, vector_lengths_scalar, wrap_degrees_scalar, offset_floats_scalar };
+	}
+}
+
+static Kernels select_kernels()
+{
+	auto path = detect_kernel_path();
+
+	if (auto limit = std::getenv("HLDEMO_KERNELS")) {
+		for (auto p : { DemoKernelPath::SCALAR, DemoKernelPath::SSE2, DemoKernelPath::AVX2, DemoKernelPath::AVX512 }) {
+			// Lower case without the dash, like avx512.
+			std::string name;
+			for (auto c : std::string(KernelPathName(p))) {
+				if (c != '-')
+					name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			}
+			if (name == limit && p < path)
+				path = p;
+		}
+	}
+
+	return kernels_for(path);
+}
+
+static const Kernels& kernels()
+{
+	static const Kernels k = select_kernels();
+	return k;
+}
+
+DemoKernelPath ActiveKernelPath()
+{
+	return kernels().path;
+}
+
+const char* KernelPathName(DemoKernelPath path)
+{
+	switch (path) {
+	case DemoKernelPath::SCALAR:
+		return "Scalar";
+	case DemoKernelPath::SSE2:
+		return "SSE2";
+	case DemoKernelPath::AVX2:
+		return "AVX2";
+	case DemoKernelPath::AVX512:
+		return "AVX-512";
+	}
+
+	return "Unknown";
+}
+
+size_t FindFrameTypeByte(const char* data, size_t from, size_t size)
+{
+	return kernels().findFrameTypeByte(data, from, size);
+}
+
+void ReduceFloats(const float* values, size_t count, float& min, float& max, double& sum)
+{
+	kernels().reduceFloats(values, count, min, max, sum);
+}
+
+void ReduceBytes(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum)
+{
+	kernels().reduceBytes(values, count, min, max, sum);
+}
+
+void InterpolateDelta(const float* values, const uint32_t* index, const float* weight,
+	const float* base, size_t count, float* out)
+{
+	kernels().interpolateDelta(values, index, weight, base, count, out);
+}
+
+void VectorLengths(const float* x, const float* y, const float* z, size_t count, float* out)
+{
+	kernels().vectorLengths(x, y, z, count, out);
+}
+
+void WrapDegrees(float* values, size_t count)
+{
+	kernels().wrapDegrees(values, count);
+}
+
+void OffsetFloats(float* values, size_t count, float offset)
+{
+	kernels().offsetFloats(values, count, offset);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Hot loops with versions for several instruction sets. The best one the
+ * CPU supports is picked on first use, so the library doesn't need to be
+ * built with -march=native to use them. These are the loops over arrays
+ * of values: the frame type scan in recovery mode, the frame statistics,
+ * the trajectory comparison and the angle transforms. Frames themselves
+ * are decoded one at a time.
+ */
+enum class DemoKernelPath {
+	SCALAR,
+	SSE2,
+	AVX2,
+	AVX512
+};
+
+/*
+ * The path in use. Setting the HLDEMO_KERNELS environment variable to
+ * scalar, sse2, avx2 or avx512 forces that path, or the best one the CPU
+ * supports if it doesn't support that one, for comparing the paths.
+ */
+DemoKernelPath ActiveKernelPath();
+const char* KernelPathName(DemoKernelPath path);
+
+// Returns the position of the first byte in [from, size) that is a valid frame type, or size.
+size_t FindFrameTypeByte(const char* data, size_t from, size_t size);
+
+// Computes the min, max and sum of the values. count must be positive.
+void ReduceFloats(const float* values, size_t count, float& min, float& max, double& sum);
+void ReduceBytes(const uint8_t* values, size_t count, uint8_t& min, uint8_t& max, long long& sum);
+
+/*
+ * out[k] = base[k] - lerp(values[index[k]], values[index[k] + 1], weight[k]),
+ * the difference to a series resampled at the given points.
+ */
+void InterpolateDelta(const float* values, const uint32_t* index, const float* weight,
+	const float* base, size_t count, float* out);
+// out[k] = |(x[k], y[k], z[k])|.
+void VectorLengths(const float* x, const float* y, const float* z, size_t count, float* out);
+/*
+ * Wraps the angles in degrees into [-180, 180] in place, like
+ * std::remainder(value, 360) in double. Infinities become NaNs.
+ */
+void WrapDegrees(float* values, size_t count);
+// Adds the offset to the values in place.
+void OffsetFloats(float* values, size_t count, float offset);
+
+// Whether the value is neither infinite nor NaN. Checks the bits, as -Ofast lets std::isfinite assume it always is.
+inline bool IsFiniteFloat(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x7F800000) != 0x7F800000;
+}
@@ -0,0 +1,141 @@
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+
+// A shared_ptr constructed from a raw pointer allocates a separate control block
+// holding a vtable pointer, the two reference counts and the pointer itself.
+static const size_t SHARED_PTR_CONTROL_BLOCK_SIZE = 2 * sizeof(void*) + 2 * sizeof(int);
+
+static void add(DemoMemoryTally& tally, size_t bytes)
+{
+	if (bytes) {
+		tally.bytes += bytes;
+		tally.allocations++;
+	}
+}
+
+static void add(DemoMemoryTally& tally, const std::string& str)
+{
+	// Strings that fit into the small string buffer have the same capacity as an empty one.
+	if (str.capacity() > std::string().capacity())
+		add(tally, str.capacity() + 1);
+}
+
+template<typename T>
+static void add(DemoMemoryTally& tally, const std::vector<T>& vec)
+{
+	add(tally, vec.capacity() * sizeof(T));
+}
+
+static void add(DemoMemoryTally& tally, const DemoMemoryTally& other)
+{
+	tally.frames += other.frames;
+	tally.bytes += other.bytes;
+	tally.allocations += other.allocations;
+}
+
+// Shared data counts towards the first frame that refers to it.
+static bool first_use(std::unordered_set<const void*>& seen, const void* shared)
+{
+	return shared && seen.insert(shared).second;
+}
+
+static void add_shared(DemoMemoryTally& tally, std::unordered_set<const void*>& seen, const DemoString& str)
+{
+	if (first_use(seen, &str.str())) {
+		// make_shared puts the control block and the string together.
+		add(tally, SHARED_PTR_CONTROL_BLOCK_SIZE + sizeof(std::string));
+		add(tally, str.str());
+	}
+}
+
+static DemoMemoryTally frame_usage(const DemoFrame& frame, std::unordered_set<const void*>& seen)
+{
+	DemoMemoryTally tally = { 1, 0, 0 };
+	add(tally, SHARED_PTR_CONTROL_BLOCK_SIZE);
+
+	switch (frame.type) {
+	case DemoFrameType::DEMO_START:
+	case DemoFrameType::NEXT_SECTION:
+		add(tally, sizeof(DemoFrame));
+		break;
+
+	case DemoFrameType::CONSOLE_COMMAND:
+		add(tally, sizeof(ConsoleCommandFrame));
+		add_shared(tally, seen, static_cast<const ConsoleCommandFrame&>(frame).command);
+		break;
+
+	case DemoFrameType::CLIENT_DATA:
+		add(tally, sizeof(ClientDataFrame));
+		break;
+
+	case DemoFrameType::EVENT:
+		add(tally, sizeof(EventFrame));
+		break;
+
+	case DemoFrameType::WEAPON_ANIM:
+		add(tally, sizeof(WeaponAnimFrame));
+		break;
+
+	case DemoFrameType::SOUND:
+		add(tally, sizeof(SoundFrame));
+		add(tally, static_cast<const SoundFrame&>(frame).sample);
+		break;
+
+	case DemoFrameType::DEMO_BUFFER:
+		add(tally, sizeof(DemoBufferFrame));
+		add(tally, static_cast<const DemoBufferFrame&>(frame).buffer);
+		break;
+
+	default:
+	{
+		const auto& f = static_cast<const NetMsgFrame&>(frame);
+		add(tally, sizeof(NetMsgFrame));
+		if (first_use(seen, f.DemoInfo.MoveVars.get())) {
+			add(tally, SHARED_PTR_CONTROL_BLOCK_SIZE + sizeof(DemoMoveVars));
+			add_shared(tally, seen, f.DemoInfo.MoveVars->skyName);
+		}
+		add(tally, f.msg);
+	}
+		break;
+	}
+
+	return tally;
+}
+
+DemoMemoryUsage DemoFile::MemoryUsage() const
+{
+	DemoMemoryUsage usage;
+	std::memset(usage.frameTypes, 0, sizeof(usage.frameTypes));
+	usage.total = DemoMemoryTally{ 0, 0, 0 };
+
+	add(usage.total, header.mapName);
+	add(usage.total, header.gameDir);
+	add(usage.total, directoryEntries);
+
+	std::unordered_set<const void*> seen;
+
+	for (const auto& entry : directoryEntries) {
+		DemoMemoryTally tally = { 0, 0, 0 };
+		add(tally, entry.description);
+		add(tally, entry.frames);
+
+		for (const auto& frame : entry.frames) {
+			auto f = frame_usage(*frame, seen);
+			add(usage.frameTypes[static_cast<uint8_t>(frame->type)], f);
+			add(tally, f);
+		}
+
+		usage.entries.push_back(tally);
+		add(usage.total, tally);
+	}
+
+	add(usage.total, skippedRanges);
+
+	return usage;
+}
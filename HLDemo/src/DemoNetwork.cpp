@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoNetwork.hpp"
+
+// Sequences jumping further than that were reset rather than lost packets.
+static const int64_t MAX_SEQUENCE_JUMP = 10000;
+
+DemoNetworkProfile::DemoNetworkProfile()
+	: frames(0)
+	, bytes(0)
+	, duration(0)
+	, minSize(UINT32_MAX)
+	, maxSize(0)
+	, sizeHistogram()
+	, windows(0)
+	, peakRate(0)
+	, peakEntry(0)
+	, peakTime(0)
+	, incomingPackets(0)
+	, incomingGaps(0)
+	, incomingLost(0)
+	, outgoingPackets(0)
+	, outgoingGaps(0)
+	, outgoingLost(0)
+	, sequenceResets(0)
+	, unackedSum(0)
+	, unackedMax(0)
+	, reliableMessages(0)
+	, reliableStalls(0)
+	, stallTime(0)
+	, longestStall(0)
+{
+}
+
+void DemoNetworkProfile::Merge(const DemoNetworkProfile& other)
+{
+	frames += other.frames;
+	bytes += other.bytes;
+	duration += other.duration;
+	minSize = std::min(minSize, other.minSize);
+	maxSize = std::max(maxSize, other.maxSize);
+	for (size_t b = 0; b < NETWORK_SIZE_BUCKETS; ++b)
+		sizeHistogram[b] += other.sizeHistogram[b];
+
+	windows += other.windows;
+	if (other.peakRate > peakRate) {
+		peakRate = other.peakRate;
+		peakEntry = other.peakEntry;
+		peakTime = other.peakTime;
+	}
+
+	incomingPackets += other.incomingPackets;
+	incomingGaps += other.incomingGaps;
+	incomingLost += other.incomingLost;
+	outgoingPackets += other.outgoingPackets;
+	outgoingGaps += other.outgoingGaps;
+	outgoingLost += other.outgoingLost;
+	sequenceResets += other.sequenceResets;
+
+	unackedSum += other.unackedSum;
+	unackedMax = std::max(unackedMax, other.unackedMax);
+
+	reliableMessages += other.reliableMessages;
+	reliableStalls += other.reliableStalls;
+	stallTime += other.stallTime;
+	longestStall = std::max(longestStall, other.longestStall);
+}
+
+double DemoNetworkProfile::BytesPerSecond() const
+{
+	return duration > 0 ? bytes / duration : 0;
+}
+
+double DemoNetworkProfile::LossRate() const
+{
+	auto expected = incomingPackets + incomingLost;
+	return expected ? static_cast<double>(incomingLost) / expected : 0;
+}
+
+static size_t size_bucket(uint32_t size)
+{
+	size_t bucket = 0;
+	while (size) {
+		size >>= 1;
+		bucket++;
+	}
+	return std::min<size_t>(bucket, NETWORK_SIZE_BUCKETS - 1);
+}
+
+NetworkProfileStage::NetworkProfileStage(float windowLength, float stallThreshold)
+	: windowLength(windowLength > 0 ? windowLength : 1)
+	, stallThreshold(stallThreshold)
+	, entries(nullptr)
+	, currentEntry(nullptr)
+{
+	ResetEntry();
+}
+
+void NetworkProfileStage::Begin(DemoFile& demo)
+{
+	entries = demo.directoryEntries.data();
+	currentEntry = nullptr;
+	profile = DemoNetworkProfile();
+	ResetEntry();
+}
+
+void NetworkProfileStage::ResetEntry()
+{
+	window.entry = currentEntry ? static_cast<size_t>(currentEntry - entries) : 0;
+	window.start = 0;
+	window.frames = 0;
+	window.bytes = 0;
+	window.lost = 0;
+
+	havePrevious = false;
+	previousTime = 0;
+	previousIncoming = previousOutgoing = previousReliable = 0;
+	outstanding = false;
+	outstandingSince = lastTime = 0;
+}
+
+void NetworkProfileStage::CloseWindow()
+{
+	if (window.frames == 0)
+		return;
+
+	profile.windows++;
+	auto rate = window.bytes / static_cast<double>(windowLength);
+	if (rate > profile.peakRate) {
+		profile.peakRate = rate;
+		profile.peakEntry = window.entry;
+		profile.peakTime = window.start;
+	}
+	if (onWindow)
+		onWindow(window);
+
+	window.frames = 0;
+	window.bytes = 0;
+	window.lost = 0;
+}
+
+void NetworkProfileStage::CloseStall(float time)
+{
+	if (!outstanding)
+		return;
+
+	outstanding = false;
+	auto length = static_cast<double>(time) - outstandingSince;
+	if (length > stallThreshold) {
+		profile.reliableStalls++;
+		profile.stallTime += length;
+		profile.longestStall = std::max(profile.longestStall, length);
+	}
+}
+
+void NetworkProfileStage::ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame)
+{
+	if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+		return;
+
+	if (&entry != currentEntry) {
+		CloseWindow();
+		CloseStall(lastTime);
+		currentEntry = &entry;
+		ResetEntry();
+	}
+
+	const auto& f = static_cast<const NetMsgFrame&>(frame);
+	auto time = frame.time;
+	auto size = static_cast<uint32_t>(f.msg.size());
+
+	profile.frames++;
+	profile.bytes += size;
+	profile.minSize = std::min(profile.minSize, size);
+	profile.maxSize = std::max(profile.maxSize, size);
+	profile.sizeHistogram[size_bucket(size)]++;
+
+	// Windows are aligned to the first frame of the entry, time going backwards starts them over.
+	if (!havePrevious) {
+		window.start = time;
+	} else if (!(time >= window.start && time < window.start + windowLength)) {
+		auto start = time >= window.start
+			? window.start + windowLength * std::floor((time - window.start) / windowLength)
+			: time;
+		CloseWindow();
+		window.start = start;
+	}
+	window.frames++;
+	window.bytes += size;
+
+	if (havePrevious) {
+		if (time > previousTime)
+			profile.duration += time - previousTime;
+
+		auto incoming = static_cast<int64_t>(f.incoming_sequence) - previousIncoming;
+		auto outgoing = static_cast<int64_t>(f.outgoing_sequence) - previousOutgoing;
+		if (incoming < 0 || outgoing < 0 || incoming > MAX_SEQUENCE_JUMP || outgoing > MAX_SEQUENCE_JUMP) {
+			profile.sequenceResets++;
+		} else {
+			if (incoming > 0)
+				profile.incomingPackets++;
+			if (incoming > 1) {
+				profile.incomingGaps++;
+				profile.incomingLost += incoming - 1;
+				window.lost += incoming - 1;
+			}
+
+			if (outgoing > 0)
+				profile.outgoingPackets++;
+			if (outgoing > 1) {
+				profile.outgoingGaps++;
+				profile.outgoingLost += outgoing - 1;
+			}
+		}
+
+		if (f.reliable_sequence != previousReliable)
+			profile.reliableMessages++;
+	}
+
+	auto unacked = static_cast<int64_t>(f.outgoing_sequence) - f.incoming_acknowledged;
+	if (unacked >= 0 && unacked <= MAX_SEQUENCE_JUMP) {
+		profile.unackedSum += unacked;
+		profile.unackedMax = std::max(profile.unackedMax, static_cast<uint32_t>(unacked));
+	}
+
+	auto waiting = f.incoming_reliable_acknowledged != f.reliable_sequence;
+	if (waiting && !outstanding) {
+		outstanding = true;
+		outstandingSince = time;
+	} else if (!waiting) {
+		CloseStall(time);
+	}
+
+	havePrevious = true;
+	previousTime = time;
+	previousIncoming = f.incoming_sequence;
+	previousOutgoing = f.outgoing_sequence;
+	previousReliable = f.reliable_sequence;
+	lastTime = time;
+}
+
+void NetworkProfileStage::End(DemoFile&)
+{
+	CloseWindow();
+	CloseStall(lastTime);
+}
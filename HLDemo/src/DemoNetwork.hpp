@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPipeline.hpp"
+
+enum {
+	// Bucket 0 counts the empty messages, bucket b the sizes in [2^(b-1), 2^b).
+	NETWORK_SIZE_BUCKETS = 18
+};
+
+// The traffic of one time window of an entry.
+struct DemoNetworkWindow {
+	// Index into DemoFile::directoryEntries.
+	size_t entry;
+	float start;
+	size_t frames;
+	uint64_t bytes;
+	// Incoming packets that never showed up.
+	uint64_t lost;
+};
+
+/*
+ * What the netmsg frames tell about the connection: how much the server
+ * sent, how big the messages were, which packets got lost on the way
+ * and how long reliable messages waited for their acknowledgement.
+ */
+struct DemoNetworkProfile {
+	size_t frames;
+	// Of the messages.
+	uint64_t bytes;
+	// Seconds covered by the frames.
+	double duration;
+	uint32_t minSize, maxSize;
+	uint64_t sizeHistogram[NETWORK_SIZE_BUCKETS];
+
+	// The busiest window, in bytes per second.
+	size_t windows;
+	double peakRate;
+	size_t peakEntry;
+	float peakTime;
+
+	/*
+	 * incoming_sequence going up by more than one means that the packets
+	 * in between were lost, outgoing_sequence doing so means that the
+	 * client sent packets no frame was recorded for.
+	 */
+	uint64_t incomingPackets, incomingGaps, incomingLost;
+	uint64_t outgoingPackets, outgoingGaps, outgoingLost;
+	// Sequences going backwards, like on a reconnect.
+	uint64_t sequenceResets;
+
+	// Sent packets the server hasn't acknowledged yet: outgoing_sequence - incoming_acknowledged.
+	uint64_t unackedSum;
+	uint32_t unackedMax;
+
+	/*
+	 * A reliable message is outstanding while the server hasn't acknowledged
+	 * the current reliable_sequence. Outstanding longer than the threshold
+	 * counts as a stall.
+	 */
+	uint64_t reliableMessages;
+	uint64_t reliableStalls;
+	double stallTime, longestStall;
+
+	DemoNetworkProfile();
+
+	// Adds up the profiles of several demos.
+	void Merge(const DemoNetworkProfile& other);
+
+	double BytesPerSecond() const;
+	// The share of the incoming packets that got lost.
+	double LossRate() const;
+};
+
+/*
+ * Profiles the network traffic as the frames stream by, in constant memory.
+ * Meant to run with DemoFile::keepFrames cleared. The frames of every
+ * entry are split into windows of windowLength seconds.
+ */
+class NetworkProfileStage : public DemoStage
+{
+public:
+	NetworkProfileStage(float windowLength = 1, float stallThreshold = 0.5f);
+	void Begin(DemoFile& demo) override;
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+	void End(DemoFile& demo) override;
+
+	// Called with every window that has frames in it, in order.
+	std::function<void(const DemoNetworkWindow& window)> onWindow;
+
+	DemoNetworkProfile profile;
+
+protected:
+	float windowLength;
+	float stallThreshold;
+	const DemoDirectoryEntry* entries;
+	const DemoDirectoryEntry* currentEntry;
+
+	DemoNetworkWindow window;
+	bool havePrevious;
+	float previousTime;
+	int32_t previousIncoming, previousOutgoing, previousReliable;
+	bool outstanding;
+	float outstandingSince, lastTime;
+
+	void ResetEntry();
+	void CloseWindow();
+	void CloseStall(float time);
+};
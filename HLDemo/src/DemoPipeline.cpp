@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoKernels.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoWriter.hpp"
+
+void DemoPipeline::AddStage(std::shared_ptr<DemoStage> stage)
+{
+	stages.push_back(std::move(stage));
+}
+
+void DemoPipeline::Run(DemoFile& demo)
+{
+	for (const auto& stage : stages)
+		stage->Begin(demo);
+
+	demo.ReadFrames([this](DemoDirectoryEntry& entry, DemoFrame& frame) {
+		for (const auto& stage : stages)
+			stage->ProcessFrame(entry, frame);
+	});
+
+	for (const auto& stage : stages)
+		stage->End(demo);
+}
+
+void DemoPipeline::Run(DemoFile& demo, DemoWriter& writer)
+{
+	for (const auto& stage : stages)
+		stage->Begin(demo);
+
+	// Begins the entries before the given one, including those without frames.
+	size_t next = 0;
+	auto begin_entries = [&](size_t end) {
+		for (; next < end; ++next)
+			writer.BeginEntry(demo.directoryEntries[next]);
+	};
+
+	demo.ReadFrames([&](DemoDirectoryEntry& entry, DemoFrame& frame) {
+		for (const auto& stage : stages)
+			stage->ProcessFrame(entry, frame);
+
+		begin_entries(static_cast<size_t>(&entry - demo.directoryEntries.data()) + 1);
+		writer.WriteFrame(frame);
+	});
+
+	for (const auto& stage : stages)
+		stage->End(demo);
+
+	begin_entries(demo.directoryEntries.size());
+	writer.Close();
+}
+
+SanitizeStage::SanitizeStage()
+	: sanitizedSoundFrames(0)
+	, sanitizedDemoBufferFrames(0)
+{
+}
+
+void SanitizeStage::ProcessFrame(DemoDirectoryEntry&, DemoFrame& frame)
+{
+	if (frame.type == DemoFrameType::SOUND) {
+		auto& f = static_cast<SoundFrame&>(frame);
+		if (f.sample.size() > MAX_SOUND_SAMPLE_SIZE) {
+			f.sample.resize(MAX_SOUND_SAMPLE_SIZE);
+			f.MarkModified();
+			sanitizedSoundFrames++;
+		}
+	} else if (frame.type == DemoFrameType::DEMO_BUFFER) {
+		auto& f = static_cast<DemoBufferFrame&>(frame);
+		if (f.buffer.size() > MAX_DEMO_BUFFER_SIZE) {
+			f.buffer.resize(MAX_DEMO_BUFFER_SIZE);
+			f.MarkModified();
+			sanitizedDemoBufferFrames++;
+		}
+	}
+}
+
+FixYawStage::FixYawStage(float yaw)
+	: yaw(yaw)
+{
+}
+
+void FixYawStage::ProcessFrame(DemoDirectoryEntry&, DemoFrame& frame)
+{
+	if (static_cast<int>(frame.type) < 2 || static_cast<int>(frame.type) > 9) {
+		auto& f = static_cast<NetMsgFrame&>(frame);
+		f.DemoInfo.RefParams.viewangles[1] = yaw;
+		f.DemoInfo.RefParams.cl_viewangles[1] = yaw;
+		f.DemoInfo.UserCmd.viewangles[1] = yaw;
+		f.MarkModified();
+	}
+}
+
+FrameStatsStage::FrameStatsStage()
+	: count(0)
+	, frametimeMin(0)
+	, frametimeMax(0)
+	, frametimeSum(0.0)
+	, msecMin(0)
+	, msecMax(0)
+	, msecSum(0)
+{
+	frametimes.reserve(BATCH_SIZE);
+	msecs.reserve(BATCH_SIZE);
+}
+
+void FrameStatsStage::ProcessFrame(DemoDirectoryEntry&, DemoFrame& frame)
+{
+	if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+		return;
+
+	const auto& f = static_cast<const NetMsgFrame&>(frame);
+	frametimes.push_back(f.DemoInfo.RefParams.frametime);
+	msecs.push_back(f.DemoInfo.UserCmd.msec);
+	if (frametimes.size() == BATCH_SIZE)
+		Flush();
+}
+
+void FrameStatsStage::End(DemoFile&)
+{
+	Flush();
+}
+
+void FrameStatsStage::Flush()
+{
+	if (frametimes.empty())
+		return;
+
+	float ftMin, ftMax;
+	double ftSum;
+	ReduceFloats(frametimes.data(), frametimes.size(), ftMin, ftMax, ftSum);
+	uint8_t mMin, mMax;
+	long long mSum;
+	ReduceBytes(msecs.data(), msecs.size(), mMin, mMax, mSum);
+
+	if (count == 0) {
+		frametimeMin = ftMin;
+		frametimeMax = ftMax;
+		msecMin = mMin;
+		msecMax = mMax;
+	} else {
+		frametimeMin = std::min(frametimeMin, ftMin);
+		frametimeMax = std::max(frametimeMax, ftMax);
+		msecMin = std::min(msecMin, mMin);
+		msecMax = std::max(msecMax, mMax);
+	}
+
+	frametimeSum += ftSum;
+	msecSum += mSum;
+	count += frametimes.size();
+
+	frametimes.clear();
+	msecs.clear();
+}
+
+CommandScanStage::CommandScanStage(std::vector<std::string> commands)
+	: commands(std::move(commands))
+{
+}
+
+void CommandScanStage::ProcessFrame(DemoDirectoryEntry&, DemoFrame& frame)
+{
+	if (frame.type != DemoFrameType::CONSOLE_COMMAND)
+		return;
+
+	const auto& f = static_cast<const ConsoleCommandFrame&>(frame);
+	const auto& command = f.command.str();
+	if (std::find(commands.begin(), commands.end(), command) != commands.end()
+		&& std::find(found.begin(), found.end(), command) == found.end())
+		found.push_back(command);
+}
+
+std::vector<std::string> CommandScanStage::CameraCommands()
+{
+	return {
+		"+lookup",
+		"+lookdown",
+		"+left",
+		"+right"
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoWriter.hpp"
+
+/*
+ * A single step of a DemoPipeline. Every stage sees every frame
+ * in the demo order, right after the frame has been decoded.
+ * Transform stages modify the frame in place, analysis stages
+ * just accumulate their results.
+ */
+class DemoStage
+{
+public:
+	virtual ~DemoStage() = default;
+
+	// Called once before the first frame of the demo.
+	virtual void Begin(DemoFile&) {}
+	virtual void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) = 0;
+	// Called once after the last frame of the demo.
+	virtual void End(DemoFile&) {}
+};
+
+/*
+ * Runs a number of stages over the demo in a single pass:
+ * each frame is decoded once and goes through all stages
+ * before the next one is read.
+ */
+class DemoPipeline
+{
+public:
+	void AddStage(std::shared_ptr<DemoStage> stage);
+
+	// Only reads the demo through the stages, saving it is a separate pass.
+	void Run(DemoFile& demo);
+
+	/*
+	 * Also writes every frame to the writer as soon as the stages are done
+	 * with it, so reading, the stages and writing are one pass. With
+	 * keepFrames unset only the frame at hand is in memory. The writer gets
+	 * every entry of the demo, empty ones included, and is closed after the
+	 * stages have ended. The result is the file Save would write.
+	 */
+	void Run(DemoFile& demo, DemoWriter& writer);
+
+protected:
+	std::vector<std::shared_ptr<DemoStage>> stages;
+};
+
+// Truncates sound samples and demo buffers that would overflow the engine buffers.
+class SanitizeStage : public DemoStage
+{
+public:
+	// The engine has a 256 byte long buffer
+	// and additionally inserts a \0 in the end after reading into it.
+	static const size_t MAX_SOUND_SAMPLE_SIZE = 255;
+	// The engine has a 32768 byte long buffer.
+	static const size_t MAX_DEMO_BUFFER_SIZE = 32768;
+
+	SanitizeStage();
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+
+	size_t sanitizedSoundFrames;
+	size_t sanitizedDemoBufferFrames;
+};
+
+// Sets the view yaw to the given value.
+class FixYawStage : public DemoStage
+{
+public:
+	FixYawStage(float yaw);
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+
+protected:
+	float yaw;
+};
+
+// Frametime and msec statistics over all netmsg frames.
+class FrameStatsStage : public DemoStage
+{
+public:
+	FrameStatsStage();
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+	void End(DemoFile& demo) override;
+
+	// Valid once the pipeline has finished.
+	size_t count;
+	float frametimeMin, frametimeMax;
+	double frametimeSum;
+	uint8_t msecMin, msecMax;
+	long long msecSum;
+
+protected:
+	// The values are gathered into batches and reduced with the vector kernels.
+	static const size_t BATCH_SIZE = 1024;
+	std::vector<float> frametimes;
+	std::vector<uint8_t> msecs;
+
+	void Flush();
+};
+
+// Looks for console commands that exactly match any of the given ones.
+class CommandScanStage : public DemoStage
+{
+public:
+	CommandScanStage(std::vector<std::string> commands);
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+
+	// The commands that were found, in order of their first appearance.
+	std::vector<std::string> found;
+
+	// The camera movement commands Listdemo checks for.
+	static std::vector<std::string> CameraCommands();
+
+protected:
+	std::vector<std::string> commands;
+};
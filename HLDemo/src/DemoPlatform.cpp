@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "DemoFormat.hpp"
+#include "DemoPlatform.hpp"
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite) : data(nullptr), size(0), mapping(nullptr)
+{
+	auto file = CreateFileW(utf8_to_utf16(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		throw std::runtime_error("Error reading " + filename + ".");
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	if (size) {
+		mapping = CreateFileMappingW(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+			data = static_cast<const char*>(MapViewOfFile(mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+	}
+	CloseHandle(file);
+
+	if (size && !data) {
+		if (mapping)
+			CloseHandle(mapping);
+		throw std::runtime_error("Error mapping " + filename + ".");
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+}
+
+static bool handle_version(HANDLE file, FileVersion& version)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	if (!GetFileInformationByHandle(file, &info))
+		return false;
+
+	version.device = info.dwVolumeSerialNumber;
+	version.index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	version.size = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	// In 100 nanosecond units since 1601.
+	auto written = (static_cast<int64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+	version.modified = (written - 116444736000000000LL) * 100;
+	return true;
+}
+
+// Other programs can still write, rename or delete the file, Unchanged() tells if they did.
+PositionalFile::PositionalFile(const std::string& filename) : size(0), filename(filename)
+{
+	file = CreateFileW(utf8_to_utf16(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	if (!handle_version(file, version)) {
+		CloseHandle(file);
+		throw std::runtime_error("Error reading " + filename + ".");
+	}
+	size = version.size;
+}
+
+bool PositionalFile::Unchanged() const
+{
+	FileVersion now;
+	return handle_version(file, now) && now == version;
+}
+
+const FileVersion& PositionalFile::Version() const
+{
+	return version;
+}
+
+bool PositionalFile::IsFile(const std::string& other) const
+{
+	FileVersion v;
+	return file_version(other, v) && v.device == version.device && v.index == version.index;
+}
+
+bool file_version(const std::string& filename, FileVersion& version)
+{
+	auto handle = CreateFileW(utf8_to_utf16(filename).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	auto ok = handle_version(handle, version);
+	CloseHandle(handle);
+	return ok;
+}
+
+PositionalFile::~PositionalFile()
+{
+	CloseHandle(file);
+}
+
+size_t PositionalFile::ReadAt(uint64_t offset, void* dst, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		// The offset in an OVERLAPPED is used instead of the file position.
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset + done);
+		overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+
+		DWORD read;
+		auto chunk = static_cast<DWORD>(std::min<size_t>(size - done, 1u << 30));
+		if (!ReadFile(file, static_cast<char*>(dst) + done, chunk, &read, &overlapped)) {
+			if (GetLastError() == ERROR_HANDLE_EOF)
+				break;
+			throw std::runtime_error("Error reading " + filename + ".");
+		}
+		if (read == 0)
+			break;
+		done += read;
+	}
+
+	return done;
+}
+
+bool stat_file(const std::string& filename, uint64_t& size, int64_t& time)
+{
+	struct _stat64 st;
+	if (_wstat64(utf8_to_utf16(filename).c_str(), &st))
+		return false;
+
+	size = static_cast<uint64_t>(st.st_size);
+	time = static_cast<int64_t>(st.st_mtime);
+	return true;
+}
+
+bool same_file(const std::string& a, const std::string& b)
+{
+	BY_HANDLE_FILE_INFORMATION info[2];
+	const std::string* names[2] = { &a, &b };
+	for (size_t i = 0; i < 2; ++i) {
+		auto file = CreateFileW(utf8_to_utf16(*names[i]).c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		auto ok = GetFileInformationByHandle(file, &info[i]);
+		CloseHandle(file);
+		if (!ok)
+			return false;
+	}
+
+	return info[0].dwVolumeSerialNumber == info[1].dwVolumeSerialNumber
+		&& info[0].nFileIndexHigh == info[1].nFileIndexHigh
+		&& info[0].nFileIndexLow == info[1].nFileIndexLow;
+}
+
+std::string full_path(const std::string& filename)
+{
+	auto path = _wfullpath(nullptr, utf8_to_utf16(filename).c_str(), 0);
+	if (!path)
+		return filename;
+
+	auto result = utf16_to_utf8(path);
+	std::free(path);
+	return result;
+}
+
+std::vector<std::string> list_directory(const std::string& directory)
+{
+	std::vector<std::string> names;
+
+	WIN32_FIND_DATAW data;
+	auto find = FindFirstFileW(utf8_to_utf16(directory + "\\*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return names;
+
+	do {
+		names.push_back(utf16_to_utf8(data.cFileName));
+	} while (FindNextFileW(find, &data));
+	FindClose(find);
+
+	return names;
+}
+
+void make_directory(const std::string& directory)
+{
+	_wmkdir(utf8_to_utf16(directory).c_str());
+}
+
+void touch_file(const std::string& filename)
+{
+	_wutime(utf8_to_utf16(filename).c_str(), nullptr);
+}
+
+void remove_file(const std::string& filename)
+{
+	_wremove(utf8_to_utf16(filename).c_str());
+}
+
+bool replace_file(const std::string& from, const std::string& to)
+{
+	return MoveFileExW(utf8_to_utf16(from).c_str(), utf8_to_utf16(to).c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static unsigned long process_id()
+{
+	return GetCurrentProcessId();
+}
+#else
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite) : data(nullptr), size(0)
+{
+	auto fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw std::runtime_error("Error reading " + filename + ".");
+	}
+	size = static_cast<size_t>(st.st_size);
+
+	if (size) {
+		auto p = mmap(nullptr, size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Error mapping " + filename + ".");
+		}
+		data = static_cast<const char*>(p);
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data)
+		munmap(const_cast<char*>(data), size);
+}
+
+static FileVersion stat_version(const struct stat& st)
+{
+	FileVersion version;
+	version.device = static_cast<uint64_t>(st.st_dev);
+	version.index = static_cast<uint64_t>(st.st_ino);
+	version.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+	version.modified = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	version.modified = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return version;
+}
+
+PositionalFile::PositionalFile(const std::string& filename) : size(0), filename(filename)
+{
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw std::runtime_error("Error reading " + filename + ".");
+	}
+	version = stat_version(st);
+	size = version.size;
+}
+
+bool PositionalFile::Unchanged() const
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 && stat_version(st) == version;
+}
+
+const FileVersion& PositionalFile::Version() const
+{
+	return version;
+}
+
+bool PositionalFile::IsFile(const std::string& other) const
+{
+	FileVersion v;
+	return file_version(other, v) && v.device == version.device && v.index == version.index;
+}
+
+bool file_version(const std::string& filename, FileVersion& version)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st))
+		return false;
+
+	version = stat_version(st);
+	return true;
+}
+
+PositionalFile::~PositionalFile()
+{
+	close(fd);
+}
+
+size_t PositionalFile::ReadAt(uint64_t offset, void* dst, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		auto read = pread(fd, static_cast<char*>(dst) + done, size - done, static_cast<off_t>(offset + done));
+		if (read == -1) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("Error reading " + filename + ".");
+		}
+		if (read == 0)
+			break;
+		done += static_cast<size_t>(read);
+	}
+
+	return done;
+}
+
+bool stat_file(const std::string& filename, uint64_t& size, int64_t& time)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st))
+		return false;
+
+	size = static_cast<uint64_t>(st.st_size);
+	time = static_cast<int64_t>(st.st_mtime);
+	return true;
+}
+
+bool same_file(const std::string& a, const std::string& b)
+{
+	struct stat stA, stB;
+	if (stat(a.c_str(), &stA) || stat(b.c_str(), &stB))
+		return false;
+
+	return stA.st_dev == stB.st_dev && stA.st_ino == stB.st_ino;
+}
+
+std::string full_path(const std::string& filename)
+{
+	auto path = realpath(filename.c_str(), nullptr);
+	if (!path) {
+		// realpath needs the file to exist, still make the path absolute.
+		if (filename.empty() || filename[0] == '/')
+			return filename;
+
+		auto cwd = getcwd(nullptr, 0);
+		if (!cwd)
+			return filename;
+
+		std::string result(cwd);
+		std::free(cwd);
+		return result + '/' + filename;
+	}
+
+	std::string result(path);
+	std::free(path);
+	return result;
+}
+
+std::vector<std::string> list_directory(const std::string& directory)
+{
+	std::vector<std::string> names;
+
+	auto dir = opendir(directory.c_str());
+	if (!dir)
+		return names;
+
+	while (auto entry = readdir(dir))
+		names.push_back(entry->d_name);
+	closedir(dir);
+
+	return names;
+}
+
+void make_directory(const std::string& directory)
+{
+	mkdir(directory.c_str(), 0777);
+}
+
+void touch_file(const std::string& filename)
+{
+	utime(filename.c_str(), nullptr);
+}
+
+void remove_file(const std::string& filename)
+{
+	std::remove(filename.c_str());
+}
+
+bool replace_file(const std::string& from, const std::string& to)
+{
+	return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+static unsigned long process_id()
+{
+	return static_cast<unsigned long>(getpid());
+}
+#endif
+
+std::string temporary_filename(const std::string& filename)
+{
+	static std::atomic<unsigned> counter(0);
+	return filename + '.' + std::to_string(process_id()) + '.' + std::to_string(counter++) + ".tmp";
+}
+
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+/*
+ * Internal platform specific file system and threading helpers.
+ * All filenames are multibyte UTF-8.
+ */
+
+/*
+ * A memory mapping of a whole file. A copy-on-write mapping can be
+ * written through data, the changes stay private to the mapping.
+ */
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filename, bool copyOnWrite = false);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data;
+	size_t size;
+
+#ifdef _WIN32
+protected:
+	HANDLE mapping;
+#endif
+};
+
+// Which file it is, its size and when it was last written, as precisely as the file system keeps it.
+struct FileVersion {
+	uint64_t device;
+	uint64_t index;
+	uint64_t size;
+	// Nanoseconds since the epoch.
+	int64_t modified;
+
+	bool operator==(const FileVersion& other) const
+	{
+		return device == other.device && index == other.index && size == other.size && modified == other.modified;
+	}
+};
+
+/*
+ * A file read at given offsets, without a file position, so that a read
+ * is a single system call and one file can be read from several threads.
+ */
+class PositionalFile
+{
+public:
+	explicit PositionalFile(const std::string& filename);
+	~PositionalFile();
+
+	PositionalFile(const PositionalFile&) = delete;
+	PositionalFile& operator=(const PositionalFile&) = delete;
+
+	// Returns the number of bytes read, less than size only at the end of the file.
+	size_t ReadAt(uint64_t offset, void* dst, size_t size);
+
+	// Whether the file hasn't been written since it was opened, false if that can't be told.
+	bool Unchanged() const;
+	// Taken when the file was opened.
+	const FileVersion& Version() const;
+	// Whether the name refers to this file, through links or otherwise.
+	bool IsFile(const std::string& other) const;
+
+	uint64_t size;
+
+protected:
+	std::string filename;
+	// Taken when the file was opened.
+	FileVersion version;
+#ifdef _WIN32
+	HANDLE file;
+#else
+	int fd;
+#endif
+};
+
+// Of the file by name, false if it doesn't exist.
+bool file_version(const std::string& filename, FileVersion& version);
+// The size and the modification time in seconds since the epoch, false if the file doesn't exist.
+bool stat_file(const std::string& filename, uint64_t& size, int64_t& time);
+// Whether both names refer to the same existing file, through links or otherwise.
+bool same_file(const std::string& a, const std::string& b);
+// The absolute path, or the filename itself if it can't be resolved.
+std::string full_path(const std::string& filename);
+// The names of the entries in the directory, empty if it can't be read.
+std::vector<std::string> list_directory(const std::string& directory);
+
+// These ignore errors.
+void make_directory(const std::string& directory);
+void touch_file(const std::string& filename);
+void remove_file(const std::string& filename);
+
+// Renames the file, overwriting the destination.
+bool replace_file(const std::string& from, const std::string& to);
+// A name next to the file to write it under first, unique to the calling process and call.
+std::string temporary_filename(const std::string& filename);
+
+// How many workers parallel_for runs count jobs on, 0 threads meaning one per core.
+inline unsigned parallel_workers(size_t count, unsigned threads)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, count)));
+}
+
+/*
+ * Runs job(worker, i) for every i in [0, count) on parallel_workers(count, threads)
+ * threads, the calling one being worker 0. The workers take the next i as they go,
+ * so a worker can keep its own buffers. The first exception thrown by a job stops
+ * the remaining jobs from starting and is rethrown once all workers are done.
+ */
+template<typename Job>
+void parallel_for(size_t count, unsigned threads, const Job& job)
+{
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorMutex;
+
+	auto worker = [&](unsigned w) {
+		for (auto i = next++; i < count; i = next++) {
+			try {
+				job(w, i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+				next = count;
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	auto n = parallel_workers(count, threads);
+	for (unsigned w = 1; w < n; ++w)
+		workers.emplace_back(worker, w);
+	worker(0);
+	for (auto& w : workers)
+		w.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoProbe.hpp"
+
+static DemoProbeString add_string(std::string& strings, const char* data, size_t size)
+{
+	DemoProbeString s = { strings.size(), static_cast<uint32_t>(size) };
+	strings.append(data, size);
+	return s;
+}
+
+// A fixed size field, up to the first zero.
+static DemoProbeString add_field(std::string& strings, const char* data, size_t size)
+{
+	auto zero = static_cast<const char*>(std::memchr(data, '\0', size));
+	return add_string(strings, data, zero ? zero - data : size);
+}
+
+// Takes the header and the directory from a DemoFile, which handles decompression and reports the errors.
+static void probe_with_demo_file(const std::string& filename, DemoProbe& probe, DemoProbes& out)
+{
+	DemoFile demo(filename);
+	const auto& h = demo.header;
+	probe.netProtocol = h.netProtocol;
+	probe.demoProtocol = h.demoProtocol;
+	probe.mapName = add_string(out.strings, h.mapName.data(), h.mapName.size());
+	probe.gameDir = add_string(out.strings, h.gameDir.data(), h.gameDir.size());
+	probe.mapCRC = h.mapCRC;
+	probe.directoryOffset = h.directoryOffset;
+
+	for (const auto& e : demo.directoryEntries) {
+		DemoProbeEntry entry;
+		entry.type = e.type;
+		entry.description = add_string(out.strings, e.description.data(), e.description.size());
+		entry.flags = e.flags;
+		entry.CDTrack = e.CDTrack;
+		entry.trackTime = e.trackTime;
+		entry.frameCount = e.frameCount;
+		entry.offset = e.offset;
+		entry.fileLength = e.fileLength;
+		out.entries.push_back(entry);
+	}
+}
+
+// Decodes the header the way DemoFile::DecodeHeader does, once the signature is known to match.
+static void decode_header(const char* data, DemoProbe& probe, DemoProbes& out)
+{
+	BufferReader r = { data + HEADER_SIGNATURE_SIZE, data + HEADER_SIZE };
+	probe.demoProtocol = r.Read<int32_t>();
+	probe.netProtocol = r.Read<int32_t>();
+	probe.mapName = add_field(out.strings, r.p, HEADER_MAPNAME_SIZE);
+	r.p += HEADER_MAPNAME_SIZE;
+	probe.gameDir = add_field(out.strings, r.p, HEADER_GAMEDIR_SIZE);
+	r.p += HEADER_GAMEDIR_SIZE;
+	probe.mapCRC = r.Read<int32_t>();
+	probe.directoryOffset = r.Read<int32_t>();
+}
+
+// Decodes the directory the way DemoFile::DecodeDirectory does.
+static void decode_directory(const char* data, size_t size, DemoProbes& out)
+{
+	auto count = DemoFile::DecodeDirectoryCount(data, size);
+	BufferReader r = { data + sizeof(int32_t), data + size };
+	for (size_t i = 0; i < count; ++i) {
+		DemoProbeEntry entry;
+		entry.type = r.Read<int32_t>();
+		entry.description = add_field(out.strings, r.p, DIR_ENTRY_DESCRIPTION_SIZE);
+		r.p += DIR_ENTRY_DESCRIPTION_SIZE;
+		entry.flags = r.Read<int32_t>();
+		entry.CDTrack = r.Read<int32_t>();
+		entry.trackTime = r.Read<float>();
+		entry.frameCount = r.Read<int32_t>();
+		entry.offset = r.Read<int32_t>();
+		entry.fileLength = r.Read<int32_t>();
+		out.entries.push_back(entry);
+	}
+}
+
+/*
+ * Appends the probe of the demo to out, its offsets relative to out.
+ * The buffer is reused between the demos probed by one thread.
+ */
+static DemoProbe probe_demo(const std::string& filename, std::vector<char>& buf, DemoProbes& out)
+{
+	DemoProbe probe = {};
+	probe.firstEntry = out.entries.size();
+	auto strings = out.strings.size();
+
+	try {
+		PositionalFile file(filename);
+		probe.size = file.size;
+
+		char header[HEADER_SIZE];
+		if (file.size < HEADER_SIZE || file.ReadAt(0, header, sizeof(header)) != sizeof(header)
+			|| std::memcmp(header, "HLDEMO", HEADER_SIGNATURE_CHECK_SIZE)) {
+			// Compressed, or not a demo at all.
+			probe_with_demo_file(filename, probe, out);
+		} else {
+			decode_header(header, probe, out);
+
+			auto offset = probe.directoryOffset;
+			if (offset < 0 || file.size - 4 < static_cast<uint64_t>(offset))
+				throw std::runtime_error("Error parsing the demo directory: invalid directory offset.");
+
+			buf.resize(static_cast<size_t>(std::min<uint64_t>(file.size - offset, MAX_DIRECTORY_SIZE)));
+			buf.resize(file.ReadAt(offset, buf.data(), buf.size()));
+			decode_directory(buf.data(), buf.size(), out);
+		}
+	} catch (const std::exception& ex) {
+		// Nothing but the size and the error is kept from a failed probe.
+		out.entries.resize(static_cast<size_t>(probe.firstEntry));
+		out.strings.resize(strings);
+		auto size = probe.size;
+		auto firstEntry = probe.firstEntry;
+		probe = {};
+		probe.size = size;
+		probe.firstEntry = firstEntry;
+		probe.error = add_string(out.strings, ex.what(), std::strlen(ex.what()));
+	}
+
+	probe.entryCount = static_cast<uint32_t>(out.entries.size() - probe.firstEntry);
+	return probe;
+}
+
+DemoProbes ProbeDemo(const std::string& filename)
+{
+	DemoProbes out;
+	std::vector<char> buf;
+	out.probes.push_back(probe_demo(filename, buf, out));
+	return out;
+}
+
+DemoProbes ProbeDemos(const std::vector<std::string>& filenames, unsigned threads)
+{
+	if (threads == 0)
+		threads = PROBE_THREADS_PER_CORE * std::max(1u, std::thread::hardware_concurrency());
+
+	// Every worker fills its own pools, which are joined afterwards.
+	struct Worker {
+		std::vector<char> buf;
+		DemoProbes out;
+	};
+	std::vector<Worker> workers(parallel_workers(filenames.size(), threads));
+	std::vector<unsigned> prober(filenames.size());
+
+	DemoProbes result;
+	result.probes.resize(filenames.size());
+	parallel_for(filenames.size(), threads, [&](unsigned worker, size_t i) {
+		auto& w = workers[worker];
+		result.probes[i] = probe_demo(filenames[i], w.buf, w.out);
+		prober[i] = worker;
+	});
+
+	std::vector<uint64_t> stringBase(workers.size()), entryBase(workers.size());
+	size_t strings = 0, entries = 0;
+	for (size_t w = 0; w < workers.size(); ++w) {
+		stringBase[w] = strings;
+		entryBase[w] = entries;
+		strings += workers[w].out.strings.size();
+		entries += workers[w].out.entries.size();
+	}
+
+	result.strings.reserve(strings);
+	result.entries.reserve(entries);
+	for (size_t w = 0; w < workers.size(); ++w) {
+		auto& out = workers[w].out;
+		result.strings += out.strings;
+		for (auto entry : out.entries) {
+			entry.description.offset += stringBase[w];
+			result.entries.push_back(entry);
+		}
+		out = DemoProbes();
+	}
+
+	for (size_t i = 0; i < result.probes.size(); ++i) {
+		auto& probe = result.probes[i];
+		auto w = prober[i];
+		probe.error.offset += stringBase[w];
+		probe.mapName.offset += stringBase[w];
+		probe.gameDir.offset += stringBase[w];
+		probe.firstEntry += entryBase[w];
+	}
+
+	return result;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum {
+	// The probing threads mostly wait for the reads.
+	PROBE_THREADS_PER_CORE = 8
+};
+
+// A string in DemoProbes::strings.
+struct DemoProbeString {
+	uint64_t offset;
+	uint32_t size;
+};
+
+// A directory entry without its frames.
+struct DemoProbeEntry {
+	int32_t type;
+	DemoProbeString description;
+	int32_t flags;
+	int32_t CDTrack;
+	float trackTime;
+	int32_t frameCount;
+	int32_t offset;
+	int32_t fileLength;
+};
+
+// The header and the directory of a demo, what opening a DemoFile reads.
+struct DemoProbe {
+	// Of the file, before any decompression.
+	uint64_t size;
+	// Empty if the demo was probed successfully.
+	DemoProbeString error;
+
+	int32_t netProtocol;
+	int32_t demoProtocol;
+	DemoProbeString mapName;
+	DemoProbeString gameDir;
+	int32_t mapCRC;
+	int32_t directoryOffset;
+
+	// The entries are DemoProbes::entries[firstEntry, firstEntry + entryCount).
+	uint64_t firstEntry;
+	uint32_t entryCount;
+};
+
+/*
+ * The probes of a list of demos, in the order of the filenames. Every
+ * probe and entry is a plain record, their strings are in one pool, so
+ * probing an archive makes a few large allocations rather than several
+ * per demo.
+ */
+struct DemoProbes {
+	std::vector<DemoProbe> probes;
+	std::vector<DemoProbeEntry> entries;
+	std::string strings;
+
+	std::string String(const DemoProbeString& s) const
+	{
+		return strings.substr(static_cast<size_t>(s.offset), s.size);
+	}
+
+	const DemoProbeEntry* Entries(const DemoProbe& probe) const
+	{
+		return entries.data() + probe.firstEntry;
+	}
+};
+
+/*
+ * Reads the header and the directory of a demo with at most two positional
+ * reads: the header, then the directory it points to. The directory of a
+ * compressed demo is somewhere in the compressed stream, so those are
+ * decompressed by DemoFile instead. Errors are reported in the result,
+ * a bad header or directory with the same message DemoFile would throw.
+ *
+ * The filenames are multibyte UTF-8.
+ */
+DemoProbes ProbeDemo(const std::string& filename);
+
+/*
+ * Probes the demos on the given number of threads. Running many more
+ * threads than cores keeps many reads in flight, so probing an archive
+ * is bound by how many reads the storage can serve.
+ * threads = 0 means PROBE_THREADS_PER_CORE per core.
+ */
+DemoProbes ProbeDemos(const std::vector<std::string>& filenames, unsigned threads = 0);
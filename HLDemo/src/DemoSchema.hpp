@@ -0,0 +1,764 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+
+/*
+ * The wire layout of every frame type, written down once as the list of
+ * its fields in file order, after the frame header. Decoding, encoding,
+ * the size calculation, the bounds checks, dumping and comparing frames
+ * are all generated from these lists, so that the reading and the writing
+ * code can't disagree about the format.
+ *
+ * Every field has a codec, which knows the wire width of the field:
+ * - ValueCodec: numbers and arrays of numbers, stored as they are.
+ * - StringCodec<N>: a string in a zero-padded N byte field.
+ * - MoveVarsCodec: the netmsg movevars, shared between frames.
+ * - BlobCodec<Max>: an int32 length followed by that many bytes.
+ *
+ * The widths and the offsets are known at compile time, so decoding and
+ * encoding come down to copies at fixed offsets. A frame can have one
+ * blob, which splits it into a head ending with the blob length and a
+ * tail after the blob bytes. Decoding checks the bounds once for the head
+ * and once for the blob together with the tail.
+ */
+
+/*
+ * Whether the fixed size string field is written back the same way:
+ * nothing but zeros after the terminating zero, if there's one.
+ */
+inline bool canonical_string(const char* field, size_t size)
+{
+	auto end = static_cast<const char*>(std::memchr(field, '\0', size));
+	return !end || std::all_of(end, field + size, [](char c) { return c == '\0'; });
+}
+
+template<typename Codec, typename Get>
+struct SchemaField {
+	typedef Codec CodecType;
+
+	// The path of the field within the frame, like DemoInfo.RefParams.vieworg.
+	const char* name;
+	Get get;
+};
+
+template<typename Codec, typename Get>
+inline SchemaField<Codec, Get> schema_field(const char* name, Get get)
+{
+	return SchemaField<Codec, Get>{ name, get };
+}
+
+#define SCHEMA_FIELD(codec, path) schema_field<codec>(#path, [](auto& f) -> auto& { return f.path; })
+
+// Specialized for every frame class, Fields() returns a tuple of SchemaFields.
+template<typename Frame>
+struct FrameSchema;
+
+template<typename Frame>
+using SchemaFields = decltype(FrameSchema<Frame>::Fields());
+
+template<typename Frame>
+constexpr size_t schema_field_count()
+{
+	return std::tuple_size<SchemaFields<Frame>>::value;
+}
+
+template<typename Frame, size_t I>
+using SchemaFieldAt = typename std::tuple_element<I, SchemaFields<Frame>>::type;
+
+template<typename Frame, size_t I>
+using SchemaFieldCodec = typename SchemaFieldAt<Frame, I>::CodecType;
+
+template<typename Frame, size_t I>
+using SchemaFieldType = std::remove_reference_t<decltype(std::declval<SchemaFieldAt<Frame, I>>().get(std::declval<Frame&>()))>;
+
+// Forward declarations for the codecs of nested schemas.
+template<typename Frame>
+constexpr size_t schema_fixed_size();
+template<typename Frame, typename Context>
+inline void schema_decode_fixed(const char* p, Frame& frame, Context& ctx);
+template<typename Frame, typename Context>
+inline void schema_check_strings(const char* p, Context& ctx);
+template<typename Frame>
+inline void schema_encode(char* p, const Frame& frame);
+
+struct ValueCodec {
+	static const bool isBlob = false;
+
+	template<typename T>
+	static constexpr size_t Size()
+	{
+		static_assert(std::is_arithmetic<std::remove_all_extents_t<T>>::value, "ValueCodec stores numbers and arrays of numbers.");
+		return sizeof(T);
+	}
+
+	template<typename T, typename Context>
+	static void Decode(const char* p, T& value, Context&)
+	{
+		std::memcpy(&value, p, sizeof(T));
+	}
+
+	template<typename Context>
+	static void Check(const char*, Context&)
+	{
+	}
+
+	template<typename T>
+	static void Encode(char* p, const T& value)
+	{
+		std::memcpy(p, &value, sizeof(T));
+	}
+};
+
+template<size_t N>
+struct StringCodec {
+	static const bool isBlob = false;
+
+	template<typename T>
+	static constexpr size_t Size()
+	{
+		return N;
+	}
+
+	template<typename T, typename Context>
+	static void Decode(const char* p, T& value, Context& ctx)
+	{
+		Check(p, ctx);
+
+		char text[N + 1];
+		std::memcpy(text, p, N);
+		text[N] = '\0';
+		Assign(value, text, ctx);
+	}
+
+	// Clears ctx.canonical if the field wouldn't be encoded back to the same bytes.
+	template<typename Context>
+	static void Check(const char* p, Context& ctx)
+	{
+		ctx.canonical = ctx.canonical && canonical_string(p, N);
+	}
+
+	template<typename T>
+	static void Encode(char* p, const T& value)
+	{
+		const std::string& str = value;
+		auto length = std::min(str.size(), N);
+		std::memcpy(p, str.data(), length);
+		std::memset(p + length, 0, N - length);
+	}
+
+protected:
+	template<typename Context>
+	static void Assign(std::string& value, const char* text, Context&)
+	{
+		value = text;
+	}
+
+	// Frames with the same text share it.
+	template<typename Context>
+	static void Assign(DemoString& value, const char* text, Context& ctx)
+	{
+		value = ctx.Intern(text);
+	}
+};
+
+// Null movevars are stored as all zeros.
+struct MoveVarsCodec {
+	static const bool isBlob = false;
+
+	template<typename T>
+	static constexpr size_t Size()
+	{
+		return schema_fixed_size<DemoMoveVars>();
+	}
+
+	template<typename Context>
+	static void Decode(const char* p, std::shared_ptr<const DemoMoveVars>& value, Context& ctx)
+	{
+		// The context may hand out movevars decoded earlier, so the strings are checked here.
+		Check(p, ctx);
+		value = ctx.MoveVars(p);
+	}
+
+	template<typename Context>
+	static void Check(const char* p, Context& ctx)
+	{
+		schema_check_strings<DemoMoveVars>(p, ctx);
+	}
+
+	static void Encode(char* p, const std::shared_ptr<const DemoMoveVars>& value)
+	{
+		static const DemoMoveVars none = {};
+		schema_encode(p, value ? *value : none);
+	}
+};
+
+// The length goes into the fixed part, the bytes follow it.
+template<int32_t Max>
+struct BlobCodec {
+	static const bool isBlob = true;
+	static const int32_t maxLength = Max;
+
+	template<typename T>
+	static constexpr size_t Size()
+	{
+		static_assert(sizeof(typename T::value_type) == 1, "BlobCodec stores byte vectors.");
+		return sizeof(int32_t);
+	}
+
+	// The length is checked and the bytes are read by schema_decode.
+	template<typename T, typename Context>
+	static void Decode(const char*, T&, Context&)
+	{
+	}
+
+	template<typename Context>
+	static void Check(const char*, Context&)
+	{
+	}
+
+	template<typename T>
+	static void Encode(char* p, const T& value)
+	{
+		auto length = static_cast<int32_t>(value.size());
+		std::memcpy(p, &length, sizeof(length));
+	}
+};
+
+// DEMO_START, NEXT_SECTION: no extra data.
+template<>
+struct FrameSchema<DemoFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple();
+	}
+};
+
+template<>
+struct FrameSchema<ConsoleCommandFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(StringCodec<FRAME_CONSOLE_COMMAND_SIZE>, command)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<ClientDataFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, origin),
+			SCHEMA_FIELD(ValueCodec, viewangles),
+			SCHEMA_FIELD(ValueCodec, weaponBits),
+			SCHEMA_FIELD(ValueCodec, fov)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<EventFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, flags),
+			SCHEMA_FIELD(ValueCodec, index),
+			SCHEMA_FIELD(ValueCodec, delay),
+			SCHEMA_FIELD(ValueCodec, EventArgs.flags),
+			SCHEMA_FIELD(ValueCodec, EventArgs.entityIndex),
+			SCHEMA_FIELD(ValueCodec, EventArgs.origin),
+			SCHEMA_FIELD(ValueCodec, EventArgs.angles),
+			SCHEMA_FIELD(ValueCodec, EventArgs.velocity),
+			SCHEMA_FIELD(ValueCodec, EventArgs.ducking),
+			SCHEMA_FIELD(ValueCodec, EventArgs.fparam1),
+			SCHEMA_FIELD(ValueCodec, EventArgs.fparam2),
+			SCHEMA_FIELD(ValueCodec, EventArgs.iparam1),
+			SCHEMA_FIELD(ValueCodec, EventArgs.iparam2),
+			SCHEMA_FIELD(ValueCodec, EventArgs.bparam1),
+			SCHEMA_FIELD(ValueCodec, EventArgs.bparam2)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<WeaponAnimFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, anim),
+			SCHEMA_FIELD(ValueCodec, body)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<SoundFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, channel),
+			SCHEMA_FIELD(BlobCodec<FRAME_SOUND_MAX_SAMPLE_LENGTH>, sample),
+			SCHEMA_FIELD(ValueCodec, attenuation),
+			SCHEMA_FIELD(ValueCodec, volume),
+			SCHEMA_FIELD(ValueCodec, flags),
+			SCHEMA_FIELD(ValueCodec, pitch)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<DemoBufferFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(BlobCodec<FRAME_DEMO_BUFFER_MAX_LENGTH>, buffer)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<DemoMoveVars> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, gravity),
+			SCHEMA_FIELD(ValueCodec, stopspeed),
+			SCHEMA_FIELD(ValueCodec, maxspeed),
+			SCHEMA_FIELD(ValueCodec, spectatormaxspeed),
+			SCHEMA_FIELD(ValueCodec, accelerate),
+			SCHEMA_FIELD(ValueCodec, airaccelerate),
+			SCHEMA_FIELD(ValueCodec, wateraccelerate),
+			SCHEMA_FIELD(ValueCodec, friction),
+			SCHEMA_FIELD(ValueCodec, edgefriction),
+			SCHEMA_FIELD(ValueCodec, waterfriction),
+			SCHEMA_FIELD(ValueCodec, entgravity),
+			SCHEMA_FIELD(ValueCodec, bounce),
+			SCHEMA_FIELD(ValueCodec, stepsize),
+			SCHEMA_FIELD(ValueCodec, maxvelocity),
+			SCHEMA_FIELD(ValueCodec, zmax),
+			SCHEMA_FIELD(ValueCodec, waveHeight),
+			SCHEMA_FIELD(ValueCodec, footsteps),
+			SCHEMA_FIELD(StringCodec<FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE>, skyName),
+			SCHEMA_FIELD(ValueCodec, rollangle),
+			SCHEMA_FIELD(ValueCodec, rollspeed),
+			SCHEMA_FIELD(ValueCodec, skycolor_r),
+			SCHEMA_FIELD(ValueCodec, skycolor_g),
+			SCHEMA_FIELD(ValueCodec, skycolor_b),
+			SCHEMA_FIELD(ValueCodec, skyvec_x),
+			SCHEMA_FIELD(ValueCodec, skyvec_y),
+			SCHEMA_FIELD(ValueCodec, skyvec_z)
+		);
+	}
+};
+
+template<>
+struct FrameSchema<NetMsgFrame> {
+	static auto Fields()
+	{
+		return std::make_tuple(
+			SCHEMA_FIELD(ValueCodec, DemoInfo.timestamp),
+
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.vieworg),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.viewangles),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.forward),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.right),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.up),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.frametime),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.time),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.intermission),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.paused),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.spectator),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.onground),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.waterlevel),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.simvel),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.simorg),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.viewheight),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.idealpitch),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.cl_viewangles),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.health),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.crosshairangle),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.viewsize),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.punchangle),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.maxclients),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.viewentity),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.playernum),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.max_entities),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.demoplayback),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.hardware),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.smoothing),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.ptr_cmd),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.ptr_movevars),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.viewport),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.nextView),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.RefParams.onlyClientDraw),
+
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.lerp_msec),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.msec),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.align_1),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.viewangles),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.forwardmove),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.sidemove),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.upmove),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.lightlevel),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.align_2),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.buttons),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.impulse),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.weaponselect),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.align_3),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.align_4),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.impact_index),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.UserCmd.impact_position),
+
+			SCHEMA_FIELD(MoveVarsCodec, DemoInfo.MoveVars),
+
+			SCHEMA_FIELD(ValueCodec, DemoInfo.view),
+			SCHEMA_FIELD(ValueCodec, DemoInfo.viewmodel),
+
+			SCHEMA_FIELD(ValueCodec, incoming_sequence),
+			SCHEMA_FIELD(ValueCodec, incoming_acknowledged),
+			SCHEMA_FIELD(ValueCodec, incoming_reliable_acknowledged),
+			SCHEMA_FIELD(ValueCodec, incoming_reliable_sequence),
+			SCHEMA_FIELD(ValueCodec, outgoing_sequence),
+			SCHEMA_FIELD(ValueCodec, reliable_sequence),
+			SCHEMA_FIELD(ValueCodec, last_reliable_sequence),
+
+			SCHEMA_FIELD(BlobCodec<FRAME_NETMSG_MAX_MESSAGE_LENGTH>, msg)
+		);
+	}
+};
+
+/*
+ * Calls f with a null pointer to the class of the frames of the given type,
+ * DemoFrame for the frames without data of their own.
+ */
+template<typename F>
+inline auto dispatch_frame_type(DemoFrameType type, F&& f) -> decltype(f(static_cast<DemoFrame*>(nullptr)))
+{
+	switch (type) {
+	case DemoFrameType::DEMO_START:
+	case DemoFrameType::NEXT_SECTION:
+		return f(static_cast<DemoFrame*>(nullptr));
+	case DemoFrameType::CONSOLE_COMMAND:
+		return f(static_cast<ConsoleCommandFrame*>(nullptr));
+	case DemoFrameType::CLIENT_DATA:
+		return f(static_cast<ClientDataFrame*>(nullptr));
+	case DemoFrameType::EVENT:
+		return f(static_cast<EventFrame*>(nullptr));
+	case DemoFrameType::WEAPON_ANIM:
+		return f(static_cast<WeaponAnimFrame*>(nullptr));
+	case DemoFrameType::SOUND:
+		return f(static_cast<SoundFrame*>(nullptr));
+	case DemoFrameType::DEMO_BUFFER:
+		return f(static_cast<DemoBufferFrame*>(nullptr));
+	default:
+		return f(static_cast<NetMsgFrame*>(nullptr));
+	}
+}
+
+// The compile time part: wire widths and offsets.
+
+template<typename Frame, size_t I>
+constexpr size_t schema_field_size()
+{
+	return SchemaFieldCodec<Frame, I>::template Size<SchemaFieldType<Frame, I>>();
+}
+
+template<typename Frame, size_t... I>
+constexpr size_t schema_sum_sizes(std::index_sequence<I...>)
+{
+	const size_t sizes[] = { 0, schema_field_size<Frame, I>()... };
+	size_t total = 0;
+	for (auto size : sizes)
+		total += size;
+	return total;
+}
+
+template<size_t Begin, size_t... I>
+constexpr std::index_sequence<(Begin + I)...> schema_shift(std::index_sequence<I...>)
+{
+	return {};
+}
+
+// The fields in [Begin, End).
+template<size_t Begin, size_t End>
+using SchemaRange = decltype(schema_shift<Begin>(std::make_index_sequence<End - Begin>()));
+
+// The wire width of the fields in [Begin, End), not counting blob bytes.
+template<typename Frame, size_t Begin, size_t End>
+constexpr size_t schema_range_size()
+{
+	return schema_sum_sizes<Frame>(SchemaRange<Begin, End>());
+}
+
+// The wire width of all fields, not counting blob bytes.
+template<typename Frame>
+constexpr size_t schema_fixed_size()
+{
+	return schema_range_size<Frame, 0, schema_field_count<Frame>()>();
+}
+
+// The offset of the field after the frame header, for the fields up to the blob length.
+template<typename Frame, size_t I>
+constexpr size_t schema_field_offset()
+{
+	return schema_range_size<Frame, 0, I>();
+}
+
+template<typename Frame, size_t... I>
+constexpr size_t schema_find_blob(std::index_sequence<I...>)
+{
+	const bool blobs[] = { false, SchemaFieldCodec<Frame, I>::isBlob... };
+	size_t found = sizeof...(I), count = 0;
+	for (size_t i = 1; i <= sizeof...(I); ++i) {
+		if (blobs[i]) {
+			found = std::min(found, i - 1);
+			count++;
+		}
+	}
+	return count > 1 ? SIZE_MAX : found;
+}
+
+// The index of the blob field, or the field count if there's none.
+template<typename Frame>
+constexpr size_t schema_blob_index()
+{
+	return schema_find_blob<Frame>(std::make_index_sequence<schema_field_count<Frame>()>());
+}
+
+template<typename Frame>
+constexpr bool schema_has_blob()
+{
+	return schema_blob_index<Frame>() < schema_field_count<Frame>();
+}
+
+// With a blob, the head ends with its length and the tail follows its bytes.
+template<typename Frame>
+constexpr size_t schema_head_end()
+{
+	return schema_has_blob<Frame>() ? schema_blob_index<Frame>() + 1 : schema_field_count<Frame>();
+}
+
+template<typename Frame>
+constexpr size_t schema_head_size()
+{
+	return schema_range_size<Frame, 0, schema_head_end<Frame>()>();
+}
+
+template<typename Frame>
+constexpr size_t schema_tail_size()
+{
+	return schema_range_size<Frame, schema_head_end<Frame>(), schema_field_count<Frame>()>();
+}
+
+// The run time part: the fields of a range at their offsets from p.
+
+template<typename Frame, size_t Begin, typename Context, size_t... I>
+inline void schema_decode_range(const char* p, Frame& frame, Context& ctx, std::index_sequence<I...>)
+{
+	auto fields = FrameSchema<Frame>::Fields();
+	int expand[] = { 0, (SchemaFieldCodec<Frame, I>::Decode(p + schema_range_size<Frame, Begin, I>(), std::get<I>(fields).get(frame), ctx), 0)... };
+	(void)p;
+	(void)fields;
+	(void)expand;
+}
+
+template<typename Frame, size_t Begin, typename Context, size_t... I>
+inline void schema_check_range(const char* p, Context& ctx, std::index_sequence<I...>)
+{
+	int expand[] = { 0, (SchemaFieldCodec<Frame, I>::Check(p + schema_range_size<Frame, Begin, I>(), ctx), 0)... };
+	(void)p;
+	(void)ctx;
+	(void)expand;
+}
+
+template<typename Frame, size_t Begin, size_t... I>
+inline void schema_encode_range(char* p, const Frame& frame, std::index_sequence<I...>)
+{
+	auto fields = FrameSchema<Frame>::Fields();
+	int expand[] = { 0, (SchemaFieldCodec<Frame, I>::Encode(p + schema_range_size<Frame, Begin, I>(), std::get<I>(fields).get(frame)), 0)... };
+	(void)p;
+	(void)fields;
+	(void)expand;
+}
+
+template<size_t I, typename Fields, typename Visitor, typename... Frames>
+inline void schema_visit_field(const Fields& fields, Visitor& visit, Frames&... frames)
+{
+	visit(std::get<I>(fields).name, std::get<I>(fields).get(frames)...);
+}
+
+template<typename Frame, typename Visitor, typename... Frames, size_t... I>
+inline void schema_visit_range(Visitor& visit, std::index_sequence<I...>, Frames&... frames)
+{
+	auto fields = FrameSchema<Frame>::Fields();
+	int expand[] = { 0, (schema_visit_field<I>(fields, visit, frames...), 0)... };
+	(void)fields;
+	(void)expand;
+}
+
+// Decodes a frame without a blob from its fixed part.
+template<typename Frame, typename Context>
+inline void schema_decode_fixed(const char* p, Frame& frame, Context& ctx)
+{
+	static_assert(!schema_has_blob<Frame>(), "The frame has variable length data.");
+	schema_decode_range<Frame, 0>(p, frame, ctx, std::make_index_sequence<schema_field_count<Frame>()>());
+}
+
+// Checks the string fields of a frame without a blob, see StringCodec::Check.
+template<typename Frame, typename Context>
+inline void schema_check_strings(const char* p, Context& ctx)
+{
+	static_assert(!schema_has_blob<Frame>(), "The frame has variable length data.");
+	schema_check_range<Frame, 0>(p, ctx, std::make_index_sequence<schema_field_count<Frame>()>());
+}
+
+template<typename Frame>
+inline size_t schema_blob_size(const Frame&, std::false_type)
+{
+	return 0;
+}
+
+template<typename Frame>
+inline size_t schema_blob_size(const Frame& frame, std::true_type)
+{
+	return std::get<schema_blob_index<Frame>()>(FrameSchema<Frame>::Fields()).get(frame).size();
+}
+
+// The encoded size of the frame without its header.
+template<typename Frame>
+inline size_t schema_encoded_size(const Frame& frame)
+{
+	return schema_fixed_size<Frame>() + schema_blob_size(frame, std::integral_constant<bool, schema_has_blob<Frame>()>());
+}
+
+template<typename Frame>
+inline void schema_encode_rest(char*, const Frame&, std::false_type)
+{
+}
+
+template<typename Frame>
+inline void schema_encode_rest(char* p, const Frame& frame, std::true_type)
+{
+	const auto& blob = std::get<schema_blob_index<Frame>()>(FrameSchema<Frame>::Fields()).get(frame);
+	if (!blob.empty())
+		std::memcpy(p, blob.data(), blob.size());
+
+	p += blob.size();
+	schema_encode_range<Frame, schema_head_end<Frame>()>(p, frame,
+		SchemaRange<schema_head_end<Frame>(), schema_field_count<Frame>()>());
+}
+
+// Encodes the frame without its header into schema_encoded_size(frame) bytes at p.
+template<typename Frame>
+inline void schema_encode(char* p, const Frame& frame)
+{
+	schema_encode_range<Frame, 0>(p, frame, SchemaRange<0, schema_head_end<Frame>()>());
+	schema_encode_rest(p + schema_head_size<Frame>(), frame, std::integral_constant<bool, schema_has_blob<Frame>()>());
+}
+
+template<typename Frame, typename Source, typename Context>
+inline bool schema_decode_rest(const char*, Source&, Frame&, Context&, std::false_type)
+{
+	return true;
+}
+
+template<typename Frame, typename Source, typename Context>
+inline bool schema_decode_rest(const char* head, Source& source, Frame& frame, Context& ctx, std::true_type)
+{
+	typedef SchemaFieldCodec<Frame, schema_blob_index<Frame>()> Codec;
+	const auto tailSize = schema_tail_size<Frame>();
+
+	int32_t length;
+	std::memcpy(&length, head + schema_field_offset<Frame, schema_blob_index<Frame>()>(), sizeof(length));
+	if (length < 0 || length > Codec::maxLength || !source.Available(int64_t{ length } + static_cast<int64_t>(tailSize)))
+		return false;
+
+	auto& blob = std::get<schema_blob_index<Frame>()>(FrameSchema<Frame>::Fields()).get(frame);
+	blob.resize(static_cast<size_t>(length));
+	if (length)
+		source.Read(blob.data(), static_cast<size_t>(length));
+
+	if (tailSize) {
+		schema_decode_range<Frame, schema_head_end<Frame>()>(source.template Fixed<tailSize>(), frame, ctx,
+			SchemaRange<schema_head_end<Frame>(), schema_field_count<Frame>()>());
+	}
+	return true;
+}
+
+/*
+ * Decodes the frame, without its header, from the source, which has:
+ * - bool Available(int64_t size): whether there are size more bytes,
+ * - const char* Fixed<size_t Size>(): the next Size bytes, once checked,
+ * - void Read(void* dst, size_t size): reads the next size bytes, once checked.
+ * The context has a bool canonical, cleared if a string field wouldn't be
+ * encoded back to the same bytes, and DemoString Intern(const char* text)
+ * and std::shared_ptr<const DemoMoveVars> MoveVars(const char* raw).
+ * Returns false if the frame is cut off or its blob length is out of range.
+ */
+template<typename Frame, typename Source, typename Context>
+inline bool schema_decode(Source& source, Frame& frame, Context& ctx)
+{
+	static_assert(schema_blob_index<Frame>() != SIZE_MAX, "A frame can have only one blob.");
+
+	const auto headSize = schema_head_size<Frame>();
+	if (!headSize)
+		return true;
+	if (!source.Available(headSize))
+		return false;
+
+	auto head = source.template Fixed<headSize>();
+	schema_decode_range<Frame, 0>(head, frame, ctx, SchemaRange<0, schema_head_end<Frame>()>());
+	return schema_decode_rest(head, source, frame, ctx, std::integral_constant<bool, schema_has_blob<Frame>()>());
+}
+
+/*
+ * Calls visit(name, field, ...) for every field of the frames, in file
+ * order, passing the field of each of the frames. The frames must be of
+ * the same class.
+ */
+template<typename Frame, typename Visitor, typename... Frames>
+inline void schema_visit(Visitor&& visit, Frames&... frames)
+{
+	schema_visit_range<Frame>(visit, std::make_index_sequence<schema_field_count<Frame>()>(), frames...);
+}
+
+// A context that makes everything from scratch.
+struct SchemaDecodeContext {
+	bool canonical = true;
+
+	DemoString Intern(const char* text)
+	{
+		return DemoString(text);
+	}
+
+	std::shared_ptr<const DemoMoveVars> MoveVars(const char* raw)
+	{
+		auto mv = std::make_shared<DemoMoveVars>();
+		schema_decode_fixed(raw, *mv, *this);
+		return mv;
+	}
+};
+
+static_assert(schema_fixed_size<ConsoleCommandFrame>() == FRAME_CONSOLE_COMMAND_SIZE, "Console command frame size mismatch.");
+static_assert(schema_fixed_size<ClientDataFrame>() == FRAME_CLIENT_DATA_SIZE, "Client data frame size mismatch.");
+static_assert(schema_fixed_size<EventFrame>() == FRAME_EVENT_SIZE, "Event frame size mismatch.");
+static_assert(schema_fixed_size<WeaponAnimFrame>() == FRAME_WEAPON_ANIM_SIZE, "Weapon anim frame size mismatch.");
+static_assert(schema_head_size<SoundFrame>() == FRAME_SOUND_SIZE_1, "Sound frame size mismatch.");
+static_assert(schema_tail_size<SoundFrame>() == FRAME_SOUND_SIZE_2, "Sound frame size mismatch.");
+static_assert(schema_fixed_size<DemoBufferFrame>() == FRAME_DEMO_BUFFER_SIZE, "Demo buffer frame size mismatch.");
+static_assert(schema_fixed_size<DemoMoveVars>() == FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE, "Movevars size mismatch.");
+static_assert(schema_field_offset<DemoMoveVars, 17>() == FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_OFFSET, "Movevars sky name offset mismatch.");
+static_assert(schema_fixed_size<NetMsgFrame>() == FRAME_NETMSG_SIZE, "Netmsg frame size mismatch.");
+static_assert(schema_tail_size<NetMsgFrame>() == 0, "The netmsg length must end the fixed part.");
@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoSchema.hpp"
+#include "DemoSnapshot.hpp"
+
+enum {
+	SNAPSHOT_VERSION = 6,
+	// The frames used in place in the mapping start at multiples of this.
+	SNAPSHOT_ALIGNMENT = 16
+};
+
+static const char SNAPSHOT_MAGIC[8] = "HLDSNAP";
+static const char SNAPSHOT_EXTENSION[] = ".hlsnap";
+
+struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	// Changes whenever the in-memory layout of the frames does.
+	uint32_t layout;
+	DemoSnapshotKey key;
+	// The source id of the demo, 0 if the frames can't be copied from it.
+	uint64_t sourceId;
+	uint64_t entryCount;
+	// The size of the block the frames with strings, vectors or movevars are built in.
+	uint64_t arenaSize;
+};
+
+static bool ends_with(const std::string& str, const char* suffix)
+{
+	auto length = std::strlen(suffix);
+	return str.size() >= length && !str.compare(str.size() - length, length, suffix);
+}
+
+static size_t align_up(size_t offset, size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Snapshot encoding. Frames without strings or vectors are stored whole
+ * and aligned, so that they can be used in place. The others are stored
+ * in blocks between those members. Movevars and strings shared between
+ * frames are stored once.
+ */
+static_assert(std::is_trivially_copyable<DemoFrame>::value, "DemoFrame must be trivially copyable.");
+static_assert(std::is_trivially_copyable<ClientDataFrame>::value, "ClientDataFrame must be trivially copyable.");
+static_assert(std::is_trivially_copyable<EventFrame>::value, "EventFrame must be trivially copyable.");
+static_assert(std::is_trivially_copyable<WeaponAnimFrame>::value, "WeaponAnimFrame must be trivially copyable.");
+static_assert(alignof(ClientDataFrame) <= SNAPSHOT_ALIGNMENT && alignof(EventFrame) <= SNAPSHOT_ALIGNMENT
+	&& alignof(WeaponAnimFrame) <= SNAPSHOT_ALIGNMENT, "Frames used in place must fit the snapshot alignment.");
+static_assert(alignof(NetMsgFrame) <= alignof(std::max_align_t) && alignof(SoundFrame) <= alignof(std::max_align_t),
+	"Frames built in the arena must fit its alignment.");
+
+struct Block {
+	char* data;
+	size_t size;
+};
+
+// The bytes of an object from one of its members up to another one.
+static Block block(const void* from, const void* to)
+{
+	auto p = static_cast<char*>(const_cast<void*>(from));
+	return Block{ p, static_cast<size_t>(static_cast<const char*>(to) - p) };
+}
+
+static Block base_block(const DemoFrame& f)
+{
+	return block(&f, &f + 1);
+}
+
+static Block sound_block_1(const SoundFrame& f)
+{
+	return block(&f.channel, &f.channel + 1);
+}
+
+static Block sound_block_2(const SoundFrame& f)
+{
+	return block(&f.attenuation, &f.pitch + 1);
+}
+
+static Block netmsg_block_1(const NetMsgFrame& f)
+{
+	return block(&f.DemoInfo, &f.DemoInfo.MoveVars);
+}
+
+static Block netmsg_block_2(const NetMsgFrame& f)
+{
+	return block(&f.DemoInfo.view, &f.msg);
+}
+
+static Block movevars_block_1(const DemoMoveVars& mv)
+{
+	return block(&mv, &mv.skyName);
+}
+
+static Block movevars_block_2(const DemoMoveVars& mv)
+{
+	return block(&mv.rollangle, &mv.skyvec_z + 1);
+}
+
+static uint32_t layout_signature()
+{
+	SoundFrame s;
+	NetMsgFrame n;
+	DemoMoveVars mv;
+	const uint64_t sizes[] = {
+		sizeof(DemoFrame),
+		sizeof(ClientDataFrame),
+		sizeof(EventFrame),
+		sizeof(WeaponAnimFrame),
+		sound_block_1(s).size,
+		sound_block_2(s).size,
+		netmsg_block_1(n).size,
+		netmsg_block_2(n).size,
+		movevars_block_1(mv).size,
+		movevars_block_2(mv).size
+	};
+
+	return static_cast<uint32_t>(hash_bytes(reinterpret_cast<const char*>(sizes), sizeof(sizes)));
+}
+
+static void write_block(std::vector<char>& o, const Block& b)
+{
+	o.insert(o.end(), b.data, b.data + b.size);
+}
+
+static void read_block(BufferReader& r, const Block& b)
+{
+	r.Read(b.data, b.size);
+}
+
+// Marks a shared object that isn't there.
+static const uint32_t NO_SHARED = UINT32_MAX;
+
+/*
+ * Shared objects are referred to by index in the order they first appear.
+ * The index one past the known ones is followed by the new object.
+ */
+struct SharedWriter {
+	std::unordered_map<const void*, uint32_t> moveVars, strings;
+
+	// Returns true if the object has to be written next.
+	static bool WriteIndex(std::vector<char>& o, std::unordered_map<const void*, uint32_t>& ids, const void* p)
+	{
+		if (!p) {
+			write_object(o, NO_SHARED);
+			return false;
+		}
+
+		auto it = ids.find(p);
+		if (it != ids.end()) {
+			write_object(o, it->second);
+			return false;
+		}
+
+		auto id = static_cast<uint32_t>(ids.size());
+		ids.emplace(p, id);
+		write_object(o, id);
+		return true;
+	}
+
+	void WriteMoveVars(std::vector<char>& o, const std::shared_ptr<const DemoMoveVars>& mv)
+	{
+		if (!WriteIndex(o, moveVars, mv.get()))
+			return;
+
+		write_block(o, movevars_block_1(*mv));
+		write_block(o, movevars_block_2(*mv));
+		WriteString(o, mv->skyName);
+	}
+
+	void WriteString(std::vector<char>& o, const DemoString& str)
+	{
+		if (WriteIndex(o, strings, &str.str()))
+			write_blob(o, str.str());
+	}
+};
+
+struct SharedReader {
+	std::vector<std::shared_ptr<const DemoMoveVars>> moveVars;
+	std::vector<DemoString> strings;
+
+	// Returns true if a new object follows the index.
+	static bool IsNew(uint32_t id, size_t known)
+	{
+		if (id > known)
+			throw std::runtime_error("Invalid shared object index.");
+		return id == known;
+	}
+
+	std::shared_ptr<const DemoMoveVars> ReadMoveVars(BufferReader& r)
+	{
+		auto id = r.Read<uint32_t>();
+		if (id == NO_SHARED)
+			return nullptr;
+		if (!IsNew(id, moveVars.size()))
+			return moveVars[id];
+
+		auto mv = std::make_shared<DemoMoveVars>();
+		read_block(r, movevars_block_1(*mv));
+		read_block(r, movevars_block_2(*mv));
+		mv->skyName = ReadString(r);
+		moveVars.push_back(mv);
+		return mv;
+	}
+
+	DemoString ReadString(BufferReader& r)
+	{
+		auto id = r.Read<uint32_t>();
+		if (!IsNew(id, strings.size()))
+			return strings[id];
+
+		std::string str;
+		r.ReadBlob(str);
+		strings.emplace_back(str);
+		return strings.back();
+	}
+};
+
+template<typename T>
+static void write_in_place(std::vector<char>& o, const T& frame)
+{
+	o.resize(align_up(o.size(), SNAPSHOT_ALIGNMENT), '\0');
+	write_object(o, frame);
+}
+
+// Adds the room a frame built in the arena takes.
+template<typename T>
+static void reserve_frame(size_t& arenaSize)
+{
+	arenaSize = align_up(arenaSize, alignof(T)) + sizeof(T);
+}
+
+static void write_frame(std::vector<char>& o, const DemoFrame& frame, SharedWriter& shared, size_t& arenaSize)
+{
+	write_object(o, frame.type);
+
+	switch (frame.type) {
+	case DemoFrameType::DEMO_START:
+	case DemoFrameType::NEXT_SECTION:
+		write_in_place(o, frame);
+		break;
+
+	case DemoFrameType::CONSOLE_COMMAND:
+	{
+		const auto& f = static_cast<const ConsoleCommandFrame&>(frame);
+		write_block(o, base_block(f));
+		shared.WriteString(o, f.command);
+		reserve_frame<ConsoleCommandFrame>(arenaSize);
+	}
+		break;
+
+	case DemoFrameType::CLIENT_DATA:
+		write_in_place(o, static_cast<const ClientDataFrame&>(frame));
+		break;
+
+	case DemoFrameType::EVENT:
+		write_in_place(o, static_cast<const EventFrame&>(frame));
+		break;
+
+	case DemoFrameType::WEAPON_ANIM:
+		write_in_place(o, static_cast<const WeaponAnimFrame&>(frame));
+		break;
+
+	case DemoFrameType::SOUND:
+	{
+		const auto& f = static_cast<const SoundFrame&>(frame);
+		write_block(o, base_block(f));
+		write_block(o, sound_block_1(f));
+		write_block(o, sound_block_2(f));
+		write_blob(o, f.sample);
+		reserve_frame<SoundFrame>(arenaSize);
+	}
+		break;
+
+	case DemoFrameType::DEMO_BUFFER:
+	{
+		const auto& f = static_cast<const DemoBufferFrame&>(frame);
+		write_block(o, base_block(f));
+		write_blob(o, f.buffer);
+		reserve_frame<DemoBufferFrame>(arenaSize);
+	}
+		break;
+
+	default:
+	{
+		const auto& f = static_cast<const NetMsgFrame&>(frame);
+		write_block(o, base_block(f));
+		write_block(o, netmsg_block_1(f));
+		write_block(o, netmsg_block_2(f));
+		shared.WriteMoveVars(o, f.DemoInfo.MoveVars);
+		write_blob(o, f.msg);
+		reserve_frame<NetMsgFrame>(arenaSize);
+	}
+		break;
+	}
+}
+
+/*
+ * Owns the memory of the frames read from a snapshot: the mapping with
+ * the frames used in place and the arena with the others.
+ */
+struct SnapshotStorage {
+	explicit SnapshotStorage(const std::string& filename)
+		: mapping(filename, true)
+		, arenaSize(0)
+		, arenaUsed(0)
+	{
+	}
+
+	~SnapshotStorage()
+	{
+		for (const auto& frame : built) {
+			dispatch_frame_type(frame.first, [&](auto* tag) {
+				using Frame = std::remove_pointer_t<decltype(tag)>;
+				static_cast<Frame*>(frame.second)->~Frame();
+			});
+		}
+	}
+
+	SnapshotStorage(const SnapshotStorage&) = delete;
+	SnapshotStorage& operator=(const SnapshotStorage&) = delete;
+
+	MappedFile mapping;
+	std::unique_ptr<char[]> arena;
+	size_t arenaSize;
+	size_t arenaUsed;
+	// The frames built in the arena, to be destroyed with it.
+	std::vector<std::pair<DemoFrameType, DemoFrame*>> built;
+
+	void AllocateArena(size_t size)
+	{
+		arena.reset(new char[size]);
+		arenaSize = size;
+	}
+
+	// The type decides which destructor runs, so it's the one read and not the frame's own.
+	template<typename T>
+	T* Build(DemoFrameType type)
+	{
+		auto offset = align_up(arenaUsed, alignof(T));
+		if (offset > arenaSize || sizeof(T) > arenaSize - offset)
+			throw std::runtime_error("Snapshot arena too small.");
+
+		auto frame = new (arena.get() + offset) T;
+		built.emplace_back(type, frame);
+		arenaUsed = offset + sizeof(T);
+		return frame;
+	}
+};
+
+template<typename T>
+static T* view_frame(BufferReader& r, const SnapshotStorage& storage)
+{
+	auto base = storage.mapping.data;
+	auto offset = align_up(static_cast<size_t>(r.p - base), SNAPSHOT_ALIGNMENT);
+	if (offset > storage.mapping.size || sizeof(T) > storage.mapping.size - offset)
+		throw std::runtime_error("Unexpected end of data.");
+
+	r.p = base + offset + sizeof(T);
+	return reinterpret_cast<T*>(const_cast<char*>(base + offset));
+}
+
+static DemoFrame* read_frame(BufferReader& r, SharedReader& shared, SnapshotStorage& storage)
+{
+	auto type = r.Read<DemoFrameType>();
+
+	DemoFrame* frame;
+	switch (type) {
+	case DemoFrameType::DEMO_START:
+	case DemoFrameType::NEXT_SECTION:
+		frame = view_frame<DemoFrame>(r, storage);
+		break;
+
+	case DemoFrameType::CONSOLE_COMMAND:
+	{
+		auto f = storage.Build<ConsoleCommandFrame>(type);
+		read_block(r, base_block(*f));
+		f->command = shared.ReadString(r);
+		frame = f;
+	}
+		break;
+
+	case DemoFrameType::CLIENT_DATA:
+		frame = view_frame<ClientDataFrame>(r, storage);
+		break;
+
+	case DemoFrameType::EVENT:
+		frame = view_frame<EventFrame>(r, storage);
+		break;
+
+	case DemoFrameType::WEAPON_ANIM:
+		frame = view_frame<WeaponAnimFrame>(r, storage);
+		break;
+
+	case DemoFrameType::SOUND:
+	{
+		auto f = storage.Build<SoundFrame>(type);
+		read_block(r, base_block(*f));
+		read_block(r, sound_block_1(*f));
+		read_block(r, sound_block_2(*f));
+		r.ReadBlob(f->sample);
+		frame = f;
+	}
+		break;
+
+	case DemoFrameType::DEMO_BUFFER:
+	{
+		auto f = storage.Build<DemoBufferFrame>(type);
+		read_block(r, base_block(*f));
+		r.ReadBlob(f->buffer);
+		frame = f;
+	}
+		break;
+
+	default:
+	{
+		auto f = storage.Build<NetMsgFrame>(type);
+		read_block(r, base_block(*f));
+		read_block(r, netmsg_block_1(*f));
+		read_block(r, netmsg_block_2(*f));
+		f->DemoInfo.MoveVars = shared.ReadMoveVars(r);
+		r.ReadBlob(f->msg);
+		frame = f;
+	}
+		break;
+	}
+
+	// The type byte in front of the frame has to agree with the frame itself.
+	if (frame->type != type)
+		throw std::runtime_error("Invalid frame type.");
+	return frame;
+}
+
+DemoSnapshotKey DemoSnapshotCache::KeyOf(const std::string& filename)
+{
+	FileVersion version;
+	if (!file_version(filename, version))
+		throw std::runtime_error("Error opening " + filename + ".");
+
+	DemoSnapshotKey key;
+	key.device = version.device;
+	key.index = version.index;
+	key.size = version.size;
+	key.modificationTime = version.modified;
+	return key;
+}
+
+void DemoSnapshotCache::WriteSnapshot(const std::string& filename, const DemoFile& demo, const DemoSnapshotKey& key)
+{
+	std::vector<char> o;
+
+	SnapshotHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.layout = layout_signature();
+	h.key = key;
+	h.sourceId = demo.sourceId;
+	h.entryCount = demo.directoryEntries.size();
+	write_object(o, h);
+
+	write_object(o, demo.header.netProtocol);
+	write_object(o, demo.header.demoProtocol);
+	write_object(o, demo.header.mapCRC);
+	write_object(o, demo.header.directoryOffset);
+	write_blob(o, demo.header.mapName);
+	write_blob(o, demo.header.gameDir);
+
+	SharedWriter shared;
+	size_t arenaSize = 0;
+	for (const auto& entry : demo.directoryEntries) {
+		write_object(o, entry.type);
+		write_object(o, entry.flags);
+		write_object(o, entry.CDTrack);
+		write_object(o, entry.trackTime);
+		write_object(o, entry.frameCount);
+		write_object(o, entry.offset);
+		write_object(o, entry.fileLength);
+		write_blob(o, entry.description);
+
+		write_object(o, static_cast<uint64_t>(entry.frames.size()));
+		for (const auto& frame : entry.frames)
+			write_frame(o, *frame, shared, arenaSize);
+	}
+
+	reinterpret_cast<SnapshotHeader*>(o.data())->arenaSize = arenaSize;
+
+	// Write into a temporary file first so that a snapshot is never seen half-written.
+	auto temporary = temporary_filename(filename);
+	{
+		std::ofstream out(utf8_filename(temporary), std::ios::trunc | std::ios::binary);
+		out.write(o.data(), o.size());
+		out.close();
+		if (!out) {
+			remove_file(temporary);
+			throw std::runtime_error("Error writing " + temporary + ".");
+		}
+	}
+
+	if (!replace_file(temporary, filename)) {
+		remove_file(temporary);
+		throw std::runtime_error("Error writing " + filename + ".");
+	}
+}
+
+std::unique_ptr<DemoFile> DemoSnapshotCache::ReadSnapshot(const std::string& filename, const std::string& demoFilename,
+	const DemoSnapshotKey& key)
+{
+	try {
+		auto storage = std::make_shared<SnapshotStorage>(filename);
+		const auto& file = storage->mapping;
+		BufferReader r{ file.data, file.data + file.size };
+
+		auto h = r.Read<SnapshotHeader>();
+		if (std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic))
+			|| h.version != SNAPSHOT_VERSION
+			|| h.layout != layout_signature()
+			|| h.key.device != key.device
+			|| h.key.index != key.index
+			|| h.key.size != key.size
+			|| h.key.modificationTime != key.modificationTime
+			// Every entry takes at least its seven numbers.
+			|| h.entryCount > file.size / (7 * sizeof(int32_t))
+			// The frames in the arena are at most a few times bigger than what they're read from.
+			|| h.arenaSize > file.size * 4)
+			return nullptr;
+
+		storage->AllocateArena(static_cast<size_t>(h.arenaSize));
+
+		std::unique_ptr<DemoFile> demo(new DemoFile());
+		auto& header = demo->header;
+		header.netProtocol = r.Read<int32_t>();
+		header.demoProtocol = r.Read<int32_t>();
+		header.mapCRC = r.Read<int32_t>();
+		header.directoryOffset = r.Read<int32_t>();
+		r.ReadBlob(header.mapName);
+		r.ReadBlob(header.gameDir);
+
+		SharedReader shared;
+		std::vector<DemoDirectoryEntry> entries(static_cast<size_t>(h.entryCount));
+		for (size_t e = 0; e < entries.size(); ++e) {
+			auto& entry = entries[e];
+			entry.type = r.Read<int32_t>();
+			entry.flags = r.Read<int32_t>();
+			entry.CDTrack = r.Read<int32_t>();
+			entry.trackTime = r.Read<float>();
+			entry.frameCount = r.Read<int32_t>();
+			entry.offset = r.Read<int32_t>();
+			entry.fileLength = r.Read<int32_t>();
+			r.ReadBlob(entry.description);
+
+			// Every frame takes at least its type byte.
+			auto count = static_cast<size_t>(r.ReadCount(1));
+			entry.frames.reserve(count);
+			for (size_t i = 0; i < count; ++i)
+				entry.frames.emplace_back(storage, read_frame(r, shared, *storage));
+		}
+
+		if (r.p != r.end)
+			return nullptr;
+
+		demo->directoryEntries = std::move(entries);
+		demo->readFrames = true;
+
+		// The frames were read from the demo file version with this id, so Save can copy them while it still is.
+		if (h.sourceId) {
+			demo->OpenSource(demoFilename);
+			if (demo->sourceId != h.sourceId)
+				demo->source.reset();
+		}
+		return demo;
+	} catch (const std::exception&) {
+		return nullptr;
+	}
+}
+
+DemoSnapshotCache::DemoSnapshotCache(const std::string& directory, uint64_t maxSize)
+	: lastOpenHit(false)
+	, directory(directory)
+	, maxSize(maxSize)
+{
+	make_directory(directory);
+}
+
+DemoSnapshotCache::DemoSnapshotCache(const std::wstring& directory, uint64_t maxSize)
+	: DemoSnapshotCache(utf16_to_utf8(directory), maxSize)
+{
+}
+
+std::string DemoSnapshotCache::SnapshotPath(const std::string& filename) const
+{
+	auto path = full_path(filename);
+
+	char name[17];
+	std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash_bytes(path.data(), path.size())));
+	return directory + '/' + name + SNAPSHOT_EXTENSION;
+}
+
+std::unique_ptr<DemoFile> DemoSnapshotCache::Open(const std::string& filename)
+{
+	// The key is taken first, so a demo changed while it's read is stored under an outdated key.
+	auto key = KeyOf(filename);
+	auto path = SnapshotPath(filename);
+
+	auto demo = ReadSnapshot(path, filename, key);
+	lastOpenHit = static_cast<bool>(demo);
+	if (lastOpenHit) {
+		// The modification time of a snapshot is its last use.
+		touch_file(path);
+		return demo;
+	}
+
+	demo.reset(new DemoFile(filename));
+	demo->ReadFrames();
+
+	// Not being able to store the snapshot only costs speed next time.
+	try {
+		WriteSnapshot(path, *demo, key);
+		Trim();
+	} catch (const std::exception&) {
+	}
+
+	return demo;
+}
+
+std::unique_ptr<DemoFile> DemoSnapshotCache::Open(const std::wstring& filename)
+{
+	return Open(utf16_to_utf8(filename));
+}
+
+struct SnapshotFile {
+	std::string path;
+	uint64_t size;
+	int64_t time;
+};
+
+static std::vector<SnapshotFile> list_snapshots(const std::string& directory)
+{
+	std::vector<SnapshotFile> snapshots;
+
+	for (const auto& name : list_directory(directory)) {
+		if (!ends_with(name, SNAPSHOT_EXTENSION))
+			continue;
+
+		SnapshotFile s;
+		s.path = directory + '/' + name;
+		if (stat_file(s.path, s.size, s.time))
+			snapshots.push_back(s);
+	}
+
+	return snapshots;
+}
+
+void DemoSnapshotCache::Trim()
+{
+	auto snapshots = list_snapshots(directory);
+	std::sort(snapshots.begin(), snapshots.end(), [](const SnapshotFile& a, const SnapshotFile& b) {
+		return a.time > b.time;
+	});
+
+	uint64_t total = 0;
+	for (const auto& s : snapshots) {
+		total += s.size;
+		if (total > maxSize)
+			remove_file(s.path);
+	}
+}
+
+uint64_t DemoSnapshotCache::Size() const
+{
+	uint64_t total = 0;
+	for (const auto& s : list_snapshots(directory))
+		total += s.size;
+	return total;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "DemoFile.hpp"
+
+// Identifies the demo file a snapshot was made from and its version, without reading it.
+struct DemoSnapshotKey {
+	uint64_t device;
+	uint64_t index;
+	uint64_t size;
+	// Nanoseconds since the epoch.
+	int64_t modificationTime;
+};
+
+/*
+ * A cache directory of parsed demos. A snapshot holds the header, the
+ * directory and all frames in the in-memory layout of this build. The
+ * snapshot is mapped copy-on-write and the frames made of plain data
+ * are used right where they are in the mapping. The frames that own
+ * strings, vectors or shared movevars are built in one block of memory
+ * from whole blocks of the snapshot. The frames keep the mapping and
+ * that block alive for as long as any of them is.
+ *
+ * Snapshots are validated against the demo's file identity, size and
+ * modification time in nanoseconds, so a hit doesn't read the demo at
+ * all, nor decompress a compressed one. An uncompressed demo is only
+ * opened for Save to copy the frames from. The least recently used
+ * snapshots are evicted when the cache grows over its size limit.
+ *
+ * The std::string versions accept multibyte UTF-8 filenames,
+ * the std::wstring versions accept wide UTF-16 filenames.
+ */
+class DemoSnapshotCache
+{
+public:
+	// maxSize is the total size of the snapshots to keep, in bytes.
+	DemoSnapshotCache(const std::string& directory, uint64_t maxSize);
+	DemoSnapshotCache(const std::wstring& directory, uint64_t maxSize);
+
+	/*
+	 * Opens the demo with its frames read: from a matching snapshot if
+	 * there is one, otherwise with ReadFrames, storing a new snapshot.
+	 */
+	std::unique_ptr<DemoFile> Open(const std::string& filename);
+	std::unique_ptr<DemoFile> Open(const std::wstring& filename);
+
+	// Removes the least recently used snapshots until the cache fits into maxSize.
+	void Trim();
+	// The total size of the snapshots in the cache, in bytes.
+	uint64_t Size() const;
+
+	// Whether the last Open was served from a snapshot.
+	bool lastOpenHit;
+
+	static DemoSnapshotKey KeyOf(const std::string& filename);
+	static void WriteSnapshot(const std::string& filename, const DemoFile& demo, const DemoSnapshotKey& key);
+	// Returns null if the snapshot is missing, damaged, from another build or doesn't match the key.
+	static std::unique_ptr<DemoFile> ReadSnapshot(const std::string& filename, const std::string& demoFilename,
+		const DemoSnapshotKey& key);
+
+protected:
+	std::string directory;
+	uint64_t maxSize;
+
+	std::string SnapshotPath(const std::string& filename) const;
+};
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoSummary.hpp"
+
+enum {
+	SUMMARY_DATABASE_VERSION = 1
+};
+
+static const char SUMMARY_DATABASE_MAGIC[8] = { 'H', 'L', 'D', 'S', 'U', 'M', 'D', 'B' };
+
+double DemoSummary::AverageFPS() const
+{
+	return frametimeSum > 0 ? frameCount / frametimeSum : 0.0;
+}
+
+DemoSummary DemoSummaryDatabase::Summarize(const std::string& filename)
+{
+	DemoSummary s;
+	s.path = full_path(filename);
+	s.size = 0;
+	s.modificationTime = 0;
+	stat_file(s.path, s.size, s.modificationTime);
+
+	s.header = DemoHeader{ 0, 0, std::string(), std::string(), 0, 0 };
+	s.frameCount = 0;
+	s.frametimeMin = s.frametimeMax = 0;
+	s.frametimeSum = 0;
+	s.msecMin = s.msecMax = 0;
+	s.msecSum = 0;
+	s.cameraCommands = false;
+
+	try {
+		DemoFile demo(s.path);
+		s.header = demo.header;
+		demo.keepFrames = false;
+
+		auto stats = std::make_shared<FrameStatsStage>();
+		auto commands = std::make_shared<CommandScanStage>(CommandScanStage::CameraCommands());
+		DemoPipeline pipeline;
+		pipeline.AddStage(stats);
+		pipeline.AddStage(commands);
+		pipeline.Run(demo);
+
+		for (const auto& entry : demo.directoryEntries) {
+			s.entries.push_back(entry);
+			s.entries.back().frames.clear();
+		}
+
+		s.frameCount = stats->count;
+		if (stats->count) {
+			s.frametimeMin = stats->frametimeMin;
+			s.frametimeMax = stats->frametimeMax;
+			s.frametimeSum = stats->frametimeSum;
+			s.msecMin = stats->msecMin;
+			s.msecMax = stats->msecMax;
+			s.msecSum = stats->msecSum;
+		}
+		s.cameraCommands = !commands->found.empty();
+	} catch (const std::exception& ex) {
+		s.error = ex.what();
+		if (s.error.empty())
+			s.error = "Unknown error.";
+	}
+
+	return s;
+}
+
+DemoSummaryDatabase::DemoSummaryDatabase(const std::string& filename)
+	: filename(filename)
+{
+	Load();
+}
+
+DemoSummaryDatabase::DemoSummaryDatabase(const std::wstring& filename)
+	: filename(utf16_to_utf8(filename))
+{
+	Load();
+}
+
+void DemoSummaryDatabase::Load()
+{
+	uint64_t size;
+	int64_t time;
+	if (!stat_file(filename, size, time))
+		return;
+
+	MappedFile file(filename);
+	BufferReader r{ file.data, file.data + file.size };
+
+	try {
+		char magic[sizeof(SUMMARY_DATABASE_MAGIC)];
+		r.Read(magic, sizeof(magic));
+		if (std::memcmp(magic, SUMMARY_DATABASE_MAGIC, sizeof(magic)))
+			throw std::runtime_error("the signature doesn't match");
+		if (r.Read<uint32_t>() != SUMMARY_DATABASE_VERSION)
+			throw std::runtime_error("unsupported version");
+
+		// Every summary takes at least its fixed size fields.
+		summaries.resize(static_cast<size_t>(r.ReadCount(64)));
+		for (auto& s : summaries) {
+			r.ReadBlob(s.path);
+			s.size = r.Read<uint64_t>();
+			s.modificationTime = r.Read<int64_t>();
+			r.ReadBlob(s.error);
+
+			s.header.netProtocol = r.Read<int32_t>();
+			s.header.demoProtocol = r.Read<int32_t>();
+			s.header.mapCRC = r.Read<int32_t>();
+			s.header.directoryOffset = r.Read<int32_t>();
+			r.ReadBlob(s.header.mapName);
+			r.ReadBlob(s.header.gameDir);
+
+			s.entries.resize(static_cast<size_t>(r.ReadCount(DIR_ENTRY_SIZE - DIR_ENTRY_DESCRIPTION_SIZE)));
+			for (auto& entry : s.entries) {
+				entry.type = r.Read<int32_t>();
+				entry.flags = r.Read<int32_t>();
+				entry.CDTrack = r.Read<int32_t>();
+				entry.trackTime = r.Read<float>();
+				entry.frameCount = r.Read<int32_t>();
+				entry.offset = r.Read<int32_t>();
+				entry.fileLength = r.Read<int32_t>();
+				r.ReadBlob(entry.description);
+			}
+
+			s.frameCount = r.Read<uint64_t>();
+			s.frametimeMin = r.Read<float>();
+			s.frametimeMax = r.Read<float>();
+			s.frametimeSum = r.Read<double>();
+			s.msecMin = r.Read<uint8_t>();
+			s.msecMax = r.Read<uint8_t>();
+			s.msecSum = r.Read<int64_t>();
+			s.cameraCommands = r.Read<uint8_t>() != 0;
+		}
+	} catch (const std::exception& ex) {
+		throw std::runtime_error("Invalid summary database " + filename + " (" + ex.what() + ").");
+	}
+}
+
+void DemoSummaryDatabase::Save()
+{
+	std::vector<char> o;
+	o.insert(o.end(), SUMMARY_DATABASE_MAGIC, SUMMARY_DATABASE_MAGIC + sizeof(SUMMARY_DATABASE_MAGIC));
+	write_object(o, static_cast<uint32_t>(SUMMARY_DATABASE_VERSION));
+
+	write_object(o, static_cast<uint64_t>(summaries.size()));
+	for (const auto& s : summaries) {
+		write_blob(o, s.path);
+		write_object(o, s.size);
+		write_object(o, s.modificationTime);
+		write_blob(o, s.error);
+
+		write_object(o, s.header.netProtocol);
+		write_object(o, s.header.demoProtocol);
+		write_object(o, s.header.mapCRC);
+		write_object(o, s.header.directoryOffset);
+		write_blob(o, s.header.mapName);
+		write_blob(o, s.header.gameDir);
+
+		write_object(o, static_cast<uint64_t>(s.entries.size()));
+		for (const auto& entry : s.entries) {
+			write_object(o, entry.type);
+			write_object(o, entry.flags);
+			write_object(o, entry.CDTrack);
+			write_object(o, entry.trackTime);
+			write_object(o, entry.frameCount);
+			write_object(o, entry.offset);
+			write_object(o, entry.fileLength);
+			write_blob(o, entry.description);
+		}
+
+		write_object(o, s.frameCount);
+		write_object(o, s.frametimeMin);
+		write_object(o, s.frametimeMax);
+		write_object(o, s.frametimeSum);
+		write_object(o, s.msecMin);
+		write_object(o, s.msecMax);
+		write_object(o, s.msecSum);
+		write_object(o, static_cast<uint8_t>(s.cameraCommands));
+	}
+
+	// Write into a temporary file first so that the database is never left half-written.
+	auto temporary = temporary_filename(filename);
+	{
+		std::ofstream out(utf8_filename(temporary), std::ios::trunc | std::ios::binary);
+		out.write(o.data(), o.size());
+		out.close();
+		if (!out) {
+			remove_file(temporary);
+			throw std::runtime_error("Error writing " + temporary + ".");
+		}
+	}
+
+	if (!replace_file(temporary, filename)) {
+		remove_file(temporary);
+		throw std::runtime_error("Error writing " + filename + ".");
+	}
+}
+
+size_t DemoSummaryDatabase::Update(const std::vector<std::string>& filenames, unsigned threads)
+{
+	std::unordered_map<std::string, size_t> index;
+	for (size_t i = 0; i < summaries.size(); ++i)
+		index[summaries[i].path] = i;
+
+	std::vector<bool> remove(summaries.size(), false);
+	std::vector<std::string> changed;
+	std::unordered_set<std::string> seen;
+
+	for (const auto& name : filenames) {
+		auto path = full_path(name);
+		if (!seen.insert(path).second)
+			continue;
+
+		auto it = index.find(path);
+
+		uint64_t size;
+		int64_t time;
+		if (!stat_file(path, size, time)) {
+			if (it != index.end())
+				remove[it->second] = true;
+			continue;
+		}
+
+		if (it != index.end()) {
+			const auto& s = summaries[it->second];
+			if (s.size == size && s.modificationTime == time)
+				continue;
+			remove[it->second] = true;
+		}
+
+		changed.push_back(path);
+	}
+
+	std::vector<DemoSummary> fresh(changed.size());
+	parallel_for(changed.size(), threads, [&](unsigned, size_t i) {
+		fresh[i] = Summarize(changed[i]);
+	});
+
+	std::vector<DemoSummary> merged;
+	merged.reserve(summaries.size());
+	for (size_t i = 0; i < summaries.size(); ++i) {
+		if (!remove[i])
+			merged.push_back(std::move(summaries[i]));
+	}
+	for (auto& s : fresh)
+		merged.push_back(std::move(s));
+
+	std::sort(merged.begin(), merged.end(), [](const DemoSummary& a, const DemoSummary& b) {
+		return a.path < b.path;
+	});
+	summaries = std::move(merged);
+
+	return changed.size();
+}
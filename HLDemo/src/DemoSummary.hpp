@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+
+// What Listdemo shows about a demo, small enough to keep for a whole archive.
+struct DemoSummary {
+	// Absolute path, the key together with the size and the modification time.
+	std::string path;
+	uint64_t size;
+	// Seconds since the epoch.
+	int64_t modificationTime;
+
+	// Empty if the demo was read successfully.
+	std::string error;
+
+	DemoHeader header;
+	// The directory entries without their frames.
+	std::vector<DemoDirectoryEntry> entries;
+
+	// Frametime and msec statistics over all netmsg frames, see FrameStatsStage.
+	uint64_t frameCount;
+	float frametimeMin, frametimeMax;
+	double frametimeSum;
+	uint8_t msecMin, msecMax;
+	int64_t msecSum;
+
+	// Whether any camera movement commands were found.
+	bool cameraCommands;
+
+	double AverageFPS() const;
+};
+
+/*
+ * A persistent database of demo summaries. Updating it only reads
+ * the demos that are new or have changed since they were summarized.
+ *
+ * The std::string versions accept multibyte UTF-8 filenames,
+ * the std::wstring versions accept wide UTF-16 filenames.
+ */
+class DemoSummaryDatabase
+{
+public:
+	// Loads the database if the file exists.
+	DemoSummaryDatabase(const std::string& filename);
+	DemoSummaryDatabase(const std::wstring& filename);
+
+	/*
+	 * Brings the summaries of the given demos up to date, reading the new
+	 * and changed ones on the given number of threads (0 means one per core).
+	 * Demos that don't exist anymore are removed. Returns the number of
+	 * demos that were read.
+	 */
+	size_t Update(const std::vector<std::string>& filenames, unsigned threads = 0);
+	void Save();
+
+	static DemoSummary Summarize(const std::string& filename);
+
+	// Sorted by path.
+	std::vector<DemoSummary> summaries;
+
+protected:
+	std::string filename;
+
+	void Load();
+};
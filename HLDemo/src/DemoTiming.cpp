@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoTiming.hpp"
+
+static const size_t NO_ANOMALY = SIZE_MAX;
+// The anomaly went over maxAnomalies and was only counted.
+static const size_t DROPPED_ANOMALY = SIZE_MAX - 1;
+
+// msec is a byte, the engine clamps it.
+static const float MAX_MSEC = 255;
+
+TimingAnomalyStage::TimingAnomalyStage(size_t window)
+	: msecTolerance(1.5f)
+	, maxMismatches(8)
+	, maxTimeJump(0.25f)
+	, maxFPS(1010)
+	, maxAnomalies(64)
+	, frames(0)
+	, droppedAnomalies(0)
+	, window(std::max<size_t>(window, 1))
+	, entries(nullptr)
+	, currentEntry(nullptr)
+{
+	mismatchRing.resize(this->window);
+	frametimeRing.resize(this->window);
+	ResetEntry();
+}
+
+const char* TimingAnomalyStage::KindName(TimingAnomalyKind kind)
+{
+	switch (kind) {
+	case TimingAnomalyKind::MSEC_MISMATCH:
+		return "msec mismatch";
+	case TimingAnomalyKind::CLIENT_TIME_BACKWARDS:
+		return "client time backwards";
+	case TimingAnomalyKind::CLIENT_TIME_JUMP:
+		return "client time jump";
+	case TimingAnomalyKind::DEMO_TIME_BACKWARDS:
+		return "demo time backwards";
+	case TimingAnomalyKind::DEMO_TIME_JUMP:
+		return "demo time jump";
+	case TimingAnomalyKind::FPS_SPIKE:
+		return "FPS spike";
+	}
+
+	return "unknown";
+}
+
+void TimingAnomalyStage::Begin(DemoFile& demo)
+{
+	entries = demo.directoryEntries.data();
+	currentEntry = nullptr;
+	frames = 0;
+	anomalies.clear();
+	droppedAnomalies = 0;
+	ResetEntry();
+}
+
+void TimingAnomalyStage::ResetEntry()
+{
+	std::fill(mismatchRing.begin(), mismatchRing.end(), 0);
+	std::fill(frametimeRing.begin(), frametimeRing.end(), 0.0f);
+	ringPos = 0;
+	ringFill = 0;
+	mismatchCount = 0;
+	frametimeSum = 0;
+
+	havePrevious = false;
+	previousClientTime = previousDemoTime = 0;
+
+	for (size_t i = 0; i < KIND_COUNT; ++i) {
+		open[i] = NO_ANOMALY;
+		lastFlagged[i] = 0;
+	}
+}
+
+void TimingAnomalyStage::Flag(TimingAnomalyKind kind, const DemoFrame& frame, double value)
+{
+	auto k = static_cast<size_t>(kind);
+
+	if (open[k] != NO_ANOMALY && frames - lastFlagged[k] <= window) {
+		if (open[k] != DROPPED_ANOMALY) {
+			auto& a = anomalies[open[k]];
+			a.timeEnd = frame.time;
+			a.frameEnd = frame.frame;
+			a.frames++;
+			a.worst = std::max(a.worst, value);
+		}
+	} else if (anomalies.size() < maxAnomalies) {
+		TimingAnomaly a;
+		a.kind = kind;
+		a.entry = entries ? static_cast<size_t>(currentEntry - entries) : 0;
+		a.timeStart = a.timeEnd = frame.time;
+		a.frameStart = a.frameEnd = frame.frame;
+		a.frames = 1;
+		a.worst = value;
+		anomalies.push_back(a);
+		open[k] = anomalies.size() - 1;
+	} else {
+		droppedAnomalies++;
+		open[k] = DROPPED_ANOMALY;
+	}
+
+	lastFlagged[k] = frames;
+}
+
+void TimingAnomalyStage::ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame)
+{
+	if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+		return;
+
+	// Every entry has its own timeline.
+	if (&entry != currentEntry) {
+		currentEntry = &entry;
+		ResetEntry();
+	}
+
+	const auto& f = static_cast<const NetMsgFrame&>(frame);
+	auto frametime = f.DemoInfo.RefParams.frametime;
+	auto clientTime = f.DemoInfo.RefParams.time;
+	frames++;
+
+	// Slide the windows.
+	auto msecDifference = std::fabs(f.DemoInfo.UserCmd.msec - std::min(frametime * 1000, MAX_MSEC));
+	uint8_t mismatch = msecDifference > msecTolerance;
+	if (ringFill == window) {
+		mismatchCount -= mismatchRing[ringPos];
+		frametimeSum -= frametimeRing[ringPos];
+	} else {
+		ringFill++;
+	}
+	mismatchRing[ringPos] = mismatch;
+	frametimeRing[ringPos] = frametime;
+	mismatchCount += mismatch;
+	frametimeSum += frametime;
+	ringPos = (ringPos + 1) % window;
+
+	if (mismatch && mismatchCount > maxMismatches)
+		Flag(TimingAnomalyKind::MSEC_MISMATCH, frame, msecDifference);
+
+	if (ringFill == window && frametimeSum > 0) {
+		auto fps = window / frametimeSum;
+		if (fps > maxFPS)
+			Flag(TimingAnomalyKind::FPS_SPIKE, frame, fps);
+	}
+
+	if (havePrevious) {
+		auto clientStep = clientTime - previousClientTime;
+		if (clientStep < 0)
+			Flag(TimingAnomalyKind::CLIENT_TIME_BACKWARDS, frame, -clientStep);
+		else if (clientStep > frametime + maxTimeJump)
+			Flag(TimingAnomalyKind::CLIENT_TIME_JUMP, frame, clientStep);
+
+		auto demoStep = frame.time - previousDemoTime;
+		if (demoStep < 0)
+			Flag(TimingAnomalyKind::DEMO_TIME_BACKWARDS, frame, -demoStep);
+		else if (demoStep > frametime + maxTimeJump)
+			Flag(TimingAnomalyKind::DEMO_TIME_JUMP, frame, demoStep);
+	}
+
+	havePrevious = true;
+	previousClientTime = clientTime;
+	previousDemoTime = frame.time;
+}
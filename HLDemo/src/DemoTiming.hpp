@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPipeline.hpp"
+
+enum class TimingAnomalyKind {
+	// UserCmd.msec doesn't match RefParams.frametime in too many frames of a window.
+	MSEC_MISMATCH,
+	// RefParams.time went backwards.
+	CLIENT_TIME_BACKWARDS,
+	// RefParams.time advanced by much more than the frametime.
+	CLIENT_TIME_JUMP,
+	// The frame time went backwards.
+	DEMO_TIME_BACKWARDS,
+	// The frame time advanced by much more than the frametime.
+	DEMO_TIME_JUMP,
+	// The average FPS over a window went over the limit.
+	FPS_SPIKE
+};
+
+// A run of netmsg frames flagged for the same reason.
+struct TimingAnomaly {
+	TimingAnomalyKind kind;
+	// Index into DemoFile::directoryEntries.
+	size_t entry;
+	float timeStart, timeEnd;
+	int32_t frameStart, frameEnd;
+	// The number of flagged frames.
+	size_t frames;
+	/*
+	 * The largest msec difference in milliseconds, time step in seconds
+	 * or window FPS, depending on the kind.
+	 */
+	double worst;
+};
+
+/*
+ * Checks the timing of the netmsg frames as they stream by, using
+ * fixed-size sliding windows, so the memory use doesn't depend on the
+ * demo length. Meant to run with DemoFile::keepFrames cleared.
+ *
+ * Flagged frames of the same kind closer than a window apart are
+ * reported as one anomaly.
+ */
+class TimingAnomalyStage : public DemoStage
+{
+public:
+	TimingAnomalyStage(size_t window = 64);
+	void Begin(DemoFile& demo) override;
+	void ProcessFrame(DemoDirectoryEntry& entry, DemoFrame& frame) override;
+
+	static const char* KindName(TimingAnomalyKind kind);
+
+	// Thresholds, can be changed before the first frame.
+	// The largest difference between msec and frametime that's fine, in milliseconds.
+	float msecTolerance;
+	// How many mismatching frames a window may have.
+	size_t maxMismatches;
+	// How much more than the frametime the time may advance by, in seconds.
+	float maxTimeJump;
+	float maxFPS;
+	// At most this many anomalies are stored, the rest are only counted.
+	size_t maxAnomalies;
+
+	size_t frames;
+	std::vector<TimingAnomaly> anomalies;
+	size_t droppedAnomalies;
+
+protected:
+	size_t window;
+	const DemoDirectoryEntry* entries;
+	const DemoDirectoryEntry* currentEntry;
+
+	// Ring buffers over the last window frames.
+	std::vector<uint8_t> mismatchRing;
+	std::vector<float> frametimeRing;
+	size_t ringPos, ringFill;
+	size_t mismatchCount;
+	double frametimeSum;
+
+	bool havePrevious;
+	float previousClientTime, previousDemoTime;
+
+	// Per kind: the anomaly being extended and the frame it was last flagged at.
+	static const size_t KIND_COUNT = 6;
+	size_t open[KIND_COUNT];
+	size_t lastFlagged[KIND_COUNT];
+
+	void ResetEntry();
+	void Flag(TimingAnomalyKind kind, const DemoFrame& frame, double value);
+};
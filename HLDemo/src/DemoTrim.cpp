@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoWriter.hpp"
+
+enum {
+	// Most frames are small, so the headers are walked over chunks read in one go.
+	TRIM_SCAN_CHUNK_SIZE = 64 * 1024,
+	TRIM_COPY_CHUNK_SIZE = 1 << 20
+};
+
+// Reads small pieces of the demo through a chunk buffer, moving it forward as needed.
+class TrimReader
+{
+public:
+	TrimReader(std::istream& demo, std::streamoff demoSize)
+		: demo(demo)
+		, demoSize(demoSize)
+		, bufStart(0)
+	{
+	}
+
+	bool Read(std::streamoff offset, void* dst, std::streamoff size)
+	{
+		if (offset < 0 || demoSize - size < offset)
+			return false;
+
+		if (offset < bufStart || offset + size > bufStart + static_cast<std::streamoff>(buf.size())) {
+			// A frame larger than the chunk is skipped over without reading its payload.
+			auto chunk = std::min<std::streamoff>(TRIM_SCAN_CHUNK_SIZE, demoSize - offset);
+			buf.resize(static_cast<size_t>(chunk));
+			bufStart = offset;
+
+			demo.clear();
+			demo.seekg(offset, std::ios::beg);
+			demo.read(buf.data(), chunk);
+			if (!demo) {
+				buf.clear();
+				return false;
+			}
+		}
+
+		std::memcpy(dst, buf.data() + (offset - bufStart), static_cast<size_t>(size));
+		return true;
+	}
+
+protected:
+	std::istream& demo;
+	std::streamoff demoSize;
+	std::vector<char> buf;
+	std::streamoff bufStart;
+};
+
+void DemoFile::Trim(const std::string& filename, float from, float to)
+{
+	// The frames are copied from the demo file while the output is written.
+	if (!sourceFilename.empty() && same_file(sourceFilename, filename))
+		throw std::runtime_error("The trimmed demo can't replace the demo itself.");
+
+	std::ofstream o(utf8_filename(filename), std::ios::trunc | std::ios::binary);
+	if (!o)
+		throw std::runtime_error("Error opening the output file.");
+
+	try {
+		Trim(o, from, to);
+		o.close();
+		if (!o)
+			throw std::runtime_error("Error writing the output file.");
+	} catch (...) {
+		o.close();
+		remove_file(filename);
+		throw;
+	}
+}
+
+void DemoFile::Trim(const std::wstring& filename, float from, float to)
+{
+	Trim(utf16_to_utf8(filename), from, to);
+}
+
+void DemoFile::Trim(std::ostream& o, float from, float to)
+{
+	if (readFrames)
+		throw std::runtime_error("Trimming needs the demo file, which is closed once the frames are read.");
+	if (header.demoProtocol != 5)
+		throw std::runtime_error("Only demo protocol 5 is supported.");
+
+	std::vector<TrimRange> ranges;
+	ComputeTrimRanges(from, to, ranges);
+
+	auto directoryOffset = static_cast<int64_t>(HEADER_SIZE);
+	for (const auto& range : ranges) {
+		directoryOffset += range.size;
+		if (range.addDemoStart)
+			directoryOffset += FRAME_HEADER_SIZE;
+		if (range.addNextSection)
+			directoryOffset += FRAME_HEADER_SIZE;
+	}
+	if (directoryOffset > INT32_MAX)
+		throw std::runtime_error("The trimmed demo is too large.");
+
+	std::vector<char> buf;
+	DemoWriter::EncodeHeader(buf, header, static_cast<int32_t>(directoryOffset));
+	o.write(buf.data(), buf.size());
+
+	auto write_marker = [&](DemoFrameType type, const TrimFrame& at) {
+		DemoFrame frame;
+		frame.type = type;
+		frame.time = at.time;
+		frame.frame = at.frame;
+
+		buf.clear();
+		DemoWriter::EncodeFrame(buf, frame);
+		o.write(buf.data(), buf.size());
+	};
+
+	std::vector<DemoDirectoryEntry> directory;
+	auto offset = static_cast<int64_t>(HEADER_SIZE);
+	for (const auto& range : ranges) {
+		const auto& source = directoryEntries[range.entry];
+
+		DemoDirectoryEntry entry;
+		entry.type = source.type;
+		entry.description = source.description;
+		entry.flags = source.flags;
+		entry.CDTrack = source.CDTrack;
+		entry.trackTime = source.trackTime;
+		entry.frameCount = source.frameCount;
+		entry.offset = static_cast<int32_t>(offset);
+
+		if (range.addDemoStart)
+			write_marker(DemoFrameType::DEMO_START, range.first);
+
+		buf.resize(static_cast<size_t>(std::min<std::streamoff>(TRIM_COPY_CHUNK_SIZE, range.size)));
+		demo.clear();
+		demo.seekg(range.offset, std::ios::beg);
+		for (std::streamoff done = 0; done < range.size; ) {
+			if (cancellation && cancellation->IsCancelled())
+				throw DemoCancelled();
+
+			auto chunk = std::min<std::streamoff>(static_cast<std::streamoff>(buf.size()), range.size - done);
+			demo.read(buf.data(), chunk);
+			if (!demo)
+				throw std::runtime_error("Error reading the demo file.");
+			o.write(buf.data(), chunk);
+			done += chunk;
+		}
+
+		if (range.addNextSection)
+			write_marker(DemoFrameType::NEXT_SECTION, range.last);
+
+		auto length = range.size + (range.addDemoStart ? FRAME_HEADER_SIZE : 0) + (range.addNextSection ? FRAME_HEADER_SIZE : 0);
+		entry.fileLength = static_cast<int32_t>(length);
+		if (!range.whole) {
+			entry.trackTime = range.last.time - range.first.time;
+			entry.frameCount = range.netMsgFrames;
+		}
+		directory.push_back(entry);
+
+		offset += length;
+		if (!o)
+			throw std::runtime_error("Error writing the output file.");
+	}
+
+	buf.clear();
+	DemoWriter::EncodeDirectory(buf, directory);
+	o.write(buf.data(), buf.size());
+	if (!o)
+		throw std::runtime_error("Error writing the output file.");
+}
+
+void DemoFile::ComputeTrimRanges(float from, float to, std::vector<TrimRange>& ranges)
+{
+	TrimReader reader(demo, demoSize);
+	bool kept = false;
+
+	for (size_t i = 0; i < directoryEntries.size(); ++i) {
+		const auto& entry = directoryEntries[i];
+		if (entry.offset < 0 || demoSize < entry.offset)
+			continue;
+
+		TrimRange range = {};
+		range.entry = i;
+		range.whole = (entry.type == 0);
+		range.offset = entry.offset;
+		range.addNextSection = true;
+
+		auto corrupt = [&]() {
+			return std::runtime_error("Error trimming the demo: corrupt frame in entry " + std::to_string(i + 1)
+				+ ", try recovering it first.");
+		};
+
+		bool started = range.whole;
+		auto end = EntryScanEnd(entry);
+		auto pos = range.offset;
+		while (end - std::streamoff{ FRAME_HEADER_SIZE } >= pos) {
+			if (cancellation && cancellation->IsCancelled())
+				throw DemoCancelled();
+
+			char h[FRAME_HEADER_SIZE];
+			if (!reader.Read(pos, h, sizeof(h)))
+				throw corrupt();
+
+			DemoFrameType type;
+			TrimFrame at;
+			std::memcpy(&type, h, 1);
+			std::memcpy(&at.time, h + 1, 4);
+			std::memcpy(&at.frame, h + 5, 4);
+
+			int64_t fixed, lengthOffset;
+			frame_layout(type, fixed, lengthOffset);
+
+			int32_t length = 0;
+			if (lengthOffset >= 0) {
+				if (!reader.Read(pos + FRAME_HEADER_SIZE + lengthOffset, &length, sizeof(length))
+					|| length < 0 || length > frame_max_length(type))
+					throw corrupt();
+			}
+
+			auto size = std::streamoff{ FRAME_HEADER_SIZE } + fixed + length;
+			if (end - size < pos)
+				throw corrupt();
+
+			if (!range.whole) {
+				// The cut entry gets a NEXT_SECTION of its own, and frames are assumed to be in time order.
+				if (type == DemoFrameType::NEXT_SECTION || at.time > to)
+					break;
+				if (!started && at.time < from) {
+					pos += size;
+					continue;
+				}
+			}
+
+			if (!started || pos == range.offset) {
+				started = true;
+				range.offset = pos;
+				range.first = at;
+				range.addDemoStart = !range.whole && type != DemoFrameType::DEMO_START;
+			}
+			range.last = at;
+			if (static_cast<int>(type) < 2 || static_cast<int>(type) > 9)
+				range.netMsgFrames++;
+
+			pos += size;
+			if (type == DemoFrameType::NEXT_SECTION) {
+				range.addNextSection = false;
+				break;
+			}
+		}
+
+		if (started) {
+			range.size = pos - range.offset;
+			ranges.push_back(range);
+			kept = kept || !range.whole;
+		}
+	}
+
+	if (!kept)
+		throw std::runtime_error("There are no frames between the given times.");
+}
@@ -0,0 +1,219 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+#include "DemoSchema.hpp"
+#include "DemoWriter.hpp"
+
+enum {
+	// The buffer is flushed to the file once it grows past this size.
+	WRITE_BUFFER_SIZE = 1 << 20
+};
+
+DemoWriter::DemoWriter(const std::string& filename, const DemoHeader& header)
+	: file(utf8_filename(filename), std::ios::trunc | std::ios::binary)
+{
+	ConstructorInternal(header);
+}
+
+DemoWriter::DemoWriter(const std::wstring& filename, const DemoHeader& header)
+	: file(utf16_filename(filename), std::ios::trunc | std::ios::binary)
+{
+	ConstructorInternal(header);
+}
+
+DemoWriter::DemoWriter(std::ofstream o, const DemoHeader& header)
+	: file(std::move(o))
+{
+	ConstructorInternal(header);
+}
+
+void DemoWriter::ConstructorInternal(const DemoHeader& header)
+{
+	if (!file)
+		throw std::runtime_error("Error opening the output file.");
+
+	flushed = 0;
+	directoryOffset = 0;
+	inEntry = false;
+	updateCounts = false;
+	wroteNextSection = false;
+	closed = false;
+	buffer.reserve(WRITE_BUFFER_SIZE);
+
+	// The directory offset is patched in on Close().
+	EncodeHeader(buffer, header, 0);
+}
+
+int64_t DemoWriter::Position() const
+{
+	return flushed + static_cast<int64_t>(buffer.size());
+}
+
+int32_t DemoWriter::Offset() const
+{
+	auto position = Position();
+	if (position > INT32_MAX)
+		throw std::runtime_error("The demo is too big to be saved.");
+	return static_cast<int32_t>(position);
+}
+
+void DemoWriter::Flush()
+{
+	file.write(buffer.data(), buffer.size());
+	if (!file)
+		throw std::runtime_error("Error writing the output file.");
+
+	flushed += buffer.size();
+	buffer.clear();
+}
+
+void DemoWriter::BeginEntry(const DemoDirectoryEntry& entry, bool updateCounts)
+{
+	if (closed)
+		throw std::logic_error("The demo writer is closed.");
+	if (inEntry)
+		EndEntry();
+
+	DemoDirectoryEntry e;
+	e.type = entry.type;
+	e.description = entry.description;
+	e.flags = entry.flags;
+	e.CDTrack = entry.CDTrack;
+	e.trackTime = entry.trackTime;
+	e.frameCount = updateCounts ? 0 : entry.frameCount;
+	e.offset = Offset();
+	e.fileLength = entry.fileLength;
+	directory.push_back(std::move(e));
+
+	inEntry = true;
+	this->updateCounts = updateCounts;
+	wroteNextSection = false;
+}
+
+void DemoWriter::WriteFrame(const DemoFrame& frame)
+{
+	if (!inEntry)
+		throw std::logic_error("Frames can only be written inside of an entry.");
+
+	EncodeFrame(buffer, frame);
+	// Stop right away rather than writing what can't be addressed.
+	Offset();
+
+	if (frame.type == DemoFrameType::NEXT_SECTION)
+		wroteNextSection = true;
+	if (updateCounts && (static_cast<int>(frame.type) < 2 || static_cast<int>(frame.type) > 9))
+		directory.back().frameCount++;
+
+	if (buffer.size() >= WRITE_BUFFER_SIZE)
+		Flush();
+}
+
+void DemoWriter::EndEntry()
+{
+	if (!inEntry)
+		return;
+
+	// We need to write at least one NextSectionFrame, otherwise
+	// the engine might break trying to play back the demo.
+	if (!wroteNextSection) {
+		DemoFrame f;
+		f.type = DemoFrameType::NEXT_SECTION;
+		f.time = 0;
+		f.frame = 0;
+		EncodeFrame(buffer, f);
+	}
+
+	auto& entry = directory.back();
+	if (updateCounts)
+		entry.fileLength = Offset() - entry.offset;
+
+	inEntry = false;
+}
+
+void DemoWriter::Close()
+{
+	if (closed)
+		return;
+
+	EndEntry();
+
+	directoryOffset = Offset();
+	EncodeDirectory(buffer, directory);
+	Flush();
+
+	file.seekp(HEADER_SIZE - 4, std::ios::beg);
+	file.write(reinterpret_cast<const char*>(&directoryOffset), sizeof(directoryOffset));
+	file.close();
+	if (!file)
+		throw std::runtime_error("Error writing the output file.");
+
+	closed = true;
+}
+
+const std::vector<DemoDirectoryEntry>& DemoWriter::Directory() const
+{
+	return directory;
+}
+
+int32_t DemoWriter::DirectoryOffset() const
+{
+	return directoryOffset;
+}
+
+void DemoWriter::EncodeHeader(std::vector<char>& o, const DemoHeader& header, int32_t directoryOffset)
+{
+	char signature[] = { 'H', 'L', 'D', 'E', 'M', 'O', '\0', '\0' };
+	o.insert(o.end(), signature, signature + sizeof(signature));
+	write_object(o, header.demoProtocol);
+	write_object(o, header.netProtocol);
+	write_string(o, header.mapName, HEADER_MAPNAME_SIZE);
+	write_string(o, header.gameDir, HEADER_GAMEDIR_SIZE);
+	write_object(o, header.mapCRC);
+	write_object(o, directoryOffset);
+}
+
+void DemoWriter::EncodeDirectory(std::vector<char>& o, const std::vector<DemoDirectoryEntry>& entries)
+{
+	write_object(o, static_cast<int32_t>(entries.size()));
+	for (const auto& entry : entries) {
+		write_object(o, entry.type);
+		write_string(o, entry.description, DIR_ENTRY_DESCRIPTION_SIZE);
+		write_object(o, entry.flags);
+		write_object(o, entry.CDTrack);
+		write_object(o, entry.trackTime);
+		write_object(o, entry.frameCount);
+		write_object(o, entry.offset);
+		write_object(o, entry.fileLength);
+	}
+}
+
+size_t DemoWriter::EncodedFrameSize(const DemoFrame& frame)
+{
+	return dispatch_frame_type(frame.type, [&](auto* tag) {
+		using T = std::remove_pointer_t<decltype(tag)>;
+		return FRAME_HEADER_SIZE + schema_encoded_size(static_cast<const T&>(frame));
+	});
+}
+
+void DemoWriter::EncodeFrame(std::vector<char>& o, const DemoFrame& frame)
+{
+	dispatch_frame_type(frame.type, [&](auto* tag) {
+		using T = std::remove_pointer_t<decltype(tag)>;
+		const auto& f = static_cast<const T&>(frame);
+
+		auto start = o.size();
+		o.resize(start + FRAME_HEADER_SIZE + schema_encoded_size(f));
+		auto p = o.data() + start;
+		std::memcpy(p, &frame.type, sizeof(frame.type));
+		std::memcpy(p + 1, &frame.time, sizeof(frame.time));
+		std::memcpy(p + 5, &frame.frame, sizeof(frame.frame));
+		schema_encode(p + FRAME_HEADER_SIZE, f);
+	});
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFrame.hpp"
+
+/*
+ * Writes a demo incrementally: the header goes out on construction,
+ * then the entries one frame at a time, and the directory on Close().
+ * Only the output buffer is kept in memory, so demos of any size
+ * can be produced without holding all of their frames.
+ *
+ * The std::string versions accept multibyte UTF-8 filenames,
+ * the std::wstring versions accept wide UTF-16 filenames.
+ */
+class DemoWriter
+{
+public:
+	DemoWriter(const std::string& filename, const DemoHeader& header);
+	DemoWriter(const std::wstring& filename, const DemoHeader& header);
+	DemoWriter(std::ofstream o, const DemoHeader& header);
+
+	/*
+	 * Starts a new directory entry with the metadata of the given one,
+	 * its frames are ignored. If updateCounts is set, frameCount and
+	 * fileLength are filled in from what gets written: the number of
+	 * netmsg frames (one per engine frame) and the number of bytes.
+	 */
+	void BeginEntry(const DemoDirectoryEntry& entry, bool updateCounts = false);
+	void WriteFrame(const DemoFrame& frame);
+	// Terminates the entry with a NEXT_SECTION frame if it doesn't have one.
+	void EndEntry();
+
+	// Writes the directory, patches the header and closes the file.
+	void Close();
+
+	// The entries written so far, without frames, with their offsets filled in.
+	const std::vector<DemoDirectoryEntry>& Directory() const;
+	int32_t DirectoryOffset() const;
+
+	// Append the encoded header and directory to the buffer.
+	static void EncodeHeader(std::vector<char>& o, const DemoHeader& header, int32_t directoryOffset);
+	static void EncodeDirectory(std::vector<char>& o, const std::vector<DemoDirectoryEntry>& entries);
+	// Appends the encoded frame to the buffer.
+	static void EncodeFrame(std::vector<char>& o, const DemoFrame& frame);
+	// The exact number of bytes EncodeFrame appends for the frame.
+	static size_t EncodedFrameSize(const DemoFrame& frame);
+
+protected:
+	std::ofstream file;
+	std::vector<char> buffer;
+	// Bytes written to the file so far, not counting the buffer.
+	int64_t flushed;
+
+	std::vector<DemoDirectoryEntry> directory;
+	int32_t directoryOffset;
+	bool inEntry;
+	bool updateCounts;
+	bool wroteNextSection;
+	bool closed;
+
+	void ConstructorInternal(const DemoHeader& header);
+	int64_t Position() const;
+	// The position as a demo file offset, throws if it doesn't fit.
+	int32_t Offset() const;
+	void Flush();
+};
@@ -0,0 +1,154 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "DemoAngles.hpp"
+#include "DemoFile.hpp"
+#include "DemoKernels.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tAngleTransform <path to demo.dem> <operations...> [-o <path to output.dem>]"
+		"\n\t\t- Apply the operations to the view angles in the given order,"
+		"\n\t\t  save the result into output.dem or <demo>_angles.dem."
+		"\n\t\t  If output.dem is -, write the result to the standard output."
+		"\n\nOperations (<axis> is pitch, yaw or roll):"
+		"\n\t-set <axis> <degrees>\t\tset the angle."
+		"\n\t-offset <axis> <degrees>\tadd to the angle, -offset yaw turns the view."
+		"\n\t-normalize <axis>\t\twrap the angle into [-180, 180]."
+		"\n\t-smooth <axis> <frames>\t\taverage the angle over this many frames on either side."
+		"\n\t-rotate <axis> <degrees>\trotate the whole view around the world's vertical (yaw),"
+		"\n\t\t\t\t\tside (pitch) or forward (roll) axis."
+		"\n\t-range <from> <to>\t\tapply the following operations only to the frames"
+		"\n\t\t\t\t\tbetween these times, in seconds."
+		"\n\t-all\t\t\t\tapply the following operations to all frames again."
+		<< std::endl;
+}
+
+static bool parse_axis(const char* name, DemoAngleAxis& axis)
+{
+	if (!std::strcmp(name, "pitch"))
+		axis = DemoAngleAxis::PITCH;
+	else if (!std::strcmp(name, "yaw"))
+		axis = DemoAngleAxis::YAW;
+	else if (!std::strcmp(name, "roll"))
+		axis = DemoAngleAxis::ROLL;
+	else
+		return false;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+
+	std::string input = argv[1];
+	std::string output;
+	std::vector<DemoAngleTransform> transforms;
+	float from = 0, to = 0;
+	auto allFrames = true;
+
+	for (int i = 2; i < argc; ++i) {
+		DemoAngleTransform t;
+		t.value = 0;
+		t.from = from;
+		t.to = to;
+		t.allFrames = allFrames;
+
+		auto option = argv[i];
+		auto left = argc - i - 1;
+		if (!std::strcmp(option, "-o") && left >= 1) {
+			output = argv[++i];
+			continue;
+		} else if (!std::strcmp(option, "-range") && left >= 2) {
+			from = static_cast<float>(std::atof(argv[++i]));
+			to = static_cast<float>(std::atof(argv[++i]));
+			allFrames = false;
+			continue;
+		} else if (!std::strcmp(option, "-all")) {
+			allFrames = true;
+			continue;
+		} else if (!std::strcmp(option, "-set") && left >= 2) {
+			t.operation = DemoAngleOperation::SET;
+		} else if (!std::strcmp(option, "-offset") && left >= 2) {
+			t.operation = DemoAngleOperation::OFFSET;
+		} else if (!std::strcmp(option, "-smooth") && left >= 2) {
+			t.operation = DemoAngleOperation::SMOOTH;
+		} else if (!std::strcmp(option, "-rotate") && left >= 2) {
+			t.operation = DemoAngleOperation::ROTATE;
+		} else if (!std::strcmp(option, "-normalize") && left >= 1) {
+			t.operation = DemoAngleOperation::NORMALIZE;
+		} else {
+			usage();
+			return 1;
+		}
+
+		if (!parse_axis(argv[++i], t.axis)) {
+			usage();
+			return 1;
+		}
+		if (t.operation != DemoAngleOperation::NORMALIZE)
+			t.value = static_cast<float>(std::atof(argv[++i]));
+		transforms.push_back(t);
+	}
+
+	if (transforms.empty()) {
+		usage();
+		return 1;
+	}
+
+	// When the demo goes to stdout, the messages go to stderr.
+	auto toStdout = (output == "-");
+	auto& out = toStdout ? nowide::cerr : nowide::cout;
+
+	try {
+		DemoFile demo(input);
+		out << "Transforming the angles in " << input << "..." << std::endl;
+		demo.ReadFrames();
+
+		auto changed = TransformAngles(demo, transforms);
+		out << "Changed " << changed << " frames with the " << KernelPathName(ActiveKernelPath()) << " kernels." << std::endl;
+
+		if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			demo.Save(std::cout);
+		} else {
+			if (output.empty()) {
+				output = input;
+				auto dot = output.rfind('.');
+				if (dot != std::string::npos) {
+					output = output.substr(0, dot) + "_angles" + output.substr(dot);
+				} else {
+					output += "_angles";
+				}
+			}
+
+			demo.Save(output);
+		}
+
+		out << "Done." << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoCommandIndex.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tCommandIndex build <path to index> [-threads <count>] [-list <path to list.txt>] <paths to demos...>"
+		"\n\t\t- Add the console commands of the demos to the index, reading only the new or changed demos."
+		"\n\t\t  -list adds the demos listed in the file, one per line."
+		"\n\tCommandIndex query <path to index> [-prefix] <command>"
+		"\n\t\t- List the places where the command was used, or any command starting with it with -prefix."
+		<< std::endl;
+}
+
+static int build(int argc, char *argv[])
+{
+	std::vector<std::string> demos;
+	unsigned threads = 0;
+
+	for (int i = 3; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+		} else if (!std::strcmp(argv[i], "-list") && i + 1 < argc) {
+			nowide::ifstream list(argv[++i]);
+			if (!list) {
+				nowide::cerr << "Error opening " << argv[i] << "." << std::endl;
+				return 1;
+			}
+
+			std::string line;
+			while (std::getline(list, line)) {
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if (!line.empty())
+					demos.push_back(line);
+			}
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	DemoCommandIndex index(argv[2]);
+	auto read = index.Update(demos, threads);
+	index.Save();
+
+	for (const auto& demo : index.demos) {
+		if (!demo.error.empty())
+			nowide::cerr << demo.path << ": error: " << demo.error << '\n';
+	}
+	nowide::cout << "Read " << read << " new or changed demos out of " << demos.size()
+		<< ", the index has " << index.demos.size() << " demos." << std::endl;
+
+	return 0;
+}
+
+static int query(int argc, char *argv[])
+{
+	bool prefix = false;
+	std::string command;
+
+	for (int i = 3; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-prefix")) {
+			prefix = true;
+		} else if (command.empty()) {
+			command = argv[i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (command.empty()) {
+		usage();
+		return 1;
+	}
+
+	DemoCommandIndex index(argv[2]);
+	auto occurrences = index.Find(command, prefix);
+
+	size_t demos = 0;
+	for (size_t i = 0; i < occurrences.size(); ++i) {
+		const auto& o = occurrences[i];
+		if (i == 0 || o.demo != occurrences[i - 1].demo)
+			++demos;
+
+		nowide::cout << index.demos[o.demo].path << '\t' << (o.entry + 1) << '\t'
+			<< o.time << "s\t" << o.frame << '\t' << o.command << '\n';
+	}
+	nowide::cout << occurrences.size() << " occurrences in " << demos << " demos." << std::endl;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 4) {
+		usage();
+		return 1;
+	}
+
+	try {
+		if (!std::strcmp(argv[1], "build"))
+			return build(argc, argv);
+		if (!std::strcmp(argv[1], "query"))
+			return query(argc, argv);
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	usage();
+	return 1;
+}
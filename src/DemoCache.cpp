@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoSnapshot.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoCache <path to cache directory> [-max <megabytes>] <paths to demos...>"
+		"\n\t\t- Load the demos through the snapshot cache, storing snapshots of the ones not in it yet."
+		"\n\t\t  The least recently used snapshots are removed once the cache grows over"
+		"\n\t\t  the given size (1024 MB by default)."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	uint64_t maxSize = 1024;
+	std::vector<std::string> demos;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-max") && i + 1 < argc) {
+			maxSize = std::strtoull(argv[++i], nullptr, 10);
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.empty()) {
+		usage();
+		return 1;
+	}
+
+	try {
+		DemoSnapshotCache cache(argv[1], maxSize * 1024 * 1024);
+
+		for (const auto& filename : demos) {
+			try {
+				auto start = std::chrono::steady_clock::now();
+				auto demo = cache.Open(filename);
+				auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+				size_t frames = 0;
+				for (const auto& entry : demo->directoryEntries)
+					frames += entry.frames.size();
+
+				nowide::cout << filename << ": " << (cache.lastOpenHit ? "loaded from the snapshot" : "parsed and stored")
+					<< " in " << (elapsed.count() / 1000.0) << " ms, " << frames << " frames." << std::endl;
+			} catch (const std::exception& ex) {
+				nowide::cerr << filename << ": error: " << ex.what() << std::endl;
+			}
+		}
+
+		cache.Trim();
+		nowide::cout << "Cache size: " << cache.Size() << " bytes." << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+#include <cstring>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoDiff.hpp"
+
+namespace nowide = boost::nowide;
+
+static const char* frame_type_name(DemoFrameType type)
+{
+	switch (type) {
+	case DemoFrameType::DEMO_START: return "DEMO_START";
+	case DemoFrameType::CONSOLE_COMMAND: return "CONSOLE_COMMAND";
+	case DemoFrameType::CLIENT_DATA: return "CLIENT_DATA";
+	case DemoFrameType::NEXT_SECTION: return "NEXT_SECTION";
+	case DemoFrameType::EVENT: return "EVENT";
+	case DemoFrameType::WEAPON_ANIM: return "WEAPON_ANIM";
+	case DemoFrameType::SOUND: return "SOUND";
+	case DemoFrameType::DEMO_BUFFER: return "DEMO_BUFFER";
+	default: return "NETMSG";
+	}
+}
+
+static void print_tally(const char* name, const DemoDiffTally& tally)
+{
+	nowide::cout << name << '\t' << tally.identical << '\t' << tally.changed << '\t'
+		<< tally.onlyInFirst << '\t' << tally.onlyInSecond << '\n';
+}
+
+static void print_divergence(const DemoDivergence& d)
+{
+	nowide::cout << "First difference: ";
+	switch (d.place) {
+	case DemoDivergencePlace::HEADER:
+		nowide::cout << "header\n";
+		break;
+
+	case DemoDivergencePlace::ENTRY:
+		nowide::cout << "entry " << (d.entry + 1) << '\n';
+		break;
+
+	case DemoDivergencePlace::FRAME:
+		nowide::cout << "entry " << (d.entry + 1) << ", frame ";
+		if (d.firstFrame != DemoDiff::NO_FRAME)
+			nowide::cout << '#' << d.firstFrame;
+		else
+			nowide::cout << '-';
+		nowide::cout << " / ";
+		if (d.secondFrame != DemoDiff::NO_FRAME)
+			nowide::cout << '#' << d.secondFrame;
+		else
+			nowide::cout << '-';
+		nowide::cout << " (f: " << d.frame << " t: " << d.time << ' ' << frame_type_name(d.type) << ")\n";
+
+		if (d.firstFrame == DemoDiff::NO_FRAME)
+			nowide::cout << "\tonly in the second demo\n";
+		else if (d.secondFrame == DemoDiff::NO_FRAME)
+			nowide::cout << "\tonly in the first demo\n";
+		break;
+	}
+
+	for (const auto& field : d.fields)
+		nowide::cout << '\t' << field.name << ": " << field.first << " -> " << field.second << '\n';
+}
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoDiff <path to first.dem> <path to second.dem>"
+		"\n\t\t- Compare the two demos frame by frame and show the first difference"
+		"\n\t\t  and how many frames of each type are identical, changed or only in one of them."
+		"\n\t\t  Exits with 0 if the demos are identical, 1 if they differ and 2 on errors."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc != 3) {
+		usage();
+		return 2;
+	}
+
+	try {
+		DemoDiff diff{ std::string(argv[1]), std::string(argv[2]) };
+
+		nowide::cout.precision(8);
+		nowide::cout.setf(std::ios::fixed);
+
+		if (diff.Identical())
+			nowide::cout << "The demos are identical.\n";
+		else
+			print_divergence(diff.divergence);
+
+		nowide::cout << "\nType\tIdentical\tChanged\tOnly in first\tOnly in second\n";
+		#define t(name) \
+			print_tally(#name, diff.frameTypes[static_cast<uint8_t>(DemoFrameType::name)]);
+		t(DEMO_START);
+		t(CONSOLE_COMMAND);
+		t(CLIENT_DATA);
+		t(NEXT_SECTION);
+		t(EVENT);
+		t(WEAPON_ANIM);
+		t(SOUND);
+		t(DEMO_BUFFER);
+		#undef t
+
+		DemoDiffTally netmsg = { 0, 0, 0, 0 };
+		for (size_t i = 0; i < 256; ++i) {
+			if (i < 2 || i > 9) {
+				netmsg.identical += diff.frameTypes[i].identical;
+				netmsg.changed += diff.frameTypes[i].changed;
+				netmsg.onlyInFirst += diff.frameTypes[i].onlyInFirst;
+				netmsg.onlyInSecond += diff.frameTypes[i].onlyInSecond;
+			}
+		}
+		print_tally("NETMSG", netmsg);
+
+		nowide::cout << '\n';
+		print_tally("Total", diff.total);
+		nowide::cout << "Skipped " << diff.bytesSkipped << " identical bytes without comparing the fields." << std::endl;
+
+		return diff.Identical() ? 0 : 1;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 2;
+	}
+}
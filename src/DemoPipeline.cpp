@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/cstdio.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoKernels.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoPlatform.hpp"
+#include "DemoWriter.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoPipeline <path to demo.dem> [stages...] [-o <path to output.dem>]"
+		"\n\t\t- Run the given stages over the demo in a single pass."
+		"\n\t\t  If any stage modifies the demo, save the result into output.dem"
+		"\n\t\t  or <demo>_pipeline.dem. Every frame is written as soon as it is"
+		"\n\t\t  through the stages, unless saving with more than one thread."
+		"\n\nStages (run in the given order):"
+		"\n\t-sanitize\tneutralize oversized sound and demo buffer frames."
+		"\n\t-fixyaw <yaw>\tfix the view yaw to <yaw>."
+		"\n\t-stats\t\tprint the FPS and msec statistics."
+		"\n\t-commands\tcheck for camera movement commands."
+		"\n\nOptions:"
+		"\n\t-threads <count>\tsave the result using the given number of threads,"
+		"\n\t\t\t\tafter reading the whole demo."
+		"\n\t-progress\t\tprint the progress of reading and saving."
+		"\n\t-timeout <seconds>\tgive up if reading and saving take longer than that."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	DemoPipeline pipeline;
+	std::shared_ptr<SanitizeStage> sanitize;
+	std::shared_ptr<FrameStatsStage> stats;
+	std::shared_ptr<CommandScanStage> commands;
+	bool modifies = false;
+	std::string output;
+	int threads = 1;
+	bool progress = false;
+	double timeout = 0;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-sanitize")) {
+			sanitize = std::make_shared<SanitizeStage>();
+			pipeline.AddStage(sanitize);
+			modifies = true;
+		} else if (!std::strcmp(argv[i], "-fixyaw") && i + 1 < argc) {
+			pipeline.AddStage(std::make_shared<FixYawStage>(static_cast<float>(std::atof(argv[++i]))));
+			modifies = true;
+		} else if (!std::strcmp(argv[i], "-stats")) {
+			stats = std::make_shared<FrameStatsStage>();
+			pipeline.AddStage(stats);
+		} else if (!std::strcmp(argv[i], "-commands")) {
+			commands = std::make_shared<CommandScanStage>(CommandScanStage::CameraCommands());
+			pipeline.AddStage(commands);
+		} else if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = std::atoi(argv[++i]);
+		} else if (!std::strcmp(argv[i], "-progress")) {
+			progress = true;
+		} else if (!std::strcmp(argv[i], "-timeout") && i + 1 < argc) {
+			timeout = std::atof(argv[++i]);
+		} else if (!std::strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	// Cancels the demo once the timeout runs out.
+	std::mutex watchdogMutex;
+	std::condition_variable watchdogWake;
+	bool finished = false;
+	std::thread watchdog;
+	auto stop_watchdog = [&]() {
+		if (!watchdog.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(watchdogMutex);
+			finished = true;
+		}
+		watchdogWake.notify_one();
+		watchdog.join();
+	};
+
+	try {
+		DemoFile demo(argv[1]);
+		nowide::cout << "Processing " << argv[1] << "..." << std::endl;
+
+		if (progress) {
+			demo.onProgress = [&](const DemoProgress& p) {
+				nowide::cerr << "\rEntry " << (p.entry + 1) << ": " << (p.entryDone * 100 / std::max<int64_t>(p.entryTotal, 1))
+					<< "%, total: " << (p.done * 100 / std::max<int64_t>(p.total, 1)) << "%   " << std::flush;
+			};
+		}
+
+		if (timeout > 0) {
+			demo.cancellation = std::make_shared<DemoCancellation>();
+			auto cancellation = demo.cancellation;
+			watchdog = std::thread([&, cancellation]() {
+				std::unique_lock<std::mutex> lock(watchdogMutex);
+				auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<double>(timeout));
+				if (!watchdogWake.wait_for(lock, duration, [&]() { return finished; }))
+					cancellation->Cancel();
+			});
+		}
+
+		if (modifies && output.empty()) {
+			output = argv[1];
+			auto dot = output.rfind('.');
+			if (dot != std::string::npos) {
+				output = output.substr(0, dot) + "_pipeline" + output.substr(dot);
+			} else {
+				output += "_pipeline";
+			}
+		}
+
+		// Writing over the demo itself needs all of it read first.
+		auto writeFrames = modifies && threads == 1 && !same_file(argv[1], output);
+		if (writeFrames) {
+			demo.keepFrames = false;
+			try {
+				DemoWriter writer(output, demo.header);
+				pipeline.Run(demo, writer);
+			} catch (...) {
+				nowide::remove(output.c_str());
+				throw;
+			}
+		} else {
+			pipeline.Run(demo);
+		}
+		if (progress)
+			nowide::cerr << std::endl;
+
+		if (sanitize) {
+			nowide::cout << "Sanitized sound frames: " << sanitize->sanitizedSoundFrames << '\n';
+			nowide::cout << "Sanitized demo buffer frames: " << sanitize->sanitizedDemoBufferFrames << '\n';
+		}
+
+		if (stats) {
+			if (stats->count == 0) {
+				nowide::cout << "There are no demo frames.\n";
+			} else {
+				auto msecAvg = stats->msecSum / static_cast<double>(stats->count);
+				nowide::cout << "Highest FPS: " << (1 / stats->frametimeMin) << '\n';
+				nowide::cout << "Lowest FPS: " << (1 / stats->frametimeMax) << '\n';
+				nowide::cout << "Average FPS: " << (stats->count / stats->frametimeSum) << '\n';
+				nowide::cout << "Lowest msec: " << static_cast<unsigned>(stats->msecMin) << " (" << (1000.0 / stats->msecMin) << " FPS)\n";
+				nowide::cout << "Highest msec: " << static_cast<unsigned>(stats->msecMax) << " (" << (1000.0 / stats->msecMax) << " FPS)\n";
+				nowide::cout << "Average msec: " << msecAvg << " (" << (1000.0 / msecAvg) << " FPS)\n";
+			}
+			nowide::cout << "Vector kernels: " << KernelPathName(ActiveKernelPath()) << '\n';
+		}
+
+		if (commands) {
+			if (commands->found.empty())
+				nowide::cout << "No camera movement commands found.\n";
+			for (const auto& command : commands->found)
+				nowide::cout << "Found camera movement command: " << command << '\n';
+		}
+
+		if (modifies && !writeFrames) {
+			if (threads == 1)
+				demo.Save(output);
+			else
+				demo.SaveParallel(output, static_cast<unsigned>(std::max(threads, 0)));
+			if (progress)
+				nowide::cerr << std::endl;
+		}
+
+		stop_watchdog();
+		nowide::cout << "Done." << std::endl;
+	} catch (const std::exception& ex) {
+		stop_watchdog();
+		if (progress)
+			nowide::cerr << std::endl;
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoKernels.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoRecover <path to demo.dem>"
+		"\n\t\t- Recover the frames of a damaged demo, save the result into <demo>_recovered.dem."
+		"\n\tDemoRecover <path to demo.dem> -o <path to output.dem>"
+		"\n\t\t- Recover the frames of a damaged demo, save the result into output.dem."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if ((argc != 2 && argc != 4) || (argc == 4 && std::strcmp(argv[2], "-o"))) {
+		usage();
+		return 1;
+	}
+
+	try {
+		DemoFile demo(argv[1]);
+		nowide::cout << "Recovering " << argv[1] << "..." << std::endl;
+		demo.recoveryMode = true;
+		demo.ReadFrames();
+
+		for (const auto& range : demo.skippedRanges) {
+			nowide::cout << "Entry " << (range.entry + 1) << ": skipped " << range.length
+				<< " bytes at offset " << range.offset << "." << std::endl;
+		}
+		if (demo.skippedRanges.empty())
+			nowide::cout << "No damage found." << std::endl;
+		nowide::cout << "Scanned with the " << KernelPathName(ActiveKernelPath()) << " kernels." << std::endl;
+
+		std::string filename;
+		if (argc == 4) {
+			filename = argv[3];
+		} else {
+			filename = argv[1];
+			auto dot = filename.rfind('.');
+			if (dot != std::string::npos) {
+				filename = filename.substr(0, dot) + "_recovered" + filename.substr(dot);
+			} else {
+				filename += "_recovered";
+			}
+		}
+
+		demo.Save(filename);
+
+		nowide::cout << "Done." << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,8 +1,13 @@
 #include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <iostream>
 #include <boost/nowide/args.hpp>
 #include <boost/nowide/iostream.hpp>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "DemoFile.hpp"
 
@@ -15,6 +20,7 @@ void usage()
 		"\n\t\t- Sanitize the given demo, save the result into <demo>_sanitized.dem."
 		"\n\tDemoSanitizer <path to demo.dem> -o <path to output.dem>"
 		"\n\t\t- Sanitize the given demo, save the result into output.dem."
+		"\n\t\t  If output.dem is -, write the result to the standard output."
 		<< std::endl;
 }
 
@@ -27,9 +33,13 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// When the demo goes to stdout, the messages go to stderr.
+	auto toStdout = (argc == 4 && !std::strcmp(argv[3], "-"));
+	auto& out = toStdout ? nowide::cerr : nowide::cout;
+
 	try {
 		DemoFile demo(argv[1]);
-		nowide::cout << "Sanitizing " << argv[1] << "..." << std::endl;
+		out << "Sanitizing " << argv[1] << "..." << std::endl;
 		demo.ReadFrames();
 
 		// Some of the incorrect or malicious frames were filtered out on the demo reading stage.
@@ -43,7 +53,8 @@ int main(int argc, char *argv[])
 					auto s = f->sample.size();
 					if (s > 255) {
 						f->sample.resize(255);
-						nowide::cout << "Sanitized a sound frame, sample size was: " << s << "; maximum allowed is: 255." << std::endl;
+						f->MarkModified();
+						out << "Sanitized a sound frame, sample size was: " << s << "; maximum allowed is: 255." << std::endl;
 					}
 				} else if (frame->type == DemoFrameType::DEMO_BUFFER) {
 					auto f = reinterpret_cast<DemoBufferFrame*>(frame.get());
@@ -51,13 +62,19 @@ int main(int argc, char *argv[])
 					auto s = f->buffer.size();
 					if (s > 32768) {
 						f->buffer.resize(32768);
-						nowide::cout << "Sanitized a demo buffer frame, buffer size was: " << s << "; maximum allowed is: 32768." << std::endl;
+						f->MarkModified();
+						out << "Sanitized a demo buffer frame, buffer size was: " << s << "; maximum allowed is: 32768." << std::endl;
 					}
 				}
 			}
 		}
 
-		if (argc == 4) {
+		if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			demo.Save(std::cout);
+		} else if (argc == 4) {
 			demo.Save(argv[3]);
 		} else {
 			auto filename = std::string{ argv[1] };
@@ -71,9 +88,11 @@ int main(int argc, char *argv[])
 			demo.Save(filename);
 		}
 
-		nowide::cout << "Done." << std::endl;
+		out << "Done." << std::endl;
 	} catch (const std::exception& ex) {
 		nowide::cerr << "Error: " << ex.what() << std::endl;
+		if (toStdout)
+			return 1;
 		char c;
 		nowide::cin.getline(&c, 1);
 	}
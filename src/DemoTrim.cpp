@@ -0,0 +1,81 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "DemoFile.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoTrim <path to demo.dem> <from> <to> [-o <path to output.dem>]"
+		"\n\t\t- Cut out the frames between the given times, in seconds,"
+		"\n\t\t  save them into output.dem or <demo>_trimmed.dem."
+		"\n\t\t  The frames are copied as they are, only the headers are read to find the cut."
+		"\n\t\t  If output.dem is -, write the result to the standard output."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc != 4 && !(argc == 6 && !std::strcmp(argv[4], "-o"))) {
+		usage();
+		return 1;
+	}
+
+	std::string input = argv[1];
+	auto from = static_cast<float>(std::atof(argv[2]));
+	auto to = static_cast<float>(std::atof(argv[3]));
+	std::string output = (argc == 6) ? argv[5] : "";
+
+	if (!(from <= to)) {
+		usage();
+		return 1;
+	}
+
+	// When the demo goes to stdout, the messages go to stderr.
+	auto toStdout = (output == "-");
+	auto& out = toStdout ? nowide::cerr : nowide::cout;
+
+	try {
+		DemoFile demo(input);
+		out << "Trimming " << input << " to " << from << "s-" << to << "s..." << std::endl;
+
+		if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			demo.Trim(std::cout, from, to);
+			std::cout.flush();
+		} else {
+			if (output.empty()) {
+				output = input;
+				auto dot = output.rfind('.');
+				if (dot != std::string::npos) {
+					output = output.substr(0, dot) + "_trimmed" + output.substr(dot);
+				} else {
+					output += "_trimmed";
+				}
+			}
+
+			demo.Trim(output, from, to);
+		}
+
+		out << "Done." << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
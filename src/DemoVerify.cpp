@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoIntegrity.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tDemoVerify create [-threads <count>] <paths to demos...>"
+		"\n\t\t- Hash the demos into Merkle trees and store them next to the demos in <demo>.hlmerkle."
+		"\n\tDemoVerify check [-threads <count>] [-age <days>] [-readonly] <paths to demos...>"
+		"\n\t\t- Check the demos against their trees and show the damaged frames."
+		"\n\t\t  With -age only the blocks not verified in the given number of days are checked,"
+		"\n\t\t  unless the demo has changed since the last run."
+		"\n\t\t  The verification times are stored in the sidecars unless -readonly is given."
+		"\n\t\t  Exits with 0 if all demos are intact, 1 if some are damaged and 2 on errors."
+		<< std::endl;
+}
+
+static std::string hex(const DemoHash& hash)
+{
+	std::string s;
+	char digits[3];
+	for (auto b : hash) {
+		std::snprintf(digits, sizeof(digits), "%02x", b);
+		s += digits;
+	}
+	return s;
+}
+
+static void print_block(const DemoIntegrityBlock& b)
+{
+	nowide::cout << '\t';
+	if (b.entry == DemoIntegrity::NO_ENTRY) {
+		nowide::cout << (b.offset == 0 ? "header" : "outside of the entries");
+	} else {
+		nowide::cout << "entry " << (b.entry + 1) << ", frames " << b.firstFrame << '-' << (b.firstFrame + b.frameCount - 1)
+			<< " (" << b.startTime << "s-" << b.endTime << "s)";
+	}
+	nowide::cout << ", bytes " << b.offset << '-' << (b.offset + b.size - 1) << '\n';
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 3 || (std::strcmp(argv[1], "create") && std::strcmp(argv[1], "check"))) {
+		usage();
+		return 2;
+	}
+
+	bool create = !std::strcmp(argv[1], "create");
+	unsigned threads = 0;
+	int64_t maxAge = 0;
+	bool readOnly = false;
+	std::vector<std::string> demos;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+		} else if (!create && !std::strcmp(argv[i], "-age") && i + 1 < argc) {
+			maxAge = static_cast<int64_t>(std::atof(argv[++i]) * 24 * 60 * 60);
+		} else if (!create && !std::strcmp(argv[i], "-readonly")) {
+			readOnly = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 2;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.empty()) {
+		usage();
+		return 2;
+	}
+
+	int result = 0;
+	for (const auto& filename : demos) {
+		try {
+			if (create) {
+				auto integrity = DemoIntegrity::Create(filename, threads);
+				integrity.Save();
+				nowide::cout << filename << ": " << integrity.blocks.size() << " blocks, root " << hex(integrity.root) << '\n';
+				continue;
+			}
+
+			auto integrity = DemoIntegrity::Load(filename);
+			auto report = integrity.Verify(maxAge, threads);
+
+			nowide::cout << filename << ": ";
+			if (report.damaged.empty() && report.size == integrity.fileSize)
+				nowide::cout << "intact";
+			else
+				nowide::cout << "DAMAGED";
+			nowide::cout << ", checked " << report.checkedBlocks << " of " << integrity.blocks.size() << " blocks ("
+				<< report.checkedBytes << " bytes)";
+			if (report.fileChanged)
+				nowide::cout << ", changed since the last run";
+			nowide::cout << ".\n";
+
+			for (auto i : report.damaged)
+				print_block(integrity.blocks[i]);
+			if (report.size != integrity.fileSize)
+				nowide::cout << "\tthe size changed from " << integrity.fileSize << " to " << report.size << " bytes\n";
+
+			if (!report.damaged.empty() || report.size != integrity.fileSize)
+				result = std::max(result, 1);
+			else if (!readOnly)
+				integrity.Save();
+		} catch (const std::exception& ex) {
+			nowide::cerr << filename << ": error: " << ex.what() << std::endl;
+			result = 2;
+		}
+	}
+	nowide::cout.flush();
+
+	return result;
+}
@@ -1,18 +1,86 @@
 #include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 #include <boost/nowide/args.hpp>
 #include <boost/nowide/fstream.hpp>
 #include <boost/nowide/iostream.hpp>
 
 #include "DemoFile.hpp"
+#include "DemoSchema.hpp"
 
 using namespace boost;
 
+// Prints every field of a frame on its own line, called by schema_visit.
+class FieldPrinter
+{
+public:
+	template<typename T>
+	void operator()(const char* name, const T& value)
+	{
+		nowide::cout << '\t' << prefix << name << ": ";
+		Print(value);
+		nowide::cout << '\n';
+	}
+
+	void operator()(const char* name, const std::shared_ptr<const DemoMoveVars>& value)
+	{
+		static const DemoMoveVars noMoveVars = {};
+		auto outer = prefix;
+		prefix += name;
+		prefix += '.';
+		schema_visit<DemoMoveVars>(*this, value ? *value : noMoveVars);
+		prefix = outer;
+	}
+
+protected:
+	// Of the fields of nested structures.
+	std::string prefix;
+
+	// Unary plus prints the one byte fields as numbers.
+	template<typename T>
+	static void Print(const T& value)
+	{
+		nowide::cout << +value;
+	}
+
+	template<typename T, size_t N>
+	static void Print(const T (&values)[N])
+	{
+		for (size_t i = 0; i < N; ++i) {
+			if (i)
+				nowide::cout << ' ';
+			Print(values[i]);
+		}
+	}
+
+	static void Print(const std::string& value)
+	{
+		nowide::cout << '"' << value << '"';
+	}
+
+	static void Print(const DemoString& value)
+	{
+		Print(value.str());
+	}
+
+	template<typename T>
+	static void Print(const std::vector<T>& value)
+	{
+		nowide::cout << value.size() << " bytes";
+	}
+};
+
 int main(int argc, char *argv[])
 {
 	nowide::args a(argc, argv);
 
-	if (argc != 2) {
-		nowide::cerr << "Usage:\n\tDumpFrames <path to demo.dem>" << std::endl;
+	bool fields = (argc == 3 && !std::strcmp(argv[2], "-fields"));
+	if (argc != 2 && !fields) {
+		nowide::cerr << "Usage:\n\tDumpFrames <path to demo.dem> [-fields]"
+			"\n\t\t- With -fields every field of every frame is printed as well." << std::endl;
 		return 1;
 	}
 
@@ -45,7 +113,7 @@ int main(int argc, char *argv[])
 
 				if (frame->type == DemoFrameType::CONSOLE_COMMAND){
 					ConsoleCommandFrame *f = static_cast<ConsoleCommandFrame*>(frame.get());
-					nowide::cout << " `" << f->command << '`';
+					nowide::cout << " `" << f->command.str() << '`';
 				}
 
 				if (static_cast<int>(frame->type) < 2 || static_cast<int>(frame->type) > 9) {
@@ -55,6 +123,13 @@ int main(int argc, char *argv[])
 				}
 
 				nowide::cout << '\n';
+
+				if (fields) {
+					dispatch_frame_type(frame->type, [&](auto* tag) {
+						using T = std::remove_pointer_t<decltype(tag)>;
+						schema_visit<T>(FieldPrinter(), static_cast<const T&>(*frame));
+					});
+				}
 			}
 		}
 	} catch (const std::exception& ex) {
@@ -2,9 +2,16 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iostream>
+#include <string>
 #include <boost/nowide/args.hpp>
 #include <boost/nowide/iostream.hpp>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
+#include "DemoAngles.hpp"
 #include "DemoFile.hpp"
 
 namespace nowide = boost::nowide;
@@ -14,6 +21,9 @@ void usage()
 	nowide::cerr << "Usage:"
 		"\n\tFixYaw <path to demo.dem> <yaw>"
 		"\n\t\t- Fix the yaw to <yaw>, save the result into <demo>_fixyaw.dem."
+		"\n\tFixYaw <path to demo.dem> <yaw> -o <path to output.dem>"
+		"\n\t\t- Fix the yaw to <yaw>, save the result into output.dem."
+		"\n\t\t  If output.dem is -, write the result to the standard output."
 		<< std::endl;
 }
 
@@ -21,42 +31,55 @@ int main(int argc, char *argv[])
 {
 	nowide::args a(argc, argv);
 
-	if (argc != 3) {
+	if ((argc != 3 && argc != 5) || (argc == 5 && std::strcmp(argv[3], "-o"))) {
 		usage();
 		return 1;
 	}
 
 	auto yaw = std::atof(argv[2]);
 
+	// When the demo goes to stdout, the messages go to stderr.
+	auto toStdout = (argc == 5 && !std::strcmp(argv[4], "-"));
+	auto& out = toStdout ? nowide::cerr : nowide::cout;
+
 	try {
 		DemoFile demo(argv[1]);
-		nowide::cout << "Fixing the yaw in " << argv[1] << "..." << std::endl;
+		out << "Fixing the yaw in " << argv[1] << "..." << std::endl;
 		demo.ReadFrames();
 
-		for (auto& entry : demo.directoryEntries) {
-			for (auto& frame : entry.frames) {
-				if (static_cast<int>(frame->type) < 2 || static_cast<int>(frame->type) > 9) {
-					NetMsgFrame *f = static_cast<NetMsgFrame*>(frame.get());
-					f->DemoInfo.RefParams.viewangles[1] = yaw;
-					f->DemoInfo.RefParams.cl_viewangles[1] = yaw;
-					f->DemoInfo.UserCmd.viewangles[1] = yaw;
-				}
-			}
-		}
-		
-		auto filename = std::string{ argv[1] };
-		auto dot = filename.rfind('.');
-		if (dot != std::string::npos) {
-			filename = filename.substr(0, dot) + "_fixyaw" + filename.substr(dot);
+		DemoAngleTransform fix = {
+			DemoAngleOperation::SET,
+			DemoAngleAxis::YAW,
+			static_cast<float>(yaw),
+			0, 0,
+			true
+		};
+		TransformAngles(demo, { fix });
+
+		if (toStdout) {
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			demo.Save(std::cout);
+		} else if (argc == 5) {
+			demo.Save(argv[4]);
 		} else {
-			filename += "_fixyaw";
-		}
+			auto filename = std::string{ argv[1] };
+			auto dot = filename.rfind('.');
+			if (dot != std::string::npos) {
+				filename = filename.substr(0, dot) + "_fixyaw" + filename.substr(dot);
+			} else {
+				filename += "_fixyaw";
+			}
 
-		demo.Save(filename);
+			demo.Save(filename);
+		}
 
-		nowide::cout << "Done." << std::endl;
+		out << "Done." << std::endl;
 	} catch (const std::exception& ex) {
 		nowide::cerr << "Error: " << ex.what() << std::endl;
+		if (toStdout)
+			return 1;
 		char c;
 		nowide::cin.getline(&c, 1);
 	}
@@ -0,0 +1,128 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoGhost.hpp"
+#include "DemoKernels.hpp"
+#include "DemoPipeline.hpp"
+
+namespace nowide = boost::nowide;
+
+static DemoTrajectory read_trajectory(const std::string& filename, std::string& mapName)
+{
+	DemoFile demo(filename);
+	demo.keepFrames = false;
+	mapName = demo.header.mapName;
+
+	auto stage = std::make_shared<TrajectoryStage>();
+	DemoPipeline pipeline;
+	pipeline.AddStage(stage);
+	pipeline.Run(demo);
+
+	return std::move(stage->trajectory);
+}
+
+static void write_deltas(std::ostream& o, const DemoGhostDelta& delta)
+{
+	o << "time\tdx\tdy\tdz\tdistance\tdpitch\tdyaw\tdroll\n";
+	for (size_t k = 0; k < delta.time.size(); ++k) {
+		o << delta.time[k] << '\t' << delta.origin[0][k] << '\t' << delta.origin[1][k] << '\t' << delta.origin[2][k]
+			<< '\t' << delta.distance[k] << '\t' << delta.angles[0][k] << '\t' << delta.angles[1][k] << '\t' << delta.angles[2][k] << '\n';
+	}
+}
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tGhostDelta [options] <path to run.dem> <path to reference.dem>"
+		"\n\t\t- Compare the view origin and angles of the run against the reference run,"
+		"\n\t\t  with the reference resampled onto the run's frame times."
+		"\n\t\t  Both runs are timed from their first frame."
+		"\n\nOptions:"
+		"\n\t-o <path to deltas.tsv>\twrite the per-frame differences (run minus reference) there, - for the standard output."
+		"\n\t-offset <seconds>\tshift the reference in time by this much."
+		"\n\t-anymap\t\t\tcompare the runs even if they are on different maps."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	std::string output;
+	float offset = 0;
+	bool anyMap = false;
+	std::vector<std::string> demos;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (!std::strcmp(argv[i], "-offset") && i + 1 < argc) {
+			offset = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-anymap")) {
+			anyMap = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.size() != 2) {
+		usage();
+		return 1;
+	}
+
+	try {
+		std::string runMap, referenceMap;
+		auto run = read_trajectory(demos[0], runMap);
+		auto reference = read_trajectory(demos[1], referenceMap);
+
+		if (runMap != referenceMap && !anyMap) {
+			nowide::cerr << "Error: the run is on " << runMap << " and the reference is on " << referenceMap
+				<< ", use -anymap to compare them anyway." << std::endl;
+			return 1;
+		}
+
+		auto delta = ComputeGhostDelta(run, reference, offset);
+		auto summary = SummarizeGhostDelta(delta, run, reference);
+
+		if (output == "-") {
+			write_deltas(nowide::cout, delta);
+			nowide::cout << '\n';
+		} else if (!output.empty()) {
+			nowide::ofstream o(output.c_str(), std::ios::trunc);
+			write_deltas(o, delta);
+			o.close();
+			if (!o) {
+				nowide::cerr << "Error writing " << output << '.' << std::endl;
+				return 1;
+			}
+		}
+
+		nowide::cout << "Compared frames: " << summary.frames << " (" << delta.outside << " run frames outside of the reference)\n";
+		if (summary.frames) {
+			nowide::cout << "Distance: mean " << summary.meanDistance << ", RMS " << summary.rmsDistance
+				<< ", max " << summary.maxDistance << " at " << summary.maxDistanceTime << "s, final " << summary.finalDistance << '\n';
+			nowide::cout << "Pitch difference: mean " << summary.meanPitch << ", max " << summary.maxPitch << '\n';
+			nowide::cout << "Yaw difference: mean " << summary.meanYaw << ", max " << summary.maxYaw << '\n';
+		}
+		nowide::cout << "The run is " << std::fabs(summary.durationDelta) << "s " << (summary.durationDelta < 0 ? "shorter" : "longer")
+			<< " than the reference.\n";
+		nowide::cout << "Vector kernels: " << KernelPathName(ActiveKernelPath()) << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoKernels.hpp"
+#include "DemoPlatform.hpp"
+
+namespace nowide = boost::nowide;
+
+// GoldSource maps can't extend past +-4096 units.
+static const float WORLD_MIN = -4096;
+static const float WORLD_MAX = 4096;
+
+struct Grid {
+	size_t size[3];
+	float cellSize;
+	std::vector<float> cells;
+
+	Grid(float cellSize, bool threeD)
+		: cellSize(cellSize)
+	{
+		auto n = Side(cellSize);
+		size[0] = n;
+		size[1] = n;
+		size[2] = threeD ? n : 1;
+		cells.resize(size[0] * size[1] * size[2]);
+	}
+
+	// The number of cells along a side, cellSize must be at least 1.
+	static size_t Side(float cellSize)
+	{
+		return static_cast<size_t>(std::ceil((WORLD_MAX - WORLD_MIN) / cellSize));
+	}
+
+	static uint64_t CellCount(float cellSize, bool threeD)
+	{
+		uint64_t n = Side(cellSize);
+		return threeD ? n * n * n : n * n;
+	}
+
+	void Add(const float (&pos)[3], float weight)
+	{
+		size_t index[3];
+		for (size_t j = 0; j < 3; ++j) {
+			if (size[j] == 1) {
+				index[j] = 0;
+				continue;
+			}
+
+			if (!(pos[j] >= WORLD_MIN && pos[j] < WORLD_MAX))
+				return;
+			index[j] = std::min(static_cast<size_t>((pos[j] - WORLD_MIN) / cellSize), size[j] - 1);
+		}
+
+		cells[(index[2] * size[1] + index[1]) * size[0] + index[0]] += weight;
+	}
+
+	void Merge(const Grid& other)
+	{
+		for (size_t i = 0; i < cells.size(); ++i)
+			cells[i] += other.cells[i];
+	}
+};
+
+typedef std::map<std::string, Grid> MapGrids;
+
+enum {
+	// The most grids a thread keeps, a 3D grid takes 64 MB with 32 unit cells.
+	MAX_WORKER_GRIDS = 4
+};
+
+// A 3D grid with 16 unit cells still fits, with 8 unit cells it doesn't.
+static const uint64_t MAX_GRID_CELLS = uint64_t{ 1 } << 27;
+// The most memory the grids of the threads may take together.
+static const uint64_t MAX_GRIDS_MEMORY = uint64_t{ 4 } << 30;
+
+static void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tHeatmap [options] <output prefix> <path to demo.dem>..."
+		"\n\t\t- Accumulate the time players spend at each position into a grid per map"
+		"\n\t\t  and save it into <prefix><map>.raw (32-bit floats, x varies fastest)"
+		"\n\t\t  and <prefix><map>.pgm."
+		"\n\nOptions:"
+		"\n\t-cell <size>\tgrid cell size in units, 32 by default."
+		"\n\t-3d\t\tbuild a 3D grid instead of a top-down 2D one."
+		"\n\t-map <name>\tonly use demos recorded on the given map."
+		"\n\t-threads <count>\tnumber of worker threads, by default one per core,"
+		"\n\t\t\t\tas many as the memory for the grids allows."
+		<< std::endl;
+}
+
+// Adds the grid to the target's grid of the map, or moves it there if the target has none.
+static void merge_grid(MapGrids& target, const std::string& map, Grid& grid)
+{
+	auto it = target.find(map);
+	if (it == target.end())
+		target.emplace(map, std::move(grid));
+	else
+		it->second.Merge(grid);
+}
+
+// Merges the per-thread grids pairwise, halving the number of grids every round.
+static void reduce(std::vector<MapGrids>& grids)
+{
+	for (size_t step = 1; step < grids.size(); step *= 2) {
+		auto pairs = (grids.size() + step - 1) / (step * 2);
+		parallel_for(pairs, static_cast<unsigned>(pairs), [&](unsigned, size_t p) {
+			auto i = p * step * 2;
+			for (auto& m : grids[i + step])
+				merge_grid(grids[i], m.first, m.second);
+			grids[i + step].clear();
+		});
+	}
+}
+
+static void save(const std::string& prefix, const std::string& map, const Grid& grid)
+{
+	auto name = prefix + map;
+
+	nowide::ofstream raw(name + ".raw", std::ios::trunc | std::ios::binary);
+	raw.write(reinterpret_cast<const char*>(grid.cells.data()), grid.cells.size() * sizeof(float));
+	if (!raw)
+		throw std::runtime_error("Error writing " + name + ".raw.");
+
+	// The image is a top-down view, so sum the 3D grid over z.
+	auto width = grid.size[0], height = grid.size[1];
+	std::vector<float> image(width * height);
+	for (size_t z = 0; z < grid.size[2]; ++z)
+		for (size_t i = 0; i < image.size(); ++i)
+			image[i] += grid.cells[z * image.size() + i];
+
+	// Scale logarithmically, otherwise spawn points outshine everything else.
+	auto max = *std::max_element(image.begin(), image.end());
+	std::vector<unsigned char> pixels(image.size());
+	if (max > 0) {
+		for (size_t y = 0; y < height; ++y) {
+			for (size_t x = 0; x < width; ++x) {
+				auto v = std::log1p(image[y * width + x]) / std::log1p(max);
+				// +y points up in the image.
+				pixels[(height - 1 - y) * width + x] = static_cast<unsigned char>(v * 255 + 0.5f);
+			}
+		}
+	}
+
+	nowide::ofstream pgm(name + ".pgm", std::ios::trunc | std::ios::binary);
+	pgm << "P5\n" << width << ' ' << height << "\n255\n";
+	pgm.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+	if (!pgm)
+		throw std::runtime_error("Error writing " + name + ".pgm.");
+
+	nowide::cout << map << ": " << grid.size[0] << 'x' << grid.size[1] << 'x' << grid.size[2]
+		<< " grid, " << grid.cellSize << " units per cell, saved into " << name << ".raw and " << name << ".pgm." << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	float cellSize = 32;
+	bool threeD = false;
+	std::string mapFilter;
+	// 0 is a thread per core.
+	unsigned threadCount = 0;
+
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; ++i) {
+		if (!std::strcmp(argv[i], "-cell") && i + 1 < argc) {
+			cellSize = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-3d")) {
+			threeD = true;
+		} else if (!std::strcmp(argv[i], "-map") && i + 1 < argc) {
+			mapFilter = argv[++i];
+		} else if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threadCount = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - i < 2 || !(cellSize >= 1)) {
+		usage();
+		return 1;
+	}
+
+	std::string prefix = argv[i++];
+	std::vector<std::string> demos(argv + i, argv + argc);
+
+	auto gridCells = Grid::CellCount(cellSize, threeD);
+	if (gridCells > MAX_GRID_CELLS) {
+		nowide::cerr << "Error: a grid with " << cellSize << " unit cells would have " << gridCells
+			<< " cells, at most " << MAX_GRID_CELLS << " are supported. Use a larger cell size." << std::endl;
+		return 1;
+	}
+
+	/*
+	 * Every thread keeps up to MAX_WORKER_GRIDS grids, with one more being
+	 * merged into the shared ones. A thread per core is cut down to what
+	 * fits, a given thread count has to fit. Even the largest grids fit one.
+	 */
+	auto gridBytes = gridCells * sizeof(float);
+	auto fitThreads = (MAX_GRIDS_MEMORY / gridBytes - 1) / MAX_WORKER_GRIDS;
+	auto workers = parallel_workers(demos.size(), threadCount);
+	if (threadCount == 0) {
+		threadCount = static_cast<unsigned>(std::min<uint64_t>(workers, fitThreads));
+	} else if (workers > fitThreads) {
+		nowide::cerr << "Error: " << workers << " threads would need up to " << (workers * MAX_WORKER_GRIDS + 1) * gridBytes / (1 << 20)
+			<< " MB for their grids, at most " << MAX_GRIDS_MEMORY / (1 << 20)
+			<< " MB are allowed. Use fewer threads or a larger cell size." << std::endl;
+		return 1;
+	}
+
+	/*
+	 * Each thread accumulates into its own grids, so reading needs no locking.
+	 * A thread that comes across more maps than MAX_WORKER_GRIDS first hands
+	 * one of its grids over to the shared ones, so that the memory doesn't
+	 * grow with the number of maps times the number of threads.
+	 */
+	std::vector<MapGrids> grids(parallel_workers(demos.size(), threadCount));
+	MapGrids shared;
+	std::mutex sharedMutex, outputMutex;
+
+	parallel_for(demos.size(), threadCount, [&](unsigned t, size_t d) {
+		try {
+			DemoFile demo(demos[d]);
+			if (!mapFilter.empty() && demo.header.mapName != mapFilter)
+				return;
+
+			auto& local = grids[t];
+			auto it = local.find(demo.header.mapName);
+			if (it == local.end()) {
+				if (local.size() >= MAX_WORKER_GRIDS) {
+					std::lock_guard<std::mutex> lock(sharedMutex);
+					merge_grid(shared, local.begin()->first, local.begin()->second);
+					local.erase(local.begin());
+				}
+				it = local.emplace(demo.header.mapName, Grid(cellSize, threeD)).first;
+			}
+			auto& grid = it->second;
+
+			// The heatmap only needs the positions, so the frames aren't kept.
+			demo.keepFrames = false;
+			demo.ReadFrames([&](DemoDirectoryEntry&, DemoFrame& frame) {
+				if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+					return;
+
+				const auto& f = static_cast<const NetMsgFrame&>(frame);
+				auto weight = f.DemoInfo.RefParams.frametime;
+				if (weight > 0 && IsFiniteFloat(weight))
+					grid.Add(f.DemoInfo.RefParams.vieworg, weight);
+			});
+		} catch (const std::exception& ex) {
+			std::lock_guard<std::mutex> lock(outputMutex);
+			nowide::cerr << "Error reading " << demos[d] << ": " << ex.what() << std::endl;
+		}
+	});
+
+	reduce(grids);
+	if (!grids.empty()) {
+		for (auto& m : grids[0])
+			merge_grid(shared, m.first, m.second);
+		grids.clear();
+	}
+
+	try {
+		if (shared.empty())
+			nowide::cout << "No demos to process." << std::endl;
+		else
+			for (const auto& m : shared)
+				save(prefix, m.first, m.second);
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
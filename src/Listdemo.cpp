@@ -1,10 +1,19 @@
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 #include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
 #include <boost/nowide/iostream.hpp>
 
 #include "DemoFile.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoProbe.hpp"
+#include "DemoSummary.hpp"
 
 namespace nowide = boost::nowide;
 
@@ -13,23 +22,182 @@ void usage()
 	nowide::cout << "Usage:"
 		"\n\tListdemo <path to demo.dem>"
 		"\n\t- Shows information about the demo."
+		"\n\tListdemo -db <path to summary.db> [options] [paths to demos...]"
+		"\n\t- Adds the demos to the summary database, reading only the new or changed ones,"
+		"\n\t  then lists the demos in the database."
+		"\n\tListdemo -probe [-list <path to list.txt>] [-threads <count>] [paths to demos...]"
+		"\n\t- Lists the map and the length of the demos, reading only their headers and directories."
+		"\n\nOptions:"
+		"\n\t-list <path to list.txt>\tadd the demos listed in the file, one per line."
+		"\n\t-threads <count>\tread the demos using the given number of threads."
+		"\n\t\t\t\tFor -probe the default is several per core."
+		"\n\t-map <name>\t\tlist only the demos on this map."
+		"\n\t-minfps <fps>\t\tlist only the demos with at least this average FPS."
+		"\n\t-maxfps <fps>\t\tlist only the demos with at most this average FPS."
+		"\n\t-camera\t\t\tlist only the demos with camera movement commands."
 		<< std::endl;
 }
 
-template<size_t N>
-inline bool any_matches(const char* pattern, const char* const (&samples)[N])
+static bool same_name(const std::string& a, const std::string& b)
 {
-	for (size_t i = 0; i < N; ++i) {
-		if (!std::strcmp(pattern, samples[i]))
-			return true;
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			return false;
+	}
+
+	return true;
+}
+
+// Adds the demos listed in the file, one per line.
+static bool read_list(const char* filename, std::vector<std::string>& demos)
+{
+	nowide::ifstream list(filename);
+	if (!list) {
+		nowide::cerr << "Error opening " << filename << "." << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(list, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			demos.push_back(line);
 	}
-	return false;
+
+	return true;
+}
+
+static int list_database(int argc, char *argv[])
+{
+	std::vector<std::string> demos;
+	unsigned threads = 0;
+	std::string map;
+	double minFPS = 0, maxFPS = 0;
+	bool filterMinFPS = false, filterMaxFPS = false, camera = false;
+
+	for (int i = 3; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-list") && i + 1 < argc) {
+			if (!read_list(argv[++i], demos))
+				return 1;
+		} else if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+		} else if (!std::strcmp(argv[i], "-map") && i + 1 < argc) {
+			map = argv[++i];
+		} else if (!std::strcmp(argv[i], "-minfps") && i + 1 < argc) {
+			minFPS = std::atof(argv[++i]);
+			filterMinFPS = true;
+		} else if (!std::strcmp(argv[i], "-maxfps") && i + 1 < argc) {
+			maxFPS = std::atof(argv[++i]);
+			filterMaxFPS = true;
+		} else if (!std::strcmp(argv[i], "-camera")) {
+			camera = true;
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	try {
+		DemoSummaryDatabase db(argv[2]);
+
+		if (!demos.empty()) {
+			auto read = db.Update(demos, threads);
+			db.Save();
+			nowide::cerr << "Read " << read << " new or changed demos out of " << demos.size() << "." << std::endl;
+		}
+
+		bool filtered = !map.empty() || filterMinFPS || filterMaxFPS || camera;
+		for (const auto& s : db.summaries) {
+			if (!s.error.empty()) {
+				if (!filtered)
+					nowide::cout << s.path << "\tError: " << s.error << '\n';
+				continue;
+			}
+
+			auto fps = s.AverageFPS();
+			if ((!map.empty() && !same_name(s.header.mapName, map))
+				|| (filterMinFPS && fps < minFPS)
+				|| (filterMaxFPS && fps > maxFPS)
+				|| (camera && !s.cameraCommands))
+				continue;
+
+			nowide::cout << s.path << '\t' << s.header.gameDir << '\t' << s.header.mapName << '\t'
+				<< s.frametimeSum << "s\t" << fps << " FPS" << (s.cameraCommands ? "\tcamera commands" : "") << '\n';
+		}
+		nowide::cout.flush();
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int list_probes(int argc, char *argv[])
+{
+	std::vector<std::string> demos;
+	unsigned threads = 0;
+
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-list") && i + 1 < argc) {
+			if (!read_list(argv[++i], demos))
+				return 1;
+		} else if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.empty()) {
+		usage();
+		return 1;
+	}
+
+	auto probes = ProbeDemos(demos, threads);
+	int result = 0;
+	for (size_t i = 0; i < probes.probes.size(); ++i) {
+		const auto& p = probes.probes[i];
+		if (p.error.size) {
+			nowide::cout << demos[i] << "\tError: " << probes.String(p.error) << '\n';
+			result = 1;
+			continue;
+		}
+
+		// The track times are as inaccurate as in the single demo listing.
+		float time = 0;
+		auto entries = probes.Entries(p);
+		for (uint32_t e = 0; e < p.entryCount; ++e) {
+			if (entries[e].type != 0)
+				time += entries[e].trackTime;
+		}
+
+		nowide::cout << demos[i] << '\t' << probes.String(p.gameDir) << '\t' << probes.String(p.mapName) << '\t'
+			<< p.entryCount << " entries\t" << time << "s\n";
+	}
+	nowide::cout.flush();
+
+	return result;
 }
 
 int main(int argc, char *argv[])
 {
 	nowide::args a(argc, argv);
 
+	if (argc >= 3 && !std::strcmp(argv[1], "-db"))
+		return list_database(argc, argv);
+	if (argc >= 2 && !std::strcmp(argv[1], "-probe"))
+		return list_probes(argc, argv);
+
 	if (argc != 2) {
 		usage();
 		nowide::cin.get();
@@ -60,64 +228,26 @@ int main(int argc, char *argv[])
 		}
 
 		nowide::cout << "\nReading frames...\n" << std::endl;
-		demo.ReadFrames();
-
-		float frametime_min, frametime_max;
-		double frametime_sum = 0.0;
-		size_t count = 0;
-		uint8_t msec_min, msec_max;
-		long long msec_sum = 0;
-		bool first = true;
-		bool found_cam_commands = false;
-		for (auto& entry : demo.directoryEntries) {
-			for (auto& frame : entry.frames) {
-				if (static_cast<int>(frame->type) < 2 || static_cast<int>(frame->type) > 9) {
-					NetMsgFrame *f = static_cast<NetMsgFrame*>(frame.get());
-					frametime_sum += f->DemoInfo.RefParams.frametime;
-					msec_sum += f->DemoInfo.UserCmd.msec;
-					count++;
-
-					if (first) {
-						first = false;
-						frametime_min = f->DemoInfo.RefParams.frametime;
-						frametime_max = f->DemoInfo.RefParams.frametime;
-						msec_min = f->DemoInfo.UserCmd.msec;
-						msec_max = f->DemoInfo.UserCmd.msec;
-					} else {
-						frametime_min = std::min(frametime_min, f->DemoInfo.RefParams.frametime);
-						frametime_max = std::max(frametime_max, f->DemoInfo.RefParams.frametime);
-						msec_min = std::min(msec_min, f->DemoInfo.UserCmd.msec);
-						msec_max = std::max(msec_max, f->DemoInfo.UserCmd.msec);
-					}
-				}
-
-				if (frame->type == DemoFrameType::CONSOLE_COMMAND) {
-					const char* const camera_commands[] = {
-						"+lookup",
-						"+lookdown",
-						"+left",
-						"+right"
-					};
-
-					ConsoleCommandFrame *f = static_cast<ConsoleCommandFrame*>(frame.get());
-					if (!found_cam_commands && any_matches(f->command.c_str(), camera_commands)) {
-						found_cam_commands = true;
-					}
-				}
-			}
-		}
 
-		if (first) {
+		auto stats = std::make_shared<FrameStatsStage>();
+		auto commands = std::make_shared<CommandScanStage>(CommandScanStage::CameraCommands());
+		DemoPipeline pipeline;
+		pipeline.AddStage(stats);
+		pipeline.AddStage(commands);
+		pipeline.Run(demo);
+
+		if (stats->count == 0) {
 			nowide::cout << "There are no demo frames.\n";
 		} else {
-			nowide::cout << "Highest FPS: " << (1 / frametime_min) << '\n';
-			nowide::cout << "Lowest FPS: " << (1 / frametime_max) << '\n';
-			nowide::cout << "Average FPS: " << (count / frametime_sum) << '\n';
-			nowide::cout << "Lowest msec: " << static_cast<unsigned>(msec_min) << " (" << (1000.0 / msec_min) << " FPS)\n";
-			nowide::cout << "Highest msec: " << static_cast<unsigned>(msec_max) << " (" << (1000.0 / msec_max) << " FPS)\n";
-			nowide::cout << "Average msec: " << (msec_sum / static_cast<double>(count)) << " (" << (1000.0 / (msec_sum / static_cast<double>(count))) << " FPS)\n";
-
-			if (found_cam_commands)
+			auto msec_avg = stats->msecSum / static_cast<double>(stats->count);
+			nowide::cout << "Highest FPS: " << (1 / stats->frametimeMin) << '\n';
+			nowide::cout << "Lowest FPS: " << (1 / stats->frametimeMax) << '\n';
+			nowide::cout << "Average FPS: " << (stats->count / stats->frametimeSum) << '\n';
+			nowide::cout << "Lowest msec: " << static_cast<unsigned>(stats->msecMin) << " (" << (1000.0 / stats->msecMin) << " FPS)\n";
+			nowide::cout << "Highest msec: " << static_cast<unsigned>(stats->msecMax) << " (" << (1000.0 / stats->msecMax) << " FPS)\n";
+			nowide::cout << "Average msec: " << msec_avg << " (" << (1000.0 / msec_avg) << " FPS)\n";
+
+			if (!commands->found.empty())
 				nowide::cout << "\nFound camera movement commands.\n";
 		}
 	} catch (const std::exception& ex) {
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+
+namespace nowide = boost::nowide;
+
+/*
+ * Counting allocator hook: every allocation in the process is prefixed
+ * with its size, so that the live byte count and its peak are exact.
+ */
+static std::atomic<size_t> live_bytes(0);
+static std::atomic<size_t> peak_bytes(0);
+static std::atomic<size_t> allocation_count(0);
+
+// Keeps the returned pointers aligned for any type.
+static const size_t ALLOCATION_PREFIX = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+void* operator new(size_t size)
+{
+	auto p = static_cast<char*>(std::malloc(size + ALLOCATION_PREFIX));
+	if (!p)
+		throw std::bad_alloc();
+
+	std::memcpy(p, &size, sizeof(size));
+	auto live = live_bytes += size;
+	allocation_count++;
+
+	auto peak = peak_bytes.load();
+	while (live > peak && !peak_bytes.compare_exchange_weak(peak, live))
+		;
+
+	return p + ALLOCATION_PREFIX;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (!ptr)
+		return;
+
+	auto p = static_cast<char*>(ptr) - ALLOCATION_PREFIX;
+	size_t size;
+	std::memcpy(&size, p, sizeof(size));
+	live_bytes -= size;
+	std::free(p);
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+struct Measurement {
+	size_t liveBefore;
+	size_t allocationsBefore;
+
+	Measurement()
+	{
+		liveBefore = live_bytes;
+		allocationsBefore = allocation_count;
+		peak_bytes = liveBefore;
+	}
+
+	void Print(const char* name) const
+	{
+		nowide::cout << name << ": peak " << (peak_bytes - liveBefore) << " bytes, "
+			<< (allocation_count - allocationsBefore) << " allocations, "
+			<< static_cast<ptrdiff_t>(live_bytes - liveBefore) << " bytes still held afterwards.\n";
+	}
+};
+
+static void print_tally(const char* name, const DemoMemoryTally& tally)
+{
+	nowide::cout << name << '\t' << tally.frames << '\t' << tally.bytes << '\t' << tally.allocations << '\n';
+}
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tMemoryReport <path to demo.dem> [-save <path to output.dem>]"
+		"\n\t\t- Show how much memory the parsed demo takes, per frame type and per directory entry,"
+		"\n\t\t  and the peak memory use while reading (and optionally saving) it."
+		"\n\t\t  The peaks are measured, the per type and per entry figures are estimated"
+		"\n\t\t  from the object sizes and leave out the allocator overhead."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if ((argc != 2 && argc != 4) || (argc == 4 && std::strcmp(argv[2], "-save"))) {
+		usage();
+		return 1;
+	}
+
+	try {
+		size_t fileSize;
+		{
+			nowide::ifstream in(argv[1], std::ios::binary | std::ios::ate);
+			fileSize = static_cast<size_t>(in.tellg());
+		}
+
+		Measurement open;
+		DemoFile demo(argv[1]);
+		open.Print("Opening");
+
+		Measurement read;
+		demo.ReadFrames();
+		read.Print("ReadFrames");
+
+		if (argc == 4) {
+			Measurement save;
+			demo.Save(argv[3]);
+			save.Print("Save");
+		}
+
+		auto usage = demo.MemoryUsage();
+
+		nowide::cout << "\nEstimated from the object sizes, without the allocator overhead:\n";
+		nowide::cout << "\nType\tFrames\tBytes\tAllocations\n";
+		#define t(name) \
+			print_tally(#name, usage.frameTypes[static_cast<uint8_t>(DemoFrameType::name)]);
+		t(DEMO_START);
+		t(CONSOLE_COMMAND);
+		t(CLIENT_DATA);
+		t(NEXT_SECTION);
+		t(EVENT);
+		t(WEAPON_ANIM);
+		t(SOUND);
+		t(DEMO_BUFFER);
+		#undef t
+
+		DemoMemoryTally netmsg = { 0, 0, 0 };
+		for (size_t i = 0; i < 256; ++i) {
+			if (i < 2 || i > 9) {
+				netmsg.frames += usage.frameTypes[i].frames;
+				netmsg.bytes += usage.frameTypes[i].bytes;
+				netmsg.allocations += usage.frameTypes[i].allocations;
+			}
+		}
+		print_tally("NETMSG", netmsg);
+
+		nowide::cout << "\nEntry\tFrames\tBytes\tAllocations\n";
+		for (size_t i = 0; i < usage.entries.size(); ++i)
+			print_tally(std::to_string(i + 1).c_str(), usage.entries[i]);
+
+		nowide::cout << '\n';
+		print_tally("Total", usage.total);
+		nowide::cout << "File size: " << fileSize << " bytes, parsed demo: about " << usage.total.bytes << " bytes ("
+			<< (fileSize ? static_cast<double>(usage.total.bytes) / fileSize : 0.0) << "x)." << std::endl;
+	} catch (const std::exception& ex) {
+		nowide::cerr << "Error: " << ex.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
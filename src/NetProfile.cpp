@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoNetwork.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoPlatform.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tNetProfile [options] <paths to demos...>"
+		"\n\t\t- Profile the network traffic recorded in the demos: bytes per second,"
+		"\n\t\t  message sizes, lost packets and reliable messages waiting for an acknowledgement."
+		"\n\t\t  The frames are profiled as they are read, without keeping them in memory."
+		"\n\nOptions:"
+		"\n\t-window <seconds>\tthe length of the time windows (1 by default)."
+		"\n\t-stall <seconds>\tthe time a reliable message may wait for an acknowledgement (0.5 by default)."
+		"\n\t-windows <path to windows.tsv>\twrite the traffic of every window there."
+		"\n\t-threads <count>\tnumber of worker threads."
+		<< std::endl;
+}
+
+static void print_profile(const DemoNetworkProfile& p)
+{
+	nowide::cout << p.frames << " frames, " << p.duration << "s, " << p.bytes << " bytes, "
+		<< p.BytesPerSecond() << " bytes/s";
+	if (p.windows)
+		nowide::cout << ", peak " << p.peakRate << " bytes/s";
+	nowide::cout << '\n';
+	if (p.frames == 0)
+		return;
+
+	nowide::cout << "\tMessage size: min " << p.minSize << ", mean " << (static_cast<double>(p.bytes) / p.frames)
+		<< ", max " << p.maxSize << '\n';
+	nowide::cout << "\tIncoming: " << p.incomingPackets << " packets, " << p.incomingLost << " lost in "
+		<< p.incomingGaps << " gaps (" << (p.LossRate() * 100) << "%)\n";
+	nowide::cout << "\tOutgoing: " << p.outgoingPackets << " packets, " << p.outgoingLost << " without a frame in "
+		<< p.outgoingGaps << " gaps\n";
+	nowide::cout << "\tUnacknowledged packets: mean " << (static_cast<double>(p.unackedSum) / p.frames)
+		<< ", max " << p.unackedMax << '\n';
+	nowide::cout << "\tReliable messages: " << p.reliableMessages << ", " << p.reliableStalls << " stalls, "
+		<< p.stallTime << "s stalled, longest " << p.longestStall << "s\n";
+	if (p.sequenceResets)
+		nowide::cout << "\tSequence resets: " << p.sequenceResets << '\n';
+}
+
+static void print_histogram(const DemoNetworkProfile& p)
+{
+	nowide::cout << "\nSize\tMessages\n";
+	for (size_t b = 0; b < NETWORK_SIZE_BUCKETS; ++b) {
+		if (!p.sizeHistogram[b])
+			continue;
+		if (b == 0)
+			nowide::cout << '0';
+		else
+			nowide::cout << (1u << (b - 1)) << '-' << ((1u << b) - 1);
+		nowide::cout << '\t' << p.sizeHistogram[b] << '\n';
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	float windowLength = 1, stall = 0.5f;
+	std::string windowsPath;
+	// 0 is a thread per core.
+	unsigned threadCount = 0;
+	std::vector<std::string> demos;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-window") && i + 1 < argc) {
+			windowLength = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-stall") && i + 1 < argc) {
+			stall = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-windows") && i + 1 < argc) {
+			windowsPath = argv[++i];
+		} else if (!std::strcmp(argv[i], "-threads") && i + 1 < argc) {
+			threadCount = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.empty() || !(windowLength > 0)) {
+		usage();
+		return 1;
+	}
+
+	nowide::ofstream windows;
+	if (!windowsPath.empty()) {
+		windows.open(windowsPath.c_str(), std::ios::trunc);
+		if (!windows) {
+			nowide::cerr << "Error opening " << windowsPath << '.' << std::endl;
+			return 1;
+		}
+		windows << "demo\tentry\tstart\tframes\tbytes\tbytes/s\tlost\n";
+	}
+
+	// Every demo is profiled by a single thread into its own slot.
+	std::vector<DemoNetworkProfile> profiles(demos.size());
+	std::vector<std::string> errors(demos.size());
+	std::mutex windowsMutex;
+
+	parallel_for(demos.size(), threadCount, [&](unsigned, size_t d) {
+		try {
+			DemoFile demo(demos[d]);
+			demo.keepFrames = false;
+
+			auto stage = std::make_shared<NetworkProfileStage>(windowLength, stall);
+			if (windows.is_open()) {
+				stage->onWindow = [&, d](const DemoNetworkWindow& w) {
+					std::lock_guard<std::mutex> lock(windowsMutex);
+					windows << demos[d] << '\t' << (w.entry + 1) << '\t' << w.start << '\t' << w.frames << '\t'
+						<< w.bytes << '\t' << (w.bytes / windowLength) << '\t' << w.lost << '\n';
+				};
+			}
+
+			DemoPipeline pipeline;
+			pipeline.AddStage(stage);
+			pipeline.Run(demo);
+
+			profiles[d] = stage->profile;
+		} catch (const std::exception& ex) {
+			errors[d] = ex.what();
+		}
+	});
+
+	int result = 0;
+	DemoNetworkProfile total;
+	size_t profiled = 0;
+	for (size_t d = 0; d < demos.size(); ++d) {
+		if (!errors[d].empty()) {
+			nowide::cerr << demos[d] << ": error: " << errors[d] << std::endl;
+			result = 1;
+			continue;
+		}
+
+		nowide::cout << demos[d] << ": ";
+		print_profile(profiles[d]);
+		total.Merge(profiles[d]);
+		profiled++;
+	}
+
+	if (profiled > 1) {
+		nowide::cout << "\nTotal: ";
+		print_profile(total);
+	}
+	if (total.frames)
+		print_histogram(total);
+	nowide::cout.flush();
+
+	if (windows.is_open()) {
+		windows.close();
+		if (!windows) {
+			nowide::cerr << "Error writing " << windowsPath << '.' << std::endl;
+			result = 1;
+		}
+	}
+
+	return result;
+}
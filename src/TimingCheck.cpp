@@ -0,0 +1,113 @@
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoPipeline.hpp"
+#include "DemoTiming.hpp"
+
+namespace nowide = boost::nowide;
+
+void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tTimingCheck [options] <paths to demos...>"
+		"\n\t\t- Look for timing anomalies in the demos: msec not matching the frametime,"
+		"\n\t\t  time going backwards or jumping forward, and FPS spikes."
+		"\n\t\t  The frames are checked as they are read, without keeping them in memory."
+		"\n\nOptions:"
+		"\n\t-window <frames>\tthe sliding window size (64 by default)."
+		"\n\t-tolerance <ms>\t\tthe allowed msec and frametime difference (1.5 by default)."
+		"\n\t-mismatches <count>\tthe allowed mismatching frames per window (8 by default)."
+		"\n\t-jump <seconds>\t\tthe allowed time step over the frametime (0.25 by default)."
+		"\n\t-maxfps <fps>\t\tthe highest allowed average FPS over a window (1010 by default)."
+		<< std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	size_t window = 64;
+	float tolerance = 1.5f, jump = 0.25f, maxFPS = 1010;
+	size_t mismatches = 8;
+	std::vector<std::string> demos;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-window") && i + 1 < argc) {
+			window = static_cast<size_t>(std::max(std::atoi(argv[++i]), 1));
+		} else if (!std::strcmp(argv[i], "-tolerance") && i + 1 < argc) {
+			tolerance = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-mismatches") && i + 1 < argc) {
+			mismatches = static_cast<size_t>(std::max(std::atoi(argv[++i]), 0));
+		} else if (!std::strcmp(argv[i], "-jump") && i + 1 < argc) {
+			jump = static_cast<float>(std::atof(argv[++i]));
+		} else if (!std::strcmp(argv[i], "-maxfps") && i + 1 < argc) {
+			maxFPS = static_cast<float>(std::atof(argv[++i]));
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			demos.push_back(argv[i]);
+		}
+	}
+
+	if (demos.empty()) {
+		usage();
+		return 1;
+	}
+
+	int result = 0;
+	for (const auto& filename : demos) {
+		try {
+			DemoFile demo(filename);
+			demo.keepFrames = false;
+
+			auto timing = std::make_shared<TimingAnomalyStage>(window);
+			timing->msecTolerance = tolerance;
+			timing->maxMismatches = mismatches;
+			timing->maxTimeJump = jump;
+			timing->maxFPS = maxFPS;
+
+			DemoPipeline pipeline;
+			pipeline.AddStage(timing);
+			pipeline.Run(demo);
+
+			auto count = timing->anomalies.size() + timing->droppedAnomalies;
+			nowide::cout << filename << ": " << timing->frames << " frames, ";
+			if (count == 0)
+				nowide::cout << "no anomalies.\n";
+			else
+				nowide::cout << count << " anomalies.\n";
+
+			for (const auto& an : timing->anomalies) {
+				nowide::cout << '\t' << TimingAnomalyStage::KindName(an.kind) << ": entry " << (an.entry + 1)
+					<< ", " << an.timeStart << "s-" << an.timeEnd << "s (frames " << an.frameStart << '-' << an.frameEnd
+					<< "), " << an.frames << " frames, worst ";
+				switch (an.kind) {
+				case TimingAnomalyKind::MSEC_MISMATCH:
+					nowide::cout << an.worst << " ms\n";
+					break;
+				case TimingAnomalyKind::FPS_SPIKE:
+					nowide::cout << an.worst << " FPS\n";
+					break;
+				default:
+					nowide::cout << an.worst << "s\n";
+					break;
+				}
+			}
+			if (timing->droppedAnomalies)
+				nowide::cout << "\t... and " << timing->droppedAnomalies << " more.\n";
+		} catch (const std::exception& ex) {
+			nowide::cerr << filename << ": error: " << ex.what() << std::endl;
+			result = 1;
+		}
+	}
+	nowide::cout.flush();
+
+	return result;
+}
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <boost/nowide/args.hpp>
+#include <boost/nowide/fstream.hpp>
+#include <boost/nowide/iostream.hpp>
+
+#include "DemoFile.hpp"
+#include "DemoKernels.hpp"
+
+namespace nowide = boost::nowide;
+
+/*
+ * Index file layout (little endian):
+ *   "HLTRJIDX", uint32 version, float cellSize
+ *   uint32 demoCount, demoCount * string path
+ *   uint32 mapCount, mapCount * (string mapName, uint64 sectionOffset)
+ * Each map section:
+ *   uint32 segmentCount, segmentCount * Segment
+ *   uint32 cellCount, cellCount * Cell (sorted by key)
+ *   uint32 refCount, refCount * uint32 segment index
+ * Strings are stored as uint32 length followed by the bytes.
+ */
+static const char INDEX_MAGIC[8] = { 'H', 'L', 'T', 'R', 'J', 'I', 'D', 'X' };
+static const uint32_t INDEX_VERSION = 1;
+
+// A trajectory is cut into segments of at most this many points.
+static const size_t MAX_SEGMENT_POINTS = 32;
+
+struct Segment {
+	uint32_t demo;
+	uint32_t entry;
+	float timeStart, timeEnd;
+	float mins[3], maxs[3];
+};
+
+struct Cell {
+	int32_t x, y, z;
+	uint32_t first, count;
+};
+
+struct MapSection {
+	std::vector<Segment> segments;
+	std::vector<Cell> cells;
+	std::vector<uint32_t> refs;
+};
+
+template<typename T>
+static void write_object(std::ostream& o, const T& obj)
+{
+	o.write(reinterpret_cast<const char*>(&obj), sizeof(T));
+}
+
+template<typename T>
+static void write_objects(std::ostream& o, const std::vector<T>& objs)
+{
+	write_object(o, static_cast<uint32_t>(objs.size()));
+	o.write(reinterpret_cast<const char*>(objs.data()), objs.size() * sizeof(T));
+}
+
+static void write_string(std::ostream& o, const std::string& str)
+{
+	write_object(o, static_cast<uint32_t>(str.size()));
+	o.write(str.data(), str.size());
+}
+
+template<typename T>
+static void read_object(std::istream& i, T& obj)
+{
+	i.read(reinterpret_cast<char*>(&obj), sizeof(T));
+}
+
+// The counts are checked against the bytes left before end, false on a bad count or a failed read.
+template<typename T>
+static bool read_objects(std::istream& i, std::vector<T>& objs, std::streamoff end)
+{
+	uint32_t count = 0;
+	read_object(i, count);
+	if (!i || count > (end - i.tellg()) / static_cast<std::streamoff>(sizeof(T)))
+		return false;
+
+	objs.resize(count);
+	i.read(reinterpret_cast<char*>(objs.data()), objs.size() * sizeof(T));
+	return static_cast<bool>(i);
+}
+
+static bool read_string(std::istream& i, std::string& str, std::streamoff end)
+{
+	uint32_t size = 0;
+	read_object(i, size);
+	if (!i || size > end - i.tellg())
+		return false;
+
+	str.resize(size);
+	i.read(&str[0], size);
+	return static_cast<bool>(i);
+}
+
+// The values must be finite, the cells are clamped to the int32 range.
+static int32_t cell_coord(float v, float cellSize)
+{
+	auto c = std::floor(static_cast<double>(v) / cellSize);
+	if (c < INT32_MIN)
+		return INT32_MIN;
+	if (c > INT32_MAX)
+		return INT32_MAX;
+	return static_cast<int32_t>(c);
+}
+
+static void usage()
+{
+	nowide::cerr << "Usage:"
+		"\n\tTrajectoryIndex build <path to index> [-cell <size>] <path to demo.dem>..."
+		"\n\t\t- Index the player trajectories of the given demos."
+		"\n\tTrajectoryIndex query <path to index> <map> box <x1> <y1> <z1> <x2> <y2> <z2>"
+		"\n\t\t- Print the demos and time ranges passing through the given box."
+		"\n\tTrajectoryIndex query <path to index> <map> point <x> <y> <z> <radius>"
+		"\n\t\t- Print the demos and time ranges passing within radius of the given point."
+		<< std::endl;
+}
+
+static int build(int argc, char *argv[])
+{
+	float cellSize = 512;
+	int first = 3;
+	if (argc > 4 && !std::strcmp(argv[3], "-cell")) {
+		cellSize = static_cast<float>(std::atof(argv[4]));
+		first = 5;
+	}
+	if (first >= argc || !IsFiniteFloat(cellSize) || !(cellSize > 0)) {
+		usage();
+		return 1;
+	}
+
+	std::vector<std::string> demos;
+	std::map<std::string, MapSection> maps;
+
+	for (int i = first; i < argc; ++i) {
+		try {
+			DemoFile demo(argv[i]);
+			// Only the callback needs the frames.
+			demo.keepFrames = false;
+			auto& section = maps[demo.header.mapName];
+			auto demoIndex = static_cast<uint32_t>(demos.size());
+			demos.push_back(argv[i]);
+
+			Segment segment;
+			size_t points = 0;
+			float last[3] = { 0, 0, 0 };
+			const DemoDirectoryEntry* lastEntry = nullptr;
+
+			auto flush = [&]() {
+				if (points)
+					section.segments.push_back(segment);
+				points = 0;
+			};
+
+			demo.ReadFrames([&](DemoDirectoryEntry& entry, DemoFrame& frame) {
+				if (static_cast<int>(frame.type) >= 2 && static_cast<int>(frame.type) <= 9)
+					return;
+
+				const auto& f = static_cast<const NetMsgFrame&>(frame);
+				const auto& org = f.DemoInfo.RefParams.vieworg;
+				if (!IsFiniteFloat(org[0]) || !IsFiniteFloat(org[1]) || !IsFiniteFloat(org[2]))
+					return;
+
+				// Start a new segment on teleports so that segments stay small.
+				bool jump = false;
+				for (size_t j = 0; j < 3; ++j)
+					jump = jump || std::fabs(org[j] - last[j]) > cellSize;
+
+				if (points == MAX_SEGMENT_POINTS || jump || &entry != lastEntry)
+					flush();
+
+				if (points == 0) {
+					segment.demo = demoIndex;
+					segment.entry = static_cast<uint32_t>(&entry - demo.directoryEntries.data());
+					segment.timeStart = frame.time;
+					for (size_t j = 0; j < 3; ++j)
+						segment.mins[j] = segment.maxs[j] = org[j];
+				}
+
+				segment.timeEnd = frame.time;
+				for (size_t j = 0; j < 3; ++j) {
+					segment.mins[j] = std::min(segment.mins[j], org[j]);
+					segment.maxs[j] = std::max(segment.maxs[j], org[j]);
+					last[j] = org[j];
+				}
+				lastEntry = &entry;
+				points++;
+			});
+			flush();
+		} catch (const std::exception& ex) {
+			nowide::cerr << "Error reading " << argv[i] << ": " << ex.what() << std::endl;
+		}
+	}
+
+	// Bin the segments into the cells their bounding boxes overlap.
+	for (auto& m : maps) {
+		auto& section = m.second;
+
+		std::map<std::tuple<int32_t, int32_t, int32_t>, std::vector<uint32_t>> grid;
+		for (uint32_t s = 0; s < section.segments.size(); ++s) {
+			const auto& seg = section.segments[s];
+			// 64-bit, so that the walk ends at the clamped INT32_MAX cells too.
+			int64_t cmin[3], cmax[3];
+			for (size_t j = 0; j < 3; ++j) {
+				cmin[j] = cell_coord(seg.mins[j], cellSize);
+				cmax[j] = cell_coord(seg.maxs[j], cellSize);
+			}
+
+			for (auto x = cmin[0]; x <= cmax[0]; ++x)
+				for (auto y = cmin[1]; y <= cmax[1]; ++y)
+					for (auto z = cmin[2]; z <= cmax[2]; ++z)
+						grid[std::make_tuple(static_cast<int32_t>(x), static_cast<int32_t>(y), static_cast<int32_t>(z))].push_back(s);
+		}
+
+		for (const auto& cell : grid) {
+			Cell c;
+			std::tie(c.x, c.y, c.z) = cell.first;
+			c.first = static_cast<uint32_t>(section.refs.size());
+			c.count = static_cast<uint32_t>(cell.second.size());
+			section.cells.push_back(c);
+			section.refs.insert(section.refs.end(), cell.second.begin(), cell.second.end());
+		}
+	}
+
+	nowide::ofstream o(argv[2], std::ios::trunc | std::ios::binary);
+	if (!o) {
+		nowide::cerr << "Error opening the index file." << std::endl;
+		return 1;
+	}
+
+	o.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	write_object(o, INDEX_VERSION);
+	write_object(o, cellSize);
+	write_object(o, static_cast<uint32_t>(demos.size()));
+	for (const auto& path : demos)
+		write_string(o, path);
+
+	// The map table is patched with the section offsets once they are known.
+	write_object(o, static_cast<uint32_t>(maps.size()));
+	std::vector<std::streampos> offsetPositions;
+	for (const auto& m : maps) {
+		write_string(o, m.first);
+		offsetPositions.push_back(o.tellp());
+		write_object(o, uint64_t{ 0 });
+	}
+
+	size_t i = 0;
+	for (const auto& m : maps) {
+		auto sectionOffset = static_cast<uint64_t>(o.tellp());
+		write_objects(o, m.second.segments);
+		write_objects(o, m.second.cells);
+		write_objects(o, m.second.refs);
+
+		auto end = o.tellp();
+		o.seekp(offsetPositions[i++]);
+		write_object(o, sectionOffset);
+		o.seekp(end);
+	}
+
+	if (!o) {
+		nowide::cerr << "Error writing the index file." << std::endl;
+		return 1;
+	}
+
+	size_t segmentCount = 0;
+	for (const auto& m : maps)
+		segmentCount += m.second.segments.size();
+	nowide::cout << "Indexed " << demos.size() << " demos, " << maps.size() << " maps, " << segmentCount << " segments." << std::endl;
+	return 0;
+}
+
+static int query(int argc, char *argv[])
+{
+	bool box;
+	if (argc == 11 && !std::strcmp(argv[4], "box")) {
+		box = true;
+	} else if (argc == 9 && !std::strcmp(argv[4], "point")) {
+		box = false;
+	} else {
+		usage();
+		return 1;
+	}
+
+	float mins[3], maxs[3], center[3] = { 0, 0, 0 }, radius = 0;
+	auto invalid = [&]() {
+		nowide::cerr << "The coordinates and the radius must be finite, the radius not negative." << std::endl;
+		return 1;
+	};
+	if (box) {
+		for (size_t j = 0; j < 3; ++j) {
+			auto a = static_cast<float>(std::atof(argv[5 + j]));
+			auto b = static_cast<float>(std::atof(argv[8 + j]));
+			if (!IsFiniteFloat(a) || !IsFiniteFloat(b))
+				return invalid();
+			mins[j] = std::min(a, b);
+			maxs[j] = std::max(a, b);
+		}
+	} else {
+		radius = static_cast<float>(std::atof(argv[8]));
+		if (!IsFiniteFloat(radius) || radius < 0)
+			return invalid();
+		for (size_t j = 0; j < 3; ++j) {
+			center[j] = static_cast<float>(std::atof(argv[5 + j]));
+			mins[j] = center[j] - radius;
+			maxs[j] = center[j] + radius;
+			if (!IsFiniteFloat(center[j]) || !IsFiniteFloat(mins[j]) || !IsFiniteFloat(maxs[j]))
+				return invalid();
+		}
+	}
+
+	nowide::ifstream in(argv[2], std::ios::binary);
+	if (!in) {
+		nowide::cerr << "Error opening the index file." << std::endl;
+		return 1;
+	}
+
+	auto invalidIndex = []() {
+		nowide::cerr << "Invalid index file." << std::endl;
+		return 1;
+	};
+
+	in.seekg(0, std::ios::end);
+	auto fileSize = static_cast<std::streamoff>(in.tellg());
+	in.seekg(0, std::ios::beg);
+
+	char magic[sizeof(INDEX_MAGIC)];
+	uint32_t version = 0;
+	float cellSize = 0;
+	in.read(magic, sizeof(magic));
+	read_object(in, version);
+	read_object(in, cellSize);
+	if (!in || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) || version != INDEX_VERSION || !IsFiniteFloat(cellSize) || !(cellSize > 0))
+		return invalidIndex();
+
+	// Every path takes at least its length.
+	uint32_t demoCount = 0;
+	read_object(in, demoCount);
+	if (!in || demoCount > (fileSize - in.tellg()) / 4)
+		return invalidIndex();
+	std::vector<std::string> demos(demoCount);
+	for (auto& path : demos) {
+		if (!read_string(in, path, fileSize))
+			return invalidIndex();
+	}
+
+	uint32_t mapCount = 0;
+	read_object(in, mapCount);
+	if (!in)
+		return invalidIndex();
+
+	// A section ends where the next one starts.
+	std::vector<uint64_t> sectionOffsets;
+	uint64_t sectionOffset = 0;
+	bool found = false;
+	for (uint32_t i = 0; i < mapCount; ++i) {
+		std::string name;
+		uint64_t offset = 0;
+		if (!read_string(in, name, fileSize))
+			return invalidIndex();
+		read_object(in, offset);
+		if (!in || offset > static_cast<uint64_t>(fileSize))
+			return invalidIndex();
+
+		sectionOffsets.push_back(offset);
+		if (name == argv[3]) {
+			sectionOffset = offset;
+			found = true;
+		}
+	}
+
+	if (!found) {
+		nowide::cout << "The map isn't in the index." << std::endl;
+		return 0;
+	}
+
+	auto sectionEnd = fileSize;
+	for (auto offset : sectionOffsets) {
+		if (offset > sectionOffset)
+			sectionEnd = std::min(sectionEnd, static_cast<std::streamoff>(offset));
+	}
+
+	MapSection section;
+	in.seekg(static_cast<std::streamoff>(sectionOffset));
+	if (!read_objects(in, section.segments, sectionEnd)
+		|| !read_objects(in, section.cells, sectionEnd)
+		|| !read_objects(in, section.refs, sectionEnd))
+		return invalidIndex();
+
+	std::vector<uint32_t> hits;
+	if (section.cells.empty())
+		return 0;
+
+	// Only the occupied cells matter, so the query is clamped to them.
+	int64_t occupiedMin[3] = { INT32_MAX, INT32_MAX, INT32_MAX }, occupiedMax[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+	for (const auto& c : section.cells) {
+		int32_t coords[3] = { c.x, c.y, c.z };
+		for (size_t j = 0; j < 3; ++j) {
+			occupiedMin[j] = std::min<int64_t>(occupiedMin[j], coords[j]);
+			occupiedMax[j] = std::max<int64_t>(occupiedMax[j], coords[j]);
+		}
+	}
+
+	int64_t cmin[3], cmax[3];
+	for (size_t j = 0; j < 3; ++j) {
+		cmin[j] = std::max<int64_t>(cell_coord(mins[j], cellSize), occupiedMin[j]);
+		cmax[j] = std::min<int64_t>(cell_coord(maxs[j], cellSize), occupiedMax[j]);
+		if (cmin[j] > cmax[j])
+			return 0;
+	}
+
+	auto cellLess = [](const Cell& a, const Cell& b) {
+		return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+	};
+
+	auto visit = [&](const Cell& cell) {
+		if (cell.first + static_cast<uint64_t>(cell.count) > section.refs.size())
+			return;
+
+		for (uint32_t r = cell.first; r < cell.first + cell.count; ++r) {
+			auto s = section.refs[r];
+			if (s >= section.segments.size())
+				continue;
+
+			const auto& seg = section.segments[s];
+			bool hit = true;
+			float distSq = 0;
+			for (size_t j = 0; j < 3; ++j) {
+				if (seg.maxs[j] < mins[j] || seg.mins[j] > maxs[j])
+					hit = false;
+
+				// Distance from the point to the segment's bounding box.
+				auto d = std::max(std::max(seg.mins[j] - center[j], 0.0f), center[j] - seg.maxs[j]);
+				if (!box)
+					distSq += d * d;
+			}
+			if (!box && distSq > radius * radius)
+				hit = false;
+
+			if (hit)
+				hits.push_back(s);
+		}
+	};
+
+	if (static_cast<uint64_t>(cmax[0] - cmin[0] + 1) * static_cast<uint64_t>(cmax[1] - cmin[1] + 1) > section.cells.size()) {
+		// The query covers more (x, y) runs than there are cells, so check every cell instead.
+		for (const auto& cell : section.cells) {
+			if (cell.x >= cmin[0] && cell.x <= cmax[0] && cell.y >= cmin[1] && cell.y <= cmax[1]
+				&& cell.z >= cmin[2] && cell.z <= cmax[2])
+				visit(cell);
+		}
+	} else {
+		// Walk the cells covered by the query along x, looking each (y, z) run up in the sorted cell list.
+		for (auto x = cmin[0]; x <= cmax[0]; ++x) {
+			for (auto y = cmin[1]; y <= cmax[1]; ++y) {
+				Cell key;
+				key.x = static_cast<int32_t>(x);
+				key.y = static_cast<int32_t>(y);
+				key.z = static_cast<int32_t>(cmin[2]);
+				auto it = std::lower_bound(section.cells.begin(), section.cells.end(), key, cellLess);
+				for (; it != section.cells.end() && it->x == x && it->y == y && it->z <= cmax[2]; ++it)
+					visit(*it);
+			}
+		}
+	}
+
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end()), hits.end());
+
+	// Segments are stored in trajectory order, so merge the touching ones into time ranges.
+	const Segment* range = nullptr;
+	float rangeEnd = 0;
+	uint32_t previous = 0;
+	auto print = [&]() {
+		if (range && range->demo < demos.size())
+			nowide::cout << demos[range->demo] << "\tentry " << (range->entry + 1) << '\t' << range->timeStart << " - " << rangeEnd << '\n';
+	};
+
+	for (auto s : hits) {
+		const auto& seg = section.segments[s];
+		if (range && s == previous + 1 && seg.demo == range->demo && seg.entry == range->entry) {
+			rangeEnd = seg.timeEnd;
+		} else {
+			print();
+			range = &seg;
+			rangeEnd = seg.timeEnd;
+		}
+		previous = s;
+	}
+	print();
+
+	nowide::cout.flush();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	nowide::args a(argc, argv);
+
+	if (argc < 4) {
+		usage();
+		return 1;
+	}
+
+	if (!std::strcmp(argv[1], "build"))
+		return build(argc, argv);
+	if (!std::strcmp(argv[1], "query"))
+		return query(argc, argv);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "DemoKernels.hpp"
+
+/*
+ * Runs the vector kernels on fixed inputs and compares their results with
+ * plain loops. ctest runs it once for every path, forced with HLDEMO_KERNELS.
+ * A path the CPU doesn't support is reported as skipped rather than passed.
+ */
+enum {
+	EXIT_SKIPPED = 77
+};
+
+static const uint8_t MAX_FRAME_TYPE = 9;
+
+// Checks the bits, as -Ofast lets value != value assume there are no NaNs.
+static bool is_nan(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x7FFFFFFF) > 0x7F800000;
+}
+
+// Equal, or both NaN. Zeros of either sign are equal, a whole turn may come out as either.
+static bool same_float(float a, float b)
+{
+	if (is_nan(a) || is_nan(b))
+		return is_nan(a) && is_nan(b);
+	return a == b;
+}
+
+// Within a few units in the last place, for results the paths compute in a different order.
+static bool close_float(double a, double b)
+{
+	return same_float(static_cast<float>(a), static_cast<float>(b)) || std::abs(a - b) <= 1e-6 * std::max(std::abs(a), std::abs(b));
+}
+
+// HLDEMO_KERNELS spells the paths in lower case without the dash.
+static std::string env_name(DemoKernelPath path)
+{
+	std::string name;
+	for (auto c : std::string(KernelPathName(path))) {
+		if (c != '-')
+			name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+	return name;
+}
+
+static std::vector<std::string> differences;
+
+static void differ(const char* kernel, size_t index)
+{
+	differences.push_back(std::string(kernel) + " differs from the plain loop at " + std::to_string(index) + '.');
+}
+
+static void check_find(const std::vector<char>& bytes)
+{
+	for (size_t from = 0; from <= bytes.size(); from += 7) {
+		auto expected = from;
+		while (expected < bytes.size() && static_cast<uint8_t>(bytes[expected]) > MAX_FRAME_TYPE)
+			++expected;
+		if (FindFrameTypeByte(bytes.data(), from, bytes.size()) != expected)
+			differ("FindFrameTypeByte", from);
+	}
+}
+
+static void check_reduce(const std::vector<float>& floats, const std::vector<uint8_t>& bytes)
+{
+	for (size_t count = 1; count <= floats.size(); count += 13) {
+		float minA = floats[0], maxA = floats[0], minB, maxB;
+		double sumA = 0, sumB;
+		for (size_t i = 0; i < count; ++i) {
+			minA = std::min(minA, floats[i]);
+			maxA = std::max(maxA, floats[i]);
+			sumA += floats[i];
+		}
+		ReduceFloats(floats.data(), count, minB, maxB, sumB);
+		if (!same_float(minA, minB) || !same_float(maxA, maxB) || !close_float(sumA, sumB))
+			differ("ReduceFloats", count);
+	}
+
+	for (size_t count = 1; count <= bytes.size(); count += 13) {
+		uint8_t minA = bytes[0], maxA = bytes[0], minB, maxB;
+		long long sumA = 0, sumB;
+		for (size_t i = 0; i < count; ++i) {
+			minA = std::min(minA, bytes[i]);
+			maxA = std::max(maxA, bytes[i]);
+			sumA += bytes[i];
+		}
+		ReduceBytes(bytes.data(), count, minB, maxB, sumB);
+		if (minA != minB || maxA != maxB || sumA != sumB)
+			differ("ReduceBytes", count);
+	}
+}
+
+static void compare(const char* kernel, const std::vector<float>& expected, const std::vector<float>& actual, bool exact)
+{
+	for (size_t k = 0; k < expected.size(); ++k) {
+		if (exact ? !same_float(expected[k], actual[k]) : !close_float(expected[k], actual[k])) {
+			differ(kernel, k);
+			return;
+		}
+	}
+}
+
+static void check_trajectory(const std::vector<float>& values, const std::vector<float>& weights)
+{
+	auto count = values.size() - 1;
+	std::vector<uint32_t> index(count);
+	for (size_t k = 0; k < count; ++k)
+		index[k] = static_cast<uint32_t>((k * 7919) % count);
+
+	std::vector<float> expected(count), actual(count);
+	for (size_t k = 0; k < count; ++k) {
+		auto v0 = values[index[k]], v1 = values[index[k] + 1];
+		expected[k] = values[k] - (v0 + (v1 - v0) * weights[k]);
+	}
+	InterpolateDelta(values.data(), index.data(), weights.data(), values.data(), count, actual.data());
+	compare("InterpolateDelta", expected, actual, false);
+
+	expected.resize(values.size());
+	actual.resize(values.size());
+	for (size_t k = 0; k < values.size(); ++k)
+		expected[k] = std::sqrt(values[k] * values[k] + weights[k] * weights[k] + values[k] * values[k]);
+	VectorLengths(values.data(), weights.data(), values.data(), values.size(), actual.data());
+	compare("VectorLengths", expected, actual, false);
+}
+
+static void check_angles(const std::vector<float>& angles)
+{
+	std::vector<float> expected(angles.size()), actual = angles;
+	for (size_t k = 0; k < angles.size(); ++k)
+		expected[k] = static_cast<float>(std::remainder(static_cast<double>(angles[k]), 360.0));
+	WrapDegrees(actual.data(), actual.size());
+	compare("WrapDegrees", expected, actual, true);
+
+	actual = angles;
+	for (size_t k = 0; k < angles.size(); ++k)
+		expected[k] = angles[k] + 123.25f;
+	OffsetFloats(actual.data(), actual.size(), 123.25f);
+	compare("OffsetFloats", expected, actual, true);
+}
+
+int main()
+{
+	auto active = ActiveKernelPath();
+	auto forced = std::getenv("HLDEMO_KERNELS");
+	if (forced && env_name(active) != forced) {
+		std::cout << "Skipped: this CPU doesn't run the " << forced << " path, the best it runs is "
+			<< KernelPathName(active) << '.' << std::endl;
+		return EXIT_SKIPPED;
+	}
+
+	// Angles, with halves, far out of range ones and non-finite ones among them.
+	std::vector<float> angles;
+	uint32_t seed = 1;
+	auto next = [&]() {
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	};
+	for (size_t k = 0; k < 1000; ++k)
+		angles.push_back(static_cast<float>(next() % 2000000) / 1000.0f - 1000.0f);
+	const float special[] = { 0.0f, -0.0f, 180.0f, -180.0f, 540.0f, -900.0f, 359.99997f, 1e6f, -1e9f, 1e12f,
+		-1e12f, 5e11f, 3e38f, 1e-40f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+		std::numeric_limits<float>::quiet_NaN() };
+	for (size_t k = 0; k < sizeof(special) / sizeof(special[0]); ++k)
+		angles[k * 37] = special[k];
+
+	// Finite ones for the kernels that don't define what happens otherwise.
+	std::vector<float> floats, weights;
+	for (size_t k = 0; k < 1003; ++k) {
+		floats.push_back(static_cast<float>(next() % 200000) / 100.0f - 1000.0f);
+		weights.push_back(static_cast<float>(next() % 1000) / 1000.0f);
+	}
+
+	std::vector<uint8_t> bytes;
+	std::vector<char> frameBytes;
+	for (size_t k = 0; k < 1003; ++k) {
+		bytes.push_back(static_cast<uint8_t>(next()));
+		// Mostly bytes that can't be frame types.
+		frameBytes.push_back(static_cast<char>(next() % 64 ? 10 + next() % 246 : next() % 10));
+	}
+
+	check_find(frameBytes);
+	check_reduce(floats, bytes);
+	check_trajectory(floats, weights);
+	check_angles(angles);
+
+	for (const auto& d : differences)
+		std::cout << d << '\n';
+	std::cout << "Checked the " << KernelPathName(active) << " kernels: "
+		<< (differences.empty() ? "all agree with the plain loops." : "some differ.") << std::endl;
+	return differences.empty() ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "DemoFile.hpp"
+#include "DemoFormat.hpp"
+#include "DemoFrame.hpp"
+
+/*
+ * Writes a small demo with frames of every type byte by byte, without the
+ * library's encoders, reads it back and saves it with Save, SaveParallel
+ * and Save to a stream. Each of them has to give the same bytes back:
+ * with the frames copied from the file, with every frame encoded again,
+ * and with some frames changed, against a demo written with the changes.
+ */
+
+// Where the movevars start in the netmsg frame: they're followed by view and viewmodel.
+static const size_t NETMSG_MOVEVARS_OFFSET = FRAME_NETMSG_DEMOINFO_SIZE - FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE - 16;
+
+// The frames that have a blob get it filled with these, so that the changes can be written too.
+static std::vector<char> pattern(uint32_t seed, size_t size)
+{
+	std::vector<char> bytes(size);
+	for (auto& b : bytes) {
+		seed = seed * 1664525u + 1013904223u;
+		b = static_cast<char>(seed >> 24);
+	}
+	return bytes;
+}
+
+// What the tests change, the rest of the fixture is always the same.
+struct FixtureOptions {
+	std::string command;
+	size_t soundLength;
+	size_t bufferLength;
+	size_t messageLength;
+	// Save keeps the lengths of the entries as they were read.
+	std::vector<int32_t> fileLengths;
+};
+
+class FixtureWriter
+{
+public:
+	std::vector<char> o;
+
+	template<typename T>
+	void Put(T value)
+	{
+		auto p = reinterpret_cast<const char*>(&value);
+		o.insert(o.end(), p, p + sizeof(T));
+	}
+
+	void PutBytes(const std::vector<char>& bytes)
+	{
+		o.insert(o.end(), bytes.begin(), bytes.end());
+	}
+
+	void PutString(const std::string& str, size_t size)
+	{
+		o.insert(o.end(), str.begin(), str.end());
+		o.insert(o.end(), size - str.size(), '\0');
+	}
+
+	void FrameHeader(uint8_t type)
+	{
+		Put(type);
+		Put(0.01f * frame);
+		Put(frame++);
+	}
+
+	// Fixed fields get arbitrary bytes, they're stored as they are.
+	void Fixed(size_t size)
+	{
+		PutBytes(pattern(static_cast<uint32_t>(1000 + frame), size));
+	}
+
+	void Blob(uint32_t seed, size_t length)
+	{
+		Put(static_cast<int32_t>(length));
+		PutBytes(pattern(seed, length));
+	}
+
+	void NetMsg(uint8_t type, bool moveVars, size_t messageLength)
+	{
+		FrameHeader(type);
+		auto start = o.size();
+		Fixed(FRAME_NETMSG_SIZE - 4);
+		// Movevars are either all zeros or have a properly terminated sky name.
+		auto mv = o.begin() + start + NETMSG_MOVEVARS_OFFSET;
+		if (moveVars) {
+			auto sky = mv + FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_OFFSET;
+			std::fill(sky, sky + FRAME_NETMSG_DEMOINFO_MOVEVARS_SKYNAME_SIZE, '\0');
+			std::memcpy(&*sky, "desert", 6);
+		} else {
+			std::fill(mv, mv + FRAME_NETMSG_DEMOINFO_MOVEVARS_SIZE, '\0');
+		}
+		Blob(type + 100, messageLength);
+	}
+
+	int32_t frame = 0;
+};
+
+static std::vector<char> write_fixture(const FixtureOptions& options)
+{
+	FixtureWriter w;
+	w.PutString("HLDEMO", HEADER_SIGNATURE_SIZE);
+	w.Put(int32_t{ 5 });
+	w.Put(int32_t{ 48 });
+	w.PutString("c1a0", HEADER_MAPNAME_SIZE);
+	w.PutString("valve", HEADER_GAMEDIR_SIZE);
+	w.Put(int32_t{ 0x12345678 });
+	w.Put(int32_t{ 0 });
+
+	std::vector<int32_t> offsets, lengths;
+	auto begin_entry = [&]() { offsets.push_back(static_cast<int32_t>(w.o.size())); };
+	auto end_entry = [&]() { lengths.push_back(static_cast<int32_t>(w.o.size()) - offsets.back()); };
+
+	begin_entry();
+	w.NetMsg(0, false, 20);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::CONSOLE_COMMAND));
+	w.PutString("connect", FRAME_CONSOLE_COMMAND_SIZE);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::CLIENT_DATA));
+	w.Fixed(FRAME_CLIENT_DATA_SIZE);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::DEMO_START));
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::NEXT_SECTION));
+	end_entry();
+
+	begin_entry();
+	w.NetMsg(1, true, options.messageLength);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::EVENT));
+	w.Fixed(FRAME_EVENT_SIZE);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::WEAPON_ANIM));
+	w.Fixed(FRAME_WEAPON_ANIM_SIZE);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::SOUND));
+	w.Fixed(FRAME_SOUND_SIZE_1 - 4);
+	w.Blob(1, options.soundLength);
+	w.Fixed(FRAME_SOUND_SIZE_2);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::DEMO_BUFFER));
+	w.Blob(2, options.bufferLength);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::CONSOLE_COMMAND));
+	w.PutString(options.command, FRAME_CONSOLE_COMMAND_SIZE);
+	w.NetMsg(0, true, 0);
+	w.FrameHeader(static_cast<uint8_t>(DemoFrameType::NEXT_SECTION));
+	end_entry();
+
+	if (!options.fileLengths.empty())
+		lengths = options.fileLengths;
+
+	auto directoryOffset = static_cast<int32_t>(w.o.size());
+	std::memcpy(w.o.data() + HEADER_SIZE - 4, &directoryOffset, sizeof(directoryOffset));
+
+	const char* descriptions[] = { "LOADING", "Playback" };
+	const int32_t frameCounts[] = { 1, 2 };
+	w.Put(static_cast<int32_t>(offsets.size()));
+	for (size_t i = 0; i < offsets.size(); ++i) {
+		w.Put(static_cast<int32_t>(i));
+		w.PutString(descriptions[i], DIR_ENTRY_DESCRIPTION_SIZE);
+		w.Put(int32_t{ 0 });
+		w.Put(int32_t{ -1 });
+		w.Put(1.5f * i);
+		w.Put(frameCounts[i]);
+		w.Put(offsets[i]);
+		w.Put(lengths[i]);
+	}
+
+	return w.o;
+}
+
+static void write_file(const std::string& filename, const std::vector<char>& bytes)
+{
+	std::ofstream o(filename, std::ios::binary | std::ios::trunc);
+	o.write(bytes.data(), bytes.size());
+	if (!o)
+		throw std::runtime_error("Can't write " + filename + '.');
+}
+
+static std::vector<char> read_file(const std::string& filename)
+{
+	std::ifstream in(filename, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static size_t failures = 0;
+
+static void check(const std::string& what, const std::vector<char>& expected, const std::vector<char>& actual)
+{
+	if (actual == expected)
+		return;
+
+	size_t at = 0;
+	while (at < expected.size() && at < actual.size() && expected[at] == actual[at])
+		++at;
+	std::cout << what << ": " << actual.size() << " bytes instead of " << expected.size()
+		<< ", the first difference is at " << at << ".\n";
+	++failures;
+}
+
+static const char FIXTURE[] = "RoundTrip.dem";
+static const char SAVED[] = "RoundTrip_save.dem";
+static const char SAVED_PARALLEL[] = "RoundTrip_parallel.dem";
+
+// Reads the fixture with the given callback and saves it in every way.
+static void check_saves(const std::string& what, const std::vector<char>& expected, const DemoFile::FrameCallback& onFrame)
+{
+	DemoFile demo(FIXTURE);
+	demo.ReadFrames(onFrame);
+
+	demo.Save(SAVED);
+	check(what + ", Save", expected, read_file(SAVED));
+
+	for (unsigned threads : { 1, 3 }) {
+		demo.SaveParallel(SAVED_PARALLEL, threads);
+		check(what + ", SaveParallel on " + std::to_string(threads) + " threads", expected, read_file(SAVED_PARALLEL));
+	}
+
+	std::ostringstream stream(std::ios::binary);
+	demo.Save(stream);
+	auto s = stream.str();
+	check(what + ", Save to a stream", expected, std::vector<char>(s.begin(), s.end()));
+}
+
+int main()
+{
+	FixtureOptions options{ "disconnect", 40, 300, 200, {} };
+	auto fixture = write_fixture(options);
+
+	try {
+		write_file(FIXTURE, fixture);
+
+		check_saves("Copied frames", fixture, nullptr);
+		check_saves("Encoded frames", fixture, [](DemoDirectoryEntry&, DemoFrame& frame) {
+			frame.MarkModified();
+		});
+
+		// Saving over the demo itself encodes everything as well.
+		{
+			DemoFile demo(FIXTURE);
+			demo.ReadFrames();
+			demo.Save(FIXTURE);
+			check("Saved over itself", fixture, read_file(FIXTURE));
+		}
+
+		// Changes to frames of either length, some shorter and some longer.
+		auto changed = options;
+		changed.command = "changelevel c1a1";
+		changed.soundLength = 10;
+		changed.bufferLength = 1000;
+		changed.messageLength = 0;
+		changed.fileLengths = { 0, 0 };
+		{
+			DemoFile demo(FIXTURE);
+			for (size_t i = 0; i < changed.fileLengths.size(); ++i)
+				changed.fileLengths[i] = demo.directoryEntries[i].fileLength;
+		}
+
+		check_saves("Changed frames", write_fixture(changed), [&](DemoDirectoryEntry&, DemoFrame& frame) {
+			if (frame.type == DemoFrameType::CONSOLE_COMMAND && static_cast<ConsoleCommandFrame&>(frame).command.str() == options.command) {
+				static_cast<ConsoleCommandFrame&>(frame).command = changed.command;
+				frame.MarkModified();
+			} else if (frame.type == DemoFrameType::SOUND) {
+				static_cast<SoundFrame&>(frame).sample.resize(changed.soundLength);
+				frame.MarkModified();
+			} else if (frame.type == DemoFrameType::DEMO_BUFFER) {
+				auto buffer = pattern(2, changed.bufferLength);
+				static_cast<DemoBufferFrame&>(frame).buffer.assign(buffer.begin(), buffer.end());
+				frame.MarkModified();
+			} else if (static_cast<int>(frame.type) == 1) {
+				static_cast<NetMsgFrame&>(frame).msg.clear();
+				frame.MarkModified();
+			}
+		});
+	} catch (const std::exception& ex) {
+		std::cout << "Error: " << ex.what() << '\n';
+		++failures;
+	}
+
+	std::remove(FIXTURE);
+	std::remove(SAVED);
+	std::remove(SAVED_PARALLEL);
+
+	std::cout << "Saved a demo with every frame type: "
+		<< (failures == 0 ? "all outputs match." : "some differ.") << std::endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+#include "DemoSha256.hpp"
+
+/*
+ * Checks the SHA-256 the integrity trees are built with against the
+ * examples of FIPS 180-4 and its additional test vectors, hashing every
+ * message whole and fed in pieces that end inside, at and across the
+ * 64-byte blocks.
+ */
+static const struct {
+	const char* message;
+	// The message is repeated that many times.
+	size_t repeat;
+	const char* digest;
+} VECTORS[] = {
+	{ "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+	{ "", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+	{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+		"cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+	{ "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+// 0 stands for the whole message in one piece.
+static const size_t PIECE_SIZES[] = { 0, 1, 3, 55, 56, 63, 64, 65, 1000 };
+
+static std::string hex(const DemoHash& hash)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string s;
+	for (auto b : hash) {
+		s += digits[b >> 4];
+		s += digits[b & 15];
+	}
+	return s;
+}
+
+int main()
+{
+	size_t differences = 0;
+	for (const auto& v : VECTORS) {
+		std::string message;
+		for (size_t i = 0; i < v.repeat; ++i)
+			message += v.message;
+
+		for (auto pieceSize : PIECE_SIZES) {
+			Sha256 sha;
+			if (pieceSize == 0) {
+				sha.Update(message.data(), message.size());
+			} else {
+				for (size_t offset = 0; offset < message.size(); offset += pieceSize)
+					sha.Update(message.data() + offset, std::min(pieceSize, message.size() - offset));
+			}
+
+			auto digest = hex(sha.Finish());
+			if (digest != v.digest) {
+				std::cout << "SHA-256 of \"" << message.substr(0, 16) << (message.size() > 16 ? "...\"" : "\"")
+					<< " (" << message.size() << " bytes";
+				if (pieceSize)
+					std::cout << ", in pieces of " << pieceSize;
+				std::cout << "): " << digest << ", expected " << v.digest << '\n';
+				++differences;
+			}
+		}
+	}
+
+	std::cout << "Checked SHA-256 against the FIPS 180-4 test vectors: "
+		<< (differences == 0 ? "all digests match." : "some differ.") << std::endl;
+	return differences == 0 ? 0 : 1;
+}